@@ -1519,6 +1519,7 @@ CPPlot::plotEfforts()
             if (!spec.pass(r)) continue;
 
             // add the intervals
+            r->computeIntervalMetrics(QStringList() << "workout_time" << "average_power");
             foreach(IntervalItem *i, r->intervals(RideFileInterval::EFFORT)) {
 
                 // is it a silly value?
@@ -2567,6 +2568,7 @@ CPPlot::calculateForDateRanges(QList<CompareDateRange> compareDateRanges)
                     if (!compareDateRanges[j].specification.pass(r)) continue;
 
                     // add the intervals
+                    r->computeIntervalMetrics(QStringList() << "workout_time" << "average_power");
                     foreach(IntervalItem *i, r->intervals(RideFileInterval::EFFORT)) {
 
                         // is it a silly value?
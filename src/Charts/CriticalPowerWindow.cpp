@@ -1123,8 +1123,8 @@ CriticalPowerWindow::showIntervalCurve(IntervalItem *current, int index)
     // compute the mean max, this is BLAZINGLY fast, thanks to Mark Rages'
     // mean-max computer. Does a 11hr ride in 150ms
     QVector<float>vector;
-    MeanMaxComputer thread1(&f, vector, getRideSeries(series())); thread1.run();
-    thread1.wait();
+    MeanMaxComputer meanmax(&f);
+    meanmax.compute(vector, getRideSeries(series()));
 
     // no data!
     if (vector.count() == 0) return;
@@ -221,7 +221,7 @@ QString IntervalSummaryWindow::summary(QList<IntervalItem*> intervals, QString &
     fake = new RideItem(&f, context);
     fake->setFrom(*const_cast<RideItem*>(context->currentRideItem()), true); // this wipes ride_ so put back
     fake->ride_ = &f;
-    fake->getWeight();
+    fake->weight = fake->getWeight();
     fake->intervals_.clear(); // don't accidentally wipe these!!!!
     fake->samples = f.dataPoints().count() > 0;
     QHash<QString,RideMetricPtr> metrics = RideMetric::computeMetrics(fake, Specification(), intervalMetrics);
@@ -231,7 +231,7 @@ QString IntervalSummaryWindow::summary(QList<IntervalItem*> intervals, QString &
     notfake = new RideItem(&notf, context);
     notfake->setFrom(*const_cast<RideItem*>(context->currentRideItem()), true); // this wipes ride_ so put back
     notfake->ride_ = &notf;
-    notfake->getWeight();
+    notfake->weight = notfake->getWeight();
     fake->intervals_.clear(); // don't accidentally wipe these!!!!
     notfake->samples = notf.dataPoints().count() > 0;
     QHash<QString,RideMetricPtr> notmetrics = RideMetric::computeMetrics(notfake, Specification(), intervalMetrics);
@@ -242,6 +242,9 @@ QString IntervalSummaryWindow::summary(QList<IntervalItem*> intervals, QString &
     // pack the metrics away and clean up if needed
     temp.metrics().fill(0, factory.metricCount());
 
+    // these are the only ones we want, don't go computing the rest
+    temp.computed().fill(true, factory.metricCount());
+
     // NOTE INCLUDED
     // snaffle away all the computed values into the array
     QHashIterator<QString, RideMetricPtr> i(metrics);
@@ -26,6 +26,7 @@
 #include "LTMWindow.h"
 #include "RideMetric.h"
 #include "RideCache.h"
+#include "MetricColumns.h"
 #include "RideFileCache.h"
 #include "Settings.h"
 #include "Colors.h"
@@ -56,7 +57,8 @@
 //#include <QDebug>
 
 LTMPlot::LTMPlot(LTMWindow *parent, Context *context, bool first) : 
-    bg(NULL), parent(parent), context(context), highlighter(NULL), first(first), isolation(false)
+    bg(NULL), parent(parent), context(context), highlighter(NULL),
+    grouped(NULL), groupedRevision(0), groupedBy(-1), first(first), isolation(false)
 {
     // don't do this ..
     setAutoReplot(false);
@@ -371,6 +373,9 @@ LTMPlot::setData(LTMSettings *set)
     stackY.clear();
     stacks.clear();
 
+    // fill in the metric columns and PMCs for all the curves in one go
+    prepareData(context, settings);
+
     int r=0;
 
     foreach (MetricDetail metricDetail, settings->metrics) {
@@ -1542,6 +1547,9 @@ LTMPlot::setCompareData(LTMSettings *set)
         stackY.clear();
         stacks.clear();
 
+        // fill in the metric columns and PMCs for all the curves in one go
+        prepareData(cd.sourceContext, settings);
+
         int r=0;
         foreach (MetricDetail metricDetail, settings->metrics) {
             if (metricDetail.stack == true) {
@@ -2621,6 +2629,84 @@ LTMPlot::createCurveData(Context *context, LTMSettings *settings, MetricDetail m
 
 }
 
+// the metric a PMC curve is calculated from
+static QString pmcScoreType(const MetricDetail &metricDetail)
+{
+    // just use the selected metric
+    if (metricDetail.type != METRIC_PM) return metricDetail.symbol;
+
+    QString symbol = metricDetail.symbol;
+    if (symbol.startsWith("planned_")) symbol = symbol.right(symbol.length()-8);
+    else if (symbol.startsWith("expected_")) symbol = symbol.right(symbol.length()-9);
+
+    if (symbol.startsWith("skiba")) return "skiba_bike_score";
+    if (symbol.startsWith("antiss")) return "antiss_score";
+    if (symbol.startsWith("atiss")) return "atiss_score";
+    if (symbol.startsWith("coggan")) return "coggan_tss";
+    if (symbol.startsWith("daniels")) return "daniels_points";
+    if (symbol.startsWith("trimp")) return "trimp_points";
+    if (symbol.startsWith("work")) return "total_work";
+    if (symbol.startsWith("cp_")) return "skiba_cp_exp";
+    if (symbol.startsWith("wprime")) return "skiba_wprime_exp";
+    if (symbol.startsWith("distance")) return "total_distance";
+    if (symbol.startsWith("triscore")) return "triscore";
+    return "";
+}
+
+void
+LTMPlot::prepareData(Context *context, LTMSettings *settings)
+{
+    QList<const RideMetric*> metrics;
+    QStringList meta;
+
+    foreach(MetricDetail metricDetail, settings->metrics) {
+        if (metricDetail.type == METRIC_META) meta << metricDetail.name;
+        else if (metricDetail.type == METRIC_DB && metricDetail.metric) metrics << metricDetail.metric;
+    }
+
+    // one pass over the rides for any we don't have already
+    if (metrics.count() || meta.count())
+        context->athlete->rideCache->columns()->prepare(metrics, meta);
+
+    // and bring the athlete's PMCs up to date in one pass too,
+    // filtered curves have their own, see createPMCData()
+    QStringList scores;
+    foreach(MetricDetail metricDetail, settings->metrics) {
+        if (metricDetail.type != METRIC_STRESS && metricDetail.type != METRIC_PM) continue;
+        if (!SearchFilterBox::isNull(metricDetail.datafilter) || settings->specification.isFiltered()) continue;
+
+        QString scoreType = pmcScoreType(metricDetail);
+        if (!scores.contains(scoreType)) scores << scoreType;
+    }
+    if (scores.count())
+        context->athlete->getPMCFor(scores, QList<QPair<int,int> >() << QPair<int,int>(-1,-1));
+}
+
+const QVector<int> &
+LTMPlot::groupsFor(MetricColumns *columns)
+{
+    // still good ?
+    if (grouped == columns && groupedRevision == columns->revision() && groups.count() == columns->rows() &&
+        groupedBy == settings->groupBy && groupedStart == settings->start)
+        return groups;
+
+    const QVector<qint64> &days = columns->days();
+    groups.resize(days.count());
+    for (int i=0; i<days.count(); i++) {
+
+        // the date only changes every now and again
+        if (i && days[i] == days[i-1]) groups[i] = groups[i-1];
+        else groups[i] = groupForDate(QDate::fromJulianDay(days[i]), settings->groupBy);
+    }
+
+    grouped = columns;
+    groupedRevision = columns->revision();
+    groupedBy = settings->groupBy;
+    groupedStart = settings->start;
+
+    return groups;
+}
+
 void
 LTMPlot::createMetricData(Context *context, LTMSettings *settings, MetricDetail metricDetail,
                                               QVector<double>&x,QVector<double>&y,int&n, bool forceZero)
@@ -2633,148 +2719,79 @@ LTMPlot::createMetricData(Context *context, LTMSettings *settings, MetricDetail
     x.resize(maxdays+3); // one for start from zero plus two for 0 value added at head and tail
     y.resize(maxdays+3); // one for start from zero plus two for 0 value added at head and tail
 
-    // do we aggregate ?
-    bool aggZero = metricDetail.metric ? metricDetail.metric->aggregateZero() : false;
     n=-1;
     int lastDay=0;
-    unsigned long secondsPerGroupBy=0;
     bool wantZero = forceZero ? 1 : (metricDetail.curveStyle == QwtPlotCurve::Steps);
 
+    // the values come from the metric columns, which
+    // are shared by all the curves, see prepareData()
+    MetricColumns *columns = context->athlete->rideCache->columns();
+
     // curve specific filter
-    Specification spec = settings->specification;
+    QBitArray rows = columns->select(settings->specification);
     if (!SearchFilterBox::isNull(metricDetail.datafilter))
-        spec.addMatches(SearchFilterBox::matches(context, metricDetail.datafilter));
-
-    //
-    double ymean_prev=0.0;
+        rows &= columns->matches(metricDetail.datafilter);
 
-    foreach (RideItem *ride, context->athlete->rideCache->rides()) { 
-
-        // filter out unwanted stuff
-        if (!spec.pass(ride)) continue;
+    // how to aggregate
+    MetricColumns::Aggregate how;
 
-        // day we are on
-        int currentDay = groupForDate(ride->dateTime.date(), settings->groupBy);
-
-        // value for day
-        double value;
-        if (metricDetail.type == METRIC_META)
-            value = ride->getText(metricDetail.name, "0.0").toDouble();
-        else
-            value = ride->getForSymbol(metricDetail.symbol);
+    // do we aggregate ?
+    how.aggZero = metricDetail.metric ? metricDetail.metric->aggregateZero() : false;
+    how.wantZero = wantZero;
+
+    // sum totals, average averages and choose best for Peaks
+    how.type = metricDetail.metric ? metricDetail.metric->type() : RideMetric::Average;
+    if (metricDetail.uunits == "Ramp" ||
+        metricDetail.uunits == tr("Ramp")) how.type = RideMetric::Total;
+
+    if (metricDetail.metric) {
+        // convert from stored metric value to imperial
+        if (context->athlete->useMetricUnits == false) {
+            how.scale = metricDetail.metric->conversion();
+            how.offset = metricDetail.metric->conversionSum();
+        }
 
-        // check values are bounded to stop QWT going berserk
-        if (std::isnan(value) || std::isinf(value)) value = 0;
+        // convert seconds to hours
+        if (metricDetail.metric->units(true) == "seconds" ||
+            metricDetail.metric->units(true) == tr("seconds")) how.divisor = 3600;
+    }
 
-        // skip unavailable values
-        if (value == RideFile::NA) continue;
+    QVector<MetricColumns::Group> aggregated;
+    if (metricDetail.type == METRIC_META) {
+        aggregated = columns->aggregate(columns->meta(metricDetail.name), NULL, NULL,
+                                        rows, groupsFor(columns), how);
+    } else {
+        const RideMetric *m = metricDetail.metric ? metricDetail.metric
+                                                  : RideMetricFactory::instance().rideMetric(metricDetail.symbol);
+        aggregated = columns->aggregate(columns->values(m),
+                                        metricDetail.metric ? &columns->counts(m) : NULL,
+                                        metricDetail.metric ? &columns->stdmeans(m) : NULL,
+                                        rows, groupsFor(columns), how);
+    }
 
-        // set aggZero to false and value to zero if is temperature and -255
-        if (metricDetail.metric && metricDetail.metric->symbol() == "average_temp" && value == RideFile::NA) {
-            value = 0;
-            aggZero = false;
-        }
+    // now lay them out, with zeroes in the gaps if wanted
+    int startDay = groupForDate(settings->start.date(), settings->groupBy);
+    foreach(MetricColumns::Group group, aggregated) {
 
-        if (metricDetail.metric) {
-            // convert from stored metric value to imperial
-            if (context->athlete->useMetricUnits == false) {
-                value *= metricDetail.metric->conversion();
-                value += metricDetail.metric->conversionSum();
+        int currentDay = group.group;
+        if (lastDay && wantZero) {
+            while (lastDay<currentDay && n<=maxdays) {
+                lastDay++;
+                n++;
+                x[n]=lastDay - startDay;
+                y[n]=0;
             }
-
-            // convert seconds to hours
-            if (metricDetail.metric->units(true) == "seconds" ||
-                metricDetail.metric->units(true) == tr("seconds")) value /= 3600;
+        } else {
+            n++;
         }
 
-        if (value || wantZero) {
-            unsigned long seconds = metricDetail.metric ? ride->getCountForSymbol(metricDetail.metric->symbol()) : 1;
-            if (currentDay > lastDay) {
-                if (lastDay && wantZero) {
-                    while (lastDay<currentDay && n<=maxdays) {
-                        lastDay++;
-                        n++;
-                        x[n]=lastDay - groupForDate(settings->start.date(), settings->groupBy);
-                        y[n]=0;
-                    }
-                } else {
-                    n++;
-                }
-
-                // drop out of roange
-                if (n>maxdays) break;
-                // first time thru
-                if (n<0) n=0;
-
-                ymean_prev = ride->getStdMeanForSymbol(metricDetail.symbol);
-
-                y[n] = value;
-                x[n] = currentDay - groupForDate(settings->start.date(), settings->groupBy);
-
-                // only increment counter if nonzero or we aggregate zeroes
-                if (value || aggZero) secondsPerGroupBy = seconds; 
-
-            } else {
-                // sum totals, average averages and choose best for Peaks
-                int type = metricDetail.metric ? metricDetail.metric->type() : RideMetric::Average;
-
-                if (metricDetail.uunits == "Ramp" ||
-                    metricDetail.uunits == tr("Ramp")) type = RideMetric::Total;
-
-                if (metricDetail.type == METRIC_BEST) type = RideMetric::Peak;
+        // drop out of roange
+        if (n>maxdays) break;
 
-                // first time thru
-                if (n<0) n=0;
+        y[n] = group.value;
+        x[n] = currentDay - startDay;
 
-                switch (type) {
-                case RideMetric::Total:
-                    y[n] += value;
-                    break;
-                case RideMetric::Average:
-                    {
-                    // average should be calculated taking into account
-                    // the duration of the ride, otherwise high value but
-                    // short rides will skew the overall average
-                    if (value || aggZero) y[n] = ((y[n]*secondsPerGroupBy)+(seconds*value)) / (secondsPerGroupBy+seconds);
-                    break;
-                    }
-                case RideMetric::Low:
-                    if (value < y[n]) y[n] = value;
-                    break;
-                case RideMetric::Peak:
-                    if (value > y[n]) y[n] = value;
-                    break;
-                case RideMetric::MeanSquareRoot:
-                    if (value) y[n] = sqrt((pow(y[n],2)*secondsPerGroupBy + pow(value,2)*seconds)/(secondsPerGroupBy+seconds));
-                    break;
-                case RideMetric::StdDev:
-                    if (value)
-                        {
-                            double ymean_next = ride->getStdMeanForSymbol(metricDetail.symbol);
-                            double ymean =  (secondsPerGroupBy*ymean_prev + ymean_next*seconds)/(secondsPerGroupBy + seconds);
-
-                            // Combining two standard deviations using
-                            // the formula:
-                            //
-                            //   sqrt(((n1-1)*S1^2+(n2-1)*S2^2+n1*(ymean_1-ymean)^2+n2*(ymean_2-ymean)^2)/(n1+n2))
-                            //
-                            // where:
-                            //
-                            //   ymean = (n1*ymean_1 + n2*ymean_2)/(n1+n2)
-
-                            y[n] = pow(y[n],2)*(secondsPerGroupBy-1) + pow(value,2)*(seconds-1);
-                            y[n] += pow(ymean_prev - ymean,2)*secondsPerGroupBy + pow(ymean_next - ymean,2)*seconds;
-                            y[n] /= (secondsPerGroupBy + seconds);
-                            y[n] = sqrt(y[n]);
-
-                            ymean_prev = ymean;
-                        }
-                    break;
-                }
-                secondsPerGroupBy += seconds; // increment for same group
-            }
-            lastDay = currentDay;
-        }
+        lastDay = currentDay;
     }
 }
 
@@ -3299,38 +3316,10 @@ LTMPlot::createPMCData(Context *context, LTMSettings *settings, MetricDetail met
     if (metricDetail.type == METRIC_PM) {
         int valuesType = VALUES_CALCULATED;
 
-        QString symbol = metricDetail.symbol;
-        if (symbol.startsWith("planned_")) {
-            valuesType = VALUES_PLANNED;
-            symbol = symbol.right(symbol.length()-8);
-        } else if (symbol.startsWith("expected_")) {
-            valuesType = VALUES_EXPECTED;
-            symbol = symbol.right(symbol.length()-9);
-        }
+        if (metricDetail.symbol.startsWith("planned_")) valuesType = VALUES_PLANNED;
+        else if (metricDetail.symbol.startsWith("expected_")) valuesType = VALUES_EXPECTED;
 
-        if (symbol.startsWith("skiba")) {
-            scoreType = "skiba_bike_score";
-        } else if (symbol.startsWith("antiss")) {
-            scoreType = "antiss_score";
-        } else if (symbol.startsWith("atiss")) {
-            scoreType = "atiss_score";
-        } else if (symbol.startsWith("coggan")) {
-            scoreType = "coggan_tss";
-        } else if (symbol.startsWith("daniels")) {
-            scoreType = "daniels_points";
-        } else if (symbol.startsWith("trimp")) {
-            scoreType = "trimp_points";
-        } else if (symbol.startsWith("work")) {
-            scoreType = "total_work";
-        } else if (symbol.startsWith("cp_")) {
-            scoreType = "skiba_cp_exp";
-        } else if (symbol.startsWith("wprime")) {
-            scoreType = "skiba_wprime_exp";
-        } else if (symbol.startsWith("distance")) {
-            scoreType = "total_distance";
-        } else if (symbol.startsWith("triscore")) {
-            scoreType = "triscore";
-        }
+        scoreType = pmcScoreType(metricDetail);
 
         stressType = STRESS_LTS; // if in doubt
         if (valuesType == VALUES_CALCULATED) {
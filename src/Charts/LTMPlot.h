@@ -43,6 +43,7 @@ class LTMScaleDraw;
 class CompareScaleDraw;
 class StressCalculator;
 class LTMToolTip;
+class MetricColumns;
 
 class LTMPlot : public QwtPlot
 {
@@ -96,6 +97,13 @@ class LTMPlot : public QwtPlot
         QDate start, end;
         QwtPlotCurve *highlighter;
 
+        // the group each ride is in, worked out once
+        // for all the metric curves, see groupsFor()
+        MetricColumns *grouped;
+        int groupedRevision, groupedBy;
+        QDateTime groupedStart;
+        QVector<int> groups;
+
         // keeping track of axes
         QHash<QString, QwtPlotCurve*> curves; // metric symbol with curve object
         QHash<QString, QwtAxisId> axes;             // units and associated axis
@@ -124,7 +132,11 @@ class LTMPlot : public QwtPlot
         void flushAggregateEstimateData(QVector<double> &x, QVector<double> &y,
                                         QVector<double> &xCount, QVector<double> &yTotal, int &n);
 
+        // metric columns and PMCs for all the curves, before we create them
+        void prepareData(Context *, LTMSettings *);
+
         // create curve data from metadata or metric (from ridecache)
+        const QVector<int> &groupsFor(MetricColumns *);
         void createMetricData(Context *,LTMSettings *, MetricDetail, QVector<double>&, QVector<double>&, int&, bool=false);
         void createFormulaData(Context *,LTMSettings *, MetricDetail, QVector<double>&, QVector<double>&, int&, bool=false);
 
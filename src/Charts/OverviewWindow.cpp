@@ -300,6 +300,12 @@ OverviewWindow::rideSelected()
 //QTime timer;
 //timer.start();
 
+    // bring the PMCs the cards show up to date together
+    QStringList pmcs;
+    foreach(Card *card, cards)
+        if (card->type == Card::PMC && !pmcs.contains(card->settings.symbol)) pmcs << card->settings.symbol;
+    if (pmcs.count()) context->athlete->getPMCFor(pmcs, QList<QPair<int,int> >() << QPair<int,int>(-1,-1));
+
     // ride item changed
     foreach(Card *card, cards) card->setData(myRideItem);
 
@@ -820,8 +826,9 @@ Card::setData(RideItem *item)
         double miny = 999999999;
         double maxy =-999999999;
 
-        //set the x, y series
+        //set the x, y series, opening the ride once if they need computing
         QList<BPointF> points;
+        item->computeIntervalMetrics(QStringList() << settings.xsymbol << settings.ysymbol << settings.zsymbol);
         foreach(IntervalItem *interval, item->intervals()) {
             // get the x and y VALUE
             double x = interval->getForSymbol(settings.xsymbol, parent->context->athlete->useMetricUnits);
@@ -22,6 +22,8 @@
 
 #include "Colors.h"
 #include "TabView.h"
+#include "Athlete.h"
+#include "RideCache.h"
 
 #include <QtConcurrent>
 
@@ -471,6 +473,8 @@ PythonChart::setState(QString)
 void
 PythonChart::execScript(PythonChart *chart)
 {
+    // the script may hold on to ride metrics while we wait for it
+    QReadLocker locker(&chart->context->athlete->rideCache->paging());
     python->runline(chart->context, chart->script->toPlainText());
 }
 
@@ -638,22 +638,23 @@ RideSummaryWindow::htmlSummary()
     // this is only for ride summary, when showing for a date range
     // we already have a summary metrics array
 
-    // get the PMC data
+    // get the PMC data, the base metric depends upon the sport so we
+    // bring them all up to date together, in one pass over the rides,
+    // and moving between rides of different sports doesn't refresh again
+    static const QStringList bases = QStringList() << "coggan_tss" << "govss" << "swimscore" << "triscore";
+    QList<PMCData*> pmcs = context->athlete->getPMCFor(bases, QList<QPair<int,int> >() << QPair<int,int>(-1,-1));
+
     PMCData *pmc;
     if (ridesummary) {
         // For single activity use base metric according to sport
-        pmc = context->athlete->getPMCFor(
-                                    rideItem->isSwim ? "swimscore" :
-                                    rideItem->isRun ? "govss" :
-                                    "coggan_tss");
+        pmc = pmcs[rideItem->isSwim ? 2 : rideItem->isRun ? 1 : 0];
     } else {
         // For data range use base metric for single sport if homogeneous
         // or combined if mixed
-        pmc = context->athlete->getPMCFor(
-                            nActivities == nRides ? "coggan_tss" :
-                            nActivities == nRuns ? "govss" :
-                            nActivities == nSwims ? "swimscore" :
-                            "triscore");
+        pmc = pmcs[nActivities == nRides ? 0 :
+                   nActivities == nRuns ? 1 :
+                   nActivities == nSwims ? 2 :
+                   3];
     }
 
     //
@@ -1130,6 +1131,9 @@ RideSummaryWindow::htmlSummary()
             summary += "<table align=\"center\" width=\"95%\" ";
             summary += "cellspacing=0 border=0>";
 
+            // opening the ride once if they need computing
+            rideItem->computeIntervalMetrics(intervalMetrics);
+
             bool even = false;
             foreach (IntervalItem *interval, rideItem->intervals()) {
 
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "APIAthleteCache.h"
+#include "RideItem.h"
+#include "RideDBStore.h"
+#include "MeanMaxStore.h"
+
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QMutexLocker>
+
+// msecs before we look at the files again even if we weren't told they
+// changed, in case the file system doesn't tell us (e.g. network shares)
+static const int APIAthleteCacheRecheck = 60000;
+
+APIAthleteCache::Rides::~Rides()
+{
+    qDeleteAll(items);
+}
+
+APIAthleteCache::APIAthleteCache(QDir home, QObject *parent) : QObject(parent), home(home)
+{
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, SIGNAL(directoryChanged(QString)), this, SLOT(changed(QString)));
+    connect(watcher, SIGNAL(fileChanged(QString)), this, SLOT(changed(QString)));
+
+    started = QByteArray::number(QDateTime::currentDateTime().toMSecsSinceEpoch(), 16);
+}
+
+APIAthleteCache::~APIAthleteCache()
+{
+    foreach(Athlete *a, athletes) delete a->meanMaxStore;
+    qDeleteAll(athletes);
+}
+
+QStringList
+APIAthleteCache::rideFiles(QString athlete)
+{
+    // the ride store and the metadata config say what's listed
+    QString root = home.absolutePath() + "/" + athlete;
+    return QStringList() << root + "/cache/rideDB.bin" << root + "/config/metadata.xml";
+}
+
+QStringList
+APIAthleteCache::meanMaxFiles(QString athlete)
+{
+    // .cpx files coming and going, or being written (which updates the store)
+    QString root = home.absolutePath() + "/" + athlete;
+    return QStringList() << root + "/cache" << root + "/cache/meanmax.mmx";
+}
+
+QByteArray
+APIAthleteCache::etagFor(QStringList files, QDateTime *modified)
+{
+    QByteArray key;
+    QDateTime latest;
+
+    foreach(QString file, files) {
+        QFileInfo info(file);
+        if (!info.exists()) {
+            key += "-;";
+            continue;
+        }
+        key += QByteArray::number(info.size()) + ":" + QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + ";";
+        if (latest == QDateTime() || info.lastModified() > latest) latest = info.lastModified();
+    }
+
+    if (modified) *modified = latest;
+    return "\"" + QCryptographicHash::hash(key, QCryptographicHash::Md5).toHex() + "\"";
+}
+
+APIAthleteCache::Athlete *
+APIAthleteCache::athlete(QString name)
+{
+    Athlete *returning = athletes.value(name, NULL);
+    if (returning == NULL) {
+        returning = new Athlete;
+        athletes.insert(name, returning);
+
+        // the watcher isn't thread safe, it lives on our thread
+        QMetaObject::invokeMethod(this, "watch", Qt::QueuedConnection, Q_ARG(QString, name));
+    }
+    return returning;
+}
+
+void
+APIAthleteCache::watch(QString athlete)
+{
+    QMutexLocker locker(&mutex);
+
+    QString root = home.absolutePath() + "/" + athlete;
+    QStringList paths;
+    paths << root + "/cache" << root + "/config" << rideFiles(athlete) << meanMaxFiles(athlete);
+
+    foreach(QString path, paths) {
+        if (!QFileInfo(path).exists()) continue;
+        watched.insert(path, athlete);
+        if (!watcher->files().contains(path) && !watcher->directories().contains(path))
+            watcher->addPath(path);
+    }
+}
+
+void
+APIAthleteCache::changed(QString path)
+{
+    QString name = watched.value(path);
+    if (name == "") return;
+
+    {
+        QMutexLocker locker(&mutex);
+
+        Athlete *a = athletes.value(name, NULL);
+        if (a) a->ridesChanged = a->bestsChanged = true;
+    }
+
+    // files that are replaced stop being watched, and
+    // files that weren't there may be now
+    watch(name);
+}
+
+QSharedPointer<APIAthleteCache::Rides>
+APIAthleteCache::rides(QString name)
+{
+    QMutexLocker locker(&mutex);
+
+    Athlete *a = athlete(name);
+
+    // nothing changed since we last looked
+    if (a->rides && !a->ridesChanged && a->ridesChecked.elapsed() < APIAthleteCacheRecheck)
+        return a->rides;
+
+    a->ridesChanged = false;
+    a->ridesChecked.start();
+
+    // did it really change ?
+    QDateTime modified;
+    QByteArray etag = etagFor(rideFiles(name), &modified);
+    if (a->rides && a->rides->etag == etag) return a->rides;
+
+    // not upgraded yet, there is only rideDB.json
+    QString filename = rideFiles(name).first();
+    if (!QFile(filename).exists()) {
+        a->rides.clear();
+        return a->rides;
+    }
+
+    QSharedPointer<Rides> rides(new Rides);
+    rides->etag = etag;
+    rides->modified = modified;
+
+    // read the store, we only need the metrics and metadata
+    RideDBStore store(filename, true);
+    foreach(QString fileName, store.fileNames()) {
+
+        RideItem *item = new RideItem();
+        item->path = home.absolutePath() + "/" + name + "/activities";
+        item->fileName = fileName;
+        item->isstale = item->isdirty = item->isedit = false;
+
+        if (store.read(fileName, *item, RideDBStore::Columns)) rides->items << item;
+        else delete item;
+    }
+
+    // anyone still using the old ones keeps them until they're done
+    a->rides = rides;
+    return rides;
+}
+
+QSharedPointer<APIAthleteCache::MeanMax>
+APIAthleteCache::meanMax(QString name, RideFile::SeriesType series, QDate from, QDate to)
+{
+    QMutexLocker locker(&mutex);
+
+    Athlete *a = athlete(name);
+
+    // did the .cpx files change ?
+    if (a->bestsChanged || a->bestsChecked.isNull() || a->bestsChecked.elapsed() >= APIAthleteCacheRecheck) {
+
+        a->bestsChanged = false;
+        a->bestsChecked.start();
+
+        QByteArray etag = etagFor(meanMaxFiles(name));
+        if (a->generation == 0 || etag != a->meanMaxEtag) {
+            delete a->meanMaxStore;
+            a->meanMaxStore = NULL;
+            a->bests.clear();
+            a->generation++;
+            a->synced = QDateTime::currentDateTime();
+            a->meanMaxEtag = etag;
+        }
+    }
+
+    QString key = QString("%1:%2:%3").arg(static_cast<int>(series)).arg(from.toJulianDay()).arg(to.toJulianDay());
+    QSharedPointer<MeanMax> returning = a->bests.value(key);
+    if (returning) return returning;
+
+    // readonly, the athlete may be open and its store is the only writer
+    if (a->meanMaxStore == NULL) a->meanMaxStore = new MeanMaxStore(home.absolutePath() + "/" + name + "/cache", NULL, true);
+
+    returning = QSharedPointer<MeanMax>(new MeanMax);
+    returning->values = a->meanMaxStore->meanMaxFor(series, from, to);
+    returning->etag = "\"" + started + "-" + QByteArray::number(a->generation) + "\"";
+    returning->modified = a->synced;
+    a->bests.insert(key, returning);
+
+    return returning;
+}
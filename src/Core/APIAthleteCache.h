@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_APIAthleteCache_h
+#define _GC_APIAthleteCache_h 1
+
+#include <QObject>
+#include <QDir>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QDateTime>
+#include <QTime>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QFileSystemWatcher>
+
+#include "RideFile.h"
+
+class RideItem;
+class MeanMaxStore;
+
+// APIAthleteCache keeps the ride metrics and the mean-max aggregates for
+// each athlete the API serves in memory, so a dashboard polling the API
+// doesn't pay for reading the ride store or syncing the .cpx files on
+// every request.
+//
+// The athlete cache and config directories are watched, anything that
+// changes in them marks the athlete as changed. The next request checks
+// the files it depends upon and only reads them again if they really
+// did change. Each set of data has a validator (an ETag and the time it
+// last changed) so unchanged data can be answered with a 304.
+//
+// The web server handles requests on a pool of threads, everything
+// handed out is shared and immutable, a reload replaces it.
+//
+class APIAthleteCache : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        // rides from the athlete's ride store, in date order
+        struct Rides {
+            ~Rides();
+
+            QByteArray etag;
+            QDateTime modified;
+            QVector<RideItem*> items;
+        };
+
+        // best for each duration over a date range
+        struct MeanMax {
+            QByteArray etag;
+            QDateTime modified;
+            QVector<float> values;
+        };
+
+        APIAthleteCache(QDir home, QObject *parent=NULL);
+        ~APIAthleteCache();
+
+        // NULL if the athlete has no ride store (yet)
+        QSharedPointer<Rides> rides(QString athlete);
+
+        // as RideFileCache::meanMaxFor for the cache directory
+        QSharedPointer<MeanMax> meanMax(QString athlete, RideFile::SeriesType series, QDate from, QDate to);
+
+        // a validator for a set of files, from their size and timestamp
+        static QByteArray etagFor(QStringList files, QDateTime *modified=NULL);
+
+    private slots:
+
+        // called on our thread
+        void watch(QString athlete);
+        void changed(QString path);
+
+    private:
+
+        struct Athlete {
+            Athlete() : ridesChanged(true), bestsChanged(true), meanMaxStore(NULL), generation(0) {}
+
+            // something changed since we last looked, we
+            // also look now and again in case we missed it
+            bool ridesChanged, bestsChanged;
+            QTime ridesChecked, bestsChecked;
+
+            QSharedPointer<Rides> rides;
+
+            // a readonly store syncs against the .cpx files when it is
+            // first used, so it is created again when they change
+            MeanMaxStore *meanMaxStore;
+            QByteArray meanMaxEtag;     // the files as they were when synced
+            int generation;             // bumped as the .cpx files change
+            QDateTime synced;           // when they last changed
+            QHash<QString, QSharedPointer<MeanMax> > bests;
+        };
+
+        Athlete *athlete(QString name);
+        QStringList rideFiles(QString athlete);
+        QStringList meanMaxFiles(QString athlete);
+
+        QDir home;
+        QMutex mutex;
+        QFileSystemWatcher *watcher;
+        QHash<QString, Athlete*> athletes;
+        QHash<QString, QString> watched;    // path to athlete
+        QByteArray started;                 // etags don't survive a restart
+};
+
+#endif // _GC_APIAthleteCache_h
@@ -24,6 +24,7 @@
 
 #include "RideFile.h"
 #include "RideFileCache.h"
+#include "RideMetric.h"
 #include "CsvRideFile.h"
 
 #include "Zones.h"
@@ -32,6 +33,7 @@
 #include "Measures.h"
 
 #include <QTemporaryFile>
+#include <QLocale>
 #include <QFile>
 
 void
@@ -72,8 +74,8 @@ APIWebService::athleteData(QStringList &paths, HttpRequest &request, HttpRespons
         response.write("missing athlete.");
         return;
     } else {
-        QFile ridedb(home.absolutePath() + "/" + paths[0] + "/cache/rideDB.json");
-        if (!ridedb.exists()) {
+        QString cache = home.absolutePath() + "/" + paths[0] + "/cache/";
+        if (!QFile(cache + "rideDB.bin").exists() && !QFile(cache + "rideDB.json").exists()) {
             response.setStatus(404); // malformed URL
             response.setHeader("Content-Type", "text; charset=ISO-8859-1");
             response.write("unknown athlete " + paths[0].toLocal8Bit());
@@ -174,8 +176,9 @@ APIWebService::listAthletes(HttpRequest &, HttpResponse &response)
 
         // sure fire sign the athlete has been upgraded to post 3.2 and not some
         // random directory full of other things & check something basic is set
-        QString ridedb = home.absolutePath() + "/" + name + "/cache/rideDB.json";
-        if (QFile(ridedb).exists() && appsettings->cvalue(name, GC_SEX, "") != "") {
+        QString cache = home.absolutePath() + "/" + name + "/cache/";
+        bool ridedb = QFile(cache + "rideDB.bin").exists() || QFile(cache + "rideDB.json").exists();
+        if (ridedb && appsettings->cvalue(name, GC_SEX, "") != "") {
             // we got one
             QString line = name;
             line += ", " + appsettings->cvalue(name, GC_DOB).toDate().toString("yyyy/MM/dd");
@@ -191,29 +194,62 @@ APIWebService::listAthletes(HttpRequest &, HttpResponse &response)
 }
 
 
-void 
-APIWebService::writeRideLine(RideItem &item, HttpRequest *request, HttpResponse *response)
+bool
+APIWebService::notModified(HttpRequest &request, HttpResponse &response, QByteArray etag, QDateTime modified)
 {
+    // http dates are always GMT in english
+    QByteArray lastModified;
+    if (modified.isValid()) {
+        lastModified = QLocale::c().toString(modified.toUTC(), "ddd, dd MMM yyyy hh:mm:ss").toLatin1() + " GMT";
+        response.setHeader("Last-Modified", lastModified);
+    }
+    response.setHeader("ETag", etag);
+    response.setHeader("Cache-Control", "no-cache"); // always check with us
+
+    // If-None-Match wins when both are sent (RFC 7232)
+    bool unchanged = false;
+    QByteArray match = request.getHeader("If-None-Match");
+    if (match != "") {
+        foreach(QByteArray tag, match.split(',')) {
+            tag = tag.trimmed();
+            if (tag.startsWith("W/")) tag = tag.mid(2);
+            if (tag == etag || tag == "*") unchanged = true;
+        }
 
-    // honour the since parameter
-    QString sincep(request->getParameter("since"));
-    QDate since(1900,01,01);
-    if (sincep != "") since = QDate::fromString(sincep,"yyyy/MM/dd");
+    } else if (modified.isValid()) {
+        QByteArray since = request.getHeader("If-Modified-Since");
+        if (since.endsWith(" GMT")) since.chop(4);
+        QDateTime when = QLocale::c().toDateTime(QString(since), "ddd, dd MMM yyyy hh:mm:ss");
+        when.setTimeSpec(Qt::UTC);
 
-    // before parameter
-    QString beforep(request->getParameter("before"));
-    QDate before(3000,01,01);
-    if (beforep != "") before = QDate::fromString(beforep,"yyyy/MM/dd");
+        // header only has whole seconds
+        if (when.isValid() && modified.toUTC().toTime_t() <= when.toTime_t()) unchanged = true;
+    }
 
-    // in range?
-    if (item.dateTime.date() < since) return;
-    if (item.dateTime.date() > before) return;
+    if (unchanged) {
+        response.setStatus(304, "Not Modified");
+        response.write(QByteArray(), true);
+    }
+    return unchanged;
+}
 
+void 
+APIWebService::writeRideLine(RideItem &item, HttpRequest *, HttpResponse *response)
+{
     // are we doing rides or intervals?
     listRideSettings *settings = static_cast<listRideSettings *>(response->userData());
 
+    // in range?
+    if (item.dateTime.date() < settings->since) return;
+    if (item.dateTime.date() > settings->before) return;
+
     if (settings->intervals == true) {
 
+        // interval metrics are computed on demand, open the ride once for them all
+        QStringList symbols;
+        foreach(int index, settings->wanted) symbols << RideMetricFactory::instance().metricName(index);
+        item.computeIntervalMetrics(symbols);
+
         // loop through all available intervals for this ride item
         foreach(IntervalItem *interval, item.intervals()){ 
 
@@ -446,11 +482,6 @@ APIWebService::listMMP(QString athlete, QStringList paths, HttpRequest &request,
 
     if (paths[0] == "bests") {
 
-        // header
-        response.bwrite("secs, ");
-        response.bwrite(seriesp.toLocal8Bit());
-        response.bwrite("\n");
-
         // honour the since parameter
         QString sincep(request.getParameter("since"));
         QDate since(1900,01,01);
@@ -461,22 +492,39 @@ APIWebService::listMMP(QString athlete, QStringList paths, HttpRequest &request,
         QDate before(3000,01,01);
         if (beforep != "") before = QDate::fromString(beforep,"yyyy/MM/dd");
 
+        // resident and only recomputed when the .cpx files change
+        QSharedPointer<APIAthleteCache::MeanMax> bests = athletes->meanMax(athlete, series, since, before);
+        if (notModified(request, response, bests->etag, bests->modified)) return;
+
+        // header
+        response.bwrite("secs, ");
+        response.bwrite(seriesp.toLocal8Bit());
+        response.bwrite("\n");
+
         int secs=0;
-        foreach(float value, RideFileCache::meanMaxFor(home.absolutePath() + "/" + athlete + "/cache", series, since, before)) {
+        foreach(float value, bests->values) {
             if (secs >0) response.bwrite(QString("%1, %2\n").arg(secs).arg(value).toLocal8Bit());
             secs++;
         }
+        response.flush();
 
 
     } else {
         QString CPXfilename = home.absolutePath() + "/" + athlete + "/cache/" + QFileInfo(filename).completeBaseName() + ".cpx";
 
+        bool cached = QFileInfo(CPXfilename).exists();
+        if (cached) {
+            QDateTime modified;
+            QByteArray etag = APIAthleteCache::etagFor(QStringList() << CPXfilename, &modified);
+            if (notModified(request, response, etag, modified)) return;
+        }
+
         // header
         response.bwrite("secs, ");
         response.bwrite(seriesp.toLocal8Bit());
         response.bwrite("\n");
 
-        if (QFileInfo(CPXfilename).exists()) {
+        if (cached) {
             int secs=0;
             foreach(float value, RideFileCache::meanMaxFor(CPXfilename, series)) {
                 if (secs >0) response.bwrite(QString("%1, %2\n").arg(secs).arg(value).toLocal8Bit());
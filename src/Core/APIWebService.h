@@ -22,10 +22,12 @@
 #include "httprequesthandler.h"
 #include "RideItem.h"
 #include "RideMetadata.h"
+#include "APIAthleteCache.h"
 #include <QDir>
 
 struct listRideSettings {
     bool intervals;
+    QDate since, before; // date range wanted
     QList<int> wanted; // metrics to list
     QList<FieldDefinition> metafields;
     QList<QString> metawanted; // metadata to list
@@ -36,8 +38,9 @@ class APIWebService : public HttpRequestHandler
 
     public:
 
-        // nothing to do in constructor
-        APIWebService(QDir home, QObject *parent=NULL) : HttpRequestHandler(parent), home(home) {}
+        // the athlete cache lives on the main thread with us
+        APIWebService(QDir home, QObject *parent=NULL) : HttpRequestHandler(parent), home(home),
+                      athletes(new APIAthleteCache(home, this)) {}
 
         // request despatchers
         void service(HttpRequest &request, HttpResponse &response);
@@ -54,8 +57,13 @@ class APIWebService : public HttpRequestHandler
         // utility
         void writeRideLine(RideItem &item, HttpRequest *request, HttpResponse *response);
 
+        // set the validators and answer with a 304 if the client
+        // already has it, true if there is nothing more to send
+        bool notModified(HttpRequest &request, HttpResponse &response, QByteArray etag, QDateTime modified);
+
     private:
         QDir home;
+        APIAthleteCache *athletes;
 };
 
 #endif
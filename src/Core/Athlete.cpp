@@ -25,6 +25,7 @@
 #include "RideMetadata.h"
 #include "RideCache.h"
 #include "RideFileCache.h"
+#include "MeanMaxStore.h"
 #include "RideMetric.h"
 #include "Settings.h"
 #include "TimeUtils.h"
@@ -155,6 +156,7 @@ Athlete::Athlete(Context *context, const QDir &homeDir)
 
     // Metadata
     rideCache = NULL; // let metadata know we don't have a ridecache yet
+    meanMaxStore = NULL;
     rideMetadata_ = new RideMetadata(context,true);
     rideMetadata_->hide();
     colorEngine = new ColorEngine(context);
@@ -175,6 +177,9 @@ Athlete::Athlete(Context *context, const QDir &homeDir)
     cloudAutoDownload = new CloudServiceAutoDownload(context);
     connect(context, SIGNAL(refreshEnd()), cloudAutoDownload, SLOT(autoDownload()));
 
+    // athlete-wide meanmax, must exist before the ride cache refreshes
+    meanMaxStore = new MeanMaxStore(home->cache().canonicalPath(), context);
+
     // now most dependencies are in get cache
     rideCache = new RideCache(context);
 
@@ -224,6 +229,7 @@ Athlete::~Athlete()
 {
     // close the ride cache down first
     delete rideCache;
+    delete meanMaxStore;
 
     // save those preset charts
     LTMSettings reader;
@@ -517,21 +523,28 @@ Athlete::getHeight(RideFile *ride)
     return height;
 }
 
-// working with PMC data series
+// working with PMC data series, they are
+// cached for every combination of parameters
+static QString pmcKey(QString source, int stsdays, int ltsdays)
+{
+    return QString("%1|%2|%3").arg(source).arg(stsdays).arg(ltsdays);
+}
+
 PMCData *
 Athlete::getPMCFor(QString metricName, int stsdays, int ltsdays)
 {
     PMCData *returning = NULL;
 
     // if we don't already have one, create it
-    returning = pmcData.value(metricName, NULL);
+    QString key = pmcKey(metricName, stsdays, ltsdays);
+    returning = pmcData.value(key, NULL);
     if (!returning) {
 
         // specification is blank and passes for all
         returning = new PMCData(context, Specification(), metricName, stsdays, ltsdays);
 
         // add to our collection
-        pmcData.insert(metricName, returning);
+        pmcData.insert(key, returning);
     }
 
     return returning;
@@ -543,19 +556,45 @@ Athlete::getPMCFor(Leaf *expr, DataFilterRuntime *df, int stsdays, int ltsdays)
     PMCData *returning = NULL;
 
     // if we don't already have one, create it
-    returning = pmcData.value(expr->signature(), NULL);
+    QString key = pmcKey(expr->signature(), stsdays, ltsdays);
+    returning = pmcData.value(key, NULL);
     if (!returning) {
 
         // specification is blank and passes for all
         returning = new PMCData(context, Specification(), expr, df, stsdays, ltsdays);
 
         // add to our collection
-        pmcData.insert(expr->signature(), returning);
+        pmcData.insert(key, returning);
     }
 
     return returning;
 }
 
+QList<PMCData*>
+Athlete::getPMCFor(QStringList metricNames, QList<QPair<int,int> > days)
+{
+    QList<PMCData*> returning;
+
+    // get them all, new ones are left stale
+    foreach(QString metricName, metricNames) {
+        for(int i=0; i<days.count(); i++) {
+
+            QString key = pmcKey(metricName, days[i].first, days[i].second);
+            PMCData *pmc = pmcData.value(key, NULL);
+            if (!pmc) {
+                pmc = new PMCData(context, Specification(), metricName, days[i].first, days[i].second, false);
+                pmcData.insert(key, pmc);
+            }
+            returning << pmc;
+        }
+    }
+
+    // and bring them up to date together
+    PMCData::refresh(returning);
+
+    return returning;
+}
+
 PDEstimate
 Athlete::getPDEstimateFor(QDate date, QString model, bool wpk)
 {
@@ -43,6 +43,7 @@ class Seasons;
 class RideNavigator;
 class NamedSearches;
 class RideFileCache;
+class MeanMaxStore;
 class RideItem;
 class IntervalItem;
 class IntervalTreeView;
@@ -98,6 +99,7 @@ class Athlete : public QObject
         QList<PDEstimate> PDEstimates_;
         Routes *routes;
         QList<RideFileCache*> cpxCache;
+        MeanMaxStore *meanMaxStore;
         RideCache *rideCache;
         Measures *measures;
 
@@ -111,6 +113,7 @@ class Athlete : public QObject
         // PMC Data
         PMCData *getPMCFor(QString metricName, int stsDays = -1, int ltsDays = -1); // no Specification used!
         PMCData *getPMCFor(Leaf *expr, DataFilterRuntime *df, int stsDays = -1, int ltsDays = -1); // no Specification used!
+        QList<PMCData*> getPMCFor(QStringList metricNames, QList<QPair<int,int> > days); // every metric x (sts, lts), one sweep
         QMap<QString, PMCData*> pmcData; // all the different PMC series
 
         // athlete measures
@@ -1544,12 +1544,12 @@ Result DataFilter::evaluate(RideItem *item, RideFilePoint *p)
 
         // ... start at main
         if (rt.functions.contains("main"))
-            res = treeRoot->eval(&rt, rt.functions.value("main"), 0, item, p);
+            res = rt.evaluate(rt.functions.value("main"), 0, item, p);
 
     } else {
 
         // otherwise just evaluate the entire tree
-        res = treeRoot->eval(&rt, treeRoot, 0, item, p);
+        res = rt.evaluate(treeRoot, 0, item, p);
     }
 
     return res;
@@ -1562,6 +1562,8 @@ QStringList DataFilter::check(QString query)
 
     // remember where we apply
     rt.isdynamic=false;
+    rt.programs.clear();
+    rt.batches.clear();
 
     // Parse from string
     DataFiltererrors.clear(); // clear out old errors
@@ -1594,6 +1596,8 @@ QStringList DataFilter::parseFilter(Context *context, QString query, QStringList
     rt.isdynamic=false;
     rt.snips.clear();
     rt.symbols.clear();
+    rt.programs.clear();
+    rt.batches.clear();
 
     // regardless of fail/pass set the signature
     setSignature(query);
@@ -1640,7 +1644,7 @@ QStringList DataFilter::parseFilter(Context *context, QString query, QStringList
         foreach(RideItem *item, context->athlete->rideCache->rides()) {
 
             // evaluate each ride...
-            Result result = treeRoot->eval(&rt, treeRoot, 0, item, NULL);
+            Result result = rt.evaluate(treeRoot, 0, item, NULL);
             if (result.isNumber && result.number) {
                 filenames << item->fileName;
             }
@@ -1666,7 +1670,7 @@ DataFilter::dynamicParse()
         foreach(RideItem *item, context->athlete->rideCache->rides()) {
 
             // evaluate each ride...
-            Result result = treeRoot->eval(&rt, treeRoot, 0, item, NULL);
+            Result result = rt.evaluate(treeRoot, 0, item, NULL);
             if (result.isNumber && result.number)
                 filenames << item->fileName;
         }
@@ -1681,6 +1685,8 @@ void DataFilter::clearFilter()
         treeRoot->clear(treeRoot);
         treeRoot = NULL;
     }
+    rt.programs.clear();
+    rt.batches.clear();
     rt.isdynamic = false;
     sig = "";
 }
@@ -1689,6 +1695,8 @@ void DataFilter::configChanged(qint32)
 {
     rt.lookupMap.clear();
     rt.lookupType.clear();
+    rt.programs.clear(); // symbols resolved against the old lookups
+    rt.batches.clear();
 
     // create lookup map from 'friendly name' to INTERNAL-name used in summaryMetrics
     // to enable a quick lookup && the lookup for the field type (number, text)
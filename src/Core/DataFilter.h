@@ -107,6 +107,93 @@ class Leaf {
         RideFile::XDataJoin xjoin; // how to join xdata with main
 };
 
+// The numeric subset of the language is compiled to a compact bytecode
+// for a register machine. Symbols are resolved to metric indexes and
+// series types when compiled, so evaluating a filter for each ride or a
+// user metric for each sample is a loop over the instructions with all
+// values held as doubles; no QString or Result in sight.
+//
+// Builtin functions that always return a number (best, estimate, sts ..)
+// are delegated to Leaf::eval, anything else the compiler doesn't handle
+// (strings, vectors, user functions, while loops etc) rejects the program
+// and the tree is evaluated as before.
+class DataFilterProgram {
+
+    public:
+
+        DataFilterProgram() : valid(false), sample(false), registers(0) {}
+
+        // compile the tree, returns false if it can't be
+        bool compile(DataFilterRuntime *df, Leaf *leaf);
+        bool isValid() const { return valid; }
+
+        // run it, returns false if it can't run in this context
+        // i.e. it refers to data series but p is NULL
+        bool run(DataFilterRuntime *df, double &result, float x, RideItem *m, RideFilePoint *p = NULL,
+                 const QHash<QString,RideMetric*> *metrics=NULL) const;
+
+        struct Instruction {
+            int code;
+            int dst, a, b;      // registers, b is target for jumps
+            int index;          // metric, series, name, leaf or function
+            double k;           // constant
+        };
+
+    private:
+
+        bool generate(DataFilterRuntime *df, Leaf *leaf, int dst);
+        bool generateSymbol(DataFilterRuntime *df, Leaf *leaf, int dst);
+        bool generateFunction(DataFilterRuntime *df, Leaf *leaf, int dst);
+        int add(int code, int dst, int a=0, int b=0, int index=0, double k=0);
+
+        bool valid, sample;
+        int registers;
+        QVector<Instruction> code;
+        QStringList names;
+        QVector<Leaf*> leaves;
+};
+
+// Batch evaluation of a user metric's sample { } function across all
+// the samples in a ride. Only possible when each statement reduces a
+// side effect free expression into a user symbol; either a running sum
+// like "total <- total + POWER;" or an assignment where the last value
+// wins, optionally guarded by if/else. The expressions are compiled to
+// column code that is run over chunks of samples at a time, the caller
+// falls back to evaluating point by point when it isn't valid.
+class DataFilterBatch {
+
+    public:
+
+        DataFilterBatch() : valid(false), registers(0) {}
+
+        // compile the function, returns false if it can't be
+        bool compile(DataFilterRuntime *df, Leaf *leaf);
+        bool isValid() const { return valid; }
+
+        // run over samples from..to inclusive, updating the symbols
+        void run(DataFilterRuntime *df, float x, RideItem *m, int from, int to,
+                 const QHash<QString,RideMetric*> *metrics=NULL) const;
+
+    private:
+
+        enum { Sum, Last };
+        struct Reduction {
+            int kind;
+            int symbol;         // index into names
+            int value, mask;    // registers, mask is -1 when unconditional
+        };
+
+        bool statement(DataFilterRuntime *df, Leaf *leaf, int mask);
+        bool generate(DataFilterRuntime *df, Leaf *leaf, int dst);
+        int add(int code, int dst, int a=0, int b=0, int index=0, double k=0);
+
+        bool valid;
+        int registers;
+        QVector<DataFilterProgram::Instruction> code;
+        QVector<Reduction> reductions;
+        QStringList names, stored;
+};
+
 class DataFilterRuntime {
 
     // allocated for each thread to avoid race
@@ -139,6 +226,18 @@ public:
 
     QHash<Leaf*, int> indexes;
 
+    // compiled programs, keyed by the leaf they were compiled from
+    // they must be cleared whenever the tree or lookups change
+    QHash<Leaf*, DataFilterProgram> programs;
+    const DataFilterProgram &program(Leaf *leaf);
+
+    // compiled sample functions for user metrics
+    QHash<Leaf*, DataFilterBatch> batches;
+    const DataFilterBatch &batch(Leaf *leaf);
+
+    // evaluate using the compiled program if there is one
+    Result evaluate(Leaf *leaf, float x, RideItem *m, RideFilePoint *p = NULL, const QHash<QString,RideMetric*> *metrics=NULL);
+
     // pd models for estimates
     QList <PDModel*>models;
 
@@ -0,0 +1,902 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "DataFilter.h"
+#include "Context.h"
+#include "RideItem.h"
+#include "RideMetric.h"
+
+#include "DataFilter_yacc.h"
+
+#include <cmath>
+#include <QVarLengthArray>
+
+// opcodes
+enum {
+    OpLoadConst, OpLoadX, OpLoadMetric, OpLoadMeta, OpLoadSeries, OpLoadSymbol, OpStoreSymbol,
+    OpIsRun, OpIsSwim, OpRecIntSecs, OpCurrent, OpToday, OpDate,
+    OpNeg, OpNot, OpAdd, OpSubtract, OpMultiply, OpDivide, OpPow,
+    OpEq, OpNeq, OpLt, OpLte, OpGt, OpGte,
+    OpMath, OpEval, OpJump, OpJumpZero, OpJumpNonZero,
+
+    // batch only, no jumps in column code
+    OpAnd, OpOr, OpElvis, OpSelect
+};
+
+// samples evaluated at a time in batch mode
+static const int DataFilterBatchChunk = 256;
+
+// must match the first entries in DataFilterFunctions since
+// the offset is used when calling them, see Leaf::eval
+static const char *mathFunctions[] = {
+    "cos", "tan", "sin", "acos", "atan", "asin", "cosh", "tanh", "sinh",
+    "acosh", "atanh", "asinh", "exp", "log", "log10", "ceil", "floor", "round",
+    "fabs", "isinf", "isnan", NULL
+};
+
+// builtins that always return a number, we leave those to the tree
+static const char *numericFunctions[] = {
+    "best", "tiz", "config", "sum", "mean", "max", "min", "count",
+    "lts", "sts", "sb", "rr", "estimate", "vdottime", "besttime", NULL
+};
+
+static int lookup(const char **table, QString name)
+{
+    for (int i=0; table[i]; i++) if (name == table[i]) return i;
+    return -1;
+}
+
+int
+DataFilterProgram::add(int code, int dst, int a, int b, int index, double k)
+{
+    Instruction i;
+    i.code = code;
+    i.dst = dst;
+    i.a = a;
+    i.b = b;
+    i.index = index;
+    i.k = k;
+    this->code << i;
+
+    if (dst >= registers) registers = dst+1;
+    return this->code.count()-1;
+}
+
+bool
+DataFilterProgram::compile(DataFilterRuntime *df, Leaf *leaf)
+{
+    code.clear();
+    names.clear();
+    leaves.clear();
+    registers = 0;
+    sample = false;
+
+    valid = leaf && generate(df, leaf, 0);
+    if (!valid) code.clear();
+
+    return valid;
+}
+
+//
+// Code generation, the result of leaf is left in register dst and only
+// registers above dst are used for temporaries so the register file is
+// really just a stack.
+//
+bool
+DataFilterProgram::generate(DataFilterRuntime *df, Leaf *leaf, int dst)
+{
+    if (leaf == NULL) return false;
+
+    switch(leaf->type) {
+
+    case Leaf::Float :
+        add(OpLoadConst, dst, 0, 0, 0, leaf->lvalue.f);
+        return true;
+
+    case Leaf::Integer :
+        add(OpLoadConst, dst, 0, 0, 0, leaf->lvalue.i);
+        return true;
+
+    case Leaf::String :
+    {
+        // only dates, which are numbers
+        QDate date = QDate::fromString(*(leaf->lvalue.s), "yyyy/MM/dd");
+        if (!date.isValid()) return false;
+        add(OpLoadConst, dst, 0, 0, 0, QDate(1900,01,01).daysTo(date));
+        return true;
+    }
+
+    case Leaf::Symbol :
+        return generateSymbol(df, leaf, dst);
+
+    case Leaf::Function :
+        return generateFunction(df, leaf, dst);
+
+    case Leaf::Logical :
+    {
+        if (leaf->op != AND && leaf->op != OR) return generate(df, leaf->lvalue.l, dst); // parenthesis
+
+        // short circuit
+        int branch = (leaf->op == AND) ? OpJumpZero : OpJumpNonZero;
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        int first = add(branch, dst, dst);
+        if (!generate(df, leaf->rvalue.l, dst)) return false;
+        int second = add(branch, dst, dst);
+        add(OpLoadConst, dst, 0, 0, 0, leaf->op == AND ? 1 : 0);
+        int done = add(OpJump, dst);
+        code[first].b = code[second].b = code.count();
+        add(OpLoadConst, dst, 0, 0, 0, leaf->op == AND ? 0 : 1);
+        code[done].b = code.count();
+        return true;
+    }
+
+    case Leaf::UnaryOperation :
+    {
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        if (leaf->op == '-') add(OpNeg, dst, dst);
+        else if (leaf->op == '!') add(OpNot, dst, dst);
+        else add(OpLoadConst, dst);
+        return true;
+    }
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+    {
+        int op;
+        switch(leaf->op) {
+
+        case ASSIGN:
+        {
+            // only plain symbols, not indexes into a vector
+            if (leaf->lvalue.l->type != Leaf::Symbol) return false;
+            if (!generate(df, leaf->rvalue.l, dst)) return false;
+            names << *(leaf->lvalue.l->lvalue.n);
+            add(OpStoreSymbol, dst, dst, 0, names.count()-1);
+            return true;
+        }
+
+        case ELVIS:
+        {
+            // rhs only evaluated if lhs is zero
+            if (!generate(df, leaf->lvalue.l, dst)) return false;
+            int skip = add(OpJumpNonZero, dst, dst);
+            if (!generate(df, leaf->rvalue.l, dst)) return false;
+            code[skip].b = code.count();
+            return true;
+        }
+
+        case ADD: op = OpAdd; break;
+        case SUBTRACT: op = OpSubtract; break;
+        case MULTIPLY: op = OpMultiply; break;
+        case DIVIDE: op = OpDivide; break;
+        case POW: op = OpPow; break;
+        case EQ: op = OpEq; break;
+        case NEQ: op = OpNeq; break;
+        case LT: op = OpLt; break;
+        case LTE: op = OpLte; break;
+        case GT: op = OpGt; break;
+        case GTE: op = OpGte; break;
+
+        default: // string operators
+            return false;
+        }
+
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        if (!generate(df, leaf->rvalue.l, dst+1)) return false;
+        add(op, dst, dst, dst+1);
+        return true;
+    }
+
+    case Leaf::Conditional :
+    {
+        // while loops stay in the tree, they need bounding
+        if (leaf->op != IF_ && leaf->op != 0) return false;
+
+        if (!generate(df, leaf->cond.l, dst)) return false;
+        int otherwise = add(OpJumpZero, dst, dst);
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        int done = add(OpJump, dst);
+        code[otherwise].b = code.count();
+        if (leaf->rvalue.l) {
+            if (!generate(df, leaf->rvalue.l, dst)) return false;
+        } else {
+            add(OpLoadConst, dst);
+        }
+        code[done].b = code.count();
+        return true;
+    }
+
+    case Leaf::Compound :
+    {
+        // value of the last statement
+        if (leaf->lvalue.b->isEmpty()) add(OpLoadConst, dst);
+        foreach(Leaf *statement, *(leaf->lvalue.b))
+            if (!generate(df, statement, dst)) return false;
+        return true;
+    }
+
+    default: // vectors, indexes, scripts ..
+        return false;
+    }
+}
+
+// resolve a symbol to the instruction that loads it, this must follow
+// the same order as Leaf::eval; data series win when iterating over
+// samples, then user symbols, then the builtins and lastly metrics
+// and metadata
+static bool resolve(DataFilterRuntime *df, QString symbol, QStringList &names, DataFilterProgram::Instruction &i)
+{
+    i.index = 0;
+    i.k = 0;
+
+    if (df->dataSeriesSymbols.contains(symbol)) {
+
+        RideFile::SeriesType type = RideFile::seriesForSymbol(symbol);
+        if (type == RideFile::index) return false; // indexOf is slow anyway
+
+        i.code = OpLoadSeries;
+        i.index = type;
+        return true;
+    }
+
+    // user defined symbols, all of them are known after validation
+    if (df->symbols.contains(symbol)) {
+        names << symbol;
+        i.code = OpLoadSymbol;
+        i.index = names.count()-1;
+        return true;
+    }
+
+    if (symbol == "x") i.code = OpLoadX;
+    else if (symbol == "isRun") i.code = OpIsRun;
+    else if (symbol == "isSwim") i.code = OpIsSwim;
+    else if (!symbol.compare("NA", Qt::CaseInsensitive)) { i.code = OpLoadConst; i.k = RideFile::NA; }
+    else if (!symbol.compare("RECINTSECS", Qt::CaseInsensitive)) i.code = OpRecIntSecs;
+    else if (!symbol.compare("Current", Qt::CaseInsensitive)) i.code = OpCurrent;
+    else if (!symbol.compare("Today", Qt::CaseInsensitive)) i.code = OpToday;
+    else if (!symbol.compare("Date", Qt::CaseInsensitive)) i.code = OpDate;
+    else if (!symbol.compare("ctl", Qt::CaseInsensitive) || !symbol.compare("atl", Qt::CaseInsensitive)
+             || !symbol.compare("tsb", Qt::CaseInsensitive)) return false;
+    else if (df->lookupType.value(symbol, false) == true) {
+
+        // metrics go to the metric index once any metadata field of
+        // the same name has been checked, numeric metadata fields
+        // still need to be looked up by name
+        QString name = df->lookupMap.value(symbol, "");
+        const RideMetric *metric = RideMetricFactory::instance().rideMetric(name);
+
+        names << name;
+        i.index = names.count()-1;
+        if (metric) {
+            i.code = OpLoadMetric;
+            i.k = metric->index();
+        } else {
+            i.code = OpLoadMeta;
+        }
+
+    } else {
+        // string metadata
+        return false;
+    }
+    return true;
+}
+
+bool
+DataFilterProgram::generateSymbol(DataFilterRuntime *df, Leaf *leaf, int dst)
+{
+    Instruction i;
+    if (!resolve(df, *(leaf->lvalue.n), names, i)) return false;
+
+    // if we refer to data series we can only run
+    // when there is a sample to look at
+    if (i.code == OpLoadSeries) sample = true;
+
+    add(i.code, dst, 0, 0, i.index, i.k);
+    return true;
+}
+
+bool
+DataFilterProgram::generateFunction(DataFilterRuntime *df, Leaf *leaf, int dst)
+{
+    // user defined functions may return anything
+    if (df->functions.contains(leaf->function)) return false;
+
+    // builtins that return a number stay in the tree
+    if (lookup(numericFunctions, leaf->function) >= 0) {
+        leaves << leaf;
+        add(OpEval, dst, 0, 0, leaves.count()-1);
+        return true;
+    }
+
+    // math.h
+    int fnum = lookup(mathFunctions, leaf->function);
+    if (fnum < 0 || leaf->fparms.count() != 1) return false;
+
+    if (!generate(df, leaf->fparms[0], dst)) return false;
+    add(OpMath, dst, dst, 0, fnum);
+    return true;
+}
+
+static double math(int fnum, double x)
+{
+    switch(fnum) {
+    case 0 : return cos(x);
+    case 1 : return tan(x);
+    case 2 : return sin(x);
+    case 3 : return acos(x);
+    case 4 : return atan(x);
+    case 5 : return asin(x);
+    case 6 : return cosh(x);
+    case 7 : return tanh(x);
+    case 8 : return sinh(x);
+    case 9 : return acosh(x);
+    case 10 : return atanh(x);
+    case 11 : return asinh(x);
+    case 12 : return exp(x);
+    case 13 : return log(x);
+    case 14 : return log10(x);
+    case 15 : return ceil(x);
+    case 16 : return floor(x);
+    case 17 : return round(x);
+    case 18 : return fabs(x);
+    case 19 : return std::isinf(x);
+    case 20 : return std::isnan(x);
+    }
+    return 0;
+}
+
+// values that don't change from sample to sample
+static double load(const DataFilterProgram::Instruction &i, const QStringList &names,
+                   DataFilterRuntime *df, RideItem *m, const QHash<QString,RideMetric*> *c)
+{
+    switch(i.code) {
+
+    case OpLoadMetric:
+    {
+        // metadata with the same name wins, as it does in Leaf::eval, and
+        // the metric count is the factory's now, user metrics are added
+        // after their programs are compiled
+        QString meta = m->getText(names[i.index], "unknown");
+        if (meta != "unknown") return meta.toDouble();
+        if (c) return RideMetric::getForSymbol(names[i.index], c);
+
+        const QVector<double> &metrics = m->metrics();
+        int index = int(i.k);
+        if (metrics.size() == RideMetricFactory::instance().metricCount() && index < metrics.size())
+            return metrics[index];
+        return 0;
+    }
+
+    case OpLoadMeta:
+    {
+        QString meta = m->getText(names[i.index], "unknown");
+        if (meta != "unknown") return meta.toDouble();
+        else if (c) return RideMetric::getForSymbol(names[i.index], c);
+        else return m->getForSymbol(names[i.index]);
+    }
+
+    case OpLoadSymbol:
+    {
+        QHash<QString,Result>::const_iterator it = df->symbols.constFind(names[i.index]);
+        return (it != df->symbols.constEnd()) ? it.value().number : 0;
+    }
+
+    case OpIsRun: return m->isRun ? 1 : 0;
+    case OpIsSwim: return m->isSwim ? 1 : 0;
+    case OpRecIntSecs: return m->ride(false) ? m->ride(false)->recIntSecs() : 1;
+    case OpCurrent:
+        if (m->context->currentRideItem())
+            return QDate(1900,01,01).daysTo(m->context->currentRideItem()->dateTime.date());
+        else
+            return 0;
+    case OpToday: return QDate(1900,01,01).daysTo(QDate::currentDate());
+    case OpDate: return QDate(1900,01,01).daysTo(m->dateTime.date());
+    }
+    return 0;
+}
+
+bool
+DataFilterProgram::run(DataFilterRuntime *df, double &result, float x, RideItem *m, RideFilePoint *p,
+                       const QHash<QString,RideMetric*> *c) const
+{
+    if (!valid || (sample && !p)) return false;
+
+    QVarLengthArray<double, 32> r(registers);
+    const Instruction *instructions = code.constData();
+    const int count = code.count();
+
+    for (int pc=0; pc < count; pc++) {
+
+        const Instruction &i = instructions[pc];
+        switch(i.code) {
+
+        case OpLoadConst: r[i.dst] = i.k; break;
+        case OpLoadX: r[i.dst] = x; break;
+        case OpLoadSeries: r[i.dst] = p->value(static_cast<RideFile::SeriesType>(i.index)); break;
+
+        case OpLoadMetric:
+        case OpLoadMeta:
+        case OpLoadSymbol:
+        case OpIsRun:
+        case OpIsSwim:
+        case OpRecIntSecs:
+        case OpCurrent:
+        case OpToday:
+        case OpDate:
+            r[i.dst] = load(i, names, df, m, c);
+            break;
+
+        case OpStoreSymbol:
+            df->symbols.insert(names[i.index], Result(r[i.a]));
+            break;
+
+        case OpNeg: r[i.dst] = r[i.a] * -1; break;
+        case OpNot: r[i.dst] = !r[i.a]; break;
+        case OpAdd: r[i.dst] = r[i.a] + r[i.b]; break;
+        case OpSubtract: r[i.dst] = r[i.a] - r[i.b]; break;
+        case OpMultiply: r[i.dst] = r[i.a] * r[i.b]; break;
+        case OpDivide: r[i.dst] = r[i.b] ? r[i.a] / r[i.b] : 0; break; // avoid divide by zero
+        case OpPow: r[i.dst] = r[i.b] ? pow(r[i.a], r[i.b]) : 0; break;
+        case OpEq: r[i.dst] = r[i.a] == r[i.b]; break;
+        case OpNeq: r[i.dst] = r[i.a] != r[i.b]; break;
+        case OpLt: r[i.dst] = r[i.a] < r[i.b]; break;
+        case OpLte: r[i.dst] = r[i.a] <= r[i.b]; break;
+        case OpGt: r[i.dst] = r[i.a] > r[i.b]; break;
+        case OpGte: r[i.dst] = r[i.a] >= r[i.b]; break;
+
+        case OpMath: r[i.dst] = math(i.index, r[i.a]); break;
+        case OpEval: r[i.dst] = leaves[i.index]->eval(df, leaves[i.index], x, m, p, c).number; break;
+
+        case OpJump: pc = i.b - 1; break;
+        case OpJumpZero: if (!r[i.a]) pc = i.b - 1; break;
+        case OpJumpNonZero: if (r[i.a]) pc = i.b - 1; break;
+        }
+    }
+
+    result = r[0];
+    return true;
+}
+
+//
+// Batch evaluation of sample functions
+//
+int
+DataFilterBatch::add(int code, int dst, int a, int b, int index, double k)
+{
+    DataFilterProgram::Instruction i;
+    i.code = code;
+    i.dst = dst;
+    i.a = a;
+    i.b = b;
+    i.index = index;
+    i.k = k;
+    this->code << i;
+
+    if (dst >= registers) registers = dst+1;
+    return this->code.count()-1;
+}
+
+// all the symbols assigned in the tree
+static void assigned(Leaf *leaf, QStringList &symbols)
+{
+    if (leaf == NULL) return;
+
+    switch(leaf->type) {
+
+    case Leaf::Compound :
+        foreach(Leaf *statement, *(leaf->lvalue.b)) assigned(statement, symbols);
+        break;
+
+    case Leaf::Conditional :
+        assigned(leaf->cond.l, symbols);
+        assigned(leaf->lvalue.l, symbols);
+        assigned(leaf->rvalue.l, symbols);
+        break;
+
+    case Leaf::UnaryOperation :
+        assigned(leaf->lvalue.l, symbols);
+        break;
+
+    case Leaf::Logical :
+        assigned(leaf->lvalue.l, symbols);
+        if (leaf->op == AND || leaf->op == OR) assigned(leaf->rvalue.l, symbols);
+        break;
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+        if (leaf->op == ASSIGN && leaf->lvalue.l->type == Leaf::Symbol)
+            symbols << *(leaf->lvalue.l->lvalue.n);
+        else
+            assigned(leaf->lvalue.l, symbols);
+        assigned(leaf->rvalue.l, symbols);
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool
+DataFilterBatch::compile(DataFilterRuntime *df, Leaf *leaf)
+{
+    code.clear();
+    reductions.clear();
+    names.clear();
+    stored.clear();
+    registers = 0;
+
+    if (leaf) assigned(leaf, stored);
+
+    valid = leaf && statement(df, leaf, -1);
+    if (!valid) {
+        code.clear();
+        reductions.clear();
+    }
+    return valid;
+}
+
+bool
+DataFilterBatch::statement(DataFilterRuntime *df, Leaf *leaf, int mask)
+{
+    if (leaf == NULL) return false;
+
+    switch(leaf->type) {
+
+    case Leaf::Compound :
+    {
+        foreach(Leaf *statement, *(leaf->lvalue.b))
+            if (!this->statement(df, statement, mask)) return false;
+        return true;
+    }
+
+    case Leaf::Conditional :
+    {
+        if (leaf->op != IF_ && leaf->op != 0) return false;
+
+        // the mask for each branch is the condition anded with ours
+        int cond = registers;
+        if (!generate(df, leaf->cond.l, cond)) return false;
+
+        int when = cond;
+        if (mask >= 0) {
+            when = registers;
+            add(OpAnd, when, mask, cond);
+        }
+        if (!this->statement(df, leaf->lvalue.l, when)) return false;
+
+        if (leaf->rvalue.l) {
+            int otherwise = registers;
+            add(OpNot, otherwise, cond);
+            if (mask >= 0) add(OpAnd, otherwise, otherwise, mask);
+            if (!this->statement(df, leaf->rvalue.l, otherwise)) return false;
+        }
+        return true;
+    }
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+    {
+        if (leaf->op != ASSIGN || leaf->lvalue.l->type != Leaf::Symbol) return false;
+
+        // a symbol with the same name as a data series can't be read back
+        // and we keep the order of updates simple; one statement per symbol
+        QString symbol = *(leaf->lvalue.l->lvalue.n);
+        if (df->dataSeriesSymbols.contains(symbol) || !df->symbols.contains(symbol)) return false;
+        if (stored.count(symbol) > 1) return false;
+
+        // running sum is symbol + expr, expr + symbol or symbol - expr
+        Reduction reduction;
+        Leaf *rhs = leaf->rvalue.l;
+        Leaf *expr = rhs;
+        bool negate = false;
+        reduction.kind = Last;
+
+        if (rhs->type == Leaf::BinaryOperation && (rhs->op == ADD || rhs->op == SUBTRACT)) {
+
+            Leaf *l = rhs->lvalue.l, *r = rhs->rvalue.l;
+            if (l->type == Leaf::Symbol && *(l->lvalue.n) == symbol) {
+                reduction.kind = Sum;
+                negate = (rhs->op == SUBTRACT);
+                expr = r;
+            } else if (rhs->op == ADD && r->type == Leaf::Symbol && *(r->lvalue.n) == symbol) {
+                reduction.kind = Sum;
+                expr = l;
+            }
+        }
+
+        reduction.value = registers;
+        if (!generate(df, expr, reduction.value)) return false;
+        if (negate) add(OpNeg, reduction.value, reduction.value);
+
+        names << symbol;
+        reduction.symbol = names.count()-1;
+        reduction.mask = mask;
+        reductions << reduction;
+        return true;
+    }
+
+    default: // expressions with no effect, loops etc
+        return false;
+    }
+}
+
+// column code for a side effect free expression
+bool
+DataFilterBatch::generate(DataFilterRuntime *df, Leaf *leaf, int dst)
+{
+    if (leaf == NULL) return false;
+
+    switch(leaf->type) {
+
+    case Leaf::Float :
+        add(OpLoadConst, dst, 0, 0, 0, leaf->lvalue.f);
+        return true;
+
+    case Leaf::Integer :
+        add(OpLoadConst, dst, 0, 0, 0, leaf->lvalue.i);
+        return true;
+
+    case Leaf::String :
+    {
+        QDate date = QDate::fromString(*(leaf->lvalue.s), "yyyy/MM/dd");
+        if (!date.isValid()) return false;
+        add(OpLoadConst, dst, 0, 0, 0, QDate(1900,01,01).daysTo(date));
+        return true;
+    }
+
+    case Leaf::Symbol :
+    {
+        // symbols we are updating change from sample to sample
+        QString symbol = *(leaf->lvalue.n);
+        if (stored.contains(symbol) && !df->dataSeriesSymbols.contains(symbol)) return false;
+
+        DataFilterProgram::Instruction i;
+        if (!resolve(df, symbol, names, i)) return false;
+        add(i.code, dst, 0, 0, i.index, i.k);
+        return true;
+    }
+
+    case Leaf::Function :
+    {
+        if (df->functions.contains(leaf->function)) return false;
+
+        int fnum = lookup(mathFunctions, leaf->function);
+        if (fnum < 0 || leaf->fparms.count() != 1) return false;
+
+        if (!generate(df, leaf->fparms[0], dst)) return false;
+        add(OpMath, dst, dst, 0, fnum);
+        return true;
+    }
+
+    case Leaf::Logical :
+    {
+        if (leaf->op != AND && leaf->op != OR) return generate(df, leaf->lvalue.l, dst);
+
+        // no short circuit, but there are no side effects to skip
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        if (!generate(df, leaf->rvalue.l, dst+1)) return false;
+        add(leaf->op == AND ? OpAnd : OpOr, dst, dst, dst+1);
+        return true;
+    }
+
+    case Leaf::UnaryOperation :
+    {
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        if (leaf->op == '-') add(OpNeg, dst, dst);
+        else if (leaf->op == '!') add(OpNot, dst, dst);
+        else add(OpLoadConst, dst);
+        return true;
+    }
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+    {
+        int op;
+        switch(leaf->op) {
+        case ELVIS: op = OpElvis; break;
+        case ADD: op = OpAdd; break;
+        case SUBTRACT: op = OpSubtract; break;
+        case MULTIPLY: op = OpMultiply; break;
+        case DIVIDE: op = OpDivide; break;
+        case POW: op = OpPow; break;
+        case EQ: op = OpEq; break;
+        case NEQ: op = OpNeq; break;
+        case LT: op = OpLt; break;
+        case LTE: op = OpLte; break;
+        case GT: op = OpGt; break;
+        case GTE: op = OpGte; break;
+        default: // assignment and string operators
+            return false;
+        }
+
+        if (!generate(df, leaf->lvalue.l, dst)) return false;
+        if (!generate(df, leaf->rvalue.l, dst+1)) return false;
+        add(op, dst, dst, dst+1);
+        return true;
+    }
+
+    case Leaf::Conditional :
+    {
+        // ternary, both sides are evaluated and then selected
+        if (leaf->op != IF_ && leaf->op != 0) return false;
+
+        if (!generate(df, leaf->cond.l, dst)) return false;
+        if (!generate(df, leaf->lvalue.l, dst+1)) return false;
+        if (leaf->rvalue.l) {
+            if (!generate(df, leaf->rvalue.l, dst+2)) return false;
+        } else {
+            add(OpLoadConst, dst+2);
+        }
+        add(OpSelect, dst, dst+1, dst+2, dst);
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+void
+DataFilterBatch::run(DataFilterRuntime *df, float x, RideItem *m, int from, int to,
+                     const QHash<QString,RideMetric*> *c) const
+{
+    if (!valid || from < 0 || to < from || !m->ride()) return;
+
+    const DataFilterProgram::Instruction *instructions = code.constData();
+    const int count = code.count();
+
+    // anything that doesn't change from sample to sample is only looked
+    // up once, data series are read from the ride's columns
+    QVector<double> values(count);
+    QVector<QVector<double> > series(count);
+    for (int pc=0; pc<count; pc++) {
+        const DataFilterProgram::Instruction &i = instructions[pc];
+        switch (i.code) {
+        case OpLoadConst: values[pc] = i.k; break;
+        case OpLoadX: values[pc] = x; break;
+        case OpLoadSeries: series[pc] = m->ride()->column(static_cast<RideFile::SeriesType>(i.index)); break;
+        default: values[pc] = load(i, names, df, m, c); break;
+        }
+    }
+
+    // running values for the reductions
+    QVector<double> results(reductions.count());
+    QVector<bool> updated(reductions.count(), false);
+    for (int j=0; j<reductions.count(); j++)
+        results[j] = df->symbols.value(names[reductions[j].symbol]).number;
+
+    QVector<double> columns(registers * DataFilterBatchChunk);
+    double *r = columns.data();
+
+    for (int start=from; start <= to; start += DataFilterBatchChunk) {
+
+        const int n = qMin(DataFilterBatchChunk, to - start + 1);
+
+        for (int pc=0; pc<count; pc++) {
+
+            const DataFilterProgram::Instruction &i = instructions[pc];
+            double *d = r + i.dst * DataFilterBatchChunk;
+            const double *a = r + i.a * DataFilterBatchChunk;
+            const double *b = r + i.b * DataFilterBatchChunk;
+
+            switch(i.code) {
+
+            case OpLoadSeries:
+            {
+                const double *column = series[pc].constData() + start;
+                for (int k=0; k<n; k++) d[k] = column[k];
+            }
+            break;
+
+            case OpNeg: for (int k=0; k<n; k++) d[k] = a[k] * -1; break;
+            case OpNot: for (int k=0; k<n; k++) d[k] = !a[k]; break;
+            case OpAdd: for (int k=0; k<n; k++) d[k] = a[k] + b[k]; break;
+            case OpSubtract: for (int k=0; k<n; k++) d[k] = a[k] - b[k]; break;
+            case OpMultiply: for (int k=0; k<n; k++) d[k] = a[k] * b[k]; break;
+            case OpDivide: for (int k=0; k<n; k++) d[k] = b[k] ? a[k] / b[k] : 0; break;
+            case OpPow: for (int k=0; k<n; k++) d[k] = b[k] ? pow(a[k], b[k]) : 0; break;
+            case OpEq: for (int k=0; k<n; k++) d[k] = a[k] == b[k]; break;
+            case OpNeq: for (int k=0; k<n; k++) d[k] = a[k] != b[k]; break;
+            case OpLt: for (int k=0; k<n; k++) d[k] = a[k] < b[k]; break;
+            case OpLte: for (int k=0; k<n; k++) d[k] = a[k] <= b[k]; break;
+            case OpGt: for (int k=0; k<n; k++) d[k] = a[k] > b[k]; break;
+            case OpGte: for (int k=0; k<n; k++) d[k] = a[k] >= b[k]; break;
+            case OpAnd: for (int k=0; k<n; k++) d[k] = (a[k] && b[k]) ? 1 : 0; break;
+            case OpOr: for (int k=0; k<n; k++) d[k] = (a[k] || b[k]) ? 1 : 0; break;
+            case OpElvis: for (int k=0; k<n; k++) d[k] = a[k] ? a[k] : b[k]; break;
+            case OpSelect:
+            {
+                const double *cond = r + i.index * DataFilterBatchChunk;
+                for (int k=0; k<n; k++) d[k] = cond[k] ? a[k] : b[k];
+            }
+            break;
+            case OpMath: for (int k=0; k<n; k++) d[k] = math(i.index, a[k]); break;
+
+            default: // constants
+                for (int k=0; k<n; k++) d[k] = values[pc];
+                break;
+            }
+        }
+
+        // fold this chunk into the reductions, in sample order
+        // so sums come out exactly as they would point by point
+        for (int j=0; j<reductions.count(); j++) {
+
+            const Reduction &reduction = reductions[j];
+            const double *v = r + reduction.value * DataFilterBatchChunk;
+            const double *mask = reduction.mask >= 0 ? r + reduction.mask * DataFilterBatchChunk : NULL;
+
+            if (reduction.kind == Sum) {
+                double sum = results[j];
+                for (int k=0; k<n; k++) {
+                    if (mask && !mask[k]) continue;
+                    sum += v[k];
+                    updated[j] = true;
+                }
+                results[j] = sum;
+            } else {
+                for (int k=n-1; k>=0; k--) {
+                    if (mask && !mask[k]) continue;
+                    results[j] = v[k];
+                    updated[j] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // symbols only change if they were assigned
+    for (int j=0; j<reductions.count(); j++)
+        if (updated[j]) df->symbols.insert(names[reductions[j].symbol], Result(results[j]));
+}
+
+//
+// Runtime entry points
+//
+const DataFilterProgram &
+DataFilterRuntime::program(Leaf *leaf)
+{
+    // constFind so clones sharing the programs don't detach
+    QHash<Leaf*, DataFilterProgram>::const_iterator found = programs.constFind(leaf);
+    if (found != programs.constEnd()) return found.value();
+
+    QHash<Leaf*, DataFilterProgram>::iterator it = programs.insert(leaf, DataFilterProgram());
+    it.value().compile(this, leaf);
+    return it.value();
+}
+
+const DataFilterBatch &
+DataFilterRuntime::batch(Leaf *leaf)
+{
+    QHash<Leaf*, DataFilterBatch>::const_iterator found = batches.constFind(leaf);
+    if (found != batches.constEnd()) return found.value();
+
+    QHash<Leaf*, DataFilterBatch>::iterator it = batches.insert(leaf, DataFilterBatch());
+    it.value().compile(this, leaf);
+    return it.value();
+}
+
+Result
+DataFilterRuntime::evaluate(Leaf *leaf, float x, RideItem *m, RideFilePoint *p, const QHash<QString,RideMetric*> *c)
+{
+    double result;
+    if (program(leaf).run(this, result, x, m, p, c)) return Result(result);
+
+    // not compiled or can't run here
+    return leaf->eval(this, leaf, x, m, p, c);
+}
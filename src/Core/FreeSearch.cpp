@@ -20,8 +20,8 @@
 #include "Context.h"
 #include "Athlete.h"
 #include "RideItem.h"
-#include "IntervalItem.h"
 #include "RideCache.h"
+#include "SearchIndex.h"
 
 FreeSearch::FreeSearch(QObject *parent, Context *context) : QObject(parent), context(context)
 {
@@ -32,87 +32,11 @@ FreeSearch::~FreeSearch()
 {
 }
 
-static QStringList searchSplit(QString string)
-{
-    const QString whitespace(" \n\r\t");
-    QStringList returning;
-    bool inQuotes = false;
-
-    QString current;
-    for (int i=0; i<string.length(); i++) {
-
-        // got a bit of whitespace after a word so split and add
-        if (current != "" && !inQuotes && whitespace.contains(string[i])) {
-            returning << current;
-            current = "";
-            continue;
-        }
-
-        // quote delimeted
-        if (string[i] == '\"') {
-            if (inQuotes) {
-                returning << current;
-                current = "";
-                inQuotes = false;
-            } else {
-                inQuotes = true;
-            }
-            continue;
-        }
-
-        // escaped
-        if (string[i] == '\\' && i < (string.length()-1)) {
-            i++;
-            current += string[i];
-            continue;
-        }
-
-        // just append current character
-        current += string[i];
-    }
-
-    if (current != "") returning << current;
-
-    return returning;
-}
-
 QList<QString> FreeSearch::search(QString query)
 {
-    filenames.clear();
-
-    // search split will tokenise and handle quoting and escaping
-    QStringList tokens = searchSplit(query);
-
-    foreach(RideItem*item, context->athlete->rideCache->rides()) {
-
-        QMapIterator<QString,QString> meta(item->metadata());
-        meta.toFront();
-        while (meta.hasNext()) {
-            meta.next();
-
-            // does the super string contain the tokens?
-            foreach(QString token, tokens) {
-
-                if (meta.value().contains(token, Qt::CaseInsensitive)) {
-                    filenames << item->fileName;
-                    goto nextItem;
-                }
-            }
-        }
-
-        // user intervals - even autodiscovered
-        foreach(IntervalItem *interval, item->intervals()) {
-
-            foreach (QString token, tokens) {
-
-                if (interval->name.contains(token, Qt::CaseInsensitive)) {
-                    filenames << item->fileName;
-                    goto nextItem;
-                }
-            }
-        }
-        nextItem:;
-    }
+    // the index is shared by all searches and kept up to date as rides
+    // change, see SearchIndex.h for the query syntax
+    filenames = context->athlete->rideCache->searchIndex()->search(query);
 
     emit results(filenames);
 
@@ -19,6 +19,7 @@
 #include "IntervalItem.h"
 #include "Specification.h"
 #include "RideFile.h"
+#include "Settings.h"
 #include "Context.h"
 #include "Athlete.h"
 #include "Colors.h"
@@ -41,6 +42,7 @@ IntervalItem::IntervalItem(const RideItem *ride, QString name, double start, dou
     this->rideItem_ = const_cast<RideItem*>(ride);
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
+    computed_.fill(false, RideMetricFactory::instance().metricCount());
 }
 
 IntervalItem::IntervalItem() : rideItem_(NULL), name(""), type(RideFileInterval::USER), start(0), stop(0),
@@ -48,6 +50,7 @@ IntervalItem::IntervalItem() : rideItem_(NULL), name(""), type(RideFileInterval:
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
+    computed_.fill(false, RideMetricFactory::instance().metricCount());
 }
 
 void
@@ -96,46 +99,119 @@ IntervalItem::refresh()
     // metrics
     const RideMetricFactory &factory = RideMetricFactory::instance();
 
-    // resize and set to zero
+    // resize and set to zero, nothing computed yet
     metrics_.fill(0, factory.metricCount());
     count_.fill(0, factory.metricCount());
+    computed_.fill(false, factory.metricCount());
+    stdmean_.clear();
+    stdvariance_.clear();
+
+    // the rest are computed when they're wanted
+    compute(eagerMetrics());
+}
+
+// those shown in the interval summary and interval tables
+QStringList
+IntervalItem::eagerMetrics()
+{
+    QString s = appsettings->value(NULL, GC_SETTINGS_INTERVAL_METRICS, GC_SETTINGS_INTERVAL_METRICS_DEFAULT).toString();
+    if (s == "") s = GC_SETTINGS_INTERVAL_METRICS_DEFAULT;
+    return s.split(",");
+}
+
+bool
+IntervalItem::compute(QStringList symbols, bool keepOpen)
+{
+    if (!rideItem_) return false;
+
+    // the intervals of a ride share it, and the ride file we may open
+    QMutexLocker locker(&rideItem_->intervalMutex);
+
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    const int count = factory.metricCount();
+
+    // user metrics may have been added since
+    if (metrics_.size() < count) metrics_.resize(count);
+    if (count_.size() < count) count_.resize(count);
+    if (computed_.size() < count) computed_.resize(count);
+
+    // what we still need, and what that depends upon so
+    // we keep those too rather than compute them again
+    QSharedPointer<const RideMetricPlan> plan = factory.plan();
+    QVector<char> wanted(count, 0);
+    bool any = false;
+    if (symbols.isEmpty()) {
+        for (int i=0; i<count && i<plan->order.count(); i++) if (!computed_.testBit(i)) wanted[i] = any = true;
+    } else {
+        foreach(QString symbol, symbols) {
+            const RideMetric *m = factory.rideMetric(symbol);
+            if (m && m->index() < plan->order.count() && !computed_.testBit(m->index())) wanted[m->index()] = any = true;
+        }
+    }
+    if (!any) return true;
+
+    // user metrics declare no dependencies and can use any of the builtins,
+    // those we have are passed to them (see RideMetric::computeMetrics) so
+    // we only need to fill in the builtins we don't have yet
+    bool user = false;
+    for (int i=0; i<plan->order.count(); i++) if (wanted[i] && plan->user[i]) user = true;
+    if (user) for (int i=0; i<plan->order.count(); i++) if (!plan->user[i] && !computed_.testBit(i)) wanted[i] = 1;
+
+    for (int i=plan->order.count()-1; i>=0; i--) {
+        int index = plan->order[i];
+        if (wanted[index]) foreach(int dep, plan->deps[index]) if (!computed_.testBit(dep)) wanted[dep] = 1;
+    }
+    QStringList needed;
+    for (int i=0; i<plan->order.count(); i++) if (wanted[i]) needed << factory.metricName(i);
+
+    // open the ride if we need to, and close it again after
+    bool opened = !rideItem_->isOpen();
+    RideFile *f = rideItem_->ride();
+    if (!f) return false;
 
     // ok, lets collect the metrics
-    QHash<QString,RideMetricPtr> computed=RideMetric::computeMetrics(rideItem_, Specification(this, f->recIntSecs()), factory.allMetrics());
-    // take a deep copy, quick before the thread exits.
-    //XXXcomputed.detach();
+    QHash<QString,RideMetricPtr> computed=RideMetric::computeMetrics(rideItem_, Specification(this, f->recIntSecs()), needed);
 
     // snaffle away all the computed values into the array
     QHashIterator<QString, RideMetricPtr> i(computed);
     while (i.hasNext()) {
         i.next();
-        metrics_[i.value()->index()] = i.value()->value();
-        count_[i.value()->index()] = i.value()->count();
+        int index = i.value()->index();
+        metrics_[index] = i.value()->value();
+        count_[index] = i.value()->count();
         double stdmean = i.value()->stdmean();
         double stdvariance = i.value()->stdvariance();
         if (stdmean || stdvariance) {
-            stdmean_.insert(i.value()->index(), stdmean);
-            stdvariance_.insert(i.value()->index(), stdvariance);
+            stdmean_.insert(index, stdmean);
+            stdvariance_.insert(index, stdvariance);
         }
-    }
 
-    // clean any bad values
-    for(int j=0; j<factory.metricCount(); j++)
-        if (std::isinf(metrics_[j]) || std::isnan(metrics_[j])) {
-            metrics_[j] = 0.00f;
-            count_[j] = 0.00f;
+        // clean any bad values
+        if (std::isinf(metrics_[index]) || std::isnan(metrics_[index])) {
+            metrics_[index] = 0.00f;
+            count_[index] = 0.00f;
         }
-}
+    }
 
+    // asked for is done, even if there was nothing to compute
+    for (int j=0; j<count; j++) if (wanted[j]) computed_.setBit(j);
+
+    if (opened && !keepOpen) rideItem_->close();
+    return true;
+}
 
 double
 IntervalItem::getForSymbol(QString name, bool useMetricUnits)
 {
     const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    // computed on first use, unless a refresh is due
+    const RideMetric *m = factory.rideMetric(name);
+    if (m && rideItem_ && !rideItem_->isStale()) compute(QStringList() << name);
+
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
 
         // return the precomputed metric value
-        const RideMetric *m = factory.rideMetric(name);
         if (m) {
             if (useMetricUnits) return metrics_[m->index()];
             else {
@@ -154,10 +230,14 @@ IntervalItem::getStringForSymbol(QString name, bool useMetricUnits)
     QString returning("-");
 
     const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    // computed on first use, unless a refresh is due
+    const RideMetric *m = factory.rideMetric(name);
+    if (m && rideItem_ && !rideItem_->isStale()) compute(QStringList() << name);
+
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
 
         // return the precomputed metric value
-        const RideMetric *m = factory.rideMetric(name);
         if (m) {
 
             double value = metrics_[m->index()];
@@ -26,6 +26,7 @@
 #include <QDialog>
 #include <QLabel>
 #include <QLineEdit>
+#include <QBitArray>
 
 class IntervalItem
 {
@@ -68,15 +69,26 @@ class IntervalItem
         // order to show on plot
         void setDisplaySequence(int seq) { displaySequence = seq; }
 
-        // precomputed metrics
+        // metrics, refresh() computes the eager set (the interval
+        // summary metrics) and the rest are computed when first
+        // asked for with getForSymbol() or compute()
         void refresh();
         QVector<double> metrics_;
         QVector<double> count_;
+        QBitArray computed_;
         QMap <int, double>stdmean_;
         QMap <int, double>stdvariance_;
 
+        // compute those not computed yet, all of them if none are named.
+        // the ride is opened if need be, and closed again unless keepOpen
+        // (see RideItem::computeIntervalMetrics)
+        bool compute(QStringList symbols = QStringList(), bool keepOpen = false);
+        static QStringList eagerMetrics();
+
+        // raw values, only those computed() are set
         QVector<double> &metrics() { return metrics_; }
         QVector<double> &counts() { return count_; }
+        QBitArray &computed() { return computed_; }
         QMap <int, double>&stdmeans() { return stdmean_; }
         QMap <int, double>&stdvariances() { return stdvariance_; }
 
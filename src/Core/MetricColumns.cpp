@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "MetricColumns.h"
+#include "Context.h"
+#include "Athlete.h"
+#include "RideCache.h"
+#include "RideItem.h"
+#include "RideMetric.h"
+#include "RideFile.h"
+#include "SearchFilterBox.h"
+
+#include <cmath>
+#include <algorithm>
+
+MetricColumns::MetricColumns(Context *context, RideCache *cache) :
+    context(context), cache(cache), synced(false), revision_(0)
+{
+    // rides that change are updated there and then, anything
+    // else means starting again the next time we are used
+    connect(cache, SIGNAL(itemChanged(RideItem*)), this, SLOT(update(RideItem*)));
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(refreshUpdate(QDate)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(refreshEnd()), this, SLOT(invalidate()));
+    connect(context, SIGNAL(configChanged(qint32)), this, SLOT(invalidate()));
+}
+
+void
+MetricColumns::invalidate()
+{
+    synced = false;
+}
+
+void
+MetricColumns::sync()
+{
+    if (synced) return;
+
+    items_ = cache->rides();
+    days_.resize(items_.count());
+    rowOf.clear();
+    for (int i=0; i<items_.count(); i++) {
+        days_[i] = items_[i]->dateTime.date().toJulianDay();
+        rowOf.insert(items_[i]->fileName, i);
+    }
+
+    // everything is filled in again as it is needed
+    columns.clear();
+    columns.resize(RideMetricFactory::instance().metricCount());
+    metas.clear();
+    zeroes.fill(0, items_.count());
+    filters.clear();
+
+    revision_++;
+    synced = true;
+}
+
+void
+MetricColumns::update(RideItem *item)
+{
+    if (!synced) return;
+
+    // if it moved we need to sort the rows again
+    int row = -1;
+    foreach(int i, rowOf.values(item->fileName)) if (items_[i] == item) row = i;
+    if (row < 0 || days_[row] != item->dateTime.date().toJulianDay()) {
+        invalidate();
+        return;
+    }
+
+    for (int i=0; i<columns.count(); i++)
+        if (columns[i].ready) fill(row, i, columns[i]);
+
+    QMutableHashIterator<QString, QVector<double> > m(metas);
+    while (m.hasNext()) {
+        m.next();
+        fill(row, m.key(), m.value());
+    }
+
+    // it may match differently now
+    filters.clear();
+}
+
+void
+MetricColumns::fill(int row, int index, Column &column)
+{
+    RideItem *item = items_[row];
+
+    // same as RideItem::getForSymbol et al
+    const QVector<double> &metrics = item->metrics();
+    if (metrics.count() == columns.count()) {
+        double count = item->counts()[index];
+        column.values[row] = metrics[index];
+        column.counts[row] = count ? count : 1;
+        column.stdmeans[row] = item->stdmeans().value(index, 0.0f);
+    } else {
+        column.values[row] = 0;
+        column.counts[row] = 1;
+        column.stdmeans[row] = 0;
+    }
+}
+
+void
+MetricColumns::fill(int row, QString name, QVector<double> &column)
+{
+    column[row] = items_[row]->getText(name, "0.0").toDouble();
+}
+
+void
+MetricColumns::prepare(QList<const RideMetric*> metrics, QStringList meta)
+{
+    sync();
+
+    // which ones are missing ?
+    QVector<int> indexes;
+    foreach(const RideMetric *metric, metrics) {
+        if (!metric) continue;
+        int index = metric->index();
+        if (index < 0 || index >= columns.count() || columns[index].ready || indexes.contains(index)) continue;
+
+        indexes << index;
+        columns[index].values.resize(items_.count());
+        columns[index].counts.resize(items_.count());
+        columns[index].stdmeans.resize(items_.count());
+    }
+
+    QStringList names;
+    foreach(QString name, meta) {
+        if (metas.contains(name) || names.contains(name)) continue;
+        names << name;
+        metas.insert(name, QVector<double>(items_.count()));
+    }
+
+    if (indexes.isEmpty() && names.isEmpty()) return;
+
+    // one pass over the rides for all of them
+    for (int row=0; row<items_.count(); row++) {
+        foreach(int index, indexes) fill(row, index, columns[index]);
+        foreach(QString name, names) fill(row, name, metas[name]);
+    }
+
+    foreach(int index, indexes) columns[index].ready = true;
+}
+
+int
+MetricColumns::rows()
+{
+    sync();
+    return items_.count();
+}
+
+const QVector<qint64> &
+MetricColumns::days()
+{
+    sync();
+    return days_;
+}
+
+int
+MetricColumns::lower(QDate date)
+{
+    sync();
+    if (date == QDate()) return 0;
+    return std::lower_bound(days_.begin(), days_.end(), date.toJulianDay()) - days_.begin();
+}
+
+int
+MetricColumns::upper(QDate date)
+{
+    sync();
+    if (date == QDate()) return days_.count();
+    return std::upper_bound(days_.begin(), days_.end(), date.toJulianDay()) - days_.begin();
+}
+
+const QVector<double> &
+MetricColumns::values(const RideMetric *metric)
+{
+    sync();
+    if (!metric || metric->index() < 0 || metric->index() >= columns.count()) return zeroes;
+
+    prepare(QList<const RideMetric*>() << metric);
+    return columns[metric->index()].values;
+}
+
+const QVector<double> &
+MetricColumns::counts(const RideMetric *metric)
+{
+    sync();
+    if (!metric || metric->index() < 0 || metric->index() >= columns.count()) return zeroes;
+
+    prepare(QList<const RideMetric*>() << metric);
+    return columns[metric->index()].counts;
+}
+
+const QVector<double> &
+MetricColumns::stdmeans(const RideMetric *metric)
+{
+    sync();
+    if (!metric || metric->index() < 0 || metric->index() >= columns.count()) return zeroes;
+
+    prepare(QList<const RideMetric*>() << metric);
+    return columns[metric->index()].stdmeans;
+}
+
+const QVector<double> &
+MetricColumns::meta(QString name)
+{
+    prepare(QList<const RideMetric*>(), QStringList() << name);
+    return metas[name];
+}
+
+QBitArray
+MetricColumns::select(Specification spec)
+{
+    sync();
+
+    // date range
+    QBitArray returning(items_.count());
+    DateRange dr = spec.dateRange();
+    int from = lower(dr.from);
+    int to = upper(dr.to);
+    if (from < to) returning.fill(true, from, to);
+
+    // each filter is a list of filenames that pass
+    foreach(QStringList filter, spec.filterSet().filters()) {
+        QBitArray pass(items_.count());
+        foreach(QString name, filter)
+            foreach(int row, rowOf.values(name)) pass.setBit(row);
+        returning &= pass;
+    }
+    return returning;
+}
+
+QBitArray
+MetricColumns::matches(QString datafilter)
+{
+    sync();
+
+    QHash<QString, QBitArray>::const_iterator i = filters.constFind(datafilter);
+    if (i != filters.constEnd()) return i.value();
+
+    QBitArray returning(items_.count());
+    foreach(QString name, SearchFilterBox::matches(context, datafilter))
+        foreach(int row, rowOf.values(name)) returning.setBit(row);
+    filters.insert(datafilter, returning);
+    return returning;
+}
+
+QVector<MetricColumns::Group>
+MetricColumns::aggregate(const QVector<double> &values, const QVector<double> *counts,
+                         const QVector<double> *stdmeans, const QBitArray &rows,
+                         const QVector<int> &groups, Aggregate how)
+{
+    QVector<Group> returning;
+
+    const double *v = values.constData();
+    const double *c = counts ? counts->constData() : NULL;
+    const double *s = stdmeans ? stdmeans->constData() : NULL;
+    const int *g = groups.constData();
+
+    int n = -1;
+    unsigned long secondsPerGroupBy = 0;
+    double ymean_prev = 0;
+
+    int count = qMin(rows.count(), qMin(values.count(), groups.count()));
+    for (int row=0; row<count; row++) {
+
+        if (!rows.testBit(row)) continue;
+
+        // check values are bounded to stop QWT going berserk
+        double value = v[row];
+        if (std::isnan(value) || std::isinf(value)) value = 0;
+
+        // skip unavailable values
+        if (value == RideFile::NA) continue;
+
+        // units and the like
+        value = ((value * how.scale) + how.offset) / how.divisor;
+
+        if (!value && !how.wantZero) continue;
+
+        unsigned long seconds = c ? c[row] : 1;
+
+        // a new group
+        if (n < 0 || g[row] > returning[n].group) {
+
+            returning << Group(g[row], value);
+            n++;
+
+            // only increment counter if nonzero or we aggregate zeroes
+            if (value || how.aggZero) secondsPerGroupBy = seconds;
+            ymean_prev = s ? s[row] : 0;
+            continue;
+        }
+
+        // sum totals, average averages and choose best for Peaks
+        double &y = returning[n].value;
+        switch (how.type) {
+        case RideMetric::Total:
+            y += value;
+            break;
+        case RideMetric::Average:
+            // average should be calculated taking into account
+            // the duration of the ride, otherwise high value but
+            // short rides will skew the overall average
+            if (value || how.aggZero) y = ((y*secondsPerGroupBy)+(seconds*value)) / (secondsPerGroupBy+seconds);
+            break;
+        case RideMetric::Low:
+            if (value < y) y = value;
+            break;
+        case RideMetric::Peak:
+            if (value > y) y = value;
+            break;
+        case RideMetric::MeanSquareRoot:
+            if (value) y = sqrt((pow(y,2)*secondsPerGroupBy + pow(value,2)*seconds)/(secondsPerGroupBy+seconds));
+            break;
+        case RideMetric::StdDev:
+            if (value) {
+                double ymean_next = s ? s[row] : 0;
+                double ymean = (secondsPerGroupBy*ymean_prev + ymean_next*seconds)/(secondsPerGroupBy + seconds);
+
+                // Combining two standard deviations using
+                // the formula:
+                //
+                //   sqrt(((n1-1)*S1^2+(n2-1)*S2^2+n1*(ymean_1-ymean)^2+n2*(ymean_2-ymean)^2)/(n1+n2))
+                //
+                // where:
+                //
+                //   ymean = (n1*ymean_1 + n2*ymean_2)/(n1+n2)
+
+                y = pow(y,2)*(secondsPerGroupBy-1) + pow(value,2)*(seconds-1);
+                y += pow(ymean_prev - ymean,2)*secondsPerGroupBy + pow(ymean_next - ymean,2)*seconds;
+                y /= (secondsPerGroupBy + seconds);
+                y = sqrt(y);
+
+                ymean_prev = ymean;
+            }
+            break;
+        }
+        secondsPerGroupBy += seconds; // increment for same group
+    }
+    return returning;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_MetricColumns_h
+#define _GC_MetricColumns_h 1
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QBitArray>
+#include <QDate>
+
+#include "Specification.h"
+
+class Context;
+class RideCache;
+class RideItem;
+class RideMetric;
+
+// MetricColumns holds the metric values of every ride in the ride cache
+// a column at a time, so the trends charts can work through the values
+// for a metric without looking each one up by name, ride by ride.
+//
+// Rows are the rides in date order, so a date range is a binary search.
+// Columns are filled in as they are asked for, prepare() fills in all
+// the columns a chart needs in a single pass over the rides. Filters
+// are turned into a bitmap of rows, and the bitmaps for a data filter
+// are kept until the rides change.
+//
+// aggregate() groups the values in the rows selected, summing totals,
+// averaging averages (weighted by count) and so on according to the
+// metric type, the same way LTMPlot always has.
+//
+class MetricColumns : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        MetricColumns(Context *context, RideCache *cache);
+
+        // fill in any of these columns we don't have yet
+        // in a single pass over the rides
+        void prepare(QList<const RideMetric*> metrics, QStringList meta=QStringList());
+
+        // rides in date order, the revision changes when they do
+        int rows();
+        int revision() const { return revision_; }
+        RideItem *item(int row) { return items_[row]; }
+        const QVector<qint64> &days(); // julian day for each row
+
+        // first row on or after, and first row after the date
+        int lower(QDate date);
+        int upper(QDate date);
+
+        // the columns, filled in if needed. stdmeans are only for
+        // the StdDev metrics and counts are never zero, as RideItem
+        const QVector<double> &values(const RideMetric *metric);
+        const QVector<double> &counts(const RideMetric *metric);
+        const QVector<double> &stdmeans(const RideMetric *metric);
+        const QVector<double> &meta(QString name);
+
+        // rows passing the date range and filters of the specification
+        QBitArray select(Specification spec);
+
+        // rows matching a search or filter, see SearchFilterBox::matches
+        QBitArray matches(QString datafilter);
+
+        // aggregating
+        struct Group {
+            Group() : group(0), value(0) {}
+            Group(int group, double value) : group(group), value(value) {}
+
+            int group;
+            double value;
+        };
+
+        struct Aggregate {
+            Aggregate() : type(0), aggZero(false), wantZero(false), scale(1), offset(0), divisor(1) {}
+
+            int type;           // RideMetric::MetricType
+            bool aggZero;       // zeroes count towards averages
+            bool wantZero;      // zero values make a group
+            double scale, offset, divisor; // value = ((value * scale) + offset) / divisor
+        };
+
+        // aggregate the values in the rows selected into groups, the group
+        // for each row must not go down as the rows go on. counts and
+        // stdmeans can be NULL. only groups with a value are returned
+        QVector<Group> aggregate(const QVector<double> &values, const QVector<double> *counts,
+                                 const QVector<double> *stdmeans, const QBitArray &rows,
+                                 const QVector<int> &groups, Aggregate how);
+
+    public slots:
+
+        // rides added, deleted or refreshed
+        void invalidate();
+
+        // a ride changed, update its row
+        void update(RideItem *item);
+
+    private:
+
+        struct Column {
+            Column() : ready(false) {}
+
+            bool ready;
+            QVector<double> values, counts, stdmeans;
+        };
+
+        // bring the rows in line with the ride cache
+        void sync();
+
+        // values for a row
+        void fill(int row, int index, Column &column);
+        void fill(int row, QString name, QVector<double> &column);
+
+        Context *context;
+        RideCache *cache;
+        bool synced;
+        int revision_;
+
+        QVector<RideItem*> items_;
+        QVector<qint64> days_;
+        QMultiHash<QString, int> rowOf; // by filename, planned may share them
+
+        QVector<Column> columns;        // by metric index
+        QHash<QString, QVector<double> > metas;
+        QVector<double> zeroes;         // for metrics we don't know
+        QHash<QString, QBitArray> filters;
+};
+#endif // _GC_MetricColumns_h
@@ -17,10 +17,15 @@
  */
 
 #include "RideCache.h"
+#include "RideDBStore.h"
+#include "SearchIndex.h"
+#include "MetricColumns.h"
+#include "Season.h"
 
 #include "Context.h"
 #include "Athlete.h"
 #include "RideFileCache.h"
+#include "MeanMaxStore.h"
 #include "RideCacheModel.h"
 #include "Specification.h"
 #include "DataProcessor.h"
@@ -43,6 +48,7 @@
 #include "UserMetricParser.h"
 #include <QXmlInputSource>
 #include <QXmlSimpleReader>
+#include <QDataStream>
 
 // for sorting
 bool rideCacheGreaterThan(const RideItem *a, const RideItem *b) { return a->dateTime > b->dateTime; }
@@ -56,6 +62,10 @@ RideCache::RideCache(Context *context) : context(context)
     progress_ = 100;
     refreshingEstimates = false;
     exiting = false;
+    store = NULL;
+    searchIndex_ = NULL;
+    columns_ = NULL;
+    unrefreshed_ = 0;
 
     // initial load of user defined metrics - do once we have an initial context
     // but before we refresh or check metrics for the first time
@@ -151,6 +161,25 @@ RideCache::~RideCache()
 
     // save to store
     save();
+    delete store;
+    delete searchIndex_;
+    delete columns_;
+}
+
+SearchIndex *
+RideCache::searchIndex()
+{
+    // built the first time anyone searches
+    if (searchIndex_ == NULL) searchIndex_ = new SearchIndex(context, this);
+    return searchIndex_;
+}
+
+MetricColumns *
+RideCache::columns()
+{
+    // built the first time a chart wants them
+    if (columns_ == NULL) columns_ = new MetricColumns(context, this);
+    return columns_;
 }
 
 void
@@ -339,6 +368,9 @@ RideCache::removeCurrentRide()
         QString deleteMe = QFileInfo(strOldFileName).baseName() + "." + extension;
         QFile::remove(context->athlete->home->cache().canonicalPath() + "/" + deleteMe);
 
+        // and from the athlete-wide meanmax too
+        if (extension == "cpx") context->athlete->meanMaxStore->remove(context->athlete->home->cache().canonicalPath() + "/" + deleteMe);
+
     }
 
     // we don't want the whole delete, select next flicker
@@ -425,6 +457,9 @@ itemRefresh(RideItem *&item)
     if (item->isstale) {
         item->refresh();
 
+        // journal it so the store can checkpoint as we go
+        item->context->athlete->rideCache->refreshed(item);
+
         // and trap changes during refresh to current ride
         if (item == item->context->currentRideItem())
             item->context->notifyRideChanged(item);
@@ -440,10 +475,63 @@ RideCache::progressing(int value)
 {
     // we're working away, notfy everyone where we got
     progress_ = 100.0f * (double(value) / double(watcher.progressMaximum()));
-    if (value) {
-        QDate here = reverse_.at(value-1)->dateTime.date();
+    if (value && refreshing_.count()) {
+
+        // rides are refreshed in priority order, not date order, so
+        // tell them the earliest ride still to do, all before it are
+        // done, the date then only ever moves forward
+        while (unrefreshed_ < refreshing_.count() && !refreshing_[unrefreshed_]->isstale) unrefreshed_++;
+        QDate here = refreshing_[qMin(unrefreshed_, refreshing_.count()-1)]->dateTime.date();
         context->notifyRefreshUpdate(here);
     }
+
+    // save what we've done so far every now and again
+    if (checkpointed.elapsed() > RideCacheCheckpoint) checkpoint();
+}
+
+// called from the refresh threads as each ride is done
+void
+RideCache::refreshed(RideItem *item)
+{
+    QMutexLocker locker(&journalMutex);
+    journal_ << item;
+}
+
+// write the rides refreshed since the last checkpoint to the store, if
+// we exit or crash during a long refresh we carry on from here next time
+// since their fingerprints will match and they won't be stale
+void
+RideCache::checkpoint()
+{
+    QVector<RideItem*> done;
+    journalMutex.lock();
+    done.swap(journal_);
+    journalMutex.unlock();
+
+    checkpointed.start();
+    if (store == NULL || done.isEmpty()) return;
+
+    // not the ones deleted while we were refreshing
+    for (int i=0; i<done.count(); i++)
+        if (delete_.contains(done[i])) done.remove(i--);
+
+    store->checkpoint(done);
+}
+
+// most wanted first; the ride being looked at, then the date range being
+// looked at, then the current season and then the rest newest first
+static int refreshPriority(Context *context, const QList<Season> &seasons, RideItem *item)
+{
+    if (item == context->currentRideItem()) return 0;
+
+    QDate date = item->dateTime.date();
+    DateRange range = context->currentDateRange();
+    if (range.from.isValid() && date >= range.from && (!range.to.isValid() || date <= range.to)) return 1;
+
+    foreach(const Season &season, seasons)
+        if (date >= season.start && date <= season.end) return 2;
+
+    return 3;
 }
 
 // cancel the refresh map, we're about to exit !
@@ -465,19 +553,47 @@ RideCache::refresh()
 
     // how many need refreshing ?
     int staleCount = 0;
+    QVector<RideItem*> stale;
 
     foreach(RideItem *item, rides_) {
 
         // ok set stale so we refresh
-        if (item->checkStale())
+        if (item->checkStale()) {
             staleCount++;
+            stale << item;
+        }
     }
 
     // start if there is work to do
     // and future watcher can notify of updates
     if (staleCount)  {
-        reverse_ = rides_;
-        qSort(reverse_.begin(), reverse_.end(), rideCacheGreaterThan);
+
+        // the current season(s), i.e. ones that include today
+        QList<Season> seasons;
+        QDate today = QDate::currentDate();
+        foreach(const Season &season, context->athlete->seasons->seasons)
+            if (season.type == Season::season && season.start <= today && season.end >= today)
+                seasons << season;
+
+        // only the stale rides, in priority order
+        QVector<RideItem*> tiers[4];
+        qSort(stale.begin(), stale.end(), rideCacheGreaterThan);
+        foreach(RideItem *item, stale) tiers[refreshPriority(context, seasons, item)] << item;
+
+        reverse_.clear();
+        for (int i=0; i<4; i++) reverse_ << tiers[i];
+
+        // and in date order for progress updates
+        refreshing_.clear();
+        for (int i=stale.count()-1; i>=0; i--) refreshing_ << stale[i];
+        unrefreshed_ = 0;
+
+        // and the journal is checkpointed as we go
+        journalMutex.lock();
+        journal_.clear();
+        journalMutex.unlock();
+        checkpointed.start();
+
         future = QtConcurrent::map(reverse_, itemRefresh);
         watcher.setFuture(future);
     } else {
@@ -631,6 +747,73 @@ RideCache::getBests(QString symbol, int n, Specification specification, bool use
     return results;
 }
 
+// the weekly estimates are saved in the cache along with a fingerprint
+// of the rides that were in each week, so when we next refresh we only
+// need to refit the 12 week windows that contain a week that changed
+static const int PDEstimatesVersion = 1;
+
+class PDEstimateWeek {
+    public:
+        PDEstimateWeek() : fingerprint(0) {}
+
+        quint32 fingerprint;            // rides in this week
+        QList<PDEstimate> estimates;    // fitted for the window ending this week
+};
+
+static QDataStream &operator<<(QDataStream &out, const PDEstimate &e)
+{
+    out << e.from << e.to << e.model << e.WPrime << e.CP << e.FTP << e.PMax << e.EI << e.wpk << e.parameters;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, PDEstimate &e)
+{
+    in >> e.from >> e.to >> e.model >> e.WPrime >> e.CP >> e.FTP >> e.PMax >> e.EI >> e.wpk >> e.parameters;
+    return in;
+}
+
+static void readPDEstimateWeeks(QString filename, QMap<QDate, PDEstimateWeek> &weeks)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return;
+
+    QDataStream in(&file);
+    quint32 version, cacheVersion, count;
+    in >> version >> cacheVersion >> count;
+
+    // bests derive from the cpx, so both must match
+    if (version != PDEstimatesVersion || cacheVersion != RideFileCacheVersion) return;
+
+    for (quint32 i=0; i<count && in.status() == QDataStream::Ok; i++) {
+        QDate begin;
+        PDEstimateWeek week;
+        in >> begin >> week.fingerprint >> week.estimates;
+        weeks.insert(begin, week);
+    }
+
+    // any problems and we start again
+    if (in.status() != QDataStream::Ok) weeks.clear();
+}
+
+static void writePDEstimateWeeks(QString filename, QMap<QDate, PDEstimateWeek> &weeks)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug()<<"cannot write"<<filename;
+        return;
+    }
+
+    QDataStream out(&file);
+    out << quint32(PDEstimatesVersion) << quint32(RideFileCacheVersion) << quint32(weeks.count());
+
+    QMapIterator<QDate, PDEstimateWeek> i(weeks);
+    while (i.hasNext()) {
+        i.next();
+        out << i.key() << i.value().fingerprint << i.value().estimates;
+    }
+    file.close();
+}
+
 class RollingBests {
     private:
 
@@ -682,30 +865,91 @@ class RollingBests {
         }
 };
 
+// each model fit for each week is independent so they are
+// fanned out across the thread pool, one fit per task
+static const int PDModelCount = 5;
+
+class PDModelFit {
+    public:
+        Context *context;
+        int week;
+        int model;              // 0 - PDModelCount-1
+        bool wpk;
+        QDate begin, end;
+        QVector<float> bests;   // the 12 week aggregate (implicitly shared)
+
+        bool valid;             // model derived values are sensible
+        PDEstimate estimate;
+};
+
+// same order as the estimates were always added
+static PDModel *newPDModel(Context *context, int model)
+{
+    switch(model) {
+    default:
+    case 0 : return new CP2Model(context);
+    case 1 : return new CP3Model(context);
+    case 2 : return new MultiModel(context);
+    case 3 : return new ExtendedModel(context);
+    case 4 : return new WSModel(context);
+    }
+}
+
+static void fitPDModel(PDModelFit &fit)
+{
+    PDModel *model = newPDModel(fit.context, fit.model);
+    PDEstimate &add = fit.estimate;
+
+    // set the data
+    model->setData(fit.bests);
+    model->saveParameters(add.parameters); // save the computed parms
+
+    add.wpk = fit.wpk;
+    add.from = fit.begin;
+    add.to = fit.end;
+    add.model = model->code();
+    add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
+    add.CP = model->hasCP() ? model->CP() : 0;
+    add.PMax = model->hasPMax() ? model->PMax() : 0;
+    add.FTP = model->hasFTP() ? model->FTP() : 0;
+
+    if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
+
+    if (fit.wpk == false) {
+
+        // so long as the important model derived values are sensible ...
+        fit.valid = (add.WPrime > 1000 && add.CP > 100);
+
+    } else {
+
+        // so long as the model derived values are sensible ...
+        fit.valid = ((!model->hasWPrime() || add.WPrime > 10.0f) &&
+                     (!model->hasCP() || add.CP > 1.0f) &&
+                     (!model->hasPMax() || add.PMax > 1.0f) &&
+                     (!model->hasFTP() || add.FTP > 1.0f));
+    }
+
+    //qDebug()<<add.from<<model->code()<<add.wpk<< "W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
+    delete model;
+}
+
 void
 RideCache::refreshCPModelMetrics()
 {
     // we're refreshing, so away
     if (refreshingEstimates == true) return;
-
-    // need to lock
     refreshingEstimates = true;
-    context->athlete->lock.lock();
 
     // this needs to be done once all the other metrics
-    // Calculate a *monthly* estimate of CP, W' etc using
+    // Calculate a *weekly* estimate of CP, W' etc using
     // bests data from the previous 12 weeks
-    RollingBests bests(12);
-    RollingBests bestsWPK(12);
-
-    // clear any previous calculations
-    context->athlete->PDEstimates_.clear();
+    QList<PDEstimate> estimates;
 
     // we do this by aggregating power data into bests
-    // for each month, and having a rolling set of 3 aggregates
-    // then aggregating those up into a rolling 3 month 'bests'
-    // which we feed to the models to get the estimates for that
-    // point in time based upon the available data
+    // for each week, and the 12 weeks to date are aggregated
+    // into a rolling 'bests' which we feed to the models to get
+    // the estimates for that point in time based upon the
+    // available data
     QDate from, to;
 
     // what dates have any power data ?
@@ -728,106 +972,155 @@ RideCache::refreshCPModelMetrics()
 
     // if we don't have 2 rides or more then skip this but add a blank estimate
     if (from == to || to == QDate()) {
+        context->athlete->lock.lock();
+        context->athlete->PDEstimates_.clear();
         context->athlete->PDEstimates_ << PDEstimate();
         context->athlete->lock.unlock();
         refreshingEstimates = false;
         return;
     }
 
-    // set up the models we support
-    CP2Model p2model(context);
-    CP3Model p3model(context);
-    WSModel wsmodel(context);
-    MultiModel multimodel(context);
-    ExtendedModel extmodel(context);
+    // from has first ride with Power data / looking at the next 7 days of data with Power
+    // calculate Estimates for all data per week including the week of the last Power recording
+    int weeks = (from.daysTo(to) + 6) / 7;
 
-    QList <PDModel *> models;
-    models << &p2model;
-    models << &p3model;
-    models << &multimodel;
-    models << &extmodel;
-    models << &wsmodel;
+    // fingerprint the rides in each week
+    QVector<QByteArray> content(weeks);
+    QVector<int> rideCount(weeks);
+    foreach(RideItem *item, rides()) {
 
+        if (!item->present.contains("P") || item->isRun) continue;
 
-    // from has first ride with Power data / looking at the next 7 days of data with Power
-    // calculate Estimates for all data per week including the week of the last Power recording
-    QDate date = from;
-    while (date < to) {
+        int week = from.daysTo(item->dateTime.date()) / 7;
+        if (week < 0 || week >= weeks) continue;
 
-        QDate begin = date;
-        QDate end = date.addDays(6);
+        content[week] += item->fileName.toLatin1();
+        content[week] += QByteArray::number(qulonglong(item->crc));
+        content[week] += QByteArray::number(item->weight);
+        rideCount[week]++;
+    }
+    QVector<quint32> fingerprint(weeks);
+    for (int i=0; i<weeks; i++)
+        fingerprint[i] = (quint32(qChecksum(content[i].constData(), content[i].length())) << 16) | quint16(rideCount[i]);
+
+    // what did we have last time ?
+    QString filename = context->athlete->home->cache().canonicalPath() + "/pdestimates.dat";
+    QMap<QDate, PDEstimateWeek> saved, current;
+    readPDEstimateWeeks(filename, saved);
+
+    // which weeks have changed since last time ?
+    QVector<bool> changed(weeks);
+    for (int i=0; i<weeks; i++) {
+        QDate begin = from.addDays(i*7);
+        changed[i] = !saved.contains(begin) || saved.value(begin).fingerprint != fingerprint[i];
+    }
+
+    // which windows need refitting, a window needs refitting
+    // when any of its 12 weeks changed
+    QVector<bool> refit(weeks), needed(weeks);
+    int refits = 0;
+    for (int i=0; i<weeks; i++) {
+        for (int j=qMax(0, i-11); j<=i && !refit[i]; j++) refit[i] = changed[j];
+        if (refit[i]) {
+            refits++;
+
+            // and so we need the bests for all 12 weeks
+            for (int j=qMax(0, i-11); j<=i; j++) needed[j] = true;
+        }
+    }
+
+    // compute all the rolling bests in one pass, only
+    // fetching the weeks that contribute to a refit
+    RollingBests bests(12);
+    RollingBests bestsWPK(12);
+    QVector<PDModelFit> fits;
+    fits.reserve(refits * PDModelCount * 2);
 
-        // let others know where we got to...
-        emit modelProgress(date.year(), date.month());
+    for (int i=0; i<weeks; i++) {
+
+        QDate begin = from.addDays(i*7);
+        QDate end = begin.addDays(6);
 
-        // months is a rolling 3 months sets of bests
         QVector<float> wpk; // for getting the wpk values
+        QVector<float> week;
+
+        if (needed[i]) {
+            // let others know where we got to...
+            emit modelProgress(begin.year(), begin.month());
 
-        // don't include RUNS ..................................................vvvvv
-        bests.addBests(RideFileCache::meanMaxPowerFor(context, wpk, begin, end, false));
+            // don't include RUNS ..................................................vvvvv
+            week = RideFileCache::meanMaxPowerFor(context, wpk, begin, end, false);
+        }
+        bests.addBests(week);
         bestsWPK.addBests(wpk);
 
-        // we now have the data
-        foreach(PDModel *model, models) {
-
-            PDEstimate add;
-
-            // set the data
-            model->setData(bests.aggregate());
-            model->saveParameters(add.parameters); // save the computed parms
-
-            add.wpk = false;
-            add.from = begin;
-            add.to = end;
-            add.model = model->code();
-            add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
-            add.CP = model->hasCP() ? model->CP() : 0;
-            add.PMax = model->hasPMax() ? model->PMax() : 0;
-            add.FTP = model->hasFTP() ? model->FTP() : 0;
-
-            if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
-
-            // so long as the important model derived values are sensible ...
-            if (add.WPrime > 1000 && add.CP > 100)
-                context->athlete->PDEstimates_ << add;
-
-            //qDebug()<<add.to<<add.from<<model->code()<< "W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
-
-            // set the wpk data
-            model->setData(bestsWPK.aggregate());
-            model->saveParameters(add.parameters); // save the computed parms
-
-            add.wpk = true;
-            add.from = begin;
-            add.to = end;
-            add.model = model->code();
-            add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
-            add.CP = model->hasCP() ? model->CP() : 0;
-            add.PMax = model->hasPMax() ? model->PMax() : 0;
-            add.FTP = model->hasFTP() ? model->FTP() : 0;
-            if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
-
-            // so long as the model derived values are sensible ...
-            if ((!model->hasWPrime() || add.WPrime > 10.0f) &&
-                (!model->hasCP() || add.CP > 1.0f) &&
-                (!model->hasPMax() || add.PMax > 1.0f) &&
-                (!model->hasFTP() || add.FTP > 1.0f))
-                context->athlete->PDEstimates_ << add;
-
-            //qDebug()<<add.from<<model->code()<< "KG W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
+        if (!refit[i]) continue;
+
+        // a fit for every model, absolute and wpk
+        PDModelFit fit;
+        fit.context = context;
+        fit.week = i;
+        fit.begin = begin;
+        fit.end = end;
+        fit.valid = false;
+
+        QVector<float> aggregate = bests.aggregate();
+        QVector<float> aggregateWPK = bestsWPK.aggregate();
+
+        for (int m=0; m<PDModelCount; m++) {
+            fit.model = m;
+
+            fit.wpk = false;
+            fit.bests = aggregate;
+            fits << fit;
+
+            fit.wpk = true;
+            fit.bests = aggregateWPK;
+            fits << fit;
         }
+    }
+
+    // fan out the fits across all the cores
+    if (fits.count()) QtConcurrent::blockingMap(fits, fitPDModel);
+
+    // and merge back in date order
+    int next = 0;
+    for (int i=0; i<weeks; i++) {
+
+        QDate begin = from.addDays(i*7);
+
+        PDEstimateWeek week;
+        week.fingerprint = fingerprint[i];
+
+        if (refit[i]) {
+
+            // fits are in week, model, abs/wpk order
+            while (next < fits.count() && fits[next].week == i) {
+                if (fits[next].valid) week.estimates << fits[next].estimate;
+                next++;
+            }
 
-        // go forward a week
-        date = date.addDays(7);
+        } else {
+
+            // unchanged since last time
+            week.estimates = saved.value(begin).estimates;
+        }
+
+        current.insert(begin, week);
+        estimates << week.estimates;
     }
 
+    // remember for next time
+    if (refits || current.count() != saved.count()) writePDEstimateWeeks(filename, current);
+
     // add a dummy entry if we have no estimates to stop constantly trying to refresh
-    if (context->athlete->PDEstimates_.count() == 0) {
-        context->athlete->PDEstimates_ << PDEstimate();
-    }
+    if (estimates.count() == 0) estimates << PDEstimate();
 
-    // unlock
+    // only need to lock whilst we swap in the new estimates
+    context->athlete->lock.lock();
+    context->athlete->PDEstimates_ = estimates;
     context->athlete->lock.unlock();
+
     refreshingEstimates = false;
 
     emit modelProgress(0, 0); // all done
@@ -27,6 +27,9 @@
 
 #include <QVector>
 #include <QThread>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QTime>
 
 #include <QFuture>
 #include <QFutureWatcher>
@@ -41,6 +44,12 @@ class RideCacheBackgroundRefresh;
 class Specification;
 class AthleteBest;
 class RideCacheModel;
+class RideDBStore;
+class SearchIndex;
+class MetricColumns;
+
+// msecs between checkpoints of the store during a refresh
+static const int RideCacheCheckpoint = 10000;
 
 class RideCache : public QObject
 {
@@ -83,9 +92,19 @@ class RideCache : public QObject
         // is running ?
         bool isRunning() { return future.isRunning(); }
 
+        // threads other than the gui thread hold this for reading while
+        // they use the rides, so metrics aren't paged out from under them
+        QReadWriteLock &paging() { return paging_; }
+
         // the ride list
 	    QVector<RideItem*>&rides() { return rides_; } 
 
+        // free text search over metadata and interval names
+        SearchIndex *searchIndex();
+
+        // metric values by column for the trends charts
+        MetricColumns *columns();
+
         // add/remove a ride to the list
         void addRide(QString name, bool dosignal, bool select, bool useTempActivities, bool planned);
         void removeCurrentRide();
@@ -97,15 +116,22 @@ class RideCache : public QObject
         void refresh();
         double progress() { return progress_; }
 
+        // refresh threads tell us as each ride is done
+        void refreshed(RideItem *item);
+
         // PD Model refreshing (temporary move)
         void refreshCPModelMetrics();
 
     public slots:
 
-        // restore / dump cache to disk (json)
+        // restore / dump cache to disk (binary, see RideDBStore.h)
         void load();
         void save();
 
+        // rideDB.json for compatibility with earlier versions
+        bool importJSON(QString filename);
+        void exportJSON(QString filename);
+
         // user updated options/preferences
         void configChanged(qint32);
 
@@ -115,6 +141,9 @@ class RideCache : public QObject
         // cancel background processing because about to exit
         void cancel();
 
+        // save the rides refreshed so far to the store
+        void checkpoint();
+
         // item telling us it changed
         void itemChanged();
 
@@ -136,13 +165,24 @@ class RideCache : public QObject
         QDir directory, plannedDirectory;
 
         QVector<RideItem*> rides_, reverse_, delete_;
+        QVector<RideItem*> refreshing_;     // being refreshed, in date order
+        int unrefreshed_;                   // first of them not done yet
         RideCacheModel *model_;
+        RideDBStore *store;
+        SearchIndex *searchIndex_;
+        MetricColumns *columns_;
         bool exiting;
         bool refreshingEstimates;
 	    double progress_; // percent
 
         QFuture<void> future;
         QFutureWatcher<void> watcher;
+        QReadWriteLock paging_;
+
+        // rides refreshed since the last checkpoint
+        QMutex journalMutex;
+        QVector<RideItem*> journal_;
+        QTime checkpointed;
 
 };
 
@@ -18,6 +18,7 @@
  */
 
 #include "RideDB.h"
+#include "RideDBStore.h"
 #ifdef GC_WANT_HTTP
 #include "APIWebService.h"
 #endif
@@ -119,6 +120,7 @@ ride: '{' rideelement_list '}'                                  {
                                                                     jc->item.stdvariances().clear();
                                                                     jc->interval.metrics().fill(0.0f);
                                                                     jc->interval.counts().fill(0.0f);
+                                                                    jc->interval.computed().fill(false);
                                                                     jc->interval.stdmeans().clear();
                                                                     jc->interval.stdvariances().clear();
                                                                     jc->interval.route = QUuid();
@@ -224,6 +226,7 @@ interval: '{' intervalelement_list '}'                          {
                                                                      jc->item.addInterval(jc->interval);
                                                                     jc->interval.metrics().fill(0.0f);
                                                                     jc->interval.counts().fill(0.0f);
+                                                                    jc->interval.computed().fill(false);
                                                                     jc->interval.stdmeans().clear();
                                                                     jc->interval.stdvariances().clear();
 
@@ -258,6 +261,7 @@ interval_metric: interval_metric_key ':' interval_metric_value
                                                                     if (m) {
                                                                         jc->interval.metrics()[m->index()] = $3.toDouble();
                                                                         jc->interval.counts()[m->index()] = 0; /* we don't write zeroes */
+                                                                        jc->interval.computed().setBit(m->index());
                                                                     } else qDebug()<<"metric not found:"<<$1;
                                                                }
                | interval_metric_key ':' '[' interval_metric_value ',' interval_metric_count ']'
@@ -266,6 +270,7 @@ interval_metric: interval_metric_key ':' interval_metric_value
                                                                     if (m) {
                                                                         jc->interval.metrics()[m->index()] = $4.toDouble();
                                                                         jc->interval.counts()[m->index()] = $6.toDouble();
+                                                                        jc->interval.computed().setBit(m->index());
                                                                     } else qDebug()<<"metric not found:"<<$1;
                                                                }
                | interval_metric_key ':' '[' interval_metric_value ',' interval_metric_count ',' interval_metric_stdmean ',' interval_metric_stdvariance ']'
@@ -274,6 +279,7 @@ interval_metric: interval_metric_key ':' interval_metric_value
                                                                     if (m) {
                                                                         jc->interval.metrics()[m->index()] = $4.toDouble();
                                                                         jc->interval.counts()[m->index()] = $6.toDouble();
+                                                                        jc->interval.computed().setBit(m->index());
                                                                         jc->interval.stdmeans().insert(m->index(), $8.toDouble());
                                                                         jc->interval.stdvariances().insert(m->index(), $10.toDouble());
                                                                     } else qDebug()<<"metric not found:"<<$1;
@@ -324,11 +330,46 @@ string: STRING                                               { jc->JsonString =
 %%
 
 
-void 
+void
 RideCache::load()
+{
+    QString cache = context->athlete->home->cache().canonicalPath();
+
+    // the binary store, see RideDBStore.h
+    if (store == NULL) store = new RideDBStore(cache + "/rideDB.bin");
+
+    // nothing there yet, so this is an upgrade
+    // from a version that only had rideDB.json
+    if (store->count() == 0) {
+        importJSON(cache + "/rideDB.json");
+        return;
+    }
+
+    foreach(RideItem *item, rides_) {
+
+        // just the header and metadata, the rest is paged in when
+        // needed. The item starts stale so if we don't have it, it
+        // gets refreshed
+        if (store->attach(item) == false) continue;
+        item->isstale = false;
+
+        // percentage progress, loading is too quick to update for every ride
+        if (context->mainWindow->progress && (context->mainWindow->loading++ % 50) == 0) {
+
+            QString m = QString("%1%")
+            .arg(double(context->mainWindow->loading) / double(rides_.count()) * 100.0f, 0, 'f', 0);
+            context->mainWindow->progress->setText(m);
+            QApplication::processEvents();
+        }
+    }
+}
+
+// read a rideDB.json, used when upgrading to the binary store
+bool
+RideCache::importJSON(QString filename)
 {
     // only load if it exists !
-    QFile rideDB(QString("%1/%2").arg(context->athlete->home->cache().canonicalPath()).arg("rideDB.json"));
+    QFile rideDB(filename);
     if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
 
         QDir directory = context->athlete->home->activities();
@@ -376,10 +417,12 @@ RideCache::load()
         RideDBlex_destroy(scanner);
 
         // regardless of errors we're done !
+        bool returning = jc->errors.count() == 0;
         delete jc;
 
-        return;
+        return returning;
     }
+    return false;
 }
 
 // Escape special characters (JSON compliance)
@@ -401,12 +444,27 @@ static QString protect(const QString string)
     return s;
 }
 
-// save cache to disk, "cache/rideDB.json"
+// save cache to disk, "cache/rideDB.bin"
 void RideCache::save()
+{
+    // only the rides that changed are written
+    if (store == NULL) store = new RideDBStore(context->athlete->home->cache().canonicalPath() + "/rideDB.bin");
+    store->save(rides_);
+
+    // and page out what hasn't been used for a while, unless a refresh
+    // or some other thread may be holding on to the metrics of a ride
+    if (!isRunning() && paging_.tryLockForWrite()) {
+        store->trim();
+        paging_.unlock();
+    }
+}
+
+// write a rideDB.json, no longer used by us but kept for compatibility
+void RideCache::exportJSON(QString filename)
 {
 
     // now save data away
-    QFile rideDB(QString("%1/%2").arg(context->athlete->home->cache().canonicalPath()).arg("rideDB.json"));
+    QFile rideDB(filename);
     if (rideDB.open(QFile::WriteOnly)) {
 
         const RideMetricFactory &factory = RideMetricFactory::instance();
@@ -565,14 +623,9 @@ void RideCache::save()
                     stream << "\t\t\t\"seq\":\"" << interval->displaySequence <<"\""; // last one no ',\n' see METRICS below..
 
 
-                    // check if we have any non-zero metrics
-                    bool hasMetrics=false;
-                    foreach(double v, interval->metrics()) {
-                        if (v > 0.00f || v < 0.00f) {
-                            hasMetrics=true;
-                            break;
-                        }
-                    }
+                    // check if we have any computed metrics, those not
+                    // written are computed when first used
+                    bool hasMetrics = interval->computed().count(true) > 0;
 
                     if (hasMetrics) {
                         stream << ",\n\n\t\t\t\"METRICS\":{\n";
@@ -582,8 +635,8 @@ void RideCache::save()
                             QString name = factory.metricName(i);
                             int index = factory.rideMetric(name)->index();
         
-                            // don't output 0 values, they're set to 0 by default
-                            if (interval->metrics()[index] > 0.00f || interval->metrics()[index] < 0.00f) {
+                            // only those computed, zeroes too since they're not recomputed
+                            if (index < interval->computed().size() && interval->computed().testBit(index)) {
                                 if (!firstMetric) stream << ",\n";
                                 firstMetric = false;
 
@@ -635,15 +688,16 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
 {
     listRideSettings settings;
 
-    // the ride db
-    QString ridedb = QString("%1/%2/cache/rideDB.json").arg(home.absolutePath()).arg(athlete);
-    QFile rideDB(ridedb);
+    // the ride db, binary store or rideDB.json if not upgraded yet
+    QString cache = QString("%1/%2/cache").arg(home.absolutePath()).arg(athlete);
+    QFile rideDB(cache + "/rideDB.json");
+    QFile rideStore(cache + "/rideDB.bin");
 
     // list activities and associated metrics
     response.setHeader("Content-Type", "text; charset=ISO-8859-1");
 
     // not known..
-    if (!rideDB.exists()) {
+    if (!rideDB.exists() && !rideStore.exists()) {
         response.setStatus(404);
         response.write("malformed URL or unknown athlete.\n");
         return;
@@ -654,6 +708,16 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
     if (intervalsp.toUpper() == "TRUE") settings.intervals = true;
     else settings.intervals = false;
 
+    // honour the since parameter
+    QString sincep(request.getParameter("since"));
+    settings.since = QDate(1900,01,01);
+    if (sincep != "") settings.since = QDate::fromString(sincep,"yyyy/MM/dd");
+
+    // before parameter
+    QString beforep(request.getParameter("before"));
+    settings.before = QDate(3000,01,01);
+    if (beforep != "") settings.before = QDate::fromString(beforep,"yyyy/MM/dd");
+
     // set user data
     response.setUserData(&settings);
 
@@ -739,6 +803,11 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
     // list 'em by reading the ride cache from disk
     if ((nometa == false || nometrics == false) && settings.intervals == false) {
 
+        // the rides are resident, and if the client already has them
+        // we're done (the headings are still buffered, nothing was sent)
+        QSharedPointer<APIAthleteCache::Rides> rides = athletes->rides(athlete);
+        if (rides && rides->items.count() && notModified(request, response, rides->etag, rides->modified)) return;
+
         int i=0;
         foreach(const RideMetric *m, indexed) {
 
@@ -768,8 +837,13 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
         }
         response.bwrite("\n");
 
+        // write a line for each ride in the store, streamed as we go
+        if (rides && rides->items.count()) {
+
+            foreach(RideItem *item, rides->items) writeRideLine(*item, &request, &response);
+
         // parse the rideDB and write a line for each entry
-        if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
+        } else if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
 
             // ok, lets read it in
             QTextStream stream(&rideDB);
@@ -814,15 +888,11 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
 
     } else {
 
-        // honour the since parameter
-        QString sincep(request.getParameter("since"));
-        QDate since(1900,01,01);
-        if (sincep != "") since = QDate::fromString(sincep,"yyyy/MM/dd");
-
-        // before parameter
-        QString beforep(request.getParameter("before"));
-        QDate before(3000,01,01);
-        if (beforep != "") before = QDate::fromString(beforep,"yyyy/MM/dd");
+        // the listing only changes as files come and go
+        QDir activities(home.absolutePath() + "/" + athlete + "/activities");
+        QDateTime modified;
+        QByteArray etag = APIAthleteCache::etagFor(QStringList() << activities.absolutePath(), &modified);
+        if (notModified(request, response, etag, modified)) return;
 
         // fast list of rides by traversing the directory
         response.bwrite("\n"); // headings have no metric columns
@@ -833,7 +903,6 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
         names << "*"; // anything
 
         // loop through files, make sure in time range wanted
-        QDir activities(home.absolutePath() + "/" + athlete + "/activities");
         foreach(QString name, activities.entryList(names, spec, QDir::Name)) {
 
             // parse it into date and time
@@ -841,7 +910,7 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
             if (!RideFile::parseRideFileName(name, &dateTime)) continue; 
 
             // in range?
-            if (dateTime.date() < since || dateTime.date() > before) continue;
+            if (dateTime.date() < settings.since || dateTime.date() > settings.before) continue;
 
             // is it a backup ?
             if (name.endsWith(".bak")) continue;
@@ -0,0 +1,878 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "RideDBStore.h"
+#include "RideItem.h"
+#include "IntervalItem.h"
+#include "RideMetric.h"
+
+#include <QDateTime>
+#include <QColor>
+#include <QUuid>
+#include <QSet>
+#include <QPair>
+#include <QDebug>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+// records are padded so the metric columns stay aligned
+static inline int padded(int n) { return (n + 7) & ~7; }
+
+// appending the variable length data to a record
+class RideDBStoreWriter
+{
+    public:
+        RideDBStoreWriter(QByteArray &data) : data(data) {}
+
+        void u32(uint32_t v) { data.append((const char*)&v, sizeof(v)); }
+        void i32(int32_t v) { data.append((const char*)&v, sizeof(v)); }
+        void f64(double v) { data.append((const char*)&v, sizeof(v)); }
+
+        // utf-16 so reading back is a copy, not a decode
+        void string(const QString &s) {
+            u32(s.length());
+            data.append((const char*)s.constData(), s.length() * sizeof(QChar));
+        }
+
+        // round up to the next record boundary
+        void pad() { data.append(QByteArray(padded(data.size()) - data.size(), 0)); }
+
+    private:
+        QByteArray &data;
+};
+
+// and reading it back, bounds checked since the file may be damaged
+class RideDBStoreReader
+{
+    public:
+        RideDBStoreReader(const uchar *p, const uchar *end) : ok(true), p(p), end(end) {}
+
+        uint32_t u32() { uint32_t v=0; get(&v, sizeof(v)); return v; }
+        int32_t i32() { int32_t v=0; get(&v, sizeof(v)); return v; }
+        double f64() { double v=0; get(&v, sizeof(v)); return v; }
+
+        QString string() {
+            uint32_t n = u32();
+            if (!ok || (qint64)n * (qint64)sizeof(QChar) > end - p) {
+                ok = false;
+                return QString();
+            }
+            QString s(reinterpret_cast<const QChar*>(p), n);
+            p += n * sizeof(QChar);
+            return s;
+        }
+
+        bool ok;
+
+    private:
+        void get(void *into, int n) {
+            if (!ok || end - p < n) {
+                ok = false;
+                return;
+            }
+            memcpy(into, p, n);
+            p += n;
+        }
+
+        const uchar *p, *end;
+};
+
+// a string table entry
+static QByteArray keyRecord(uint32_t id, const QString &key)
+{
+    RideDBStoreRecord head;
+    head.length = 0;
+    head.type = RideDBStore::Key;
+
+    QByteArray data((const char*)&head, sizeof(head));
+    RideDBStoreWriter w(data);
+    w.u32(id);
+    w.string(key);
+    w.pad();
+    reinterpret_cast<RideDBStoreRecord*>(data.data())->length = data.size();
+    return data;
+}
+
+// a ride has been deleted
+static QByteArray tombstone(const QString &fileName)
+{
+    RideDBStoreRecord head;
+    head.length = 0;
+    head.type = RideDBStore::Deleted;
+
+    QByteArray data((const char*)&head, sizeof(head));
+    RideDBStoreWriter w(data);
+    w.string(fileName);
+    w.pad();
+    reinterpret_cast<RideDBStoreRecord*>(data.data())->length = data.size();
+    return data;
+}
+
+RideDBStore::RideDBStore(QString filename, bool readonly) :
+             readonly(readonly), mapped(NULL), mappedSize(0), end(0), deadBytes(0), identity(false), clock(0)
+{
+    file.setFileName(filename);
+    if (!readonly || file.exists()) open();
+}
+
+RideDBStore::~RideDBStore()
+{
+    // anything not paged in by now is gone
+    foreach(RideItem *item, attached) item->store_ = NULL;
+    close();
+}
+
+QStringList
+RideDBStore::currentColumns()
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    QVector<QString> names(factory.metricCount());
+    foreach(QString name, factory.allMetrics())
+        names[factory.rideMetric(name)->index()] = name;
+
+    return names.toList();
+}
+
+void
+RideDBStore::open()
+{
+    if (!file.isOpen() && !file.open(readonly ? QIODevice::ReadOnly : QIODevice::ReadWrite)) {
+        qDebug()<<"cannot open ride db"<<file.fileName();
+        return;
+    }
+
+    // wrong version or not there yet
+    if (!map() && !readonly) reset(currentColumns());
+}
+
+void
+RideDBStore::close()
+{
+    if (mapped) file.unmap(mapped);
+    mapped = NULL;
+    mappedSize = 0;
+    if (file.isOpen()) file.close();
+    index.clear();
+    keys.clear();
+    keyIds.clear();
+    pending.clear();
+}
+
+bool
+RideDBStore::map()
+{
+    if (mapped) file.unmap(mapped);
+    mapped = NULL;
+    end = deadBytes = 0;
+    index.clear();
+    keys.clear();
+    keyIds.clear();
+    pending.clear();
+    columns.clear();
+    columnMap.clear();
+
+    mappedSize = file.size();
+    if (mappedSize < (qint64)sizeof(RideDBStoreHeader)) return false;
+
+    mapped = file.map(0, mappedSize);
+    if (!mapped) {
+        qDebug()<<"cannot map ride db"<<file.fileName();
+        return false;
+    }
+
+    const RideDBStoreHeader *head = reinterpret_cast<const RideDBStoreHeader*>(mapped);
+    bool valid = !strncmp(head->magic, "GCRB", 4) && head->version == RideDBStoreVersion &&
+                 head->length >= sizeof(RideDBStoreHeader) && head->length <= mappedSize;
+
+    // the metric name for each column
+    RideDBStoreReader names(mapped + sizeof(RideDBStoreHeader), mapped + (valid ? head->length : 0));
+    for (uint32_t i=0; valid && names.ok && i<head->columns; i++) columns << names.string();
+
+    if (!valid || !names.ok) {
+        file.unmap(mapped);
+        mapped = NULL;
+        columns.clear();
+        return false;
+    }
+
+    // and where it goes in the current metric index
+    QStringList current = currentColumns();
+    identity = (columns == current);
+    QHash<QString, int> lookup;
+    for (int i=0; i<current.count(); i++) lookup.insert(current[i], i);
+    columnMap.resize(columns.count());
+    for (int i=0; i<columns.count(); i++) columnMap[i] = lookup.value(columns[i], -1);
+
+    // walk the records, later ones supersede earlier ones
+    const qint64 fixed = sizeof(RideDBStoreRide) + 2 * columns.count() * sizeof(double);
+    qint64 offset = head->length;
+    while (offset + (qint64)sizeof(RideDBStoreRecord) <= mappedSize) {
+
+        const RideDBStoreRecord *r = reinterpret_cast<const RideDBStoreRecord*>(mapped + offset);
+
+        // a truncated write stops the walk
+        if (r->length < sizeof(RideDBStoreRecord) || r->length % 8 || offset + r->length > mappedSize) break;
+
+        const uchar *rend = mapped + offset + r->length;
+        bool ok = false;
+
+        switch (r->type) {
+
+        case Key:
+            {
+                RideDBStoreReader rd(mapped + offset + sizeof(RideDBStoreRecord), rend);
+                uint32_t id = rd.u32();
+                QString key = rd.string();
+                ok = rd.ok && id == (uint32_t)keys.count();
+                if (ok) {
+                    keys << key;
+                    keyIds.insert(key, id);
+                }
+            }
+            break;
+
+        case Ride:
+            if (r->length >= sizeof(RideDBStoreRide)) {
+                const RideDBStoreRide *ride = reinterpret_cast<const RideDBStoreRide*>(r);
+                if (ride->stdmeans < fixed || ride->xdata < ride->stdmeans || ride->intervalData < ride->xdata ||
+                    ride->used < ride->intervalData || ride->used > ride->length) break;
+
+                RideDBStoreReader rd(mapped + offset + fixed, rend);
+                QString name = rd.string();
+                ok = rd.ok;
+                if (ok) {
+                    qint64 prior = index.value(name, -1);
+                    if (prior >= 0) deadBytes += length(prior);
+                    index.insert(name, offset);
+                }
+            }
+            break;
+
+        case Deleted:
+            {
+                RideDBStoreReader rd(mapped + offset + sizeof(RideDBStoreRecord), rend);
+                QString name = rd.string();
+                ok = rd.ok;
+                if (ok) {
+                    qint64 prior = index.value(name, -1);
+                    if (prior >= 0) deadBytes += length(prior);
+                    index.remove(name);
+                    deadBytes += r->length;
+                }
+            }
+            break;
+        }
+
+        if (!ok) break;
+        offset += r->length;
+    }
+
+    // drop any junk at the end and go again
+    if (offset < mappedSize && !readonly) {
+        file.unmap(mapped);
+        mapped = NULL;
+        file.resize(offset);
+        return map();
+    }
+    end = offset;
+
+    return true;
+}
+
+void
+RideDBStore::reset(const QStringList &names)
+{
+    RideDBStoreHeader head;
+    memcpy(head.magic, "GCRB", 4);
+    head.version = RideDBStoreVersion;
+    head.columns = names.count();
+    head.length = 0;
+
+    QByteArray data((const char*)&head, sizeof(head));
+    RideDBStoreWriter w(data);
+    foreach(QString name, names) w.string(name);
+    w.pad();
+    reinterpret_cast<RideDBStoreHeader*>(data.data())->length = data.size();
+
+    if (mapped) file.unmap(mapped);
+    mapped = NULL;
+    file.resize(0);
+    file.seek(0);
+    file.write(data);
+    file.flush();
+
+    map();
+}
+
+void
+RideDBStore::compact()
+{
+    QFile compacted(file.fileName() + ".tmp");
+    if (!compacted.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+
+    // header and column names as-is, then the string table
+    // and the live rides in the order they were written
+    compacted.write((const char*)mapped, reinterpret_cast<const RideDBStoreHeader*>(mapped)->length);
+    for (int i=0; i<keys.count(); i++) compacted.write(keyRecord(i, keys[i]));
+
+    QList<qint64> offsets = index.values();
+    qSort(offsets);
+    foreach(qint64 offset, offsets) compacted.write((const char*)record(offset), length(offset));
+    compacted.close();
+
+    // swap it in
+    close();
+    QFile::remove(file.fileName());
+    QFile::rename(compacted.fileName(), file.fileName());
+    open();
+}
+
+QStringList
+RideDBStore::fileNames() const
+{
+    // ride filenames are yyyy_MM_dd_hh_mm_ss.ext
+    QStringList returning = index.keys();
+    qSort(returning);
+    return returning;
+}
+
+uint32_t
+RideDBStore::keyFor(const QString &key)
+{
+    QHash<QString, uint32_t>::const_iterator it = keyIds.constFind(key);
+    if (it != keyIds.constEnd()) return it.value();
+
+    uint32_t id = keys.count();
+    keys << key;
+    keyIds.insert(key, id);
+    pending.append(keyRecord(id, key));
+    return id;
+}
+
+
+// the sections that can be paged in are copied from the
+// record we already have if the item doesn't have them
+QByteArray
+RideDBStore::encode(RideItem *item)
+{
+    qint64 old = index.value(item->fileName, -1);
+    const RideDBStoreRide *prior = old >= 0 ? reinterpret_cast<const RideDBStoreRide*>(record(old)) : NULL;
+    const int paged = item->store_ == this ? (All & ~item->resident_) : 0;
+
+    RideDBStoreRide head;
+    memset(&head, 0, sizeof(head));
+    head.type = Ride;
+    head.date = item->dateTime.toMSecsSinceEpoch();
+    head.fingerprint = item->fingerprint;
+    head.crc = item->crc;
+    head.metacrc = item->metacrc;
+    head.timestamp = item->timestamp;
+    head.weight = item->weight;
+    head.dbversion = item->dbversion;
+    head.udbversion = item->udbversion;
+    head.zoneRange = item->zoneRange;
+    head.hrZoneRange = item->hrZoneRange;
+    head.paceZoneRange = item->paceZoneRange;
+    head.color = item->color.rgba();
+    head.flags = (item->isRun ? IsRun : 0) | (item->isSwim ? IsSwim : 0) | (item->samples ? Samples : 0);
+
+    QByteArray data((const char*)&head, sizeof(head));
+    RideDBStoreWriter w(data);
+
+    // the fixed columns, values then counts
+    const int n = columns.count();
+    const QVector<double> &metrics = item->metrics_;
+    const QVector<double> &counts = item->count_;
+    if (paged & Columns) {
+        if (prior) data.append((const char*)prior + sizeof(RideDBStoreRide), 2 * n * sizeof(double));
+        else data.append(QByteArray(2 * n * sizeof(double), 0));
+    } else if (metrics.count() == n && counts.count() == n) {
+        data.append((const char*)metrics.constData(), n * sizeof(double));
+        data.append((const char*)counts.constData(), n * sizeof(double));
+    } else {
+        for (int i=0; i<n; i++) w.f64(i < metrics.count() ? metrics[i] : 0);
+        for (int i=0; i<n; i++) w.f64(i < counts.count() ? counts[i] : 0);
+    }
+
+    // filename first, the index needs it
+    w.string(item->fileName);
+    w.string(item->present);
+
+    w.u32(item->overrides_.count());
+    foreach(QString override, item->overrides_) w.string(override);
+
+    // metadata keys are in the string table
+    w.u32(item->metadata_.count());
+    QMap<QString,QString>::const_iterator m;
+    for (m = item->metadata_.constBegin(); m != item->metadata_.constEnd(); m++) {
+        w.u32(keyFor(m.key()));
+        w.string(m.value());
+    }
+
+    // stdmean and stdvariance are always set together
+    uint32_t stdmeans = data.size();
+    QMap<int, double>::const_iterator s;
+    if (paged & Columns) {
+        if (prior) data.append((const char*)prior + prior->stdmeans, prior->xdata - prior->stdmeans);
+        else w.u32(0);
+    } else {
+        w.u32(item->stdmean_.count());
+        for (s = item->stdmean_.constBegin(); s != item->stdmean_.constEnd(); s++) {
+            w.u32(s.key());
+            w.f64(s.value());
+            w.f64(item->stdvariance_.value(s.key(), 0.0f));
+        }
+    }
+
+    // xdata names and series are in the string table too
+    uint32_t xdata = data.size();
+    if (paged & XData) {
+        if (prior) data.append((const char*)prior + prior->xdata, prior->intervalData - prior->xdata);
+        else w.u32(0);
+    } else {
+        w.u32(item->xdata_.count());
+        QMap<QString, QStringList>::const_iterator x;
+        for (x = item->xdata_.constBegin(); x != item->xdata_.constEnd(); x++) {
+            w.u32(keyFor(x.key()));
+            w.u32(x.value().count());
+            foreach(QString series, x.value()) w.u32(keyFor(series));
+        }
+    }
+
+    // intervals only hold the metrics computed so far (see IntervalItem::compute)
+    uint32_t intervalData = data.size();
+    uint32_t intervals = 0;
+    if (paged & Intervals) {
+        if (prior) {
+            data.append((const char*)prior + prior->intervalData, prior->used - prior->intervalData);
+            intervals = prior->intervals;
+        }
+    } else {
+        intervals = item->intervals_.count();
+        foreach(IntervalItem *interval, item->intervals_) {
+
+            w.string(interval->name);
+            w.f64(interval->start);
+            w.f64(interval->stop);
+            w.f64(interval->startKM);
+            w.f64(interval->stopKM);
+            w.i32(static_cast<int>(interval->type));
+            w.i32(interval->displaySequence);
+            w.u32(interval->color.rgba());
+            w.string(interval->route.isNull() ? QString() : interval->route.toString());
+
+            QVector<int> computed;
+            for (int i=0; i<interval->metrics().count() && i<interval->computed().size(); i++)
+                if (interval->computed().testBit(i)) computed << i;
+
+            w.u32(computed.count());
+            foreach(int i, computed) {
+                w.u32(i);
+                w.f64(interval->metrics()[i]);
+                w.f64(i < interval->counts().count() ? interval->counts()[i] : 0);
+            }
+
+            w.u32(interval->stdmeans().count());
+            for (s = interval->stdmeans().constBegin(); s != interval->stdmeans().constEnd(); s++) {
+                w.u32(s.key());
+                w.f64(s.value());
+                w.f64(interval->stdvariances().value(s.key(), 0.0f));
+            }
+        }
+    }
+
+    uint32_t used = data.size();
+    w.pad();
+
+    RideDBStoreRide *r = reinterpret_cast<RideDBStoreRide*>(data.data());
+    r->length = data.size();
+    r->intervals = intervals;
+    r->stdmeans = stdmeans;
+    r->xdata = xdata;
+    r->intervalData = intervalData;
+    r->used = used;
+    return data;
+}
+
+bool
+RideDBStore::readHeader(qint64 offset, RideItem &item) const
+{
+    const RideDBStoreRide *r = reinterpret_cast<const RideDBStoreRide*>(record(offset));
+
+    item.dateTime = QDateTime::fromMSecsSinceEpoch(r->date);
+    item.fingerprint = r->fingerprint;
+    item.crc = r->crc;
+    item.metacrc = r->metacrc;
+    item.timestamp = r->timestamp;
+    item.weight = r->weight;
+    item.dbversion = r->dbversion;
+    item.udbversion = r->udbversion;
+    item.zoneRange = r->zoneRange;
+    item.hrZoneRange = r->hrZoneRange;
+    item.paceZoneRange = r->paceZoneRange;
+    item.color = QColor::fromRgba(r->color);
+    item.isRun = r->flags & IsRun;
+    item.isSwim = r->flags & IsSwim;
+    item.samples = r->flags & Samples;
+    item.storedIntervals_ = r->intervals;
+
+    const uchar *fixed = record(offset) + sizeof(RideDBStoreRide) + 2 * columns.count() * sizeof(double);
+    RideDBStoreReader rd(fixed, record(offset) + r->stdmeans);
+    rd.string(); // filename
+    item.present = rd.string();
+
+    item.overrides_.clear();
+    uint32_t n = rd.u32();
+    for (uint32_t i=0; rd.ok && i<n; i++) item.overrides_ << rd.string();
+
+    item.metadata_.clear();
+    n = rd.u32();
+    for (uint32_t i=0; rd.ok && i<n; i++) {
+        uint32_t key = rd.u32();
+        QString value = rd.string();
+        if (key < (uint32_t)keys.count()) item.metadata_.insert(keys[key], value);
+    }
+
+    return rd.ok;
+}
+
+bool
+RideDBStore::readSections(qint64 offset, RideItem &item, int what) const
+{
+    const RideDBStoreRide *r = reinterpret_cast<const RideDBStoreRide*>(record(offset));
+    bool ok = true;
+
+    if (what & Columns) {
+
+        const int metricCount = RideMetricFactory::instance().metricCount();
+        const double *values = reinterpret_cast<const double*>(record(offset) + sizeof(RideDBStoreRide));
+        const double *counts = values + columns.count();
+
+        // a straight copy unless the metric set changed
+        if (identity) {
+            item.metrics_.resize(columns.count());
+            item.count_.resize(columns.count());
+            memcpy(item.metrics_.data(), values, columns.count() * sizeof(double));
+            memcpy(item.count_.data(), counts, columns.count() * sizeof(double));
+        } else {
+            item.metrics_.fill(0.0f, metricCount);
+            item.count_.fill(0.0f, metricCount);
+            for (int i=0; i<columns.count(); i++) {
+                int j = columnMap[i];
+                if (j < 0 || j >= metricCount) continue;
+                item.metrics_[j] = values[i];
+                item.count_[j] = counts[i];
+            }
+        }
+
+        item.stdmean_.clear();
+        item.stdvariance_.clear();
+        RideDBStoreReader rd(record(offset) + r->stdmeans, record(offset) + r->xdata);
+        uint32_t n = rd.u32();
+        for (uint32_t i=0; rd.ok && i<n; i++) {
+            int j = columnMap.value(rd.u32(), -1);
+            double stdmean = rd.f64();
+            double stdvariance = rd.f64();
+            if (j < 0) continue;
+            item.stdmean_.insert(j, stdmean);
+            item.stdvariance_.insert(j, stdvariance);
+        }
+        ok = ok && rd.ok;
+    }
+
+    if (what & XData) {
+
+        item.xdata_.clear();
+        RideDBStoreReader rd(record(offset) + r->xdata, record(offset) + r->intervalData);
+        uint32_t n = rd.u32();
+        for (uint32_t i=0; rd.ok && i<n; i++) {
+            uint32_t name = rd.u32();
+            uint32_t count = rd.u32();
+            QStringList series;
+            for (uint32_t k=0; rd.ok && k<count; k++) series << keys.value(rd.u32());
+            if (name < (uint32_t)keys.count()) item.xdata_.insert(keys[name], series);
+        }
+        ok = ok && rd.ok;
+    }
+
+    if (what & Intervals) {
+
+        qDeleteAll(item.intervals_);
+        item.intervals_.clear();
+
+        RideDBStoreReader rd(record(offset) + r->intervalData, record(offset) + r->used);
+        for (uint32_t i=0; rd.ok && i<r->intervals; i++) {
+
+            IntervalItem add;
+            add.name = rd.string();
+            add.start = rd.f64();
+            add.stop = rd.f64();
+            add.startKM = rd.f64();
+            add.stopKM = rd.f64();
+            add.type = static_cast<RideFileInterval::intervaltype>(rd.i32());
+            add.displaySequence = rd.i32();
+            add.color = QColor::fromRgba(rd.u32());
+            QString route = rd.string();
+            if (route != "") add.route = QUuid(route);
+
+            uint32_t m = rd.u32();
+            for (uint32_t k=0; rd.ok && k<m; k++) {
+                int j = columnMap.value(rd.u32(), -1);
+                double value = rd.f64();
+                double count = rd.f64();
+                if (j < 0 || j >= add.metrics().count()) continue;
+                add.metrics()[j] = value;
+                add.counts()[j] = count;
+                add.computed().setBit(j);
+            }
+
+            m = rd.u32();
+            for (uint32_t k=0; rd.ok && k<m; k++) {
+                int j = columnMap.value(rd.u32(), -1);
+                double stdmean = rd.f64();
+                double stdvariance = rd.f64();
+                if (j < 0) continue;
+                add.stdmeans().insert(j, stdmean);
+                add.stdvariances().insert(j, stdvariance);
+            }
+
+            // not addInterval(), it would page in again
+            if (rd.ok) {
+                IntervalItem *interval = new IntervalItem();
+                interval->setFrom(add);
+                interval->rideItem_ = &item;
+                item.intervals_ << interval;
+            }
+        }
+        ok = ok && rd.ok;
+    }
+
+    return ok;
+}
+
+bool
+RideDBStore::read(QString fileName, RideItem &item, int what)
+{
+    QMutexLocker locker(&mutex);
+
+    qint64 offset = index.value(fileName, -1);
+    if (offset < 0 || !mapped) return false;
+
+    return readHeader(offset, item) && readSections(offset, item, what);
+}
+
+bool
+RideDBStore::attach(RideItem *item)
+{
+    QMutexLocker locker(&mutex);
+
+    qint64 offset = index.value(item->fileName, -1);
+    if (offset < 0 || !mapped || !readHeader(offset, *item)) return false;
+
+    // don't hold the zeroes the constructor put there
+    item->metrics_ = QVector<double>();
+    item->count_ = QVector<double>();
+
+    item->store_ = this;
+    item->resident_ = 0;
+    attached << item;
+    return true;
+}
+
+void
+RideDBStore::detach(RideItem *item)
+{
+    QMutexLocker locker(&mutex);
+
+    int i = attached.indexOf(item);
+    if (i >= 0) attached.remove(i);
+    item->store_ = NULL;
+}
+
+void
+RideDBStore::pageIn(RideItem *item, int what)
+{
+    QMutexLocker locker(&mutex);
+
+    // another thread got there first
+    int want = what & ~item->resident_;
+    if (want == 0) return;
+
+    qint64 offset = index.value(item->fileName, -1);
+    if (offset < 0 || !mapped || !readSections(offset, *item, want)) {
+
+        // we lost it, so it will need to be recomputed
+        if (want & Columns) {
+            item->metrics_.fill(0.0f, RideMetricFactory::instance().metricCount());
+            item->count_.fill(0.0f, RideMetricFactory::instance().metricCount());
+        }
+        item->isstale = true;
+    }
+    item->resident_ |= want;
+}
+
+// do the columns in memory match what we have stored?
+bool
+RideDBStore::matches(qint64 offset, RideItem *item) const
+{
+    if (!identity || item->metrics_.count() != columns.count() || item->count_.count() != columns.count())
+        return false;
+
+    const double *values = reinterpret_cast<const double*>(record(offset) + sizeof(RideDBStoreRide));
+    const double *counts = values + columns.count();
+    if (memcmp(item->metrics_.constData(), values, columns.count() * sizeof(double)) ||
+        memcmp(item->count_.constData(), counts, columns.count() * sizeof(double)))
+        return false;
+
+    RideItem stored;
+    if (!readSections(offset, stored, Columns)) return false;
+    return stored.stdmean_ == item->stdmean_ && stored.stdvariance_ == item->stdvariance_;
+}
+
+void
+RideDBStore::trim()
+{
+    QMutexLocker locker(&mutex);
+
+    // least recently used first
+    QVector<QPair<quint64, RideItem*> > resident;
+    foreach(RideItem *item, attached)
+        if (item->resident_ & Columns) resident << QPair<quint64, RideItem*>(item->used_, item);
+
+    if (resident.count() <= RideDBStoreResident) return;
+    qSort(resident.begin(), resident.end());
+
+    // page out the oldest, leaving some headroom
+    int excess = resident.count() - (RideDBStoreResident * 3 / 4);
+    for (int i=0; i<resident.count() && excess > 0; i++) {
+
+        RideItem *item = resident[i].second;
+
+        // in use or changed since we last saved it
+        if (item->isOpen() || item->isdirty || item->isedit || item->isstale) continue;
+        qint64 offset = index.value(item->fileName, -1);
+        if (offset < 0 || !matches(offset, item)) continue;
+
+        item->metrics_ = QVector<double>();
+        item->count_ = QVector<double>();
+        item->stdmean_.clear();
+        item->stdvariance_.clear();
+        item->resident_ &= ~Columns;
+        excess--;
+    }
+}
+
+void
+RideDBStore::save(const QVector<RideItem*> &rides)
+{
+    if (readonly) return;
+
+    QMutexLocker locker(&mutex);
+
+    if (!file.isOpen()) open();
+    if (!file.isOpen()) return;
+
+    // a different metric set means a different record layout
+    // so everything is paged in before we start over
+    QStringList current = currentColumns();
+    if (!mapped || columns != current) {
+        foreach(RideItem *item, attached) {
+            int want = All & ~item->resident_;
+            qint64 offset = index.value(item->fileName, -1);
+            if (want && offset >= 0 && mapped) readSections(offset, *item, want);
+            item->resident_ = All;
+        }
+        reset(current);
+    }
+    if (!mapped) return;
+
+    QSet<QString> live;
+    QByteArray appending = changes(rides, &live);
+
+    // and the ones that have gone
+    QHashIterator<QString, qint64> i(index);
+    while (i.hasNext()) {
+        i.next();
+        if (!live.contains(i.key())) appending.append(tombstone(i.key()));
+    }
+
+    append(appending);
+}
+
+void
+RideDBStore::checkpoint(const QVector<RideItem*> &rides)
+{
+    if (readonly) return;
+
+    QMutexLocker locker(&mutex);
+
+    // if the metric set changed the next save will rewrite it all
+    if (!file.isOpen() || !mapped || columns != currentColumns()) return;
+
+    append(changes(rides, NULL));
+}
+
+// records for the rides that changed since we last saved them
+QByteArray
+RideDBStore::changes(const QVector<RideItem*> &rides, QSet<QString> *live)
+{
+    QByteArray appending;
+
+    foreach(RideItem *item, rides) {
+
+        // don't save files with discarded changes at exit
+        // they get refreshed when we next start
+        if (item->skipsave == true) continue;
+        if (live) live->insert(item->fileName);
+
+        // skip if not loaded/refreshed, a special case
+        // if saving during an initial refresh
+        if (item->store_ != this && item->metrics_.count() == 0) continue;
+
+        // unchanged since we last saved it
+        QByteArray add = encode(item);
+        qint64 offset = index.value(item->fileName, -1);
+        if (offset >= 0 && length(offset) == (uint32_t)add.size() &&
+            !memcmp(record(offset), add.constData(), add.size())) continue;
+
+        // any new keys go before the ride that uses them
+        appending.append(pending);
+        pending.clear();
+        appending.append(add);
+    }
+    return appending;
+}
+
+// add records to the end of the file and remap
+void
+RideDBStore::append(const QByteArray &appending)
+{
+    if (appending.isEmpty()) return;
+
+    file.unmap(mapped);
+    mapped = NULL;
+    file.seek(end);
+    file.write(appending);
+    file.flush();
+    map();
+
+    // tidy up if more than half is dead wood
+    if (mapped && deadBytes > 1024*1024 && deadBytes > mappedSize/2) compact();
+}
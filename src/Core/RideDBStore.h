@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_RideDBStore_h
+#define _GC_RideDBStore_h 1
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QFile>
+#include <QByteArray>
+#include <QMutex>
+#include <QAtomicInteger>
+
+#include <stdint.h>
+
+class RideItem;
+
+// RideDBStore is the binary replacement for cache/rideDB.json, it lives
+// alongside it as cache/rideDB.bin and is memory mapped. Each ride has a
+// fixed block of metric values and counts in metric index order, so a
+// load is a copy straight into RideItem::metrics_ and count_ with no
+// parsing. Metadata and xdata names are held once in a string table.
+//
+// The file is append-only; a save only appends records for the rides
+// that have changed since the last save and a tombstone for any that
+// have been deleted. It is compacted when the dead space gets too large
+// and rewritten from scratch if the metric set changes.
+//
+// When the athlete is opened only the ride header and metadata are read,
+// which is all that is needed to check if a ride is stale. The metric
+// columns, xdata and intervals are paged in when they are first accessed
+// (see RideItem::pageIn). Metric columns are paged out again, least
+// recently used first, when more than RideDBStoreResident rides have
+// them in memory and they still match what is in the store. Callers hold
+// references to the columns, so RideCache only trims on the gui thread
+// when no refresh is running and no other thread holds RideCache::paging().
+//
+// rideDB.json is still read if there is no binary store (i.e. on
+// upgrade) and RideCache::exportJSON() will write one on demand.
+//
+static const unsigned int RideDBStoreVersion = 2;
+// revision history:
+// version  date         description
+// 1        18-Mar-18    Initial - header, column table, append-only records
+// 2        21-Mar-18    Lazy sections at known offsets, interval count in header
+
+// rides with metric columns in memory before we start paging out
+static const int RideDBStoreResident = 1000;
+
+// the file starts with a header
+struct RideDBStoreHeader {
+
+    char magic[4];              // "GCRB"
+    uint32_t version;           // RideDBStoreVersion
+    uint32_t columns;           // metric values held for each ride
+    uint32_t length;            // bytes including this header and the column names
+};
+
+// followed by the names of the metric in each column, then any number of
+// records. Every record starts with a length and type and is padded to
+// a multiple of 8 bytes so the metric columns are always aligned.
+struct RideDBStoreRecord {
+
+    uint32_t length;            // bytes including this header
+    uint32_t type;              // Ride, Key or Deleted
+};
+
+// a ride record, followed by double values[columns], double counts[columns]
+// then filename, present, overrides and metadata which are always read and
+// then the sections that are paged in; stdmean and stdvariance (with the
+// columns), xdata and intervals. Offsets are from the start of the record.
+struct RideDBStoreRide {
+
+    uint32_t length;
+    uint32_t type;
+    int64_t  date;              // msecs since epoch UTC
+    uint64_t fingerprint, crc, metacrc, timestamp;
+    double   weight;
+    int32_t  dbversion, udbversion;
+    int32_t  zoneRange, hrZoneRange, paceZoneRange;
+    uint32_t color;             // QRgb
+    uint32_t flags;             // see below
+    uint32_t intervals;         // how many, so we know without reading them
+    uint32_t stdmeans;          // offset of stdmean and stdvariance
+    uint32_t xdata;             // offset of xdata
+    uint32_t intervalData;      // offset of intervals
+    uint32_t used;              // bytes used, the rest is padding
+};
+
+class RideDBStore
+{
+    public:
+
+        enum { Ride = 1, Key = 2, Deleted = 3 };
+        enum { IsRun = 0x01, IsSwim = 0x02, Samples = 0x04 };
+
+        // the parts of a ride that are paged in
+        enum { Columns = 0x01, XData = 0x02, Intervals = 0x04, All = 0x07 };
+
+        // readonly is for the api, which never writes
+        RideDBStore(QString filename, bool readonly=false);
+        ~RideDBStore();
+
+        // rides held
+        int count() const { return index.count(); }
+
+        // filenames of the rides held, in date order
+        QStringList fileNames() const;
+
+        // set the item from the store, false if we don't have it
+        bool read(QString fileName, RideItem &item, int what=All);
+
+        // set the ride header and metadata, the rest will be
+        // paged in when the item needs it
+        bool attach(RideItem *item);
+        void detach(RideItem *item);
+
+        // called by the item when it needs the rest
+        void pageIn(RideItem *item, int what);
+        quint64 tick() { return clock.fetchAndAddRelaxed(1) + 1; }
+
+        // page out the least recently used metric columns
+        void trim();
+
+        // append any rides that changed and remove any that have gone
+        void save(const QVector<RideItem*> &rides);
+
+        // append any of these rides that changed, but leave the rest
+        // alone, so a long refresh isn't lost if we exit or crash
+        void checkpoint(const QVector<RideItem*> &rides);
+
+    private:
+
+        // (re)map the file and rebuild the index
+        void open();
+        void close();
+        bool map();
+        void reset(const QStringList &columns);
+        void compact();
+
+        // metric names in metric index order
+        static QStringList currentColumns();
+
+        // reading the parts of a record
+        bool readHeader(qint64 offset, RideItem &item) const;
+        bool readSections(qint64 offset, RideItem &item, int what) const;
+        bool matches(qint64 offset, RideItem *item) const;
+
+        // encoding a ride, may add keys to the string table
+        QByteArray encode(RideItem *item);
+        QByteArray changes(const QVector<RideItem*> &rides, QSet<QString> *live);
+        void append(const QByteArray &records);
+        uint32_t keyFor(const QString &key);
+
+        const uchar *record(qint64 offset) const { return mapped + offset; }
+        uint32_t length(qint64 offset) const {
+            return reinterpret_cast<const RideDBStoreRecord*>(mapped + offset)->length;
+        }
+
+        QFile file;
+        bool readonly;
+        uchar *mapped;
+        qint64 mappedSize;
+        qint64 end;             // end of the valid records
+        qint64 deadBytes;       // superseded records and tombstones
+
+        // the columns in the file and where each one
+        // lives in the current metric index
+        QStringList columns;
+        QVector<int> columnMap;
+        bool identity;
+
+        // string table
+        QStringList keys;
+        QHash<QString, uint32_t> keyIds;
+        QByteArray pending;     // key records not yet written
+
+        // latest record offset by ride filename
+        QHash<QString, qint64> index;
+
+        // items attached for paging, refresh threads page in
+        // too so the mapping is guarded by the mutex
+        QVector<RideItem*> attached;
+        QAtomicInteger<quint64> clock;
+        QMutex mutex;
+};
+#endif // _GC_RideDBStore_h
@@ -44,16 +44,16 @@
 // merge wizard and interval navigator
 RideItem::RideItem() 
     : 
-    ride_(NULL), fileCache_(NULL), context(NULL), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
-    color(QColor(1,1,1)), isRun(false), isSwim(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0) {
+    ride_(NULL), fileCache_(NULL), store_(NULL), resident_(RideDBStore::All), storedIntervals_(0), used_(0), intervalMutex(QMutex::Recursive), context(NULL), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
+    color(QColor(1,1,1)), isRun(false), isSwim(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), weightFixed(false) {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
 }
 
 RideItem::RideItem(RideFile *ride, Context *context) 
     : 
-    ride_(ride), fileCache_(NULL), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
-    color(QColor(1,1,1)), isRun(false), isSwim(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0) 
+    ride_(ride), fileCache_(NULL), store_(NULL), resident_(RideDBStore::All), storedIntervals_(0), used_(0), intervalMutex(QMutex::Recursive), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
+    color(QColor(1,1,1)), isRun(false), isSwim(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), weightFixed(false) 
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -61,9 +61,9 @@ RideItem::RideItem(RideFile *ride, Context *context)
 
 RideItem::RideItem(QString path, QString fileName, QDateTime &dateTime, Context *context, bool planned)
     :
-    ride_(NULL), fileCache_(NULL), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(path), fileName(fileName),
+    ride_(NULL), fileCache_(NULL), store_(NULL), resident_(RideDBStore::All), storedIntervals_(0), used_(0), intervalMutex(QMutex::Recursive), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(path), fileName(fileName),
     dateTime(dateTime), color(QColor(1,1,1)), planned(planned), isRun(false), isSwim(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0),
-    metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0) 
+    metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), weightFixed(false) 
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -73,8 +73,8 @@ RideItem::RideItem(QString path, QString fileName, QDateTime &dateTime, Context
 // pre-computed metrics and storing ride metadata
 RideItem::RideItem(RideFile *ride, QDateTime &dateTime, Context *context)
     :
-    ride_(ride), fileCache_(NULL), context(context), isdirty(true), isstale(true), isedit(false), skipsave(false), dateTime(dateTime),
-    zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0)
+    ride_(ride), fileCache_(NULL), store_(NULL), resident_(RideDBStore::All), storedIntervals_(0), used_(0), intervalMutex(QMutex::Recursive), context(context), isdirty(true), isstale(true), isedit(false), skipsave(false), dateTime(dateTime),
+    zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), weightFixed(false)
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -84,6 +84,9 @@ RideItem::RideItem(RideFile *ride, QDateTime &dateTime, Context *context)
 void
 RideItem::setFrom(RideItem&here, bool temp) // used when loading cache/rideDB.json
 {
+    here.pageIn(RideDBStore::All);
+    resident_ = RideDBStore::All;
+
     ride_ = NULL;
     fileCache_ = NULL;
     metrics_ = here.metrics_;
@@ -130,6 +133,8 @@ RideItem::setFrom(RideItem&here, bool temp) // used when loading cache/rideDB.js
 void
 RideItem::setFrom(QHash<QString, RideMetricPtr> computed)
 {
+    pageIn(RideDBStore::Columns);
+
     QHashIterator<QString, RideMetricPtr> i(computed);
     while (i.hasNext()) {
         i.next();
@@ -182,6 +187,7 @@ RideFile *RideItem::ride(bool open)
 
     // link any USER intervals to the ride, bit fiddly but only used
     // when updating the physical model via the logical
+    pageIn(RideDBStore::Intervals);
     if (intervals_.count()) {
         //qDebug()<<fileName<<"LINKING INTERVALS";
         int findex=0;
@@ -234,6 +240,7 @@ RideFile *RideItem::ride(bool open)
 RideItem::~RideItem()
 {
     //qDebug()<<"deleting:"<<fileName;
+    if (store_) store_->detach(this);
     if (isOpen()) close();
     if (fileCache_) delete fileCache_;
     //XXX need to consider what to do here for the intervalitem
@@ -282,6 +289,7 @@ RideItem::setRide(RideFile *overwrite)
 bool
 RideItem::removeInterval(IntervalItem *x)
 {
+    pageIn(RideDBStore::Intervals);
     int index = intervals_.indexOf(x);
 
     if (ride_ == NULL) return false; // file not open
@@ -298,6 +306,8 @@ RideItem::removeInterval(IntervalItem *x)
 void
 RideItem::moveInterval(int from, int to)
 {
+    pageIn(RideDBStore::Intervals);
+
     // Move in RideFile
     int from2 = ride()->intervals().indexOf(intervals_.at(from)->rideInterval);
     int to2 = ride()->intervals().indexOf(intervals_.at(to)->rideInterval);
@@ -310,12 +320,29 @@ RideItem::moveInterval(int from, int to)
 void
 RideItem::addInterval(IntervalItem item)
 {
+    pageIn(RideDBStore::Intervals);
+
     IntervalItem *add = new IntervalItem();
     add->setFrom(item);
     add->rideItem_ = this;
     intervals_ << add;
 }
 
+void
+RideItem::computeIntervalMetrics(QStringList symbols)
+{
+    // refresh will recompute them anyway
+    if (isstale || !context) return;
+
+    // opened by the first that needs it, and closed if we opened it
+    QMutexLocker locker(&intervalMutex);
+    bool doclose = !isOpen();
+
+    foreach(IntervalItem *interval, intervals()) interval->compute(symbols, true);
+
+    if (doclose && isOpen()) close();
+}
+
 IntervalItem *
 RideItem::newInterval(QString name, double start, double stop, double startKM, double stopKM)
 {
@@ -327,6 +354,7 @@ RideItem::newInterval(QString name, double start, double stop, double startKM, d
     add->rideInterval = ride()->newInterval(name, start, stop);
 
     // add to list
+    pageIn(RideDBStore::Intervals);
     intervals_ << add;
 
     // refresh metrics
@@ -417,6 +445,9 @@ RideItem::setDirty(bool val)
 void
 RideItem::setFileName(QString path, QString fileName)
 {
+    // the store knows us by the old name
+    pageIn(RideDBStore::All);
+
     this->path = path;
     this->fileName = fileName;
 }
@@ -475,7 +506,7 @@ RideItem::checkStale()
 
         if (prior != now) {
 
-            getWeight();
+            weight = getWeight();
             isstale = true;
 
         } else {
@@ -520,8 +551,9 @@ RideItem::checkStale()
                 }
 
 
-                // no intervals ?
-                if (samples && intervals_.count() == 0)
+                // no intervals ? (without paging them in)
+                int intervalCount = (store_ && !(resident_ & RideDBStore::Intervals)) ? storedIntervals_ : intervals_.count();
+                if (samples && intervalCount == 0)
                     isstale = true;
 
             }
@@ -542,6 +574,9 @@ RideItem::refresh()
 {
     if (!isstale) return;
 
+    // we update everything, so get what we had first
+    pageIn(RideDBStore::All);
+
     // update current state coz we'll fix it below
     isstale = false;
 
@@ -579,7 +614,7 @@ RideItem::refresh()
         }
 
         // get weight that applies to the date
-        getWeight();
+        weight = getWeight();
 
         // first class stuff
         isRun = f->isRun();
@@ -677,7 +712,11 @@ RideItem::refresh()
 double
 RideItem::getWeight(int type)
 {
+    // fixed for a metrics pass, see fixWeight()
+    if (weightFixed && type == BodyMeasure::WeightKg) return weight;
+
     // get any body measurements first
+    BodyMeasure weightData;
     BodyMeasures* pBodyMeasures = dynamic_cast <BodyMeasures*>(context->athlete->measures->getGroup(Measures::Body));
     pBodyMeasures->getBodyMeasure(dateTime.date(), weightData);
 
@@ -688,18 +727,18 @@ RideItem::getWeight(int type)
     case BodyMeasure::WeightKg:
     {
         // get weight from whatever we got
-        weight = weightData.weightkg;
+        double kg = weightData.weightkg;
 
         // from metadata
-        if (weight <= 0.00) weight = metadata_.value("Weight", "0.0").toDouble();
+        if (kg <= 0.00) kg = metadata_.value("Weight", "0.0").toDouble();
 
         // global options and if not set default to 75 kg.
-        if (weight <= 0.00) weight = appsettings->cvalue(context->athlete->cyclist, GC_WEIGHT, "75.0").toString().toDouble();
+        if (kg <= 0.00) kg = appsettings->cvalue(context->athlete->cyclist, GC_WEIGHT, "75.0").toString().toDouble();
 
         // No weight default is weird, we'll set to 80kg
-        if (weight <= 0.00) weight = 80.00;
+        if (kg <= 0.00) kg = 80.00;
 
-        return weight;
+        return kg;
     }
 
     // all the other weight measures supported by BodyMetrics
@@ -713,6 +752,15 @@ RideItem::getWeight(int type)
     return weight;
 }
 
+void
+RideItem::fixWeight(bool fixed)
+{
+    // only ever called on the thread computing the metrics, before
+    // and after the metrics that read the weight are started
+    if (fixed) weight = getWeight();
+    weightFixed = fixed;
+}
+
 double
 RideItem::getHrvMeasure(int type)
 {
@@ -733,6 +781,8 @@ RideItem::getHrvFingerprint()
 double
 RideItem::getForSymbol(QString name, bool useMetricUnits)
 {
+    pageIn(RideDBStore::Columns);
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -752,6 +802,8 @@ RideItem::getForSymbol(QString name, bool useMetricUnits)
 double
 RideItem::getCountForSymbol(QString name)
 {
+    pageIn(RideDBStore::Columns);
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -769,6 +821,8 @@ RideItem::getCountForSymbol(QString name)
 double
 RideItem::getStdMeanForSymbol(QString name)
 {
+    pageIn(RideDBStore::Columns);
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -784,6 +838,8 @@ RideItem::getStdMeanForSymbol(QString name)
 double
 RideItem::getStdVarianceForSymbol(QString name)
 {
+    pageIn(RideDBStore::Columns);
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -799,6 +855,8 @@ RideItem::getStdVarianceForSymbol(QString name)
 QString
 RideItem::getStringForSymbol(QString name, bool useMetricUnits)
 {
+    pageIn(RideDBStore::Columns);
+
     QString returning("-");
 
     const RideMetricFactory &factory = RideMetricFactory::instance();
@@ -948,11 +1006,15 @@ RideItem::updateIntervals()
                                 tr("1 minute"), tr("5 minutes"), tr("10 minutes"), tr("20 minutes"), tr("30 minutes"), tr("45 minutes"),
                                 tr("1 hour") };
     
+        // go hunting for best peaks, all durations in one pass
+        QList<double> windows;
+        for(int i=0; durations[i] != 0; i++) windows << durations[i];
+        QList<QList<AddIntervalDialog::AddedInterval> > peaks;
+        AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::watts, RideFile::original, windows, 1, peaks, "", "");
+
         for(int i=0; durations[i] != 0; i++) {
 
-            // go hunting for best peak
-            QList<AddIntervalDialog::AddedInterval> results;
-            AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::watts, RideFile::original, durations[i], 1, results, "", "");
+            const QList<AddIntervalDialog::AddedInterval> &results = peaks[i];
 
             // did we get one ?
             if (results.count() > 0 && results[0].avg > 0 && results[0].stop > 0) {
@@ -982,11 +1044,15 @@ RideItem::updateIntervals()
                                 tr("1 hour") };
 
         bool metric = appsettings->value(this, context->athlete->paceZones(f->isSwim())->paceSetting(), true).toBool();
+        // go hunting for best peaks, all durations in one pass
+        QList<double> windows;
+        for(int i=0; durations[i] != 0; i++) windows << durations[i];
+        QList<QList<AddIntervalDialog::AddedInterval> > peaks;
+        AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::kph, RideFile::original, windows, 1, peaks, "", "");
+
         for(int i=0; durations[i] != 0; i++) {
 
-            // go hunting for best peak
-            QList<AddIntervalDialog::AddedInterval> results;
-            AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::kph, RideFile::original, durations[i], 1, results, "", "");
+            const QList<AddIntervalDialog::AddedInterval> &results = peaks[i];
 
             // did we get one ?
             if (results.count() > 0 && results[0].avg > 0 && results[0].stop > 0) {
@@ -1541,6 +1607,8 @@ RideItem::updateIntervals()
 
 QList<IntervalItem*> RideItem::intervalsSelected() const
 {
+    const_cast<RideItem*>(this)->pageIn(RideDBStore::Intervals);
+
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->selected) returning << p;
@@ -1550,6 +1618,8 @@ QList<IntervalItem*> RideItem::intervalsSelected() const
 
 QList<IntervalItem*> RideItem::intervalsSelected(RideFileInterval::intervaltype type) const
 {
+    const_cast<RideItem*>(this)->pageIn(RideDBStore::Intervals);
+
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->selected && p->type==type) returning << p;
@@ -1559,6 +1629,8 @@ QList<IntervalItem*> RideItem::intervalsSelected(RideFileInterval::intervaltype
 
 QList<IntervalItem*> RideItem::intervals(RideFileInterval::intervaltype type) const
 {
+    const_cast<RideItem*>(this)->pageIn(RideDBStore::Intervals);
+
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->type == type) returning << p;
@@ -1572,6 +1644,8 @@ QList<IntervalItem*> RideItem::intervals(RideFileInterval::intervaltype type) co
 bool
 RideItem::xdataMatch(QString name, QString series, QString &mname, QString &mseries)
 {
+    pageIn(RideDBStore::XData);
+
     QMapIterator<QString, QStringList>xi(xdata_);
     xi.toFront();
     while (xi.hasNext()) {
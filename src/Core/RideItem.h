@@ -24,10 +24,12 @@
 #include "RideMetric.h"
 #include "BodyMeasures.h"
 #include "HrvMeasures.h"
+#include "RideDBStore.h"
 
 #include <QString>
 #include <QMap>
 #include <QVector>
+#include <QMutex>
 
 class RideFile;
 class RideFileCache;
@@ -56,6 +58,7 @@ class RideItem : public QObject
         friend class ::IntervalSummaryWindow;
         friend class ::UserData;
         friend class ::ComparePane;
+        friend class ::RideDBStore;
 
         // ridefile
         RideFile *ride_;
@@ -82,6 +85,21 @@ class RideItem : public QObject
         // userdata cache
         QMap<QString, QVector<double> > userCache;
 
+        // paging in from the ride store, when store_ is NULL
+        // everything is in memory, see RideDBStore.h
+        RideDBStore *store_;
+        int resident_;          // which parts are in memory
+        int storedIntervals_;   // how many intervals the store holds
+        quint64 used_;          // for paging out least recently used
+        void pageIn(int what) {
+            if (store_ == NULL) return;
+            if ((resident_ & what) != what) store_->pageIn(this, what);
+            used_ = store_->tick();
+        }
+
+        // held while interval metrics are computed, see IntervalItem::compute
+        QMutex intervalMutex;
+
         unsigned long metaCRC();
 
     public slots:
@@ -155,20 +173,26 @@ class RideItem : public QObject
         double weight; // what weight was used ?
 
         // access to the cached data !
-        BodyMeasure weightData;
         RideFile *ride(bool open=true);
         RideFileCache *fileCache();
-        QVector<double> &metrics() { return metrics_; }
-        QVector<double> &counts() { return count_; }
-        QMap <int, double>&stdmeans() { return stdmean_; }
-        QMap <int, double>&stdvariances() { return stdvariance_; }
+        QVector<double> &metrics() { pageIn(RideDBStore::Columns); return metrics_; }
+        QVector<double> &counts() { pageIn(RideDBStore::Columns); return count_; }
+        QMap <int, double>&stdmeans() { pageIn(RideDBStore::Columns); return stdmean_; }
+        QMap <int, double>&stdvariances() { pageIn(RideDBStore::Columns); return stdvariance_; }
         const QStringList errors() { return errors_; }
-        double getWeight(int type=0);
+        double getWeight(int type=0); // a lookup, it doesn't update weight
+
+        // while fixed getWeight() returns weight, looked up once when fixing,
+        // so metrics computed in parallel don't look it up (or race to set it)
+        void fixWeight(bool fixed);
         double getHrvMeasure(int type=HrvMeasure::RMSSD);
         unsigned short getHrvFingerprint();
 
         // when retrieving interval lists we can provide criteria too
-        QList<IntervalItem*> &intervals()  { return intervals_; }
+        QList<IntervalItem*> &intervals()  { pageIn(RideDBStore::Intervals); return intervals_; }
+        // those not computed on demand yet, for all the intervals with the
+        // ride opened once, all of them if none are named
+        void computeIntervalMetrics(QStringList symbols = QStringList());
         QList<IntervalItem*> intervalsSelected() const;
         QList<IntervalItem*> intervals(RideFileInterval::intervaltype) const;
         QList<IntervalItem*> intervalsSelected(RideFileInterval::intervaltype) const;
@@ -179,7 +203,7 @@ class RideItem : public QObject
         QMap<QString, QString> &metadata() { return metadata_; }
 
         // xdata definitions maps QString<xdata>, QStringList<xdataseries>
-        QMap<QString,QStringList> &xdata() { return xdata_; }
+        QMap<QString,QStringList> &xdata() { pageIn(RideDBStore::XData); return xdata_; }
 
         // hunt down the xdata series by matching, returns true or false on match
         // and will set mname and mseries to the value that matched
@@ -219,6 +243,8 @@ class RideItem : public QObject
 
     private:
         void updateIntervals();
+
+        bool weightFixed; // see fixWeight()
 };
 
 #endif // _GC_RideItem_h
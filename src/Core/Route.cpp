@@ -102,10 +102,6 @@ RouteSegment::setMaxLon(double _maxLon) {
     maxLon = _maxLon;
 }
 
-QList<RoutePoint> RouteSegment::getPoints() {
-    return points;
-}
-
 int
 RouteSegment::addPoint(RoutePoint _point)
 {
@@ -125,7 +121,7 @@ RouteSegment::addPoint(RoutePoint _point)
 }
 
 void 
-RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
+RouteSegment::search(RideItem *item, RideFile*ride, const RouteTrack &track, QList<IntervalItem*>&here)
 {
     //qDebug() << "Opening ride: " << item->fileName << " for " << name;
 
@@ -135,6 +131,14 @@ RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
                                      // if there is performance issue we can perhaps have 1m for small segments
                                      // and keep 10m for longer.
 
+    // every route point has to be matched within minimumprecision
+    // so if the ride never comes near one of them we're done
+    QVector<RouteTrack::Point> routepoints(points.count());
+    for (int n=0; n<points.count(); n++) {
+        routepoints[n] = RouteTrack::prepare(points.at(n).lat, points.at(n).lon);
+        if (!track.near(routepoints[n], minimumprecision)) return;
+    }
+
     double precision = -1;
 
     int found = 0;
@@ -142,8 +146,8 @@ RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
     int lastpoint = -1; // Last point to match
     double start = -1, stop = -1; // Start and stop secs
 
-    for (int n=0; n< this->getPoints().count();n++) {
-        RoutePoint routepoint = this->getPoints().at(n);
+    for (int n=0; n< points.count();n++) {
+        const RouteTrack::Point &routepoint = routepoints.at(n);
 
         bool present = false;
         RideFilePoint* point;
@@ -153,14 +157,19 @@ RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
 
             double minimumdistance = -1;
 
-            if (point->lat != 0 && point->lon !=0 &&
-                ceil(point->lat) != 180 && ceil(point->lon) != 180 &&
-                ceil(point->lat) != 540 && ceil(point->lon) != 540) {
+            if (track.valid(i)) {
                 // Valid GPS value
                 if (start == -1) {
                     diverge = 0;
+
+                    // fare away from reference point, no need for the trig
+                    if (track.nearest(routepoint, i) > 1.001) {
+                        i += 50;
+                        continue;
+                    }
+
                     // Calculate distance to route point
-                    double _dist = distance(routepoint.lat, routepoint.lon, point->lat, point->lon) ;
+                    double _dist = track.distance(routepoint, i);
                     minimumdistance = _dist;
 
                     if (precision == -1 || _dist<precision)
@@ -180,14 +189,13 @@ RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
                 if (start != -1) {
                     int end = i+10;
                     for (int j=i; j<ride->dataPoints().count() && j<end;j++) {
-                        RideFilePoint* nextpoint = ride->dataPoints().at(j);
 
-                        if (nextpoint->lat != 0 && nextpoint->lon !=0 && ceil(nextpoint->lat) != 180 && ceil(nextpoint->lon) != 180) {
-                            double _nextdist = distance(routepoint.lat, routepoint.lon, nextpoint->lat, nextpoint->lon) ;
+                        if (track.usable(j)) {
+                            double _nextdist = track.distance(routepoint, j);
 
                             if (minimumdistance ==-1 || _nextdist<minimumdistance){
                                 //new minimumdistance
-                                point = nextpoint;
+                                point = ride->dataPoints().at(j);
                                 i = j;
                                 minimumdistance = _nextdist;
                             }
@@ -248,7 +256,7 @@ RouteSegment::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
         
         stop = point->secs;
         
-        if (n == this->getPoints().count()-1) {
+        if (n == points.count()-1) {
 
             // Add the interval and continue search
             //qDebug() << "    >>> Route identified in ride: " << name << " start: " << start << " stop: " << stop << " (distance " << precision << "km)\r\n";
@@ -303,6 +311,91 @@ RouteSegment::distance(double lat1, double lon1, double lat2, double lon2) {
 
 
 
+/*
+ * RouteTrack
+ *
+ */
+
+// grid cells are this many degrees square, ~1km of latitude
+static const double RouteTrackCell = 0.01;
+
+RouteTrack::RouteTrack(RideFile *ride)
+{
+    const int count = ride ? ride->dataPoints().count() : 0;
+    lat.resize(count);
+    lon.resize(count);
+    sinlat.resize(count);
+    coslat.resize(count);
+    flags.fill(0, count);
+
+    for (int i=0; i<count; i++) {
+        const RideFilePoint *point = ride->dataPoints().at(i);
+
+        lat[i] = point->lat;
+        lon[i] = point->lon;
+        sinlat[i] = sin(deg2rad(point->lat));
+        coslat[i] = cos(deg2rad(point->lat));
+
+        // same checks RouteSegment::search always made
+        if (point->lat != 0 && point->lon !=0 && ceil(point->lat) != 180 && ceil(point->lon) != 180) {
+            flags[i] = (ceil(point->lat) != 540 && ceil(point->lon) != 540) ? 2 : 1;
+            cells[cell(floor(point->lat / RouteTrackCell), floor(point->lon / RouteTrackCell))] << i;
+        }
+    }
+}
+
+RouteTrack::Point
+RouteTrack::prepare(double lat, double lon)
+{
+    Point returning;
+    returning.lat = lat;
+    returning.lon = lon;
+    returning.sinlat = sin(deg2rad(lat));
+    returning.coslat = cos(deg2rad(lat));
+    return returning;
+}
+
+double
+RouteTrack::distance(const Point &p, int i) const
+{
+    double _theta = p.lon - lon[i];
+    if (_theta == 0 && (p.lat - lat[i]) == 0) return 0;
+    return acos(p.sinlat * sinlat[i] + p.coslat * coslat[i] * cos(deg2rad(_theta))) * 6371;
+}
+
+double
+RouteTrack::nearest(const Point &p, int i) const
+{
+    // the difference in latitude alone
+    return fabs(deg2rad(p.lat - lat[i])) * 6371;
+}
+
+bool
+RouteTrack::near(const Point &p, double km) const
+{
+    // how many degrees km could be, with some room to spare
+    double dlat = rad2deg(km / 6371) * 1.1;
+    double c = cos(deg2rad(fabs(p.lat) + dlat));
+
+    // too close to the poles or the date line for the grid, look at them all
+    if (c < 0.01 || fabs(p.lon) + (dlat / c) >= 180) {
+        for (int i=0; i<flags.count(); i++)
+            if (flags[i] && distance(p, i) <= km) return true;
+        return false;
+    }
+    double dlon = dlat / c;
+
+    for (int x=floor((p.lat - dlat) / RouteTrackCell); x<=floor((p.lat + dlat) / RouteTrackCell); x++) {
+        for (int y=floor((p.lon - dlon) / RouteTrackCell); y<=floor((p.lon + dlon) / RouteTrackCell); y++) {
+            QHash<qint64, QVector<int> >::const_iterator it = cells.constFind(cell(x, y));
+            if (it == cells.constEnd()) continue;
+            foreach(int i, it.value())
+                if (distance(p, i) <= km) return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Routes (list of RouteSegment)
  *
@@ -405,6 +498,9 @@ Routes::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
 {
     if (ride) {
 
+        // the ride's gps data is prepared once for all the segments
+        RouteTrack track(ride);
+
         // search all segments
         for (int routecount=0;routecount<routes.count();routecount++) {
             RouteSegment *segment = &routes[routecount];
@@ -415,7 +511,7 @@ Routes::search(RideItem *item, RideFile*ride, QList<IntervalItem*>&here)
                 ride->getMinPoint(RideFile::lon).toDouble()<segment->getMinLon()+0.001 &&
                 ride->getMaxPoint(RideFile::lon).toDouble()>segment->getMaxLon()-0.001   )
 
-            segment->search(item, ride, here);
+            segment->search(item, ride, track, here);
         }
     }
 }
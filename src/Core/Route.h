@@ -25,11 +25,14 @@
 #include <QString>
 #include <QDate>
 #include <QFile>
+#include <QHash>
+#include <QVector>
 
 #include "Context.h"
 
 class  RideFile;
 class  Routes;
+class  RouteTrack;
 struct RoutePoint;
 
 class RouteSegment // represents a segment we match against
@@ -43,7 +46,7 @@ class RouteSegment // represents a segment we match against
         QString getName();
         void setName(QString _name);
         QUuid id() const { return _id; }
-        QList<RoutePoint> getPoints();
+        const QList<RoutePoint> &getPoints() const { return points; }
         void setId(QUuid x) { _id = x; }
 
         double getMinLat();
@@ -59,8 +62,8 @@ class RouteSegment // represents a segment we match against
         int addPoint(RoutePoint _point);
         double distance(double lat1, double lon1, double lat2, double lon2);
 
-        // find segments in ridefiles
-        void search(RideItem *, RideFile*, QList<IntervalItem*>&);
+        // find segments in ridefiles, the track is the ride's gps data
+        void search(RideItem *, RideFile*, const RouteTrack &, QList<IntervalItem*>&);
 
     private:
 
@@ -82,6 +85,42 @@ struct RoutePoint // represents a point within a segment
     double lon, lat;
 };
 
+// A ride's GPS track prepared once for matching every route against it.
+// The trig for each sample is done up front and the samples are put in
+// a grid, so a route with a point nowhere near the track is ruled out
+// without scanning the ride.
+class RouteTrack
+{
+    public:
+
+        RouteTrack(RideFile *ride);
+
+        // samples with a usable position, valid() also rules out 540
+        bool usable(int i) const { return flags[i] != 0; }
+        bool valid(int i) const { return flags[i] == 2; }
+
+        // distance in km from a point prepared with prepare() to sample i
+        // same as RouteSegment::distance(lat, lon, sample lat, sample lon)
+        struct Point { double lat, lon, sinlat, coslat; };
+        static Point prepare(double lat, double lon);
+        double distance(const Point &p, int i) const;
+
+        // cheap to compute and never more than distance()
+        double nearest(const Point &p, int i) const;
+
+        // is any usable sample within km of the point ?
+        bool near(const Point &p, double km) const;
+
+    private:
+
+        QVector<double> lat, lon, sinlat, coslat;
+        QVector<char> flags;
+
+        // samples by grid cell
+        QHash<qint64, QVector<int> > cells;
+        static qint64 cell(int latcell, int loncell) { return (qint64(latcell) << 32) | quint32(loncell); }
+};
+
 
 class Routes : public QObject { // top-level object with API and map of segments/rides
 
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SearchIndex.h"
+#include "Context.h"
+#include "Athlete.h"
+#include "RideCache.h"
+#include "RideItem.h"
+#include "IntervalItem.h"
+
+#include <QFile>
+#include <QDataStream>
+#include <QSet>
+
+#include <algorithm>
+
+// lower case words, split on anything that isn't a letter or a number
+static QStringList splitWords(const QString &text)
+{
+    QStringList returning;
+    QString lower = text.toLower();
+
+    int start = -1;
+    for (int i=0; i<lower.length(); i++) {
+        if (lower[i].isLetterOrNumber()) {
+            if (start < 0) start = i;
+        } else if (start >= 0) {
+            returning << lower.mid(start, i-start);
+            start = -1;
+        }
+    }
+    if (start >= 0) returning << lower.mid(start);
+
+    return returning;
+}
+
+static quint64 trigram(const QString &word, int i)
+{
+    return (quint64(word[i].unicode()) << 32) | (quint64(word[i+1].unicode()) << 16) | quint64(word[i+2].unicode());
+}
+
+// sorted id lists
+static QVector<int> intersect(const QVector<int> &a, const QVector<int> &b)
+{
+    QVector<int> returning(qMin(a.count(), b.count()));
+    int n = std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), returning.begin()) - returning.begin();
+    returning.resize(n);
+    return returning;
+}
+
+static QVector<int> unite(const QVector<int> &a, const QVector<int> &b)
+{
+    QVector<int> returning(a.count() + b.count());
+    int n = std::set_union(a.begin(), a.end(), b.begin(), b.end(), returning.begin()) - returning.begin();
+    returning.resize(n);
+    return returning;
+}
+
+SearchIndex::SearchIndex(Context *context, RideCache *cache) :
+    context(context), cache(cache), loaded(false), synced(false), dirty(false)
+{
+    // rides that change get reindexed there and then, anything
+    // else is picked up when we next search
+    connect(cache, SIGNAL(itemChanged(RideItem*)), this, SLOT(update(RideItem*)));
+    connect(context, SIGNAL(intervalsChanged()), this, SLOT(intervalsChanged()));
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(refreshEnd()), this, SLOT(invalidate()));
+}
+
+SearchIndex::~SearchIndex()
+{
+    save();
+}
+
+QStringList
+SearchIndex::searchSplit(QString string, QList<bool> *quoted)
+{
+    const QString whitespace(" \n\r\t");
+    QStringList returning;
+    bool inQuotes = false;
+
+    QString current;
+    for (int i=0; i<string.length(); i++) {
+
+        // got a bit of whitespace after a word so split and add
+        if (current != "" && !inQuotes && whitespace.contains(string[i])) {
+            returning << current;
+            if (quoted) quoted->append(false);
+            current = "";
+            continue;
+        }
+
+        // quote delimeted
+        if (string[i] == '\"') {
+            if (inQuotes) {
+                returning << current;
+                if (quoted) quoted->append(true);
+                current = "";
+                inQuotes = false;
+            } else {
+                inQuotes = true;
+            }
+            continue;
+        }
+
+        // escaped
+        if (string[i] == '\\' && i < (string.length()-1)) {
+            i++;
+            current += string[i];
+            continue;
+        }
+
+        // just append current character
+        current += string[i];
+    }
+
+    if (current != "") {
+        returning << current;
+        if (quoted) quoted->append(inQuotes);
+    }
+
+    return returning;
+}
+
+QStringList
+SearchIndex::search(QString query)
+{
+    if (!loaded) load();
+    if (!synced) sync();
+
+    QList<bool> quoted;
+    QStringList tokens = searchSplit(query, &quoted);
+
+    // terms are OR'd together unless joined by AND, which binds tighter
+    // so "a b AND c" is a OR (b AND c), OR is accepted but is the default
+    QVector<int> matched, group;
+    bool inGroup = false, joined = false;
+
+    for (int i=0; i<tokens.count(); i++) {
+
+        if (!quoted[i] && tokens[i] == "AND") { joined = true; continue; }
+        if (!quoted[i] && tokens[i] == "OR") { joined = false; continue; }
+
+        bool prefix = !quoted[i] && tokens[i].length() > 1 && tokens[i].endsWith("*");
+        QString term = prefix ? tokens[i].left(tokens[i].length()-1) : tokens[i];
+
+        QVector<int> hits = matchTerm(term, prefix);
+
+        if (joined && inGroup) {
+            group = intersect(group, hits);
+        } else {
+            if (inGroup) matched = unite(matched, group);
+            group = hits;
+            inGroup = true;
+        }
+        joined = false;
+    }
+    if (inGroup) matched = unite(matched, group);
+
+    QStringList returning;
+    foreach(int doc, matched) returning << docs[doc].fileName;
+
+    // filenames are date/time so this is ride order
+    returning.sort();
+    return returning;
+}
+
+QVector<int>
+SearchIndex::matchTerm(const QString &term, bool prefix) const
+{
+    QStringList parts = splitWords(term);
+
+    // a single word, the vocabulary gives an exact answer
+    if (parts.count() == 1 && parts[0] == term.toLower()) return matchWord(parts[0], prefix);
+
+    // otherwise the rides must have every word, but we need
+    // to check the text to see if the whole term is there
+    QVector<int> candidates;
+    if (parts.count() == 0) {
+        for (int i=0; i<docs.count(); i++) if (docs[i].indexed) candidates << i;
+    } else {
+        for (int i=0; i<parts.count(); i++) {
+            QVector<int> hits = matchWord(parts[i], prefix && i == parts.count()-1);
+            candidates = i ? intersect(candidates, hits) : hits;
+            if (candidates.isEmpty()) break;
+        }
+    }
+
+    QVector<int> returning;
+    foreach(int doc, candidates) {
+        foreach(const QString &text, docs[doc].texts) {
+            if (text.contains(term, Qt::CaseInsensitive)) {
+                returning << doc;
+                break;
+            }
+        }
+    }
+    return returning;
+}
+
+QVector<int>
+SearchIndex::matchWord(const QString &part, bool prefix) const
+{
+    // which words match
+    QVector<int> ids;
+    if (prefix) {
+
+        // vocabulary is sorted
+        QMap<QString,int>::const_iterator it = vocabulary.lowerBound(part);
+        while (it != vocabulary.constEnd() && it.key().startsWith(part)) {
+            ids << it.value();
+            ++it;
+        }
+
+    } else if (part.length() >= 3) {
+
+        // words with all the trigrams, then check they're in order
+        QVector<int> candidates;
+        for (int i=0; i+2<part.length(); i++) {
+            QHash<quint64, QVector<int> >::const_iterator it = trigrams.constFind(trigram(part, i));
+            if (it == trigrams.constEnd()) return QVector<int>();
+            candidates = i ? intersect(candidates, it.value()) : it.value();
+            if (candidates.isEmpty()) return candidates;
+        }
+        foreach(int w, candidates) if (part.length() == 3 || words[w].contains(part)) ids << w;
+
+    } else {
+
+        // too short for trigrams, but the vocabulary is small
+        for (int w=0; w<words.count(); w++) if (words[w].contains(part)) ids << w;
+    }
+
+    // and the rides they appear in
+    QVector<int> returning;
+    foreach(int w, ids) returning += postings[w];
+    std::sort(returning.begin(), returning.end());
+    returning.resize(std::unique(returning.begin(), returning.end()) - returning.begin());
+    return returning;
+}
+
+int
+SearchIndex::wordId(const QString &word)
+{
+    QMap<QString,int>::const_iterator it = vocabulary.constFind(word);
+    if (it != vocabulary.constEnd()) return it.value();
+
+    // new word, ids only increase so the trigram lists stay sorted
+    int id = words.count();
+    words << word;
+    postings << QVector<int>();
+    vocabulary.insert(word, id);
+    for (int i=0; i+2<word.length(); i++) trigrams[trigram(word, i)] << id;
+
+    return id;
+}
+
+void
+SearchIndex::index(int doc, RideItem *item, bool pageIn)
+{
+    Document &d = docs[doc];
+
+    d.timestamp = item->timestamp;
+    d.metacrc = item->metacrc;
+
+    // the interval names we saved are good unless the ride changed
+    if (pageIn) {
+        d.intervals.clear();
+        foreach(IntervalItem *interval, item->intervals()) d.intervals << interval->name;
+        dirty = true;
+    }
+    d.texts = QStringList(item->metadata().values()) + d.intervals;
+
+    QSet<int> ids;
+    foreach(const QString &text, d.texts)
+        foreach(const QString &word, splitWords(text))
+            ids.insert(wordId(word));
+
+    d.words.clear();
+    foreach(int id, ids) {
+        QVector<int> &posting = postings[id];
+        posting.insert(std::lower_bound(posting.begin(), posting.end(), doc), doc);
+        d.words << id;
+    }
+    d.indexed = true;
+}
+
+void
+SearchIndex::unindex(int doc)
+{
+    Document &d = docs[doc];
+
+    foreach(int id, d.words) {
+        QVector<int> &posting = postings[id];
+        QVector<int>::iterator it = std::lower_bound(posting.begin(), posting.end(), doc);
+        if (it != posting.end() && *it == doc) posting.erase(it);
+    }
+    d.words.clear();
+    d.texts.clear();
+    d.indexed = false;
+}
+
+void
+SearchIndex::remove(int doc)
+{
+    if (docs[doc].indexed) unindex(doc);
+
+    docIds.remove(docs[doc].fileName);
+    docs[doc] = Document();
+    freeDocs << doc;
+    dirty = true;
+}
+
+void
+SearchIndex::update(RideItem *item)
+{
+    // nothing to keep up to date until we're used
+    if (!loaded || item == NULL) return;
+
+    int doc = docIds.value(item->fileName, -1);
+    if (doc < 0) {
+
+        // new ride
+        Document d;
+        d.fileName = item->fileName;
+        if (freeDocs.count()) {
+            doc = freeDocs.takeLast();
+            docs[doc] = d;
+        } else {
+            doc = docs.count();
+            docs << d;
+        }
+        docIds.insert(item->fileName, doc);
+
+    } else if (docs[doc].indexed) unindex(doc);
+
+    index(doc, item, true);
+}
+
+void
+SearchIndex::intervalsChanged()
+{
+    // only the current ride's intervals get edited
+    update(context->ride);
+}
+
+void
+SearchIndex::sync()
+{
+    QSet<QString> present;
+
+    foreach(RideItem *item, cache->rides()) {
+
+        present.insert(item->fileName);
+
+        int doc = docIds.value(item->fileName, -1);
+        if (doc < 0) {
+            update(item);
+            continue;
+        }
+
+        // up to date ?
+        bool same = docs[doc].timestamp == item->timestamp && docs[doc].metacrc == item->metacrc;
+        if (same && docs[doc].indexed) continue;
+
+        // loaded from disk and unchanged, no need to read the intervals
+        if (docs[doc].indexed) unindex(doc);
+        index(doc, item, !same);
+    }
+
+    // rides that have gone
+    for (int i=0; i<docs.count(); i++)
+        if (docs[i].fileName != "" && !present.contains(docs[i].fileName))
+            remove(i);
+
+    synced = true;
+}
+
+void
+SearchIndex::load()
+{
+    loaded = true;
+
+    QFile file(context->athlete->home->cache().canonicalPath() + "/searchindex.bin");
+    if (!file.open(QFile::ReadOnly)) return;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    quint32 version;
+    qint32 count;
+    in >> version >> count;
+    if (version != SearchIndexVersion || count < 0) return;
+
+    for (int i=0; i<count && in.status() == QDataStream::Ok; i++) {
+
+        Document d;
+        quint64 timestamp, metacrc;
+        in >> d.fileName >> timestamp >> metacrc >> d.intervals;
+        d.timestamp = timestamp;
+        d.metacrc = metacrc;
+
+        if (in.status() != QDataStream::Ok || docIds.contains(d.fileName)) continue;
+
+        docIds.insert(d.fileName, docs.count());
+        docs << d;
+    }
+
+    // truncated or corrupt, just rebuild
+    if (in.status() != QDataStream::Ok) {
+        qDebug()<<"search index is corrupt, rebuilding.";
+        docs.clear();
+        docIds.clear();
+    }
+}
+
+void
+SearchIndex::save()
+{
+    if (!loaded || !dirty) return;
+
+    QFile file(context->athlete->home->cache().canonicalPath() + "/searchindex.bin");
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qDebug()<<"unable to save search index"<<file.fileName();
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_6);
+
+    out << quint32(SearchIndexVersion) << qint32(docIds.count());
+    foreach(const Document &d, docs) {
+        if (d.fileName == "") continue;
+        out << d.fileName << quint64(d.timestamp) << quint64(d.metacrc) << d.intervals;
+    }
+    file.close();
+
+    dirty = false;
+}
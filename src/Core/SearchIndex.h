@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_SearchIndex_h
+#define _GC_SearchIndex_h 1
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+
+class Context;
+class RideCache;
+class RideItem;
+
+// SearchIndex is an inverted index over the metadata values and interval
+// names of every ride, it is what FreeSearch uses to answer a query
+// without walking the ride cache (and paging in the intervals of every
+// ride to do so).
+//
+// Text is split into lower case words and each word has a list of the
+// rides it appears in. Since a search term matches anywhere in a value
+// the words themselves are indexed by trigram, so a term is matched
+// against the (small) vocabulary first and then the postings for the
+// words that contain it are merged.
+//
+// The interval names are saved to cache/searchindex.bin along with the
+// timestamp and metacrc of the ride they came from, so at startup the
+// index can be rebuilt for any ride that hasn't changed without reading
+// its intervals. Rides are reindexed as they change.
+//
+static const unsigned int SearchIndexVersion = 1;
+// revision history:
+// version  date         description
+// 1        24-Mar-18    Initial - interval names by ride
+
+class SearchIndex : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        SearchIndex(Context *context, RideCache *cache);
+        ~SearchIndex();
+
+        // filenames of the rides matching the query, terms are OR'd unless
+        // joined with AND, "quoted phrases" are matched as-is and a term
+        // ending in * only matches words that start with it
+        QStringList search(QString query);
+
+        // tokenise, handling quoting and escaping
+        static QStringList searchSplit(QString string, QList<bool> *quoted=NULL);
+
+        // write the interval names to disk
+        void save();
+
+    public slots:
+
+        // a ride changed, reindex it
+        void update(RideItem *item);
+
+        // rides added, deleted or refreshed, check
+        // them all the next time we search
+        void invalidate() { synced = false; }
+
+        // the current ride's intervals were edited
+        void intervalsChanged();
+
+    private:
+
+        struct Document {
+
+            Document() : timestamp(0), metacrc(0), indexed(false) {}
+
+            QString fileName;
+            unsigned long timestamp, metacrc;
+            bool indexed;
+
+            QStringList intervals;  // interval names, saved to disk
+            QStringList texts;      // metadata values and interval names
+            QVector<int> words;     // word ids appearing in the texts
+        };
+
+        // bring the index in line with the ride cache
+        void load();
+        void sync();
+
+        // (un)index a document
+        void index(int doc, RideItem *item, bool pageIn);
+        void unindex(int doc);
+        void remove(int doc);
+        int wordId(const QString &word);
+
+        // sorted document ids matching a single word
+        // or any text, verifying against the texts
+        QVector<int> matchWord(const QString &part, bool prefix) const;
+        QVector<int> matchTerm(const QString &term, bool prefix) const;
+
+        Context *context;
+        RideCache *cache;
+        bool loaded, synced, dirty;
+
+        QVector<Document> docs;
+        QHash<QString, int> docIds;
+        QVector<int> freeDocs;
+
+        // vocabulary is ordered for prefix queries
+        QMap<QString, int> vocabulary;
+        QVector<QString> words;
+        QVector<QVector<int> > postings;    // sorted doc ids by word id
+        QHash<quint64, QVector<int> > trigrams; // sorted word ids by trigram
+};
+#endif // _GC_SearchIndex_h
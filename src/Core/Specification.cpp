@@ -21,9 +21,9 @@
 #include "IntervalItem.h"
 #include "RideFile.h"
 
-Specification::Specification(DateRange dr, FilterSet fs) : dr(dr), fs(fs), it(NULL), recintsecs(0), ri(NULL) {}
-Specification::Specification(IntervalItem *it, double recintsecs) : it(it), recintsecs(recintsecs), ri(NULL) {}
-Specification::Specification() : it(NULL), recintsecs(0), ri(NULL) {}
+Specification::Specification(DateRange dr, FilterSet fs) : dr(dr), fs(fs), it(NULL), recintsecs(0), ri(NULL), kr(NULL) {}
+Specification::Specification(IntervalItem *it, double recintsecs) : it(it), recintsecs(recintsecs), ri(NULL), kr(NULL) {}
+Specification::Specification() : it(NULL), recintsecs(0), ri(NULL), kr(NULL) {}
 
 // does the rideitem pass the specification ?
 bool 
@@ -34,6 +34,7 @@
 class RideItem;
 class RideFile;
 class IntervalItem;
+class RideKernel;
 struct RideFilePoint;
 
 class FilterSet
@@ -71,6 +72,9 @@ class FilterSet
         }
 
         int count() { return filters_.count(); }
+
+        // the filters themselves
+        const QVector<QStringList> &filters() const { return filters_; }
 };
 
 class RideFileIterator;
@@ -94,6 +98,11 @@ class Specification
         // non-null if exists
         IntervalItem *interval() { return it; }
 
+        // series shared by the metrics in a computeMetrics pass
+        // non-null when computing metrics, see RideKernel
+        RideKernel *kernel() { return kr; }
+        void setKernel(RideKernel *kr) { this->kr = kr; }
+
         // set criteria
         void setDateRange(DateRange dr);
         void setFilterSet(FilterSet fs);
@@ -122,5 +131,6 @@ class Specification
         IntervalItem *it;
         double recintsecs;
         RideItem *ri;
+        RideKernel *kr;
 };
 #endif
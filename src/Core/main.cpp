@@ -25,11 +25,23 @@
 #include "Colors.h"
 #include "GcUpgrade.h"
 #include "IdleTimer.h"
+#include "WPrime.h"
+#include "RideItem.h"
+#include "RideMetric.h"
+#include "IntervalItem.h"
+#include "Specification.h"
+#include "DataFilter.h"
+#include "RideFileCache.h"
+#include "ErgFile.h"
+#include "NullController.h"
+#include "TrainControl.h"
 
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QtGui>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QThread>
 #ifndef NOWEBKIT
 #include <QWebSettings>
 #endif
@@ -159,6 +171,610 @@ void nostderr(QString dir)
 }
 #endif
 
+//
+// --benchmark and the checks on the ride files passed, compressed rides
+// are unpacked into the athlete's tmp folder and there is no athlete
+// here, so they are left out, as are any arguments meant for Qt
+//
+static QStringList rideFileArgs(QStringList args)
+{
+    QStringList files;
+    foreach(QString name, args.mid(1))
+        if (QFileInfo(name).isFile() && !name.endsWith(".gz", Qt::CaseInsensitive)
+            && !name.endsWith(".zip", Qt::CaseInsensitive))
+            files << name;
+    return files;
+}
+
+// a scratch athlete for the benchmarks that need a context, set up
+// the way NewCyclistDialog does so there is nothing to upgrade
+static Context *benchmarkContext()
+{
+    QDir home(QDir::tempPath());
+    QString name = "GoldenCheetah-benchmark";
+    if (!home.exists(name)) {
+        home.mkdir(name);
+        AthleteDirectoryStructure(QDir(home.canonicalPath() + "/" + name)).createAllSubdirs();
+        appsettings->initializeQSettingsNewAthlete(home.canonicalPath(), name);
+        appsettings->setCValue(name, GC_UPGRADE_FOLDER_SUCCESS, true);
+        appsettings->setCValue(name, GC_VERSION_USED, QVariant(VERSION_LATEST));
+    } else {
+        appsettings->initializeQSettingsAthlete(home.canonicalPath(), name);
+    }
+
+    Context *context = new Context(NULL);
+    context->athlete = new Athlete(context, QDir(home.canonicalPath() + "/" + name));
+    return context;
+}
+
+// the rides passed, open and with their metrics computed
+static QList<RideItem*> benchmarkItems(Context *context, QStringList files)
+{
+    QList<RideItem*> items;
+    foreach(QString name, files) {
+        QFile file(name);
+        QStringList errors;
+        RideFile *ride = RideFileFactory::instance().openRideFile(context, file, errors);
+        if (!ride) continue;
+
+        QDateTime dateTime = ride->startTime();
+        RideItem *item = new RideItem(ride, dateTime, context);
+        item->fileName = QFileInfo(name).fileName();
+        item->refresh();
+        items << item;
+    }
+    return items;
+}
+
+// a search filter over 5000 rides and a user metric's sample { } over
+// every sample, compiled (see DataFilterProgram) and walking the tree
+static void benchmarkDataFilter(Context *context, QList<RideItem*> items)
+{
+    if (items.isEmpty()) return;
+
+    // as many rides as a big athlete, metrics only
+    QList<RideItem*> rides;
+    for (int i=0; i<5000; i++) {
+        RideItem *copy = new RideItem();
+        copy->setFrom(*items[i % items.count()], true);
+        rides << copy;
+    }
+
+    const int passes = 10;
+    QElapsedTimer timer;
+
+    DataFilter filter(NULL, context, "Average_Power > 150 && Duration > 1800 && isRun == 0");
+    Leaf *root = filter.root();
+    if (root) {
+        int compiled = 0, tree = 0;
+
+        timer.start();
+        for (int pass=0; pass<passes; pass++)
+            foreach(RideItem *item, rides) if (filter.rt.evaluate(root, 0, item).number) compiled++;
+        double vm = timer.nsecsElapsed() / 1000000.0 / passes;
+
+        timer.start();
+        for (int pass=0; pass<passes; pass++)
+            foreach(RideItem *item, rides) if (root->eval(&filter.rt, root, 0, item).number) tree++;
+        double walk = timer.nsecsElapsed() / 1000000.0 / passes;
+
+        fprintf(stderr, "filter over %d rides: compiled %.2fms, tree %.2fms, %d and %d matched\n",
+                rides.count(), vm, walk, compiled / passes, tree / passes);
+    }
+
+    foreach(RideItem *copy, rides) {
+        copy->clearIntervals(); // shared with the originals
+        delete copy;
+    }
+
+    // the example from CustomMetricsPage::addClicked
+    DataFilter metric(NULL, context, "{\n"
+                      "    init { joules <- 0; seconds <- 0; }\n"
+                      "    sample { joules <- joules + (POWER * RECINTSECS); seconds <- seconds + RECINTSECS; }\n"
+                      "    value { joules / seconds; }\n"
+                      "}");
+    Leaf *init = metric.rt.functions.value("init", NULL);
+    Leaf *sample = metric.rt.functions.value("sample", NULL);
+    if (init && sample) {
+        const DataFilterBatch &batch = metric.rt.batch(sample);
+        double vm = 0, walk = 0, compiled = 0, tree = 0;
+        qint64 samples = 0;
+
+        foreach(RideItem *item, items) {
+            RideFile *ride = item->ride(false);
+            if (!ride || ride->dataPoints().isEmpty()) continue;
+            samples += ride->dataPoints().count() * passes;
+
+            timer.start();
+            for (int pass=0; pass<passes; pass++) {
+                metric.rt.evaluate(init, 0, item);
+                if (batch.isValid()) batch.run(&metric.rt, 0, item, 0, ride->dataPoints().count()-1);
+                else foreach(RideFilePoint *p, ride->dataPoints()) metric.rt.evaluate(sample, 0, item, p);
+            }
+            vm += timer.nsecsElapsed() / 1000000.0;
+            compiled += metric.rt.symbols.value("joules").number;
+
+            timer.start();
+            for (int pass=0; pass<passes; pass++) {
+                init->eval(&metric.rt, init, 0, item);
+                foreach(RideFilePoint *p, ride->dataPoints()) sample->eval(&metric.rt, sample, 0, item, p);
+            }
+            walk += timer.nsecsElapsed() / 1000000.0;
+            tree += metric.rt.symbols.value("joules").number;
+        }
+
+        if (samples) fprintf(stderr, "user metric over %lld samples: %s %.1f Msamples/s, tree %.1f Msamples/s, joules %.0f and %.0f\n",
+                             samples, batch.isValid() ? "columns" : "compiled", samples / vm / 1000.0, samples / walk / 1000.0,
+                             compiled, tree);
+    }
+}
+
+// computeMetrics for each ride as a whole, parallel for long rides, and
+// for 50 intervals across it, which are always computed serially
+static void benchmarkMetrics(QList<RideItem*> items)
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    const int passes = 3, count = 50;
+    QElapsedTimer timer;
+
+    foreach(RideItem *item, items) {
+        RideFile *ride = item->ride(false);
+        if (!ride || ride->dataPoints().count() < count) continue;
+
+        timer.start();
+        for (int pass=0; pass<passes; pass++)
+            RideMetric::computeMetrics(item, Specification(), factory.allMetrics());
+        double whole = timer.nsecsElapsed() / 1000000.0 / passes;
+
+        // equal parts of the ride, end to end
+        QList<IntervalItem*> intervals;
+        const QVector<RideFilePoint*> &points = ride->dataPoints();
+        for (int i=0; i<count; i++) {
+            RideFilePoint *from = points[i * points.count() / count];
+            RideFilePoint *to = points[(i+1) * points.count() / count - 1];
+            intervals << new IntervalItem(item, QString("Benchmark %1").arg(i+1), from->secs, to->secs,
+                                          from->km, to->km, i, Qt::black, RideFileInterval::USER);
+        }
+
+        timer.start();
+        for (int pass=0; pass<passes; pass++)
+            foreach(IntervalItem *interval, intervals)
+                RideMetric::computeMetrics(item, Specification(interval, ride->recIntSecs()), factory.allMetrics());
+        double parts = timer.nsecsElapsed() / 1000000.0 / passes;
+        qDeleteAll(intervals);
+
+        fprintf(stderr, "metrics for %s, %d samples: ride %.1fms, %d intervals %.1fms\n",
+                item->fileName.toLocal8Bit().constData(), points.count(), whole, count, parts);
+    }
+}
+
+// time the file readers, reading them all over and over for a few
+// seconds to get a stable figure, then the benchmarks over the rides
+static int benchmarkRides(QStringList files)
+{
+    qint64 bytes = 0, points = 0;
+    int rides = 0, failed = 0, passes = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        foreach(QString name, files) {
+            QFile file(name);
+            QStringList errors;
+            RideFile *ride = RideFileFactory::instance().openRideFile(NULL, file, errors);
+            if (ride) {
+                points += ride->dataPoints().count();
+                rides++;
+                delete ride;
+            } else failed++;
+            bytes += file.size();
+        }
+        passes++;
+    } while (files.count() && timer.elapsed() < 5000);
+
+    double secs = timer.elapsed() / 1000.0;
+    if (secs <= 0) secs = 0.001;
+    fprintf(stderr, "%d files x %d passes in %.1fs: %.1f rides/s, %.1f MB/s, %.0f samples/s, %d failed\n",
+            files.count(), passes, secs, rides / secs, bytes / 1048576.0 / secs, points / secs, failed / passes);
+
+    Context *context = benchmarkContext();
+    QList<RideItem*> items = benchmarkItems(context, files);
+    benchmarkDataFilter(context, items);
+    benchmarkMetrics(items);
+
+    return failed ? 1 : 0;
+}
+
+// compare WPrimeIntegrator with the exp(u/TAU) sum it replaced, for
+// integrate(), push() at 1s and at the ride's own sample times (as
+// train mode does) and the end W'bal from wbal()
+static int checkWbal(QStringList files)
+{
+    static const int count = 3;
+    const double CP[count] = { 200, 250, 300 };
+    const double W[count] = { 15000, 20000, 25000 };
+    const double TAU[count] = { 300, 450, 600 };
+    const double tolerance = 0.001; // joules
+
+    int checked = 0, failed = 0;
+    foreach(QString name, files) {
+        QFile file(name);
+        QStringList errors;
+        RideFile *ride = RideFileFactory::instance().openRideFile(NULL, file, errors);
+        if (!ride) continue;
+        if (!ride->areDataPresent()->watts || ride->dataPoints().isEmpty()) {
+            delete ride;
+            continue;
+        }
+
+        // 1s samples, gaps are zero
+        int last = ride->dataPoints().last()->secs;
+        QVector<int> watts(last+1, 0);
+        foreach(RideFilePoint *p, ride->dataPoints())
+            if (p->secs >= 0 && p->secs <= last) watts[int(p->secs)] = p->watts;
+
+        double worst = 0, expected[count], wbal[count];
+        for (int i=0; i<count; i++) {
+
+            QVector<int> above(watts.count());
+            for (int t=0; t<watts.count(); t++) above[t] = watts[t] > CP[i] ? watts[t] - CP[i] : 0;
+
+            QVector<double> output;
+            WPrimeIntegrator::integrate(above, above.count()-1, TAU[i], output);
+            WPrimeIntegrator fixed(TAU[i]), irregular(TAU[i]);
+
+            double I = 0, old = 0;
+            for (int t=0; t<above.count(); t++) {
+                I += exp(((double)(t) / TAU[i])) * above[t];
+                old = exp(-((double)(t) / TAU[i])) * I;
+                worst = qMax(worst, fabs(output[t] - old));
+                worst = qMax(worst, fabs(fixed.push(above[t]) - old));
+            }
+            expected[i] = W[i] - old;
+
+            I = 0;
+            foreach(RideFilePoint *p, ride->dataPoints()) {
+                double joules = p->watts > CP[i] ? p->watts - CP[i] : 0;
+                I += joules * exp(p->secs / TAU[i]);
+                worst = qMax(worst, fabs(irregular.push(joules, p->secs) - I * exp(-p->secs / TAU[i])));
+            }
+        }
+
+        WPrimeIntegrator::wbal(watts.constData(), watts.count(), count, CP, W, TAU, wbal);
+        for (int i=0; i<count; i++) worst = qMax(worst, fabs(wbal[i] - expected[i]));
+
+        bool ok = worst <= tolerance;
+        fprintf(stderr, "%s %s: %d secs, max difference %g J\n", ok ? "ok  " : "FAIL",
+                QFileInfo(name).fileName().toLocal8Bit().constData(), last, worst);
+        if (!ok) failed++;
+        checked++;
+        delete ride;
+    }
+
+    fprintf(stderr, "%d rides with power checked, %d failed\n", checked, failed);
+    return (failed || !checked) ? 1 : 0;
+}
+
+// the mean max as it was computed before MeanMaxComputer shared the
+// resampled series and searched prefix sums: each series resampled on
+// its own thread and searched with partial_max_mean/divided_max_mean
+class ReferenceMeanMax : public QThread
+{
+    public:
+        ReferenceMeanMax(RideFile *ride, RideFile::SeriesType series) : ride(ride), series(series) {}
+        void run();
+
+        QVector<float> array;
+
+    private:
+        RideFile *ride;
+        RideFile::SeriesType series;
+};
+
+static double referencePartialMaxMean(const double *integrated, int start, int end, int length)
+{
+    double candidate=0;
+    for (int i=start; i<(1+end-length); i++) {
+        double energy=integrated[length+i]-integrated[i];
+        if (energy>candidate) candidate=energy;
+    }
+    return candidate;
+}
+
+static double referenceDividedMaxMean(const double *integrated, int datalength, int length)
+{
+    int shift = length > 180 ? 180 : length;
+    int window_length = qMin(length+shift, datalength);
+
+    int start=0, end=0;
+    double candidate=0;
+    for (start=0; start+window_length<=datalength; start+=shift) {
+        end=start+window_length;
+        if (integrated[end]-integrated[start] < candidate) continue;
+        candidate = qMax(candidate, referencePartialMaxMean(integrated, start, end, length));
+    }
+    if (end<datalength) {
+        start=datalength-window_length;
+        end=datalength;
+        if (integrated[end]-integrated[start] >= candidate)
+            candidate = qMax(candidate, referencePartialMaxMean(integrated, start, end, length));
+    }
+    return candidate;
+}
+
+void
+ReferenceMeanMax::run()
+{
+    RideFile::SeriesType baseSeries = (series == RideFile::xPower || series == RideFile::NP || series == RideFile::wattsKg) ?
+                                      RideFile::watts : series;
+    if (series == RideFile::aPowerKg) baseSeries = RideFile::aPower;
+    else if (series == RideFile::vam) baseSeries = RideFile::alt;
+
+    RideFile::SeriesType needSeries = baseSeries;
+    if (series == RideFile::kphd) needSeries = RideFile::kph;
+    if (series == RideFile::wattsd) needSeries = RideFile::watts;
+    if (series == RideFile::cadd) needSeries = RideFile::cad;
+    if (series == RideFile::nmd) needSeries = RideFile::nm;
+    if (series == RideFile::hrd) needSeries = RideFile::hr;
+    if (ride->isDataPresent(needSeries) == false) return;
+
+    double decimals = pow(10, RideFileCache::decimalsFor(series));
+    double recIntSecs = ride->recIntSecs();
+
+    // resample with gaps filled, straight from the points
+    QVector<double> secs, values;
+    double lastsecs = 0;
+    double offset = ride->dataPoints().count() ? ride->dataPoints().first()->secs : 0;
+    foreach(RideFilePoint *p, ride->dataPoints()) {
+        double psecs = p->secs - offset + recIntSecs;
+        int count = (psecs - lastsecs - recIntSecs) / recIntSecs;
+        if (count > 3600) count = 1;
+        for(int i=0; i<count; i++) {
+            secs << round(lastsecs+((i+1)*recIntSecs *1000.0)/1000);
+            values << 0;
+        }
+        lastsecs = psecs;
+
+        double s = round(psecs * 1000.0) / 1000;
+        if (s > 0) {
+            secs << s;
+            values << (int) round(p->value(baseSeries)*decimals);
+        }
+    }
+    if (!values.count()) return;
+
+    int total_secs = (int) ceil(secs.last());
+    if (total_secs > 2*24*60*60 || total_secs < 0) return;
+
+    if (series == RideFile::vam) {
+        double lastAlt=0;
+        for (int i=0; i<values.count(); i++) {
+            if (!lastAlt || (values[i] - lastAlt) > 5) lastAlt=values[i];
+            double vam = (((values[i] - lastAlt) * 360)/recIntSecs) * 10;
+            lastAlt = values[i];
+            values[i] = vam < 0 ? 0 : vam;
+        }
+    }
+    if (series == RideFile::NP) {
+        int rollingwindowsize = 30 / recIntSecs;
+        if (rollingwindowsize > 1) {
+            QVector<double> rolling(rollingwindowsize);
+            int index = 0;
+            double sum = 0;
+            for (int i=0; i<values.count(); i++) {
+                sum += values[i];
+                sum -= rolling[index];
+                rolling[index] = values[i];
+                values[i] = pow(sum/(double)rollingwindowsize,4.0f);
+                index = (index >= rollingwindowsize-1) ? 0 : index+1;
+            }
+        }
+    }
+    if (series == RideFile::xPower) {
+        const double exp = recIntSecs / ((25.0f / recIntSecs) + recIntSecs);
+        const double rem = 1.0f - exp;
+        double ewma = 0.0;
+        if (int(25 / recIntSecs) > 1) {
+            for (int i=0; i<values.count(); i++) {
+                ewma = (values[i] * exp) + (ewma * rem);
+                values[i] = pow(ewma, 4.0f);
+            }
+        }
+    }
+    if (series == RideFile::wattsKg || series == RideFile::aPowerKg)
+        for (int i=0; i<values.count(); i++) values[i] = values[i] / ride->getWeight();
+
+    QVector<double> integrated(values.count()+1);
+    for (int i=0; i<values.count(); i++) integrated[i+1] = integrated[i] + values[i];
+
+    QVector<double> ride_bests(total_secs + 1);
+    for (int i=1; i<values.count();) {
+        double val = referenceDividedMaxMean(integrated.constData(), values.count(), i) / double(i);
+        int sec = i*recIntSecs;
+        if (sec < ride_bests.size())
+            ride_bests[sec] = (series == RideFile::NP || series == RideFile::xPower) ? pow(val, 0.25f) : val;
+
+        if (i<120) i++;
+        else if (i<600) i+= 2;
+        else if (i<1200) i += 5;
+        else if (i<3600) i += 20;
+        else if (i<7200) i += 120;
+        else i += 300;
+    }
+
+    while (ride_bests.size() && ride_bests[ride_bests.size()-1] == 0)
+        ride_bests.resize(ride_bests.size()-1);
+
+    if ((series == RideFile::kphd  || series == RideFile::wattsd || series == RideFile::cadd ||
+        series == RideFile::nmd  || series == RideFile::hrd) && ride_bests.count() > 180)
+        ride_bests.resize(180);
+    array.resize(ride_bests.count());
+
+    double last = 0;
+    for (int i=ride_bests.size()-1; i>0; i--) {
+        if (ride_bests[i] == 0) ride_bests[i]=last;
+        else last = ride_bests[i];
+        array[i] = ride_bests[i];
+    }
+}
+
+// the ride repeated end to end until it is at least 8 hours long,
+// since the search cost grows with the length of the ride
+static RideFile *longRide(RideFile *ride)
+{
+    RideFile *repeated = new RideFile(ride);
+    if (ride->dataPoints().isEmpty()) return repeated;
+
+    double secs = 0, km = 0;
+    const double length = ride->dataPoints().last()->secs + ride->recIntSecs();
+    while (secs < 8 * 3600) {
+        foreach(RideFilePoint *p, ride->dataPoints()) {
+            RideFilePoint point = *p;
+            point.secs += secs;
+            point.km += km;
+            repeated->appendPoint(point);
+        }
+        secs += length;
+        km += ride->dataPoints().last()->km;
+    }
+    repeated->recalculateDerivedSeries();
+    return repeated;
+}
+
+// compare MeanMaxComputer with the thread per series computer it
+// replaced for all 16 series, on each ride and an 8h+ repeat of it,
+// and time both
+static int checkMeanMax(QStringList files)
+{
+    static const int count = 16;
+    const RideFile::SeriesType series[count] = {
+        RideFile::watts, RideFile::hr, RideFile::cad, RideFile::nm, RideFile::kph,
+        RideFile::xPower, RideFile::NP, RideFile::vam, RideFile::wattsKg, RideFile::aPower,
+        RideFile::kphd, RideFile::wattsd, RideFile::cadd, RideFile::nmd, RideFile::hrd,
+        RideFile::aPowerKg
+    };
+    const double tolerance = 0.01; // in units of the series
+
+    Context *context = benchmarkContext();
+    double threads = 0, kernel = 0;
+    int checked = 0, failed = 0;
+    QElapsedTimer timer;
+
+    foreach(QString name, files) {
+        QFile file(name);
+        QStringList errors;
+        RideFile *opened = RideFileFactory::instance().openRideFile(context, file, errors);
+        if (!opened) continue;
+        if (opened->dataPoints().isEmpty() || opened->recIntSecs() <= 0) {
+            delete opened;
+            continue;
+        }
+        opened->recalculateDerivedSeries();
+
+        QList<RideFile*> rides;
+        rides << opened;
+        if (opened->dataPoints().last()->secs < 8 * 3600) rides << longRide(opened);
+
+        foreach(RideFile *ride, rides) {
+
+            timer.start();
+            QList<ReferenceMeanMax*> reference;
+            for (int i=0; i<count; i++) {
+                reference << new ReferenceMeanMax(ride, series[i]);
+                reference.last()->start();
+            }
+            foreach(ReferenceMeanMax *thread, reference) thread->wait();
+            double before = timer.nsecsElapsed() / 1000000.0;
+
+            timer.start();
+            QVector<float> arrays[count];
+            MeanMaxComputer meanmax(ride);
+            for (int i=0; i<count; i++) meanmax.compute(arrays[i], series[i]);
+            double after = timer.nsecsElapsed() / 1000000.0;
+
+            double worst = 0;
+            bool sized = true;
+            for (int i=0; i<count; i++) {
+                const QVector<float> &expected = reference[i]->array;
+                if (expected.count() != arrays[i].count()) sized = false;
+                for (int j=0; j<qMin(expected.count(), arrays[i].count()); j++)
+                    worst = qMax(worst, double(fabs(expected[j] - arrays[i][j])));
+            }
+            qDeleteAll(reference);
+
+            bool ok = sized && worst <= tolerance;
+            fprintf(stderr, "%s %s%s: %d secs, threads %.1fms, kernel %.1fms, max difference %g%s\n", ok ? "ok  " : "FAIL",
+                    QFileInfo(name).fileName().toLocal8Bit().constData(), ride == opened ? "" : " (repeated)",
+                    int(ride->dataPoints().last()->secs), before, after, worst, sized ? "" : ", lengths differ");
+            if (!ok) failed++;
+            threads += before;
+            kernel += after;
+            checked++;
+        }
+        qDeleteAll(rides);
+    }
+
+    fprintf(stderr, "%d rides checked, %d failed, threads %.1fms, kernel %.1fms\n", checked, failed, threads, kernel);
+    return (failed || !checked) ? 1 : 0;
+}
+
+// run TrainControl on an erg workout against a NullController, as the
+// train view does, with this thread reading the telemetry five times
+// a second and now and again stalling as a busy GUI would. Reports how
+// well the control thread kept time and that the loads it set arrived
+static int checkControl()
+{
+    static const int period = 100;    // msecs, 10x LOADRATE to get enough ticks
+    static const int duration = 20000; // msecs
+
+    Context *context = benchmarkContext();
+    ErgFile *ergFile = ErgFile::fromContent("[COURSE HEADER]\n"
+                                            "VERSION = 2\n"
+                                            "UNITS = ENGLISH\n"
+                                            "DESCRIPTION = Control check\n"
+                                            "FILE NAME = controlcheck.erg\n"
+                                            "MINUTES WATTS\n"
+                                            "[END COURSE HEADER]\n"
+                                            "[COURSE DATA]\n"
+                                            "0.00 100\n"
+                                            "1.00 400\n"
+                                            "[END COURSE DATA]\n", context);
+    if (!ergFile || !ergFile->isValid()) {
+        fprintf(stderr, "FAIL could not parse the workout\n");
+        return 1;
+    }
+
+    NullController device(NULL, NULL);
+    TrainControl control;
+    control.startControl(ergFile, QList<RealtimeController*>() << &device, true, 0, period);
+
+    QElapsedTimer timer;
+    timer.start();
+    int reads = 0;
+    while (timer.elapsed() < duration) {
+        QThread::msleep(200);
+        QCoreApplication::processEvents(); // queued setLoad
+        RealtimeData rtData;
+        device.getRealtimeData(rtData);
+
+        // painting or decoding video
+        if (++reads % 10 == 0) QThread::msleep(500);
+    }
+    control.stopControl();
+    QCoreApplication::processEvents();
+
+    TrainControl::Snapshot now = control.snapshot();
+    RealtimeData rtData;
+    device.getRealtimeData(rtData);
+    bool ok = now.ticks > 0 && rtData.getLoad() == now.load;
+
+    fprintf(stderr, "%s %ld ticks of %dms: jitter max %lldus, latency max %lldus, %ld overruns, load set %.0fW device %.0fW\n",
+            ok ? "ok  " : "FAIL", now.ticks, period, now.maxjitter, now.maxlatency, now.overruns, now.load, rtData.getLoad());
+
+    delete ergFile;
+    return ok ? 0 : 1;
+}
+
 //
 // By default will open last athlete, but will also provide
 // a dialog to select an athlete if not found, and then upgrade
@@ -194,6 +810,10 @@ main(int argc, char *argv[])
     bool debug = false;
 #endif
     bool server = false;
+    bool benchmark = false;
+    bool wbalcheck = false;
+    bool meanmaxcheck = false;
+    bool controlcheck = false;
     nogui = false;
     bool help = false;
 
@@ -223,6 +843,11 @@ main(int argc, char *argv[])
 #ifdef GC_WANT_R
             fprintf(stderr, "--no-r              to disable R startup\n");
 #endif
+            fprintf(stderr, "--benchmark files   to time reading ride files (e.g. test/rides/*.fit), filters and metrics\n");
+            fprintf(stderr, "                    on them and exit, use -platform offscreen without a display\n");
+            fprintf(stderr, "--wbalcheck files   to check integral W'bal against the original formula and exit\n");
+            fprintf(stderr, "--meanmaxcheck files to check and time mean max against the thread per series version and exit\n");
+            fprintf(stderr, "--controlcheck      to run the train load control against a simulated device, report its timing and exit\n");
             fprintf (stderr, "\nSpecify the folder and/or athlete to open on startup\n");
             fprintf(stderr, "If no parameters are passed it will reopen the last athlete.\n\n");
 
@@ -244,6 +869,22 @@ main(int argc, char *argv[])
 
             noR = true;
 #endif
+        } else if (arg == "--benchmark") {
+
+            benchmark = true;
+
+        } else if (arg == "--wbalcheck") {
+
+            wbalcheck = true;
+
+        } else if (arg == "--meanmaxcheck") {
+
+            meanmaxcheck = true;
+
+        } else if (arg == "--controlcheck") {
+
+            controlcheck = true;
+
         } else if (arg == "--debug") {
 
 #ifdef GC_DEBUG
@@ -286,6 +927,9 @@ main(int argc, char *argv[])
         exit(0);
     }
 
+    // developer checks on ride files passed, then exit
+    if (wbalcheck) exit(checkWbal(rideFileArgs(args)));
+
     //
     // INITIALISE ONE TIME OBJECTS
     //
@@ -505,7 +1149,7 @@ main(int argc, char *argv[])
 
         // now redirect stderr
 #ifndef WIN32
-        if (!debug) nostderr(home.canonicalPath());
+        if (!debug && !benchmark && !meanmaxcheck && !controlcheck) nostderr(home.canonicalPath());
 #else
         Q_UNUSED(debug)
 #endif
@@ -537,6 +1181,11 @@ main(int argc, char *argv[])
         // initialise the trainDB
         trainDB = new TrainDB(home);
 
+        // benchmarks need the metrics and an athlete, so we get this far
+        if (benchmark) terminate(benchmarkRides(rideFileArgs(args)));
+        if (meanmaxcheck) terminate(checkMeanMax(rideFileArgs(args)));
+        if (controlcheck) terminate(checkControl());
+
         // lets do what the command line says ...
         QVariant lastOpened;
         if(args.count() == 2) { // $ ./GoldenCheetah Mark -or- ./GoldenCheetah --server ~/athletedir
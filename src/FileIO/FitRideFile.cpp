@@ -29,6 +29,7 @@
 #include <QDebug>
 #include <QTime>
 #include <cstdio>
+#include <cstring>
 #include <stdint.h>
 #include <time.h>
 #include <limits>
@@ -74,6 +75,8 @@ struct FitField {
     int type; // FIT base_type
     int size; // in bytes
     int deve_idx; // Developer Data Index
+    int offset; // in bytes from the start of the record content
+    int count; // values of the base type that fit in size, 0 if none do
 };
 
 struct FitDeveField {
@@ -92,8 +95,21 @@ struct FitDefinition {
     int global_msg_num;
     bool is_big_endian;
     std::vector<FitField> fields;
+    int size; // record content in bytes, sum of the field sizes
 };
 
+// bytes in a value of each base type, 0 for those without a fixed size
+// (string, byte) or that we don't decode (float64)
+static int fitBaseTypeSize(int type)
+{
+    switch (type) {
+    case 0: case 1: case 2: case 7: case 10: case 13: return 1;
+    case 3: case 4: case 11: return 2;
+    case 5: case 6: case 8: case 12: return 4;
+    default: return 0;
+    }
+}
+
 enum fitValueType { SingleValue, ListValue, FloatValue, StringValue };
 typedef enum fitValueType FitValueType;
 
@@ -146,159 +162,112 @@ struct FitFileReaderState
     QMap<int, QString> deviceInfos;
     QList<QString> dataInfos;
 
+    // the whole file is read in one go and decoded from memory, reading
+    // each field through QFile was the bottleneck when importing and
+    // refreshing large numbers of rides
+    QByteArray buffer;
+    const uchar *data;
+    int pos, length;
+
     FitFileReaderState(QFile &file, QStringList &errors) :
         file(file), errors(errors), rideFile(NULL), start_time(0),
         last_time(0), last_distance(0.00f), interval(0), calibration(0),
         devices(0), stopped(true), isLapSwim(false), pool_length(0.0),
         last_event_type(-1), last_event(-1), last_msg_type(-1), frac_time(0.0),
-        last_lap_end(0.0)
+        last_lap_end(0.0), data(NULL), pos(0), length(0)
     {}
 
     struct TruncatedRead {};
 
-    void read_unknown( int size, int *count = NULL ) {
-        if (!file.seek(file.pos() + size))
+    // the next size bytes from the buffer
+    const uchar *take(int size, int *count) {
+        if (size < 0 || length - pos < size)
             throw TruncatedRead();
+        const uchar *p = data + pos;
+        pos += size;
         if (count)
             (*count) += size;
+        return p;
+    }
+
+    void read_unknown( int size, int *count = NULL ) {
+        take(size, count);
     }
 
     fit_string_value read_text(int len, int *count = NULL) {
-        char c;
+        const uchar *p = take(len, count);
         fit_string_value res = "";
         for (int i = 0; i < len; ++i) {
-            if (file.read(&c, 1) != 1)
-                throw TruncatedRead();
-            if (count)
-                *count += 1;
-
-            if (c != 0)
-                res += c;
+            if (p[i] != 0)
+                res += char(p[i]);
         }
         return res;
     }
 
-    fit_value_t read_int8(int *count = NULL) {
-        qint8 i;
-        if (file.read(reinterpret_cast<char*>( &i), 1) != 1)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 1;
+    // a value of a base type at p, NA_VALUE for the invalid value
+    static fit_value_t value_at(const uchar *p, int type, bool is_big_endian) {
+        switch (type) {
+        case 1: { qint8 i = qint8(*p); return i == 0x7f ? NA_VALUE : i; }
+        case 10: { quint8 i = *p; return i == 0x00 ? NA_VALUE : i; }
+        case 3: {
+            qint16 i = is_big_endian ? qFromBigEndian<qint16>(p) : qFromLittleEndian<qint16>(p);
+            return i == 0x7fff ? NA_VALUE : i;
+        }
+        case 4: case 11: {
+            quint16 i = is_big_endian ? qFromBigEndian<quint16>(p) : qFromLittleEndian<quint16>(p);
+            return i == (type == 4 ? 0xffff : 0x0000) ? NA_VALUE : i;
+        }
+        case 5: {
+            qint32 i = is_big_endian ? qFromBigEndian<qint32>(p) : qFromLittleEndian<qint32>(p);
+            return i == 0x7fffffff ? NA_VALUE : i;
+        }
+        case 6: case 12: {
+            quint32 i = is_big_endian ? qFromBigEndian<quint32>(p) : qFromLittleEndian<quint32>(p);
+            return i == (type == 6 ? 0xffffffff : 0x00000000) ? NA_VALUE : i;
+        }
+        default: { quint8 i = *p; return i == 0xff ? NA_VALUE : i; } // 0, 2, 13
+        }
+    }
 
-        return i == 0x7f ? NA_VALUE : i;
+    fit_value_t read_int8(int *count = NULL) {
+        return value_at(take(1, count), 1, false);
     }
 
     fit_value_t read_uint8(int *count = NULL) {
-        quint8 i;
-        if (file.read(reinterpret_cast<char*>( &i), 1) != 1)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 1;
-
-        return i == 0xff ? NA_VALUE : i;
+        return value_at(take(1, count), 2, false);
     }
 
     fit_value_t read_uint8z(int *count = NULL) {
-        quint8 i;
-        if (file.read(reinterpret_cast<char*>( &i), 1) != 1)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 1;
-
-        return i == 0x00 ? NA_VALUE : i;
+        return value_at(take(1, count), 10, false);
     }
 
     fit_value_t read_int16(bool is_big_endian, int *count = NULL) {
-        qint16 i;
-        if (file.read(reinterpret_cast<char*>(&i), 2) != 2)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 2;
-
-        i = is_big_endian
-            ? qFromBigEndian<qint16>( i )
-            : qFromLittleEndian<qint16>( i );
-
-        return i == 0x7fff ? NA_VALUE : i;
+        return value_at(take(2, count), 3, is_big_endian);
     }
 
     fit_value_t read_uint16(bool is_big_endian, int *count = NULL) {
-        quint16 i;
-        if (file.read(reinterpret_cast<char*>(&i), 2) != 2)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 2;
-
-        i = is_big_endian
-            ? qFromBigEndian<quint16>( i )
-            : qFromLittleEndian<quint16>( i );
-
-        return i == 0xffff ? NA_VALUE : i;
+        return value_at(take(2, count), 4, is_big_endian);
     }
 
     fit_value_t read_uint16z(bool is_big_endian, int *count = NULL) {
-        quint16 i;
-        if (file.read(reinterpret_cast<char*>(&i), 2) != 2)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 2;
-
-        i = is_big_endian
-            ? qFromBigEndian<quint16>( i )
-            : qFromLittleEndian<quint16>( i );
-
-        return i == 0x0000 ? NA_VALUE : i;
+        return value_at(take(2, count), 11, is_big_endian);
     }
 
     fit_value_t read_int32(bool is_big_endian, int *count = NULL) {
-        qint32 i;
-        if (file.read(reinterpret_cast<char*>(&i), 4) != 4)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 4;
-
-        i = is_big_endian
-            ? qFromBigEndian<qint32>( i )
-            : qFromLittleEndian<qint32>( i );
-
-        return i == 0x7fffffff ? NA_VALUE : i;
+        return value_at(take(4, count), 5, is_big_endian);
     }
 
     fit_value_t read_uint32(bool is_big_endian, int *count = NULL) {
-        quint32 i;
-        if (file.read(reinterpret_cast<char*>(&i), 4) != 4)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 4;
-
-        i = is_big_endian
-            ? qFromBigEndian<quint32>( i )
-            : qFromLittleEndian<quint32>( i );
-
-        return i == 0xffffffff ? NA_VALUE : i;
+        return value_at(take(4, count), 6, is_big_endian);
     }
 
     fit_value_t read_uint32z(bool is_big_endian, int *count = NULL) {
-        quint32 i;
-        if (file.read(reinterpret_cast<char*>(&i), 4) != 4)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 4;
-
-        i = is_big_endian
-            ? qFromBigEndian<quint32>( i )
-            : qFromLittleEndian<quint32>( i );
-
-        return i == 0x00000000 ? NA_VALUE : i;
+        return value_at(take(4, count), 12, is_big_endian);
     }
 
     fit_float_value read_float32(int *count = NULL) {
         float f;
-        if (file.read(reinterpret_cast<char*>(&f), 4) != 4)
-            throw TruncatedRead();
-        if (count)
-            (*count) += 4;
-
+        memcpy(&f, take(4, count), 4);
         return f;
     }
 
@@ -2437,6 +2406,15 @@ struct FitFileReaderState
         }
     }
 
+    // does another file follow the one just read ? trailing padding or
+    // junk after a good file isn't a file header, so it's quietly ignored
+    bool chained_header() const {
+        if (length - pos < 12) return false;
+        int header_size = data[pos];
+        return (header_size == 12 || header_size == 14) && length - pos >= header_size &&
+               memcmp(data + pos + 8, ".FIT", 4) == 0;
+    }
+
     void read_header(bool &stop, QStringList &errors, int &data_size) {
         stop = false;
         try {
@@ -2457,10 +2435,7 @@ struct FitFileReaderState
 
             data_size = read_uint32(false); // always littleEndian
             char fit_str[5];
-            if (file.read(fit_str, 4) != 4) {
-                errors << "truncated header";
-                stop = true;
-            }
+            memcpy(fit_str, take(4, NULL), 4);
             fit_str[4] = '\0';
             if (strcmp(fit_str, ".FIT") != 0) {
                 errors << QString("bad header, expected \".FIT\" but got \"%1\"").arg(fit_str);
@@ -2540,6 +2515,23 @@ struct FitFileReaderState
                     }
                 }
             }
+
+            // lay out the fields once here rather than for every data record
+            // using this definition, a field holds as many values of its base
+            // type as fit and anything left over is skipped by the offsets
+            def.size = 0;
+            for (size_t i = 0; i < def.fields.size(); ++i) {
+                FitField &field = def.fields[i];
+                int width = fitBaseTypeSize(field.type);
+                field.offset = def.size;
+                field.count = width ? field.size / width : 0;
+                def.size += field.size;
+
+                if (FIT_DEBUG && FIT_DEBUG_LEVEL>1 && width && field.count * width != field.size) {
+                    printf( "   warning : size=%d for type=%d (num=%d)\n",
+                            field.size, field.type, field.num);
+                }
+            }
         }
         else {
             // Data record
@@ -2567,102 +2559,52 @@ struct FitFileReaderState
                     def.global_msg_num );
             }
 
+            // the field layout was worked out with the definition, so the
+            // record is taken in one go and each field decoded at its offset
+            const uchar *record = take(def.size, &count);
+
             std::vector<FitValue> values;
+            values.reserve(def.fields.size());
             foreach(const FitField &field, def.fields) {
                 FitValue value;
-                int size;
+                const uchar *p = record + field.offset;
+                int width = fitBaseTypeSize(field.type);
 
                 switch (field.type) {
-                    case 0: size = 1;
-                            if (field.size==size) {
-                                value.type = SingleValue; value.v = read_uint8(&count);;
-                             } else { // Multi-values
-                                value.type = ListValue;
-                                value.list.clear();
-                                for (int i=0;i<field.size/size;i++) {
-                                    value.list.append(read_uint8(&count));
-                                }
-                                size = field.size;
-                            }
-                            break;
-                    case 1: value.type = SingleValue; value.v = read_int8(&count); size = 1;  break;
-                    case 2: size = 1;
-                            if (field.size==size) {
-                                value.type = SingleValue; value.v = read_uint8(&count);
-                            } else { // Multi-values
-                                value.type = ListValue;
-                                value.list.clear();
-                                for (int i=0;i<field.size/size;i++) {
-                                    value.list.append(read_uint8(&count));
-                                }
-                                size = field.size;
-                            }
-                            break;
-                    case 3: value.type = SingleValue; value.v = read_int16(def.is_big_endian, &count); size = 2;  break;
-                    case 4: size = 2;
-                            if (field.size==size) {
-                                value.type = SingleValue; value.v = read_uint16(def.is_big_endian, &count);
-                            } else { // Multi-values
-                                value.type = ListValue;
-                                value.list.clear();
-                                for (int i=0;i<field.size/size;i++) {
-                                    value.list.append(read_uint16(def.is_big_endian, &count));
-                                }
-                                size = field.size;
-                            }
-                            break;
-                    case 5: value.type = SingleValue; value.v = read_int32(def.is_big_endian, &count); size = 4;  break;
-                    case 6: size = 4;
-                            if (field.size==size) {
-                                value.type = SingleValue; value.v = read_uint32(def.is_big_endian, &count);
-                            } else { // Multi-values
-                                value.type = ListValue;
-                                value.list.clear();
-                                for (int i=0;i<field.size/size;i++) {
-                                    value.list.append(read_uint32(def.is_big_endian, &count));
-                                }
-                                size = field.size;
-                            }
+                    case 0: case 2: case 4: case 6: case 10:
+                        if (field.size != width) { // Multi-values
+                            value.type = ListValue;
+                            for (int i=0; i<field.count; i++)
+                                value.list.append(value_at(p + i*width, field.type, def.is_big_endian));
                             break;
+                        }
+                        // fall through
+                    case 1: case 3: case 5: case 11: case 12:
+                        value.type = SingleValue;
+                        value.v = field.count ? value_at(p, field.type, def.is_big_endian) : NA_VALUE;
+                        break;
+
                     case 7:
                         value.type = StringValue;
-                        value.s = read_text(field.size, &count);
-                        size = field.size;
+                        for (int i=0; i<field.size; i++)
+                            if (p[i] != 0) value.s += char(p[i]);
                         break;
 
                     case 8: // FLOAT32
-                        size = 4;
                         value.type = FloatValue;
-                        value.f = read_float32(&count);
+                        value.f = 0;
+                        if (field.count) memcpy(&value.f, p, 4);
                         if (value.f != value.f) // No NAN
                             value.f = 0;
-                        size = field.size;
                         break;
 
                     //case 9: // FLOAT64
 
-                    case 10: size = 1;
-                             if (field.size==size) {
-                                value.type = SingleValue; value.v = read_uint8z(&count); size = 1;
-                             } else { // Multi-values
-                                 value.type = ListValue;
-                                 value.list.clear();
-                                 for (int i=0;i<field.size/size;i++) {
-                                     value.list.append(read_uint8z(&count));
-                                 }
-                                 size = field.size;
-                             }
-                             break;
-                    case 11: value.type = SingleValue; value.v = read_uint16z(def.is_big_endian, &count); size = 2; break;
-                    case 12: value.type = SingleValue; value.v = read_uint32z(def.is_big_endian, &count); size = 4; break;
                     case 13: // BYTE
-                             value.type = ListValue;
-                             value.list.clear();
-                             for (int i=0;i<field.size;i++) {
-                                value.list.append(read_uint8(&count));
-                             }
-                             size = value.list.size();
-                             break;
+                        value.type = ListValue;
+                        for (int i=0; i<field.size; i++)
+                            value.list.append(value_at(p + i, 13, false));
+                        break;
 
                     // we may need to add support for float, string + byte base types here
                     default:
@@ -2672,26 +2614,16 @@ struct FitFileReaderState
                                    field.size);
 
                         }
-                        read_unknown( field.size, &count );
                         value.type = SingleValue;
                         value.v = NA_VALUE;
                         unknown_base_type.insert(field.type);
-                        size = field.size;
-                }
-                // Size is greater than expected
-                if (size < field.size) {
-                    if (FIT_DEBUG && FIT_DEBUG_LEVEL>1)  {
-                         printf( "   warning : size=%d for type=%d (num=%d)\n",
-                                 field.size, field.type, field.num);
-                    }
-                    read_unknown( field.size-size, &count );
                 }
 
                 values.push_back(value);
 
                 if (FIT_DEBUG && ((FIT_DEBUG_LEVEL>2 && def.global_msg_num!=RECORD_MSG_NUM) || FIT_DEBUG_LEVEL>3 )) {
-                    printf( " field: type=%d num=%d size=%d(%d) ",
-                        field.type, field.num, field.size, size);
+                    printf( " field: type=%d num=%d size=%d offset=%d ",
+                        field.type, field.num, field.size, field.offset);
                     if (value.type == SingleValue) {
                         if (value.v == NA_VALUE)
                             printf( "value=NA\n");
@@ -2840,6 +2772,11 @@ struct FitFileReaderState
             delete rideFile;
             return NULL;
         }
+        buffer = file.readAll();
+        file.close();
+        data = reinterpret_cast<const uchar*>(buffer.constData());
+        length = buffer.size();
+        pos = 0;
 
         int data_size = 0;
         weatherXdata = new XDataSeries();
@@ -2908,7 +2845,6 @@ struct FitFileReaderState
             }
         }
         if (stop) {
-            file.close();
             delete rideFile;
             return NULL;
         }
@@ -2925,8 +2861,9 @@ struct FitFileReaderState
 
                 // second file ?
                 try {
-                    while (file.canReadLine()) {
+                    while (chained_header()) {
                         read_header(stop, errors, data_size);
+                        if (stop) break;
                         if (!stop) {
 
                             int bytes_read = 0;
@@ -2977,8 +2914,6 @@ struct FitFileReaderState
             if (dataInfo.length()>0)
                 rideFile->setTag("Data Info", dataInfo);
 
-            file.close();
-
             if (weatherXdata->datapoints.count()>0)
                 rideFile->addXData("WEATHER", weatherXdata);
             else
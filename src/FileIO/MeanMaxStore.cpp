@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "MeanMaxStore.h"
+#include "RideFileCache.h"
+#include "Context.h"
+#include "Athlete.h"
+#include "RideCache.h"
+#include "RideItem.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QDebug>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+// the order the meanmax arrays are written to the .cpx
+// by RideFileCache::serialize(), we keep the same order
+static const RideFile::SeriesType storeSeries[MeanMaxStoreSeriesCount] = {
+    RideFile::watts, RideFile::wattsKg, RideFile::hr, RideFile::cad,
+    RideFile::nm, RideFile::kph, RideFile::kphd, RideFile::wattsd,
+    RideFile::cadd, RideFile::nmd, RideFile::hrd, RideFile::xPower,
+    RideFile::NP, RideFile::vam, RideFile::aPower, RideFile::aPowerKg
+};
+
+static void cacheCounts(RideFileCacheHeader &head, uint32_t *counts)
+{
+    counts[0] = head.wattsMeanMaxCount;
+    counts[1] = head.wattsKgMeanMaxCount;
+    counts[2] = head.hrMeanMaxCount;
+    counts[3] = head.cadMeanMaxCount;
+    counts[4] = head.nmMeanMaxCount;
+    counts[5] = head.kphMeanMaxCount;
+    counts[6] = head.kphdMeanMaxCount;
+    counts[7] = head.wattsdMeanMaxCount;
+    counts[8] = head.caddMeanMaxCount;
+    counts[9] = head.nmdMeanMaxCount;
+    counts[10] = head.hrdMeanMaxCount;
+    counts[11] = head.xPowerMeanMaxCount;
+    counts[12] = head.npMeanMaxCount;
+    counts[13] = head.vamMeanMaxCount;
+    counts[14] = head.aPowerMeanMaxCount;
+    counts[15] = head.aPowerKgMeanMaxCount;
+}
+
+// keep the loop trivial so the compiler will vectorize it
+static inline void maxReduce(float *into, const float *from, int n)
+{
+    for (int i=0; i<n; i++) into[i] = from[i] > into[i] ? from[i] : into[i];
+}
+
+int
+MeanMaxStore::indexFor(RideFile::SeriesType series)
+{
+    for (int i=0; i<MeanMaxStoreSeriesCount; i++)
+        if (storeSeries[i] == series) return i;
+    return -1;
+}
+
+MeanMaxStore::MeanMaxStore(QString cacheDir, Context *context, bool readonly) :
+              context(context), cacheDir(cacheDir), readonly(readonly), mapped(NULL), mappedSize(0),
+              end(0), deadBytes(0), synced(false), dirty(true)
+{
+    file.setFileName(cacheDir + "/meanmax.mmx");
+}
+
+MeanMaxStore::~MeanMaxStore()
+{
+    close();
+}
+
+void
+MeanMaxStore::close()
+{
+    if (mapped) file.unmap(mapped);
+    mapped = NULL;
+    mappedSize = 0;
+    if (file.isOpen()) file.close();
+    index.clear();
+    byDate.clear();
+    dirty = true;
+}
+
+// ride date/time order for the index
+struct MeanMaxStoreLessThan {
+    const uchar *base;
+    MeanMaxStoreLessThan(const uchar *base) : base(base) {}
+    bool operator()(qint64 a, qint64 b) const {
+        const MeanMaxStoreRecord *ra = reinterpret_cast<const MeanMaxStoreRecord*>(base + a);
+        const MeanMaxStoreRecord *rb = reinterpret_cast<const MeanMaxStoreRecord*>(base + b);
+        if (ra->julianDay != rb->julianDay) return ra->julianDay < rb->julianDay;
+        return ra->secs < rb->secs;
+    }
+};
+
+void
+MeanMaxStore::open()
+{
+    if (!file.isOpen() && !file.open(readonly ? QIODevice::ReadOnly : QIODevice::ReadWrite)) {
+        // a reader just reads the .cpx files until there is one
+        if (!readonly) qDebug()<<"cannot open meanmax store"<<file.fileName();
+        return;
+    }
+
+    // check the header, reset if not current
+    MeanMaxStoreHeader head;
+    bool valid = false;
+    if (file.size() >= (qint64)sizeof(head)) {
+        file.seek(0);
+        file.read((char*)&head, sizeof(head));
+        valid = !strncmp(head.magic, "GCMM", 4) && head.version == MeanMaxStoreVersion &&
+                head.cacheVersion == RideFileCacheVersion && head.seriesCount == MeanMaxStoreSeriesCount;
+    }
+
+    // not ours to reset
+    if (!valid && readonly) {
+        file.close();
+        return;
+    }
+
+    if (!valid) {
+        memcpy(head.magic, "GCMM", 4);
+        head.version = MeanMaxStoreVersion;
+        head.cacheVersion = RideFileCacheVersion;
+        head.seriesCount = MeanMaxStoreSeriesCount;
+        file.resize(0);
+        file.seek(0);
+        file.write((char*)&head, sizeof(head));
+        file.flush();
+        synced = false;
+    }
+
+    map();
+}
+
+bool
+MeanMaxStore::map()
+{
+    if (mapped) file.unmap(mapped);
+    mapped = NULL;
+    index.clear();
+    byDate.clear();
+    deadBytes = 0;
+
+    mappedSize = file.isOpen() ? file.size() : 0;
+    if (mappedSize <= (qint64)sizeof(MeanMaxStoreHeader)) {
+        end = sizeof(MeanMaxStoreHeader);
+        dirty = false;
+        return true;
+    }
+
+    mapped = file.map(0, mappedSize);
+    if (!mapped) {
+        qDebug()<<"cannot map meanmax store"<<file.fileName();
+        return false;
+    }
+
+    // walk the records, later ones supersede earlier ones
+    qint64 offset = sizeof(MeanMaxStoreHeader);
+    bool padding = false;
+    while (offset + (qint64)sizeof(MeanMaxStoreRecord) <= mappedSize) {
+
+        const MeanMaxStoreRecord *r = record(offset);
+
+        // the file is grown ahead of the records, see append()
+        if (r->length == 0) {
+            padding = true;
+            break;
+        }
+
+        // a truncated write stops the walk
+        qint64 expected = sizeof(MeanMaxStoreRecord);
+        for (int i=0; i<MeanMaxStoreSeriesCount; i++) expected += r->counts[i] * sizeof(float);
+        if (r->length != expected || offset + r->length > mappedSize) break;
+
+        QString name = QString::fromLatin1(r->name);
+        qint64 prior = index.value(name, -1);
+        if (prior >= 0) deadBytes += record(prior)->length;
+
+        if (r->flags & Deleted) {
+            index.remove(name);
+            deadBytes += r->length;
+        } else {
+            index.insert(name, offset);
+        }
+        offset += r->length;
+    }
+
+    // drop any junk at the end and go again, a
+    // reader ignores it, it may be being written
+    if (offset < mappedSize && !padding && !readonly) {
+        file.unmap(mapped);
+        mapped = NULL;
+        file.resize(offset);
+        return map();
+    }
+    end = offset;
+
+    // date order for range queries
+    byDate.reserve(index.count());
+    QHashIterator<QString, qint64> i(index);
+    while (i.hasNext()) {
+        i.next();
+        byDate << i.value();
+    }
+    qSort(byDate.begin(), byDate.end(), MeanMaxStoreLessThan(mapped));
+
+    dirty = false;
+    return true;
+}
+
+const float *
+MeanMaxStore::array(qint64 offset, int index) const
+{
+    const MeanMaxStoreRecord *r = record(offset);
+    const uchar *p = mapped + offset + sizeof(MeanMaxStoreRecord);
+    for (int i=0; i<index; i++) p += r->counts[i] * sizeof(float);
+    return reinterpret_cast<const float*>(p);
+}
+
+const float *
+MeanMaxStore::Extra::array(int index) const
+{
+    const char *p = data.constData();
+    for (int i=0; i<index; i++) p += head.counts[i] * sizeof(float);
+    return reinterpret_cast<const float*>(p);
+}
+
+// the record header for a .cpx, just the name and date
+static bool recordFor(QString cacheFilename, MeanMaxStoreRecord &add)
+{
+    QFileInfo info(cacheFilename);
+
+    memset(&add, 0, sizeof(add));
+    QByteArray name = info.baseName().toLatin1();
+    strncpy(add.name, name.constData(), sizeof(add.name)-1);
+
+    QDateTime dt;
+    if (!RideFile::parseRideFileName(info.fileName(), &dt)) return false;
+    add.julianDay = dt.date().toJulianDay();
+    add.secs = QTime(0,0,0).secsTo(dt.time());
+    add.length = sizeof(add);
+
+    return true;
+}
+
+bool
+MeanMaxStore::read(QString cacheFilename, bool isRun, MeanMaxStoreRecord &add, QByteArray &data)
+{
+    if (!recordFor(cacheFilename, add)) return false;
+
+    QFile cacheFile(cacheFilename);
+    if (!cacheFile.open(QIODevice::ReadOnly)) return false;
+
+    RideFileCacheHeader head;
+    if (cacheFile.read((char*)&head, sizeof(head)) != sizeof(head) || head.version != RideFileCacheVersion) {
+        cacheFile.close();
+        return false;
+    }
+
+    // the meanmax arrays follow the header in one block
+    cacheCounts(head, add.counts);
+    qint64 bytes = 0;
+    for (int i=0; i<MeanMaxStoreSeriesCount; i++) bytes += add.counts[i] * sizeof(float);
+    data = cacheFile.read(bytes);
+    cacheFile.close();
+    if (data.size() != bytes) return false;
+
+    add.flags = isRun ? Run : 0;
+    add.crc = head.crc;
+    add.stamp = QFileInfo(cacheFilename).lastModified().toMSecsSinceEpoch();
+    add.length = sizeof(add) + data.size();
+
+    return true;
+}
+
+bool
+MeanMaxStore::append(QString cacheFilename, bool isRun, bool tombstone)
+{
+    MeanMaxStoreRecord add;
+    QByteArray data;
+    if (tombstone) {
+
+        if (!recordFor(cacheFilename, add)) return false;
+        add.flags = Deleted;
+
+    } else if (!read(cacheFilename, isRun, add, data)) return false;
+
+    // grow the file ahead of the records, doubling, so it is only
+    // remapped a handful of times as it fills, the zero padding past
+    // the end is where map() stops walking
+    qint64 offset = end;
+    bool grow = offset + add.length > mappedSize;
+    if (grow) {
+        // can't resize a mapped file on some platforms
+        if (mapped) file.unmap(mapped);
+        mapped = NULL;
+        file.resize(qMax(offset + add.length, qMax(mappedSize * 2, (qint64)(1024*1024))));
+    }
+
+    // append at the end of the valid data
+    file.seek(offset);
+    file.write((char*)&add, sizeof(add));
+    file.write(data);
+    file.flush();
+    end += add.length;
+
+    // remap picks it up on the walk
+    if (grow || !mapped) return map();
+
+    // otherwise it is already in the mapping, so just index it
+    QString name = QString::fromLatin1(add.name);
+    qint64 prior = index.value(name, -1);
+    if (prior >= 0) {
+        deadBytes += record(prior)->length;
+        QVector<qint64>::iterator i = qLowerBound(byDate.begin(), byDate.end(), prior, MeanMaxStoreLessThan(mapped));
+        while (i != byDate.end() && *i != prior) i++;
+        if (i != byDate.end()) byDate.erase(i);
+    }
+    if (tombstone) {
+        index.remove(name);
+        deadBytes += add.length;
+    } else {
+        index.insert(name, offset);
+        byDate.insert(qUpperBound(byDate.begin(), byDate.end(), offset, MeanMaxStoreLessThan(mapped)), offset);
+    }
+
+    return true;
+}
+
+void
+MeanMaxStore::sync()
+{
+    // check every .cpx in the cache is current in the store
+    // and anything in the store that has gone is removed
+    // this is a directory listing with no file opens for
+    // the rides we already hold
+    QSet<QString> seen;
+    extra.clear();
+    stale.clear();
+
+    // we don't know the sport from the .cpx so get it from the ride
+    // cache when we have one, it also says which rides still exist
+    // so the .cpx left behind by deleted rides are not included.
+    // without it we look at what's in the activities folder
+    QHash<QString, bool> runs;
+    QSet<QString> rides;
+    if (context && context->athlete->rideCache) {
+        foreach(RideItem *item, context->athlete->rideCache->rides()) {
+            QString name = QFileInfo(item->fileName).baseName();
+            runs.insert(name, item->isRun);
+            rides.insert(name);
+        }
+    } else {
+        foreach(QFileInfo info, QDir(cacheDir + "/../activities").entryInfoList(QDir::Files))
+            rides.insert(info.baseName());
+    }
+
+    foreach(QFileInfo info, QDir(cacheDir).entryInfoList(QStringList() << "*.cpx", QDir::Files)) {
+
+        if (info.size() < (qint64)sizeof(RideFileCacheHeader)) continue;
+
+        QString name = info.baseName();
+        if (!rides.contains(name)) continue; // orphan
+        seen.insert(name);
+
+        qint64 offset = index.value(name, -1);
+        if (offset >= 0 && record(offset)->stamp == info.lastModified().toMSecsSinceEpoch()) continue;
+
+        bool isRun = runs.value(name, offset >= 0 ? (record(offset)->flags & Run) : false);
+
+        // a reader keeps it to itself
+        if (readonly) {
+            Extra add;
+            if (read(info.absoluteFilePath(), isRun, add.head, add.data)) {
+                extra.insert(name, add);
+                if (offset >= 0) stale.insert(name);
+            }
+            continue;
+        }
+
+        append(info.absoluteFilePath(), isRun);
+    }
+
+    foreach(QString name, index.keys()) {
+        if (!seen.contains(name)) {
+            if (readonly) {
+                stale.insert(name);
+                continue;
+            }
+            append(cacheDir + "/" + name + ".cpx", false, true);
+        }
+    }
+
+    // tidy up if more than half is dead wood
+    if (!readonly && deadBytes > 1024*1024 && deadBytes > end/2) compact();
+
+    synced = true;
+}
+
+void
+MeanMaxStore::compact()
+{
+    QFile compacted(file.fileName() + ".tmp");
+    if (!compacted.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+
+    compacted.write((char*)mapped, sizeof(MeanMaxStoreHeader));
+    foreach(qint64 offset, byDate)
+        compacted.write((char*)record(offset), record(offset)->length);
+    compacted.close();
+
+    // swap it in
+    close();
+    QFile::remove(file.fileName());
+    QFile::rename(compacted.fileName(), file.fileName());
+    open();
+}
+
+void
+MeanMaxStore::update(QString cacheFilename, bool isRun)
+{
+    if (readonly) return;
+
+    QMutexLocker locker(&mutex);
+
+    if (!file.isOpen()) open();
+    if (dirty) map();
+
+    append(cacheFilename, isRun);
+}
+
+void
+MeanMaxStore::remove(QString cacheFilename)
+{
+    if (readonly) return;
+
+    QMutexLocker locker(&mutex);
+
+    if (!file.isOpen()) open();
+    if (dirty) map();
+
+    if (index.contains(QFileInfo(cacheFilename).baseName()))
+        append(cacheFilename, false, true);
+}
+
+QVector<float>
+MeanMaxStore::meanMaxFor(RideFile::SeriesType series, QDate from, QDate to, bool wantruns)
+{
+    QVector<float> returning;
+
+    int si = indexFor(series);
+    if (si < 0) return returning;
+
+    QMutexLocker locker(&mutex);
+
+    if (!file.isOpen()) open();
+    if (dirty) map();
+    if (!synced) sync();
+    if (!mapped && extra.isEmpty()) return returning;
+
+    // binary search for the first ride in range
+    int jfrom = from.toJulianDay();
+    int jto = to.toJulianDay();
+    int lo = 0, hi = byDate.count();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (record(byDate[mid])->julianDay < jfrom) lo = mid+1;
+        else hi = mid;
+    }
+
+    // and max-reduce straight out of the mapped file
+    for (int i=lo; i<byDate.count(); i++) {
+
+        const MeanMaxStoreRecord *r = record(byDate[i]);
+        if (r->julianDay > jto) break;
+        if (!wantruns && (r->flags & Run)) continue;
+        if (stale.count() && stale.contains(QString::fromLatin1(r->name))) continue;
+
+        int n = r->counts[si];
+        if (n == 0) continue;
+        if (returning.size() < n) returning.resize(n);
+
+        maxReduce(returning.data(), array(byDate[i], si), n);
+    }
+
+    // and the ones a reader got from the .cpx
+    QHashIterator<QString, Extra> e(extra);
+    while (e.hasNext()) {
+        e.next();
+
+        const MeanMaxStoreRecord &r = e.value().head;
+        if (r.julianDay < jfrom || r.julianDay > jto) continue;
+        if (!wantruns && (r.flags & Run)) continue;
+
+        int n = r.counts[si];
+        if (n == 0) continue;
+        if (returning.size() < n) returning.resize(n);
+
+        maxReduce(returning.data(), e.value().array(si), n);
+    }
+
+    return returning;
+}
+
+QVector<float>
+MeanMaxStore::meanMaxFor(QString cacheFilename, RideFile::SeriesType series)
+{
+    QVector<float> returning;
+
+    int si = indexFor(series);
+    if (si < 0) return returning;
+
+    QMutexLocker locker(&mutex);
+
+    if (!file.isOpen()) open();
+    if (dirty) map();
+    if (!synced) sync();
+
+    QString name = QFileInfo(cacheFilename).baseName();
+    if (extra.contains(name)) {
+        const Extra &e = extra[name];
+        int n = e.head.counts[si];
+        returning.resize(n);
+        if (n) memcpy(returning.data(), e.array(si), n * sizeof(float));
+        return returning;
+    }
+    if (!mapped || stale.contains(name)) return returning;
+
+    qint64 offset = index.value(name, -1);
+    if (offset < 0) return returning;
+
+    int n = record(offset)->counts[si];
+    returning.resize(n);
+    if (n) memcpy(returning.data(), array(offset, si), n * sizeof(float));
+
+    return returning;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_MeanMaxStore_h
+#define _GC_MeanMaxStore_h 1
+
+#include "RideFile.h"
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QDate>
+#include <QFile>
+#include <QMutex>
+
+#include <stdint.h>
+
+class Context;
+
+// MeanMaxStore is an athlete-wide aggregate of the mean-max arrays that
+// are held in each of the per-ride .cpx files. It lives in the athlete
+// cache directory as "meanmax.mmx" and is memory mapped, so a query
+// for a date range is just a walk over a date sorted index with a
+// max-reduce over float arrays that point straight into the mapped
+// file. Nothing is parsed or copied per ride.
+//
+// The .cpx files remain the source of truth; the store is updated
+// whenever RideFileCache::refreshCache() writes one and re-synced
+// against the cache directory the first time it is queried.
+//
+// There is only one writer, the athlete's store, which appends to it and
+// compacts it when the dead space gets too large. Anyone else (the API)
+// opens it readonly and never writes, truncates or compacts it; rides it
+// doesn't have yet, or that changed, are read from the .cpx instead.
+//
+// Only the .cpx of rides that still exist are included, those left
+// behind when a ride is deleted outside of GoldenCheetah are ignored.
+//
+static const unsigned int MeanMaxStoreVersion = 1;
+// revision history:
+// version  date         description
+// 1        10-Mar-18    Initial - header, append-only records
+
+// the series held for each ride, in the same order they are
+// written in the .cpx file so we can copy the block in one read
+static const int MeanMaxStoreSeriesCount = 16;
+
+// the file starts with a header
+struct MeanMaxStoreHeader {
+
+    char magic[4];              // "GCMM"
+    uint32_t version;           // MeanMaxStoreVersion
+    uint32_t cacheVersion;      // RideFileCacheVersion the data came from
+    uint32_t seriesCount;       // MeanMaxStoreSeriesCount
+};
+
+// followed by any number of records, each record is followed
+// by the float arrays for each series. A record with the same
+// name as an earlier one supersedes it, when a ride is deleted
+// we append a tombstone with no data. The file is grown ahead
+// of the records and zero padded, a zero length ends the walk.
+// The writer compacts it when the dead space gets too large.
+struct MeanMaxStoreRecord {
+
+    uint32_t length;            // bytes including this header and the arrays
+    uint32_t flags;             // see below
+    int32_t  julianDay;         // ride date
+    int32_t  secs;              // ride time of day
+    uint32_t crc;               // crc of the ride file when the .cpx was written
+    uint32_t reserved;
+    int64_t  stamp;             // .cpx last modified (msecs since epoch)
+    char     name[64];          // .cpx base name e.g. 2017_01_01_09_00_00
+    uint32_t counts[MeanMaxStoreSeriesCount];
+};
+
+class MeanMaxStore
+{
+    public:
+
+        enum { Run = 0x01, Deleted = 0x02 };
+
+        // context is optional, without it the run flag is
+        // only known for rides refreshed since startup
+        MeanMaxStore(QString cacheDir, Context *context=NULL, bool readonly=false);
+        ~MeanMaxStore();
+
+        // the .cpx file was just (re)written, update from it
+        void update(QString cacheFilename, bool isRun=false);
+
+        // the .cpx was removed along with the ride
+        void remove(QString cacheFilename);
+
+        // best for each duration across the date range, values are
+        // as stored in the .cpx so wattsKg is still * 100 etc
+        QVector<float> meanMaxFor(RideFile::SeriesType series, QDate from, QDate to, bool wantruns=true);
+
+        // just for a single ride
+        QVector<float> meanMaxFor(QString cacheFilename, RideFile::SeriesType series);
+
+        // the order series are held on disk, -1 if not held
+        static int indexFor(RideFile::SeriesType series);
+
+    private:
+
+        // sync with the .cpx files in the cache directory
+        void sync();
+
+        // (re)map the file and rebuild the index
+        void open();
+        void close();
+        bool map();
+        void compact();
+
+        // read the .cpx and append a record for it
+        bool read(QString cacheFilename, bool isRun, MeanMaxStoreRecord &add, QByteArray &data);
+        bool append(QString cacheFilename, bool isRun, bool tombstone=false);
+
+        const MeanMaxStoreRecord *record(qint64 offset) const {
+            return reinterpret_cast<const MeanMaxStoreRecord*>(mapped + offset);
+        }
+        const float *array(qint64 offset, int index) const;
+
+        // readonly, rides we read from the .cpx and the
+        // ones in the file that are out of date
+        struct Extra {
+            MeanMaxStoreRecord head;
+            QByteArray data;
+            const float *array(int index) const;
+        };
+        QHash<QString, Extra> extra;
+        QSet<QString> stale;
+
+        Context *context;
+        QString cacheDir;
+        bool readonly;
+        QFile file;
+        uchar *mapped;
+        qint64 mappedSize;
+        qint64 end;         // end of the valid records
+        qint64 deadBytes;   // superseded records and tombstones
+        bool synced, dirty;
+
+        // latest record offset by cpx basename and
+        // offsets sorted by ride date/time for range queries
+        QHash<QString, qint64> index;
+        QVector<qint64> byDate;
+
+        QMutex mutex;
+};
+#endif // _GC_MeanMaxStore_h
@@ -1892,6 +1892,22 @@ RideFilePoint::setValue(RideFile::SeriesType series, double value)
     }
 }
 
+QVector<double>
+RideFile::column(SeriesType series, int first, int count) const
+{
+    if (series < 0 || series >= none) return QVector<double>();
+
+    // clamp to the samples we have, count < 0 means to the end
+    if (first < 0) first = 0;
+    if (first > dataPoints_.count()) first = dataPoints_.count();
+    if (count < 0 || first + count > dataPoints_.count()) count = dataPoints_.count() - first;
+
+    QVector<double> values(count);
+    double *v = values.data();
+    for (int i=0; i<count; i++) v[i] = dataPoints_[first+i]->value(series);
+    return values;
+}
+
 double
 RideFile::getPointValue(int index, SeriesType series) const
 {
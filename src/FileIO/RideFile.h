@@ -278,6 +278,17 @@ class RideFile : public QObject // QObject to emit signals
 
         const QVector<RideFilePoint*> &dataPoints() const { return dataPoints_; }
 
+        // Working with COLUMNS
+        // a contiguous snapshot of a data series (or count samples of it
+        // from first) for code that scans it repeatedly, e.g. mean max,
+        // W'bal and user metrics, rather than chasing the point pointers.
+        // Nothing is kept by the ride: the copy is built on each call and
+        // belongs to the caller, so it always reflects the points as they
+        // are, including fields written directly. RideFilePoint is still
+        // the storage, this is not a structure-of-arrays layout. As with
+        // points, derived series must be recalculated before they are read.
+        QVector<double> column(SeriesType series, int first=0, int count=-1) const;
+
         // recalculate all the derived data series
         // might want to move to a factory for these
         // at some point, but for now hard coded
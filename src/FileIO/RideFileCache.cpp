@@ -21,6 +21,7 @@
 #include "Context.h"
 #include "Athlete.h"
 #include "RideCache.h"
+#include "MeanMaxStore.h"
 #include "Zones.h"
 #include "HrZones.h"
 #include "PaceZones.h"
@@ -305,50 +306,14 @@ static long countForMeanMax(RideFileCacheHeader head, RideFile::SeriesType serie
 
 QVector<float> RideFileCache::meanMaxPowerFor(Context *context, QVector<float> &wpk, QDate from, QDate to, bool wantruns)
 {
-    QVector<float> returning;
-    QVector<float> returningwpk;
-    bool first = true;
-
-    // look at all the rides
-    foreach (RideItem *item, context->athlete->rideCache->rides()) {
-
-        if (item->dateTime.date() < from || item->dateTime.date() > to) continue; // not one we want
-
-        if (item->isRun && !wantruns) continue; // they don't want runs
-
-        // get the power data
-        if (first == true) {
-
-            // first time through the whole thing is going to be best
-            returning =  meanMaxPowerFor(context, returningwpk, context->athlete->home->activities().canonicalPath() + "/" + item->fileName);
-            first = false;
-
-        } else {
-
-            QVector<float> thiswpk;
-
-            // next time through we should only pick out better times
-            QVector<float> ridebest = meanMaxPowerFor(context, thiswpk, context->athlete->home->activities().canonicalPath() + "/" + item->fileName);
-
-            // do we need to increase the returning array?
-            if (returning.size() < ridebest.size()) returning.resize(ridebest.size());
+    // the athlete-wide store has every ride's bests so this
+    // is a max-reduce over the rides in range, no file reads
+    MeanMaxStore *store = context->athlete->meanMaxStore;
 
-            // now update where its a better number
-            for (int i=0; i<ridebest.size(); i++)
-                if (ridebest[i] > returning[i]) returning[i] = ridebest[i];
-
-            // do we need to increase the returning array?
-            if (returningwpk.size() < thiswpk.size()) returningwpk.resize(thiswpk.size());
-
-            // now update where its a better number
-            for (int i=0; i<thiswpk.size(); i++)
-                if (thiswpk[i] > returningwpk[i]) returningwpk[i] =thiswpk[i];
-        }
-    }
+    wpk = store->meanMaxFor(RideFile::wattsKg, from, to, wantruns);
+    for(int i=0; i<wpk.size(); i++) wpk[i] = wpk[i] / 100.00f;
 
-    // set aggregated wpk
-    wpk = returningwpk;
-    return returning;
+    return store->meanMaxFor(RideFile::watts, from, to, wantruns);
 }
 
 QVector<float> RideFileCache::meanMaxPowerFor(Context *context, QVector<float>&wpk, QString fileName)
@@ -459,49 +424,6 @@ QVector<float> RideFileCache::meanMaxFor(QString cacheFilename, RideFile::Series
 
 }
 
-// API bests for a date range
-QVector<float> RideFileCache::meanMaxFor(QString cacheDir, RideFile::SeriesType series, QDate from, QDate to)
-{
-    QTime start;
-    start.start();
-
-    bool first = true;
-    QVector<float> returning;
-
-    // loop through all CPX files
-    foreach(QString cacheFilename, QDir(cacheDir).entryList(QDir::Files)) {
-
-        // is it a cpx file ?
-        if (!cacheFilename.endsWith(".cpx")) continue;
-   
-        // is it big enough ? 
-        if (QFileInfo(cacheDir + "/" + cacheFilename).size() < (int)sizeof(struct RideFileCacheHeader)) continue;
-
-        // lets check it parses ok ?
-        QDateTime dt;
-        if (!RideFile::parseRideFileName(cacheFilename, &dt)) continue; 
-
-        // in range?
-        if (dt.date() < from || dt.date() > to) continue;
-
-        // get data
-        QVector<float> current = RideFileCache::meanMaxFor(cacheDir + "/" + cacheFilename, series);
-
-        // first ?
-        if (first) {
-            first = false;
-            returning = current;
-        } else {
-            if (current.size() > returning.size()) returning.resize(current.size());
-            for(int i=0; i< current.size(); i++) if (current[i] > returning[i]) returning[i]=current[i];
-        }
-    }
-
-    // will be empty if no up to date cache
-    return returning;
-
-}
-
 RideFileCache::RideFileCache(RideFile *ride) :
                incomplete(false), context(ride->context), rideFileName(""), ride(ride)
 {
@@ -852,6 +774,10 @@ RideFileCache::refreshCache()
         // all done now, phew
         cacheFile.close();
 
+        // update the athlete-wide meanmax aggregate
+        if (context->athlete->meanMaxStore)
+            context->athlete->meanMaxStore->update(cacheFileName, ride->isRun());
+
         // invalidate any incore cache of aggregate
         // that contains this ride in its date range
         QDate date = ride->startTime().date();
@@ -905,23 +831,25 @@ void RideFileCache::RideFileCache::compute()
         return;
     }
 
-    // all the mean maxes
-    MeanMaxComputer thread1(ride, wattsMeanMax, RideFile::watts); thread1.start();
-    MeanMaxComputer thread2(ride, hrMeanMax, RideFile::hr); thread2.start();
-    MeanMaxComputer thread3(ride, cadMeanMax, RideFile::cad); thread3.start();
-    MeanMaxComputer thread4(ride, nmMeanMax, RideFile::nm); thread4.start();
-    MeanMaxComputer thread5(ride, kphMeanMax, RideFile::kph); thread5.start();
-    MeanMaxComputer thread6(ride, xPowerMeanMax, RideFile::xPower); thread6.start();
-    MeanMaxComputer thread7(ride, npMeanMax, RideFile::NP); thread7.start();
-    MeanMaxComputer thread8(ride, vamMeanMax, RideFile::vam); thread8.start();
-    MeanMaxComputer thread9(ride, wattsKgMeanMax, RideFile::wattsKg); thread9.start();
-    MeanMaxComputer thread10(ride, aPowerMeanMax, RideFile::aPower); thread10.start();
-    MeanMaxComputer thread11(ride, kphdMeanMax, RideFile::kphd); thread11.start();
-    MeanMaxComputer thread12(ride, wattsdMeanMax, RideFile::wattsd); thread12.start();
-    MeanMaxComputer thread13(ride, caddMeanMax, RideFile::cadd); thread13.start();
-    MeanMaxComputer thread14(ride, nmdMeanMax, RideFile::nmd); thread14.start();
-    MeanMaxComputer thread15(ride, hrdMeanMax, RideFile::hrd); thread15.start();
-    MeanMaxComputer thread16(ride, aPowerKgMeanMax, RideFile::aPowerKg); thread16.start();
+    // all the mean maxes, on this thread since we are usually
+    // called from a thread pool already (see RideCache::refresh)
+    MeanMaxComputer meanmax(ride);
+    meanmax.compute(wattsMeanMax, RideFile::watts);
+    meanmax.compute(hrMeanMax, RideFile::hr);
+    meanmax.compute(cadMeanMax, RideFile::cad);
+    meanmax.compute(nmMeanMax, RideFile::nm);
+    meanmax.compute(kphMeanMax, RideFile::kph);
+    meanmax.compute(xPowerMeanMax, RideFile::xPower);
+    meanmax.compute(npMeanMax, RideFile::NP);
+    meanmax.compute(vamMeanMax, RideFile::vam);
+    meanmax.compute(wattsKgMeanMax, RideFile::wattsKg);
+    meanmax.compute(aPowerMeanMax, RideFile::aPower);
+    meanmax.compute(kphdMeanMax, RideFile::kphd);
+    meanmax.compute(wattsdMeanMax, RideFile::wattsd);
+    meanmax.compute(caddMeanMax, RideFile::cadd);
+    meanmax.compute(nmdMeanMax, RideFile::nmd);
+    meanmax.compute(hrdMeanMax, RideFile::hrd);
+    meanmax.compute(aPowerKgMeanMax, RideFile::aPowerKg);
 
     // all the different distributions
     computeDistribution(wattsDistribution, RideFile::watts);
@@ -935,24 +863,6 @@ void RideFileCache::RideFileCache::compute()
     computeDistribution(smo2Distribution, RideFile::smo2);
     computeDistribution(wbalDistribution, RideFile::wbal);
 
-    // wait for them threads
-    thread1.wait();
-    thread2.wait();
-    thread3.wait();
-    thread4.wait();
-    thread5.wait();
-    thread6.wait();
-    thread7.wait();
-    thread8.wait();
-    thread9.wait();
-    thread10.wait();
-    thread11.wait();
-    thread12.wait();
-    thread13.wait();
-    thread14.wait();
-    thread15.wait();
-    thread16.wait();
-
     // setup the doubles the users use
     doubleArray(wattsMeanMaxDouble, wattsMeanMax, RideFile::watts);
     doubleArray(hrMeanMaxDouble, hrMeanMax, RideFile::hr);
@@ -1106,29 +1016,26 @@ void RideFileCache::RideFileCache::compute()
 
 */
 
-static data_t *
-integrate_series(cpintdata &data)
-{
-    // would be better to do pure QT and use QVector -- but no memory leak
-    data_t *integrated= (data_t *)malloc(sizeof(data_t)*(data.points.size()+1)); 
-    int i;
-    data_t acc=0;
-
-    for (i=0; i<data.points.size(); i++) {
-        integrated[i]=acc;
-        acc+=data.points[i].value;
-    }
-    integrated[i]=acc;
-
-    return integrated;
-}
-
 static data_t
 partial_max_mean(data_t *dataseries_i, int start, int end, int length, int *offset)
 {
     int i=0;
     data_t candidate=0;
 
+    // when we don't need the offset it's a plain max-reduce
+    // over the differences, which the compiler will vectorise
+    if (offset == NULL) {
+        const data_t *from = dataseries_i + start;
+        const data_t *to = dataseries_i + start + length;
+        const int count = 1+end-length-start;
+
+        for (i=0; i<count; i++) {
+            data_t test_energy=to[i]-from[i];
+            candidate = test_energy > candidate ? test_energy : candidate;
+        }
+        return candidate;
+    }
+
     int best_i=0;
 
     for (i=start; i<(1+end-length); i++) {
@@ -1171,7 +1078,7 @@ divided_max_mean(data_t *dataseries_i, int datalength, int length, int *offset)
         if (energy < candidate) {
           continue;
         }
-        data_t window_mm=partial_max_mean(dataseries_i, start, end, length, &this_offset);
+        data_t window_mm=partial_max_mean(dataseries_i, start, end, length, offset ? &this_offset : NULL);
 
         if (window_mm>candidate) {
             candidate=window_mm;
@@ -1189,7 +1096,7 @@ divided_max_mean(data_t *dataseries_i, int datalength, int length, int *offset)
 
         if (energy >= candidate) {
 
-            data_t window_mm=partial_max_mean(dataseries_i, start, end, length, &this_offset);
+            data_t window_mm=partial_max_mean(dataseries_i, start, end, length, offset ? &this_offset : NULL);
 
             if (window_mm>candidate) {
                 candidate=window_mm;
@@ -1202,35 +1109,8 @@ divided_max_mean(data_t *dataseries_i, int datalength, int length, int *offset)
 }
 
 
-void
-MeanMaxComputer::run()
+MeanMaxComputer::MeanMaxComputer(RideFile *ride) : ride(ride), total_secs(0)
 {
-    // xPower and NP need watts to be present
-    RideFile::SeriesType baseSeries = (series == RideFile::xPower || series == RideFile::NP || series == RideFile::wattsKg) ?
-                                      RideFile::watts : series;
-
-    if (series == RideFile::aPowerKg) baseSeries = RideFile::aPower;
-    else if (series == RideFile::vam) baseSeries = RideFile::alt;
-
-    // there is a distinction between needing it present and using it in calcs
-    RideFile::SeriesType needSeries = baseSeries;
-    if (series == RideFile::kphd) needSeries = RideFile::kph;
-    if (series == RideFile::wattsd) needSeries = RideFile::watts;
-    if (series == RideFile::cadd) needSeries = RideFile::cad;
-    if (series == RideFile::nmd) needSeries = RideFile::nm;
-    if (series == RideFile::hrd) needSeries = RideFile::hr;
-
-    // only bother if the data series is actually present
-    if (ride->isDataPresent(needSeries) == false) return;
-
-    // if we want decimal places only keep to 1 dp max
-    // this is a factor that is applied at the end to
-    // convert from high-precision double to long
-    // e.g. 145.456 becomes 1455 if we want decimals
-    // and becomes 145 if we don't
-    double decimals =  pow(10, RideFileCache::decimalsFor(series));
-    //double decimals = RideFile::decimalsFor(baseSeries) ? 10 : 1;
-
     // decritize the data series - seems wrong, since it just
     // rounds to the nearest second - what if the recIntSecs
     // is less than a second? Has been used for a long while
@@ -1244,21 +1124,18 @@ MeanMaxComputer::run()
     // zero, since some files have a very large start time
     // that creates work for nil effect (but increases compute
     // time drastically).
-    cpintdata data;
-    data.rec_int_ms = (int) round(ride->recIntSecs() * 1000.0);
+    //
+    // The layout is the same for every series so we only work
+    // it out once and remember which sample goes where.
+    const QVector<double> secsColumn = ride->column(RideFile::secs);
     double lastsecs = 0;
-    bool first = true;
-    double offset = 0;
-    foreach (const RideFilePoint *p, ride->dataPoints()) {
-
-        // get offset to apply on all samples if first sample
-        if (first == true) {
-            offset = p->secs;
-            first = false;
-        }
+    double offset = secsColumn.count() ? secsColumn[0] : 0; // start from first sample
+    double last = 0;
+
+    for (int index=0; index < secsColumn.count(); index++) {
 
         // drag back to start at 1s or whatever recIntSecs() is !
-        double psecs = p->secs - offset + ride->recIntSecs();
+        double psecs = secsColumn[index] - offset + ride->recIntSecs();
 
         // fill in any gaps in recording - use same dodgy rounding as before
         int count = (psecs - lastsecs - ride->recIntSecs()) / ride->recIntSecs();
@@ -1266,19 +1143,66 @@ MeanMaxComputer::run()
         // gap more than an hour, damn that ride file is a mess
         if (count > 3600) count = 1;
 
-        for(int i=0; i<count; i++)
-            data.points.append(cpintpoint(round(lastsecs+((i+1)*ride->recIntSecs() *1000.0)/1000), 0));
+        for(int i=0; i<count; i++) {
+            samples << -1;
+            last = round(lastsecs+((i+1)*ride->recIntSecs() *1000.0)/1000);
+        }
         lastsecs = psecs;
 
         double secs = round(psecs * 1000.0) / 1000;
-        if (secs > 0) data.points.append(cpintpoint(secs, (int) round(p->value(baseSeries)*double(decimals))));
+        if (secs > 0) {
+            samples << index;
+            last = secs;
+        }
     }
+    total_secs = (int) ceil(last);
+}
 
+const QVector<double> &
+MeanMaxComputer::resampled(RideFile::SeriesType base, int decimals)
+{
+    QPair<int,int> key(base, decimals);
+    QMap<QPair<int,int>, QVector<double> >::iterator it = buffers.find(key);
+    if (it != buffers.end()) return it.value();
 
-    // don't bother with insufficient data
-    if (!data.points.count()) return;
+    // if we want decimal places only keep to 1 dp max
+    // this is a factor that is applied at the end to
+    // convert from high-precision double to long
+    // e.g. 145.456 becomes 1455 if we want decimals
+    // and becomes 145 if we don't
+    const double factor = pow(10, decimals);
+    const QVector<double> column = ride->column(base);
+
+    QVector<double> values(samples.count());
+    for (int i=0; i<samples.count(); i++)
+        values[i] = samples[i] < 0 ? 0 : (int) round(column[samples[i]] * factor);
+
+    return buffers.insert(key, values).value();
+}
+
+void
+MeanMaxComputer::compute(QVector<float>&array, RideFile::SeriesType series)
+{
+    // xPower and NP need watts to be present
+    RideFile::SeriesType baseSeries = (series == RideFile::xPower || series == RideFile::NP || series == RideFile::wattsKg) ?
+                                      RideFile::watts : series;
 
-    int total_secs = (int) ceil(data.points.back().secs);
+    if (series == RideFile::aPowerKg) baseSeries = RideFile::aPower;
+    else if (series == RideFile::vam) baseSeries = RideFile::alt;
+
+    // there is a distinction between needing it present and using it in calcs
+    RideFile::SeriesType needSeries = baseSeries;
+    if (series == RideFile::kphd) needSeries = RideFile::kph;
+    if (series == RideFile::wattsd) needSeries = RideFile::watts;
+    if (series == RideFile::cadd) needSeries = RideFile::cad;
+    if (series == RideFile::nmd) needSeries = RideFile::nm;
+    if (series == RideFile::hrd) needSeries = RideFile::hr;
+
+    // only bother if the data series is actually present
+    if (ride->isDataPresent(needSeries) == false) return;
+
+    // don't bother with insufficient data
+    if (!samples.count()) return;
 
     // don't allow data more than two days
     // was one week, but no single ride is longer
@@ -1288,6 +1212,11 @@ MeanMaxComputer::run()
     // don't allow if badly parsed or time goes backwards
     if (total_secs < 0) return;
 
+    // a copy of the shared buffer that we can adjust
+    QVector<double> data = resampled(baseSeries, RideFileCache::decimalsFor(series));
+    const int count = data.count();
+    double *values = data.data();
+
     //
     // Pre-process the data for NP, xPower and VAM
     //
@@ -1297,19 +1226,19 @@ MeanMaxComputer::run()
 
         double lastAlt=0;
 
-        for (int i=0; i<data.points.size(); i++) {
+        for (int i=0; i<count; i++) {
 
             // handle drops gracefully (and first sample too)
             // if you manage to rise >5m in a second thats a data error too!
-            if (!lastAlt || (data.points[i].value - lastAlt) > 5) lastAlt=data.points[i].value;
+            if (!lastAlt || (values[i] - lastAlt) > 5) lastAlt=values[i];
 
             // NOTE: It is 360 not 3600 because Altitude is factored for decimal places
             //       since it is the base data series, but we are calculating VAM
             //       And we multiply by 10 at the end!
-            double vam = (((data.points[i].value - lastAlt) * 360)/ride->recIntSecs()) * 10;
+            double vam = (((values[i] - lastAlt) * 360)/ride->recIntSecs()) * 10;
             if (vam < 0) vam = 0;
-            lastAlt = data.points[i].value;
-            data.points[i].value = vam;
+            lastAlt = values[i];
+            values[i] = vam;
         }
     }
 
@@ -1329,13 +1258,13 @@ MeanMaxComputer::run()
 
             // loop over the data and convert to a rolling
             // average for the given windowsize
-            for (int i=0; i<data.points.size(); i++) {
+            for (int i=0; i<count; i++) {
 
-                sum += data.points[i].value;
+                sum += values[i];
                 sum -= rolling[index];
 
-                rolling[index] = data.points[i].value;
-                data.points[i].value = pow(sum/(double)rollingwindowsize,4.0f); // raise rolling average to 4th power
+                rolling[index] = values[i];
+                values[i] = pow(sum/(double)rollingwindowsize,4.0f); // raise rolling average to 4th power
 
                 // move index on/round
                 index = (index >= rollingwindowsize-1) ? 0 : index+1;
@@ -1351,7 +1280,6 @@ MeanMaxComputer::run()
 
         int rollingwindowsize = 25 / ride->recIntSecs();
         double ewma = 0.0;
-        double sum = 0.0; // as we ramp up
 
         // no point doing a rolling average if the
         // sample rate is greater than the rolling average
@@ -1359,42 +1287,35 @@ MeanMaxComputer::run()
         if (rollingwindowsize > 1) {
 
             // loop over the data and convert to a EWMA
-            for (int i=0; i<data.points.size(); i++) {
-
-                // dgr : BikeScore has weighting value from first point
-                if (false && i < rollingwindowsize) {
-
-                    // get up to speed
-                    sum += data.points[i].value;
-                    ewma = sum / (i+1);
-
-                } else {
-
-                    // we're up to speed
-                    ewma = (data.points[i].value * exp) + (ewma * rem);
-                }
-                data.points[i].value = pow(ewma, 4.0f);
+            for (int i=0; i<count; i++) {
+                ewma = (values[i] * exp) + (ewma * rem);
+                values[i] = pow(ewma, 4.0f);
             }
         }
     }
 
     if (series == RideFile::wattsKg || series == RideFile::aPowerKg) {
-        for (int i=0; i<data.points.size(); i++) {
-            double wattsKg = data.points[i].value / ride->getWeight();
-            data.points[i].value = wattsKg;
-        }
+        const double weight = ride->getWeight();
+        for (int i=0; i<count; i++) values[i] = values[i] / weight;
     }
 
-
     // the bests go in here...
     QVector <double> ride_bests(total_secs + 1);
 
-    data_t *dataseries_i = integrate_series(data);
+    // prefix sums for the search
+    QVector<data_t> integrated(count+1);
+    data_t *dataseries_i = integrated.data();
+    data_t acc=0;
+    for (int i=0; i<count; i++) {
+        dataseries_i[i]=acc;
+        acc+=values[i];
+    }
+    dataseries_i[count]=acc;
 
-    for (int i=1; i<data.points.size();) {
+    for (int i=1; i<count;) {
 
-        int offset;
-        data_t c=divided_max_mean(dataseries_i,data.points.size(),i,&offset);
+        // we don't need the offset, so the search vectorises
+        data_t c=divided_max_mean(dataseries_i,count,i,NULL);
 
         // snaffle it away
         int sec = i*ride->recIntSecs();
@@ -1416,7 +1337,6 @@ MeanMaxComputer::run()
         else if (i<7200) i += 120;
         else i += 300;
     }
-    free(dataseries_i);
 
     //
     // FILL IN THE GAPS AND FILL TARGET ARRAY
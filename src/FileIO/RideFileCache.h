@@ -176,9 +176,9 @@ class RideFileCache
         // Fast standalone search reads input and outputs into ride_bests
         static void fastSearch(QVector<int>&input, QVector<int>&ride_bests, QVector<int>&ride_offsets);
 
-        // used by the API - get MM for any series for an activity or date range
+        // used by the API - get MM for any series for an activity, for a
+        // date range see APIAthleteCache::meanMax()
         static QVector<float> meanMaxFor(QString cachFilename, RideFile::SeriesType series);
-        static QVector<float> meanMaxFor(QString cacheDir, RideFile::SeriesType series, QDate from, QDate to);
 
         // not actually a copy constructor -- but we call it IN the constructor.
         RideFileCache(RideFileCache *other) { *this = *other; }
@@ -404,20 +404,32 @@ struct cpintdata {
     cpintdata() : rec_int_ms(0) {}
 };
 
-// the mean-max computer ... runs in a thread
-class MeanMaxComputer : public QThread
+// the mean-max computer ... runs on the caller's thread
+//
+// The base series are resampled once and shared by all the series that
+// derive from them (e.g. watts, NP, xPower and wattsKg all start from
+// the power column) and the search for each duration is a max-reduce
+// over the prefix sums that the compiler can vectorise.
+class MeanMaxComputer
 {
     public:
-        MeanMaxComputer(RideFile *ride, QVector<float>&array, RideFile::SeriesType series)
-        : ride(ride), array(array), series(series) {}
-        void run();
+        MeanMaxComputer(RideFile *ride);
+
+        // compute the mean max for series into array
+        void compute(QVector<float>&array, RideFile::SeriesType series);
 
     private:
 
+        // base series resampled with gaps filled, values are
+        // rounded to the precision of the series being computed
+        const QVector<double> &resampled(RideFile::SeriesType base, int decimals);
+
         RideFile *ride;
-        QVector<float> &array;
-        QVector<data_t> integratedArray;
 
-        RideFile::SeriesType series;
+        // layout after filling gaps; sample index or -1 for a gap
+        QVector<int> samples;
+        int total_secs;
+
+        QMap<QPair<int,int>, QVector<double> > buffers;
 };
 #endif // _GC_RideFileCache_h
@@ -198,8 +198,9 @@ Snippets::postProcess(RideFile *ride, DataProcessorConfig *config=0, QString op=
                 // create an interval item for each interval
                 IntervalItem interval(&rideItem, ri->name, ri->start, ri->stop, 0, 0, 1,
                                              QColor(Qt::black), RideFileInterval::USER);
-                // refresh metrics
+                // refresh metrics, all of them
                 interval.refresh();
+                interval.compute();
 
                 // lists of intervals
                 if (first) out << "\n";
@@ -29,6 +29,7 @@
 #include "HelpWhatsThis.h"
 #include <QMap>
 #include <cmath>
+#include <algorithm>
 
 // helper function
 static void clearResultsTable(QTableWidget *);
@@ -829,17 +830,12 @@ AddIntervalDialog::findPeakPowerStandard(Context *context, const RideFile *ride,
 {
     QString prefix = tr("Peak");
 
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 5, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 10, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 20, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 30, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 60, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 120, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 300, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 600, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 1200, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 1800, 1, results, prefix, "");
-    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, 3600, 1, results, prefix, "");
+    QList<double> durations;
+    durations << 5 << 10 << 20 << 30 << 60 << 120 << 300 << 600 << 1200 << 1800 << 3600;
+
+    QList<QList<AddedInterval> > peaks;
+    findPeaks(context, true, ride, Specification(), RideFile::watts, RideFile::original, durations, 1, peaks, prefix, "");
+    foreach(const QList<AddedInterval> &peak, peaks) results.append(peak);
 }
 
 void
@@ -847,125 +843,202 @@ AddIntervalDialog::findPeaks(Context *context, bool typeTime, const RideFile *ri
                              RideFile::SeriesType series, RideFile::Conversion conversion, double windowSize,
                               int maxIntervals, QList<AddedInterval> &results, QString prefixe, QString overideName)
 {
-    QList<AddedInterval> bests;
-    QList<AddedInterval> _results;
+    QList<QList<AddedInterval> > peaks;
+    findPeaks(context, typeTime, ride, spec, series, conversion, QList<double>() << windowSize,
+              maxIntervals, peaks, prefixe, overideName);
+    results.append(peaks[0]);
+}
 
-    double secsDelta = ride->recIntSecs();
-    double total = 0.0;
-    QList<const RideFilePoint*> window;
+// a candidate window ending at sample end, for the top-k heap
+struct PeakCandidate {
+    int end;
+    double start, avg;
+};
 
-    // ride is shorter than the window size!
-    if (typeTime && windowSize > ride->dataPoints().last()->secs + secsDelta) return;
-    if (!typeTime && windowSize > ride->dataPoints().last()->km*1000) return;
+struct ComparePeakCandidates {
+    // heap with the highest power and earliest start on top, same as CompareBests
+    bool operator()(const PeakCandidate &a, const PeakCandidate &b) const {
+        if (a.avg < b.avg) return true;
+        if (b.avg < a.avg) return false;
+        return a.start > b.start;
+    }
+};
 
-    // We're looking for intervals with durations in [windowSizeSecs, windowSizeSecs + secsDelta).
+void
+AddIntervalDialog::findPeaks(Context *context, bool typeTime, const RideFile *ride, Specification spec,
+                             RideFile::SeriesType series, RideFile::Conversion conversion, QList<double> windowSizes,
+                             int maxIntervals, QList<QList<AddedInterval> > &results, QString prefixe, QString overideName)
+{
+    int windows = windowSizes.count();
+    results.clear();
+    for (int w=0; w<windows; w++) results << QList<AddedInterval>();
+    if (ride->dataPoints().isEmpty() || maxIntervals < 1) return;
+
+    double secsDelta = ride->recIntSecs();
+
+    // the samples we're looking at with a running sum, so the
+    // total for samples i..j is sum[j+1]-sum[i] for any window
+    QVector<const RideFilePoint*> points;
+    QVector<double> sum;
+    sum << 0;
     RideFileIterator it(const_cast<RideFile*>(ride), spec);
     while (it.hasNext()) {
-        struct RideFilePoint *point = it.next();
+        const RideFilePoint *point = it.next();
+        points << point;
+        sum << sum.last() + point->value(series);
+    }
+    int n = points.count();
+
+    // per window: where it starts now, the best so far (when we only
+    // want one) or all the candidates (when we want the top k)
+    QVector<int> first(windows, 0);
+    QVector<bool> wanted(windows, true);
+    QVector<PeakCandidate> best(windows);
+    QVector<bool> found(windows, false);
+    QVector<QVector<PeakCandidate> > candidates(windows);
+
+    for (int w=0; w<windows; w++) {
+        // ride is shorter than the window size!
+        if (typeTime && windowSizes[w] > ride->dataPoints().last()->secs + secsDelta) wanted[w] = false;
+        if (!typeTime && windowSizes[w] > ride->dataPoints().last()->km*1000) wanted[w] = false;
+    }
 
-        // Discard points until interval duration is < windowSizeSecs + secsDelta.
-        while ((typeTime && !window.empty() && intervalDuration(window.first(), point, ride) >= windowSize + secsDelta) ||
-               (!typeTime && window.length()>1 && intervalDistance(window.at(1), point, ride) >= windowSize)) {
-            total -= window.first()->value(series);
-            window.takeFirst();
-        }
-        // Add points until interval duration or distance is >= windowSize.
-        total += point->value(series);
-        window.append(point);
-        double duration = intervalDuration(window.first(), window.last(), ride);
-        double distance = intervalDistance(window.first(), window.last(), ride);
+    // We're looking for intervals with durations in [windowSizeSecs, windowSizeSecs + secsDelta).
+    // one pass through the samples moving every window along together
+    for (int j=0; j<n; j++) {
 
-        if ((typeTime && duration >= windowSize) ||
-            (!typeTime && distance >= windowSize)) {
-            double start = window.first()->secs;
-            double stop = window.last()->secs; //start + duration;
-            double avg = total * secsDelta / duration;
-            bests.append(AddedInterval(start, stop, avg));
+        const RideFilePoint *point = points[j];
+
+        for (int w=0; w<windows; w++) {
+
+            if (!wanted[w]) continue;
+            double windowSize = windowSizes[w];
+            int &i = first[w];
+
+            // Discard points until interval duration is < windowSizeSecs + secsDelta.
+            while ((typeTime && i < j && intervalDuration(points[i], point, ride) >= windowSize + secsDelta) ||
+                   (!typeTime && j-i > 1 && intervalDistance(points[i+1], point, ride) >= windowSize)) {
+                i++;
+            }
+
+            double duration = intervalDuration(points[i], point, ride);
+            double distance = intervalDistance(points[i], point, ride);
+
+            if ((typeTime && duration >= windowSize) ||
+                (!typeTime && distance >= windowSize)) {
+
+                PeakCandidate candidate;
+                candidate.end = j;
+                candidate.start = points[i]->secs;
+                candidate.avg = (sum[j+1] - sum[i]) * secsDelta / duration;
+
+                if (maxIntervals == 1) {
+                    // just keep the best, ties go to the earliest
+                    if (!found[w] || candidate.avg > best[w].avg) {
+                        best[w] = candidate;
+                        found[w] = true;
+                    }
+                } else {
+                    candidates[w] << candidate;
+                }
+            }
         }
     }
 
-    std::sort(bests.begin(), bests.end(), CompareBests());
+    for (int w=0; w<windows; w++) {
 
-    while (!bests.empty() && (_results.size() < maxIntervals)) {
-        AddedInterval candidate = bests.takeFirst();
-        bool overlaps = false;
-        foreach (const AddedInterval &existing, _results) {
-            if (intervalsOverlap(candidate, existing)) {
-                overlaps = true;
-                break;
+        double windowSize = windowSizes[w];
+        QList<AddedInterval> &_results = results[w];
+
+        // best first, skipping any that overlap one we already have
+        QVector<PeakCandidate> &heap = candidates[w];
+        if (found[w]) heap << best[w];
+        std::make_heap(heap.begin(), heap.end(), ComparePeakCandidates());
+
+        while (!heap.isEmpty() && (_results.size() < maxIntervals)) {
+
+            std::pop_heap(heap.begin(), heap.end(), ComparePeakCandidates());
+            PeakCandidate top = heap.last();
+            heap.removeLast();
+
+            AddedInterval candidate(top.start, points[top.end]->secs, top.avg);
+            bool overlaps = false;
+            foreach (const AddedInterval &existing, _results) {
+                if (intervalsOverlap(candidate, existing)) {
+                    overlaps = true;
+                    break;
+                }
             }
-        }
-        if (!overlaps) {
-            QString name = overideName;
-            if (overideName == "") {
-                name = tr("%1 %3%4 %2");
-
-                if (prefixe == "")
-                    name = name.arg(tr("Peak"));
-                else
-                    name = name.arg(prefixe);
-
-                if (maxIntervals>1)
-                    name = name.arg(QString("#%1").arg(_results.count()+1));
-                else
-                    name = name.arg("");
-
-                if (typeTime)  {
-                    // best n mins
-                    if (windowSize < 60) {
-                        // whole seconds
-                        name = name.arg(windowSize);
-                        name = name.arg("sec");
-                    } else if (windowSize >= 60 && !(((int)windowSize)%60)) {
-                        // whole minutes
-                        name = name.arg(windowSize/60);
-                        name = name.arg("min");
-                    } else {
-                        double secs = windowSize;
-                        double mins = ((int) secs) / 60;
-                        secs = secs - mins * 60.0;
-                        double hrs = ((int) mins) / 60;
-                        mins = mins - hrs * 60.0;
-                        QString tm = "%1:%2:%3";
-                        tm = tm.arg(hrs, 0, 'f', 0);
-                        tm = tm.arg(mins, 2, 'f', 0, QLatin1Char('0'));
-                        tm = tm.arg(secs, 2, 'f', 0, QLatin1Char('0'));
-
-                        // mins and secs
-                        name = name.arg(tm);
+            if (!overlaps) {
+                QString name = overideName;
+                if (overideName == "") {
+                    name = tr("%1 %3%4 %2");
+
+                    if (prefixe == "")
+                        name = name.arg(tr("Peak"));
+                    else
+                        name = name.arg(prefixe);
+
+                    if (maxIntervals>1)
+                        name = name.arg(QString("#%1").arg(_results.count()+1));
+                    else
                         name = name.arg("");
-                    }
-                } else {
-                    // best n mins
-                    if (windowSize < 1000) {
-                        // whole seconds
-                        name = name.arg(windowSize);
-                        name = name.arg("m");
+
+                    if (typeTime)  {
+                        // best n mins
+                        if (windowSize < 60) {
+                            // whole seconds
+                            name = name.arg(windowSize);
+                            name = name.arg("sec");
+                        } else if (windowSize >= 60 && !(((int)windowSize)%60)) {
+                            // whole minutes
+                            name = name.arg(windowSize/60);
+                            name = name.arg("min");
+                        } else {
+                            double secs = windowSize;
+                            double mins = ((int) secs) / 60;
+                            secs = secs - mins * 60.0;
+                            double hrs = ((int) mins) / 60;
+                            mins = mins - hrs * 60.0;
+                            QString tm = "%1:%2:%3";
+                            tm = tm.arg(hrs, 0, 'f', 0);
+                            tm = tm.arg(mins, 2, 'f', 0, QLatin1Char('0'));
+                            tm = tm.arg(secs, 2, 'f', 0, QLatin1Char('0'));
+
+                            // mins and secs
+                            name = name.arg(tm);
+                            name = name.arg("");
+                        }
                     } else {
-                        double dist = windowSize;
-                        double kms = ((int) dist) / 1000;
-                        dist = dist - kms * 1000.0;
-                        double ms = dist;
-
-                        QString tm = "%1,%2";
-                        tm = tm.arg(kms);
-                        tm = tm.arg(ms);
-
-                        // km and m
-                        name = name.arg(tm);
-                        name = name.arg("km");
+                        // best n mins
+                        if (windowSize < 1000) {
+                            // whole seconds
+                            name = name.arg(windowSize);
+                            name = name.arg("m");
+                        } else {
+                            double dist = windowSize;
+                            double kms = ((int) dist) / 1000;
+                            dist = dist - kms * 1000.0;
+                            double ms = dist;
+
+                            QString tm = "%1,%2";
+                            tm = tm.arg(kms);
+                            tm = tm.arg(ms);
+
+                            // km and m
+                            name = name.arg(tm);
+                            name = name.arg("km");
+                        }
                     }
                 }
-            }
-            name += " (%4)";
-            name = name.arg(ride->formatValueWithUnit(round(candidate.avg), series, conversion, context, ride->isSwim()));
+                name += " (%4)";
+                name = name.arg(ride->formatValueWithUnit(round(candidate.avg), series, conversion, context, ride->isSwim()));
 
-            candidate.name = name;
-            name = "";
-            _results.append(candidate);
+                candidate.name = name;
+                _results.append(candidate);
+            }
         }
     }
-    results.append(_results);
 }
 
 void
@@ -56,6 +56,11 @@ class AddIntervalDialog : public QDialog
                               RideFile::Conversion conversion, double windowSizeSecs,
                               int maxIntervals, QList<AddedInterval> &results, QString prefixe, QString overideName);
 
+        // as above for several window sizes in one pass, results[i] are for windowSizes[i]
+        static void findPeaks(Context *context, bool typeTime, const RideFile *ride, Specification spec, RideFile::SeriesType series,
+                              RideFile::Conversion conversion, QList<double> windowSizes,
+                              int maxIntervals, QList<QList<AddedInterval> > &results, QString prefixe, QString overideName);
+
         static void findFirsts(bool typeTime, const RideFile *ride, double windowSizeSecs,
                                int maxIntervals, QList<AddedInterval> &results);
 
@@ -794,7 +794,7 @@ ComparePane::dropEvent(QDropEvent *event)
             add.rideItem->setFrom(*rideItem, true); // this wipes ride_ so put back
             add.rideItem->ride_ = add.data;
             add.rideItem->metadata_ = add.data->tags();
-            add.rideItem->getWeight();
+            add.rideItem->weight = add.rideItem->getWeight();
             add.rideItem->isRun = add.data->isRun();
             add.rideItem->isSwim = add.data->isSwim();
             add.rideItem->present = add.data->getTag("Data", "");
@@ -941,7 +941,7 @@ ComparePane::dropEvent(QDropEvent *event)
                             add.rideItem->setFrom(*matched->rideItem(), true); // this wipes ride_ so put back below
                             add.rideItem->ride_ = add.data;
                             add.rideItem->metadata_ = add.data->tags();
-                            add.rideItem->getWeight();
+                            add.rideItem->weight = add.rideItem->getWeight();
                             add.rideItem->isRun = add.data->isRun();
                             add.rideItem->isSwim = add.data->isSwim();
                             add.rideItem->present = add.data->getTag("Data", "");
@@ -471,6 +471,7 @@ MainWindow::MainWindow(const QDir &home)
 
     optionsMenu->addAction(tr("Create Heat Map..."), this, SLOT(generateHeatMap()), tr(""));
     optionsMenu->addAction(tr("Export Metrics as CSV..."), this, SLOT(exportMetrics()), tr(""));
+    optionsMenu->addAction(tr("Export Ride Cache as JSON..."), this, SLOT(exportRideCache()), tr(""));
 
 #ifdef GC_HAS_CLOUD_DB
     // CloudDB options
@@ -1939,6 +1940,24 @@ MainWindow::exportMetrics()
     currentTab->context->athlete->rideCache->writeAsCSV(fileName);
 }
 
+void
+MainWindow::exportRideCache()
+{
+    // if the refresh process is running, try again when its completed
+    if (currentTab->context->athlete->rideCache->isRunning()) {
+        QMessageBox::warning(this, tr("Refresh in Progress"),
+        "A metric refresh is currently running, please try again once that has completed.");
+        return;
+    }
+
+    // a rideDB.json as earlier versions wrote, they can read it from the cache folder
+    QString fileName = QFileDialog::getSaveFileName( this, tr("Export Ride Cache"), QDir::homePath() + "/rideDB.json", tr("JSON (*.json)"));
+    if (fileName.length() == 0) return;
+
+    // export
+    currentTab->context->athlete->rideCache->exportJSON(fileName);
+}
+
 /*----------------------------------------------------------------------
  * Import Workout from Disk
  *--------------------------------------------------------------------*/
@@ -220,6 +220,7 @@ class MainWindow : public QMainWindow
         void exportBatch();
         void generateHeatMap();
         void exportMetrics();
+        void exportRideCache();
         void addAccount();
         void manualProcess(QString);
         void importFile();
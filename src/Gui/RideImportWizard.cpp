@@ -41,6 +41,7 @@
 
 #include <QDebug>
 #include <QWaitCondition>
+#include <QtConcurrent>
 #include <QMessageBox>
 
 enum WizardTable {
@@ -52,6 +53,32 @@ enum WizardTable {
     STATUS_COLUMN,
 };
 
+// runs on the worker pool
+static RideImportParse parseRideFile(Context *context, QString filename, bool archives)
+{
+    RideImportParse returning;
+    QFile file(filename);
+    returning.ride = RideFileFactory::instance().openRideFile(context, file, returning.errors,
+                                                              archives ? &returning.rides : NULL);
+    return returning;
+}
+
+// runs on the writer
+static bool writeRideFile(Context *context, RideFile *ride, QString filename)
+{
+    JsonFileReader reader;
+    QFile target(filename);
+    return reader.writeRideFile(context, ride, target);
+}
+
+static void discard(RideImportParse &parse)
+{
+    foreach(RideFile *ride, parse.rides) if (ride != parse.ride) delete ride;
+    delete parse.ride;
+    parse.rides.clear();
+    parse.ride = NULL;
+}
+
 // drag and drop passes urls ... convert to a list of files and call main constructor
 RideImportWizard::RideImportWizard(QList<QUrl> *urls, Context *context, QWidget *parent) : QDialog(parent), context(context)
 {
@@ -551,13 +578,17 @@ RideImportWizard::process()
               this->repaint();
               QApplication::processEvents();
 
-              QList<RideFile*> rides;
-              RideFile *ride = RideFileFactory::instance().openRideFile(context, thisfile, errors, &rides);
+              // parsed on the worker pool, we only wait if it isn't ready yet
+              RideImportParse parse = parsed(i, true);
+              QList<RideFile*> rides = parse.rides;
+              RideFile *ride = parse.ride;
+              errors = parse.errors;
 
               // is this an archive of files?
               if (rides.count() > 1) {
 
                  int here = i;
+                 if (ride && !rides.contains(ride)) delete ride;
 
                  // remove current filename from state arrays and tableview
                  filenames.removeAt(here);
@@ -999,7 +1030,10 @@ RideImportWizard::abortClicked()
     QChar zero = QLatin1Char ( '0' );
 
 
-    // Saving now - process the files one-by-one
+    // Saving now - the files are parsed ahead on the worker pool, processed
+    // here in table order and written one at a time while we get on with the
+    // next, the write is finished off (added to the ride cache) in order too
+    QSet<QString> targets; // claimed so far, to catch duplicates in this import
     for (int i=0; i< filenames.count(); i++) {
 
         if (tableWidget->item(i,WizardTable::STATUS_COLUMN)->text().startsWith(tr("Error"))) continue; // skip errors
@@ -1010,6 +1044,8 @@ RideImportWizard::abortClicked()
         if (aborted) { done(0); return; }
         this->repaint();
 
+        // parsed on the worker pool, we only wait if it isn't ready yet
+        RideImportParse parse = parsed(i, false);
 
         // SAVE STEP 3 - prepare the new file names for the next steps - basic name and .JSON in GC format
 
@@ -1029,13 +1065,23 @@ RideImportWizard::abortClicked()
         QString finalActivitiesFulltarget = homeActivities.canonicalPath() + "/" + activitiesTarget;
 
         // check if a ride at this point of time already exists in /activities - if yes, skip import
-        if (QFileInfo(finalActivitiesFulltarget).exists()) { tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Activity file exists")); continue; }
+        // the earlier files in this import may not have got there yet, so check those too
+        if (QFileInfo(finalActivitiesFulltarget).exists() || targets.contains(activitiesTarget)) {
+            tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Activity file exists"));
+            delete parse.ride;
+            continue;
+        }
 
         // in addition, also check the RideCache for a Ride with the same point in Time in UTC, which also indicates
         // that there was already a ride imported - reason is that RideCache start time is in UTC, while the file Name is in "localTime"
         // which causes problems when importing the same file (for files which do not have time/date in the file name),
         // while the computer has been set to a different time zone
-        if (context->athlete->rideCache->getRide(ridedatetime.toUTC())) { tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Activity file with same start date/time exists")); continue; };
+        if (context->athlete->rideCache->getRide(ridedatetime.toUTC())) {
+            tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Activity file with same start date/time exists"));
+            delete parse.ride;
+            continue;
+        }
+        targets.insert(activitiesTarget);
 
         // SAVE STEP 4 - copy the source file to "/imports" directory (if it's not taken from there as source)
         // add the date/time of the target to the source file name (for identification)
@@ -1060,18 +1106,16 @@ RideImportWizard::abortClicked()
         }
 
 
-        // SAVE STEP 5 - open the file with the respective format reader and export as .JSON
+        // SAVE STEP 5 - process the parsed file and export as .JSON
         // to track if addRideCache() has caused an error due to bad data we work with a interim directory for the activities
-        // -- first   export to /tmpactivities
+        // -- first   export to /tmpactivities (on the writer, see finishWrite below)
         // -- second  create RideCache() entry
         // -- third   move file from /tmpactivities to /activities
 
         tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Saving file..."));
 
-        // serialize the file to .JSON
-        QStringList errors;
-        QFile thisfile(filenames[i]);
-        RideFile *ride(RideFileFactory::instance().openRideFile(context, thisfile, errors));
+        RideFile *ride = parse.ride;
+        QStringList errors = parse.errors;
 
         // did the input file parse ok ? (should be fine here - since it was alrady checked before - but just in case)
         if (ride) {
@@ -1090,46 +1134,28 @@ RideImportWizard::abortClicked()
             DataProcessorFactory::instance().autoProcess(ride, "Auto", "Import");
             ride->recalculateDerivedSeries();
 
-            // serialize
-            JsonFileReader reader;
-            QFile target(tmpActivitiesFulltarget);
-            if (reader.writeRideFile(context, ride, target)) {
-
-                // now try adding the Ride to the RideCache - since this may fail due to various reason, the activity file
-                // is stored in tmpActivities during this process to understand which file has create the problem when restarting GC
-                // - only after the step was successful the file is moved
-                // to the "clean" activities folder
-                context->athlete->addRide(QFileInfo(tmpActivitiesFulltarget).fileName(),
-                                          tableWidget->rowCount() < 20 ? true : false, // don't signal if mass importing
-                                          true, true);                                       // file is available only in /tmpActivities, so use this one please
-                // rideCache is successfully updated, let's move the file to the real /activities
-                if (moveFile(tmpActivitiesFulltarget, finalActivitiesFulltarget)) {
-                    tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("File Saved"));
-                    // and correct the path locally stored in Ride Item
-                    context->ride->setFileName(homeActivities.canonicalPath(), activitiesTarget);
-                }  else {
-                    tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Moving %1 to activities folder").arg(activitiesTarget));
-                }
+            // serialize, once the previous one is finished with
+            finishWrite();
+            writing.row = i;
+            writing.ride = ride;
+            writing.tmpTarget = tmpActivitiesFulltarget;
+            writing.finalTarget = finalActivitiesFulltarget;
+            writing.activitiesTarget = activitiesTarget;
+            writing.written = QtConcurrent::run(writeRideFile, context, ride, tmpActivitiesFulltarget);
 
-            }  else {
-                tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - .JSON creation failed"));
-            }
         } else {
             tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Import of activitiy file failed"));
         }
 
-        // now metrics have been calculated
-        DataProcessorFactory::instance().autoProcess(ride, "Save", "ADD");
-
-        // clear
-        delete ride;
-
         QApplication::processEvents();
         if (aborted) { done(0); return; }
         progressBar->setValue(progressBar->value()+1);
         this->repaint();
     }
 
+    // the last one
+    finishWrite();
+
     // how did we get on in the end then ...
     int completed = 0;
     for (int i=0; i< filenames.count(); i++)
@@ -1152,6 +1178,88 @@ RideImportWizard::abortClicked()
     }
 }
 
+void
+RideImportWizard::parseAhead(int from, bool archives)
+{
+    // keep the pool busy but don't let the parsed rides pile up
+    const int limit = QThread::idealThreadCount() * 2;
+
+    for (int i=from; i < filenames.count() && parsing.count() < limit; i++) {
+
+        if (tableWidget->item(i,WizardTable::STATUS_COLUMN)->text().startsWith(tr("Error"))) continue;
+        if (parsing.contains(filenames[i])) continue;
+
+        parsing.insert(filenames[i], QtConcurrent::run(parseRideFile, context, filenames[i], archives));
+    }
+}
+
+RideImportParse
+RideImportWizard::parsed(int row, bool archives)
+{
+    // make sure it (and the ones after it) are on the way
+    parseAhead(row, archives);
+
+    QFuture<RideImportParse> future = parsing.take(filenames[row]);
+    RideImportParse returning = future.result();
+
+    // and top up again
+    parseAhead(row+1, archives);
+    return returning;
+}
+
+void
+RideImportWizard::finishWrite()
+{
+    if (writing.ride == NULL) return;
+
+    int i = writing.row;
+    if (writing.written.result()) {
+
+        // now try adding the Ride to the RideCache - since this may fail due to various reason, the activity file
+        // is stored in tmpActivities during this process to understand which file has create the problem when restarting GC
+        // - only after the step was successful the file is moved
+        // to the "clean" activities folder
+        context->athlete->addRide(QFileInfo(writing.tmpTarget).fileName(),
+                                  tableWidget->rowCount() < 20 ? true : false, // don't signal if mass importing
+                                  true, true);                                       // file is available only in /tmpActivities, so use this one please
+        // rideCache is successfully updated, let's move the file to the real /activities
+        if (moveFile(writing.tmpTarget, writing.finalTarget)) {
+            tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("File Saved"));
+            // and correct the path locally stored in Ride Item
+            context->ride->setFileName(homeActivities.canonicalPath(), writing.activitiesTarget);
+        }  else {
+            tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - Moving %1 to activities folder").arg(writing.activitiesTarget));
+        }
+
+    }  else {
+        tableWidget->item(i,WizardTable::STATUS_COLUMN)->setText(tr("Error - .JSON creation failed"));
+    }
+
+    // now metrics have been calculated
+    DataProcessorFactory::instance().autoProcess(writing.ride, "Save", "ADD");
+
+    // clear
+    delete writing.ride;
+    writing = RideImportWrite();
+}
+
+void
+RideImportWizard::cancelPipeline()
+{
+    // wait for anything in flight and throw it away
+    foreach(QFuture<RideImportParse> future, parsing) {
+        RideImportParse parse = future.result();
+        discard(parse);
+    }
+    parsing.clear();
+
+    if (writing.ride) {
+        writing.written.waitForFinished();
+        QFile(writing.tmpTarget).remove();
+        delete writing.ride;
+        writing = RideImportWrite();
+    }
+}
 
 bool
 RideImportWizard::moveFile(const QString &source, const QString &target) {
@@ -1189,6 +1297,7 @@ RideImportWizard::closeEvent(QCloseEvent* event)
 void
 RideImportWizard::done(int rc)
 {
+    cancelPipeline();
     _importInProcess = false;
     QDialog::done(rc);
 }
@@ -1196,6 +1305,7 @@ RideImportWizard::done(int rc)
 // clean up files
 RideImportWizard::~RideImportWizard()
 {
+    cancelPipeline();
     foreach(QString name, deleteMe) QFile(name).remove();
 }
 
@@ -30,9 +30,31 @@
 #include <QList>
 #include <QListIterator>
 #include <QItemDelegate>
+#include <QHash>
+#include <QSet>
+#include <QFuture>
 #include "Context.h"
 #include "RideAutoImportConfig.h"
 
+class RideFile;
+
+// a file parsed on the worker pool
+struct RideImportParse {
+    RideImportParse() : ride(NULL) {}
+    RideFile *ride;
+    QList<RideFile*> rides; // when it is an archive of rides
+    QStringList errors;
+};
+
+// a ride being written to tmpActivities
+struct RideImportWrite {
+    RideImportWrite() : row(-1), ride(NULL) {}
+    int row;
+    RideFile *ride;
+    QString tmpTarget, finalTarget, activitiesTarget;
+    QFuture<bool> written;
+};
+
 // Dialog class to show filenames, import progress and to capture user input
 // of ride date and time
 
@@ -70,6 +92,16 @@ private:
     void init(QList<QString> files, Context *context);
     bool moveFile(const QString &source, const QString &target);
 
+    // the import pipeline; files are parsed ahead on the worker pool,
+    // processed in table order on this thread and then written one
+    // at a time while we get on with the next one
+    void parseAhead(int from, bool archives);
+    RideImportParse parsed(int row, bool archives);
+    void finishWrite();
+    void cancelPipeline();
+    QHash<QString, QFuture<RideImportParse> > parsing;
+    RideImportWrite writing;
+
     QList <QString> filenames; // list of filenames passed
     int numberOfFiles; // number of files to be processed
     QList <bool> blanks; // record of which have a RideFileReader returned date & time
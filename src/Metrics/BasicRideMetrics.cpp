@@ -25,6 +25,7 @@
 #include "LTMOutliers.h"
 #include "Units.h"
 #include "Zones.h"
+#include "RideKernel.h"
 #include "cmath"
 #include <assert.h>
 #include <algorithm>
@@ -212,10 +213,10 @@ class TimeRiding : public RideMetric {
         if (item->ride()->areDataPresent()->kph || item->ride()->areDataPresent()->cad ) {
 
             // loop through and count
-            RideFileIterator it(item->ride(), spec);
-            while (it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-                if ((point->kph > 0.0) || (point->cad > 0.0))
+            QVector<double> kph = spec.kernel()->column(RideFile::kph);
+            QVector<double> cad = spec.kernel()->column(RideFile::cad);
+            for (int i=0; i<kph.count(); i++) {
+                if ((kph[i] > 0.0) || (cad[i] > 0.0))
                     secsMovingOrPedaling += item->ride()->recIntSecs();
             }
         }
@@ -897,12 +898,10 @@ class TotalWork : public RideMetric {
 
         joules = 0;
 
-        RideFileIterator it(item->ride(), spec);
-        while (it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-
-            if (point->watts >= 0.0)
-                joules += point->watts * item->ride()->recIntSecs();
+        QVector<double> watts = spec.kernel()->column(RideFile::watts);
+        for (int i=0; i<watts.count(); i++) {
+            if (watts[i] >= 0.0)
+                joules += watts[i] * item->ride()->recIntSecs();
         }
         setValue(joules/1000);
     }
@@ -950,11 +949,9 @@ class AvgSpeed : public RideMetric {
 
             secsMoving = 0;
 
-            RideFileIterator it(item->ride(), spec);
-            while (it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-                if (point->kph > 0.0) secsMoving += item->ride()->recIntSecs();
-            }
+            QVector<double> kph = spec.kernel()->column(RideFile::kph);
+            for (int i=0; i<kph.count(); i++)
+                if (kph[i] > 0.0) secsMoving += item->ride()->recIntSecs();
 
             setValue(secsMoving ? km / secsMoving * 3600.0 : 0.0);
 
@@ -1011,12 +1008,10 @@ struct AvgPower : public RideMetric {
 
         total = count = 0;
     
-        RideFileIterator it(item->ride(), spec);
-        while (it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-
-            if (point->watts >= 0.0) {
-                total += point->watts;
+        QVector<double> watts = spec.kernel()->column(RideFile::watts);
+        for (int i=0; i<watts.count(); i++) {
+            if (watts[i] >= 0.0) {
+                total += watts[i];
                 ++count;
             }
         }
@@ -1815,11 +1810,10 @@ class MaxPower : public RideMetric {
             return;
         }
 
-        RideFileIterator it(item->ride(), spec);
-        while (it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            if (point->watts >= max)
-                max = point->watts;
+        QVector<double> watts = spec.kernel()->column(RideFile::watts);
+        for (int i=0; i<watts.count(); i++) {
+            if (watts[i] >= max)
+                max = watts[i];
         }
         setValue(max);
     }
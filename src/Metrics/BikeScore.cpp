@@ -19,6 +19,7 @@
 #include "RideMetric.h"
 #include "RideItem.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include "RideFile.h"
 #include "Context.h"
 #include "Athlete.h"
@@ -66,37 +67,15 @@ class XPower : public RideMetric {
             return;
         }
 
-        static const double EPSILON = 0.1;
-        static const double NEGLIGIBLE = 0.1;
+        // 25s exponentially weighted average, shared with other metrics
+        QVector<double> weighted = spec.kernel()->weighted(RideFile::watts, 25);
 
         double secsDelta = item->ride()->recIntSecs();
-        double sampsPerWindow = 25.0 / secsDelta;
-        double attenuation = sampsPerWindow / (sampsPerWindow + secsDelta);
-        double sampleWeight = secsDelta / (sampsPerWindow + secsDelta);
-
-        double lastSecs = 0.0;
-        double weighted = 0.0;
-
         double total = 0.0;
-        int count = 0;
-
-        RideFileIterator it(item->ride(), spec);
-        while (it.hasNext()) {
-            struct RideFilePoint *point = it.next();
+        int count = weighted.count();
+        const double *w = weighted.constData();
+        for (int i=0; i<count; i++) total += pow(w[i], 4.0);
 
-            while ((weighted > NEGLIGIBLE)
-                   && (point->secs > lastSecs + secsDelta + EPSILON)) {
-                weighted *= attenuation;
-                lastSecs += secsDelta;
-                total += pow(weighted, 4.0);
-                count++;
-            }
-            weighted *= attenuation;
-            weighted += sampleWeight * point->watts;
-            lastSecs = point->secs;
-            total += pow(weighted, 4.0);
-            count++;
-        }
         xpower = count ? pow(total / count, 0.25) : 0.0;
         secs = count * secsDelta;
 
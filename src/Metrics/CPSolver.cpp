@@ -19,9 +19,13 @@
 
 #include "CPSolver.h"
 #include <ctime>
+#include <QtConcurrent>
+
+// below this many samples x candidates its not worth using threads
+static const int CPSolverParallel = 100000;
 
 CPSolver::CPSolver(Context *context)
-   : context(context)
+   : context(context), chains(CPSolverChains)
 {
     integral = (appsettings->value(NULL, GC_WBALFORM, "int").toString() == "int");
 }
@@ -49,7 +53,9 @@ CPSolver::setData(CPSolverConstraints constraints, QList<RideItem*> rides)
             // ok, now we have a point we need to get the power data
             // from the start to the point of exhaustion into a
             // 1 second sample array
-            data << power1s(item->ride(), rp->secs);
+            if (offsets.isEmpty()) offsets << 0;
+            samples << power1s(item->ride(), rp->secs);
+            offsets << samples.count();
         }
     }
 }
@@ -73,18 +79,92 @@ CPSolver::power1s(RideFile *f, double secs)
 double
 CPSolver::cost(WBParms parms)
 {
-    // returning sum(W'bal ^ 2)
+    QVector<WBParms> candidates;
+    candidates << parms;
+
+    QVector<double> costs;
+    cost(candidates, costs);
+    return costs[0];
+}
+
+// the differential model for a batch of candidates, as
+// with the integral model the inner loop is across them
+static void differential(const int *watts, int n, int count, const double *CP,
+                         const double *W, const double *TAU, double *wbal)
+{
+    for (int i=0; i<count; i++) wbal[i] = W[i];
+
+    for (int t=0; t<n; t++) {
+
+        const double value = watts[t];
+        for (int i=0; i<count; i++) {
+            wbal[i] += value < CP[i] ? ((TAU[i]/100.0f) * (W[i] - wbal[i])/W[i] * (CP[i] - value)) : (CP[i]-value);
+        }
+    }
+}
 
-    // loop through each ride for now, but avoid foreach()
-    // since it will make a copy of the contents which has
-    // a significant performance impact
-    double sumwb2=0;
-    for(int i=0; i<data.count();i++)  sumwb2 += pow(compute(data[i], parms),2);
+// one exhaustion series and all the candidates
+struct CPSolverBatch {
+    const int *watts;
+    int n, count;
+    const double *CP, *W, *TAU;
+    double *wbal;           // count results for this series
+    bool integral;
+};
 
-    //qDebug()<<"cost="<<QString("%1").arg(sumwb2, 0, 'g', 7);
+static void computeBatch(CPSolverBatch &batch)
+{
+    if (batch.integral) WPrimeIntegrator::wbal(batch.watts, batch.n, batch.count, batch.CP, batch.W, batch.TAU, batch.wbal);
+    else differential(batch.watts, batch.n, batch.count, batch.CP, batch.W, batch.TAU, batch.wbal);
+}
+
+void
+CPSolver::cost(const QVector<WBParms> &candidates, QVector<double> &costs)
+{
+    // returning sum(W'bal ^ 2) for each candidate
+    const int count = candidates.count();
+    const int series = offsets.count() - 1;
+
+    costs.fill(0, count);
+    if (series < 1 || count == 0) return;
+
+    // parameters as arrays so the loops vectorise
+    QVector<double> CP(count), W(count), TAU(count);
+    for (int i=0; i<count; i++) {
+        CP[i] = candidates[i].CP;
+        W[i] = candidates[i].W;
+        TAU[i] = candidates[i].TAU;
+    }
+
+    // W'bal for each series (row) and candidate (column)
+    QVector<double> wbal(series * count);
+    QVector<CPSolverBatch> batches(series);
+    for (int i=0; i<series; i++) {
+        CPSolverBatch &batch = batches[i];
+        batch.watts = samples.constData() + offsets[i];
+        batch.n = offsets[i+1] - offsets[i];
+        batch.count = count;
+        batch.CP = CP.constData();
+        batch.W = W.constData();
+        batch.TAU = TAU.constData();
+        batch.wbal = wbal.data() + (i * count);
+        batch.integral = integral;
+    }
+
+    // fan out across the cores if there is enough to do
+    if (samples.count() * count > CPSolverParallel) QtConcurrent::blockingMap(batches, computeBatch);
+    else for (int i=0; i<series; i++) computeBatch(batches[i]);
+
+    // we solve for W'bal=500, see compute() below
+    for (int i=0; i<series; i++) {
+        for (int c=0; c<count; c++) {
+            double error = wbal[(i * count) + c] - 500;
+            costs[c] += error * error;
+        }
+    }
 
     // what we got - normalise to number of fits
-    return (sumwb2/data.count()) /1000.0f;
+    for (int c=0; c<count; c++) costs[c] = (costs[c]/series) /1000.0f;
 }
 
 double
@@ -92,25 +172,24 @@ CPSolver::compute(QVector<int> &ride, WBParms parms)
 {
     // compute w'bal for the ride using the paramters
     // XXX for now we use the integral model
-    double I=0.00f;
-    int t=0;
     double wpbal=parms.W;
-    foreach(int watts, ride) {
 
-        if (integral) {
+    if (integral) {
 
-            // INTEGRAL
-            I += exp(((double)(t) / parms.TAU)) * (watts > parms.CP ? watts-parms.CP : 0);
-            wpbal = parms.W - (exp(-((double)(t) / parms.TAU)) * I);
-
-        } else {
+        // INTEGRAL - see WPrimeIntegrator
+        WPrimeIntegrator I(parms.TAU);
+        for(int t=0; t<ride.count(); t++) {
+            int watts = ride[t];
+            I.push(watts > parms.CP ? watts-parms.CP : 0);
+        }
+        wpbal = parms.W - I.value();
 
+    } else {
 
-            // DIFFERENTIAL
+        // DIFFERENTIAL
+        foreach(int watts, ride) {
             wpbal  += watts < parms.CP ? ((double(parms.TAU)/100.0f) * (parms.W - wpbal)/parms.W * (parms.CP - watts) ) : (parms.CP-watts);
         }
-
-        t++;
     }
 
     // we solve for W'bal=500 as it is not possible to completely
@@ -169,14 +248,15 @@ void
 CPSolver::reset()
 {
     rides.clear();
-    data.clear();
+    samples.clear();
+    offsets.clear();
 }
 
 void
 CPSolver::start()
 {
     // set starting conditions from first ride
-    if (data.count() == 0 || rides.count() == 0) return;
+    if (offsets.count() < 2 || rides.count() == 0) return;
 
     // to flag when to stop
     halt = false;
@@ -191,47 +271,67 @@ CPSolver::start()
 
     // initial conditions
     srand((unsigned int) time (NULL)); // seed ONCE!
-    double E = cost(s0);
-    double Ebest = E;
-    WBParms s = s0;
-    WBParms sbest = s;
 
-    // 10,000 iterations at most
+    // the first chain starts at the maximals and
+    // the others are scattered across the space
+    QVector<WBParms> s(chains), snew(chains);
+    QVector<double> E(chains), Enew(chains);
+    s[0] = s0;
+    for (int c=1; c<chains; c++) {
+        s[c].CP = constraints.cpf + rand()%(constraints.cpto - constraints.cpf + 1);
+        s[c].W = constraints.wf + int(double(rand()) / double(RAND_MAX) * (constraints.wto - constraints.wf));
+        s[c].TAU = constraints.tf + rand()%(constraints.tto - constraints.tf + 1);
+    }
+    cost(s, E);
+
+    double Ebest = E[0];
+    WBParms sbest = s[0];
+    for (int c=1; c<chains; c++) {
+        if (E[c] < Ebest) {
+            Ebest = E[c];
+            sbest = s[c];
+        }
+    }
+
+    // 100,000 iterations at most, shared across the chains
     int k=0;
     int kmax = 100000;
+    int steps = kmax / chains;
 
     // give up when we're on it or run out of loops
-    while (halt == false && k < kmax) {
+    for (int step=0; halt == false && step < steps; step++) {
 
-        WBParms snew = neighbour(s, k, kmax);
-        double Enew = cost(snew);
+        // a candidate from each chain, costed together
+        for (int c=0; c<chains; c++) snew[c] = neighbour(s[c], step, steps);
+        cost(snew, Enew);
 
-        // progress update k=0 means stop so we offset by one
-        emit current(k+1, snew,Enew);
+        double temp = temperature(double(step)/double(steps));
+        for (int c=0; c<chains; c++) {
 
-        // probability - always 1 if better, but randomly accept higher
-        double random = double(rand()%101)/100.00f;
-        double temp = temperature(double(k)/double(kmax));
-        double prob = probability(E,Enew,temp);
+            // progress update k=0 means stop so we offset by one
+            emit current(k+1, snew[c], Enew[c]);
 
-        if (prob > random) {
-            s = snew;
-            E = Enew;
-        }
+            // probability - always 1 if better, but randomly accept higher
+            double random = double(rand()%101)/100.00f;
+            double prob = probability(E[c],Enew[c],temp);
 
-        // is it better than our very best?
-        if (E < Ebest) {
-            Ebest = E;
-            sbest = s;
+            if (prob > random) {
+                s[c] = snew[c];
+                E[c] = Enew[c];
+            }
 
-            // k of zero means stop so we offset by one
-            emit newBest(k+1, sbest, Ebest);
-            //qDebug()<<k<<"new best"<<Ebest <<s.CP<<s.W<<s.TAU;
-        }
+            // is it better than our very best?
+            if (E[c] < Ebest) {
+                Ebest = E[c];
+                sbest = s[c];
 
-        // don't run forever
-        k++;
+                // k of zero means stop so we offset by one
+                emit newBest(k+1, sbest, Ebest);
+                //qDebug()<<k<<"new best"<<Ebest <<s[c].CP<<s[c].W<<s[c].TAU;
+            }
 
+            k++;
+        }
     }
 
     // k of zero means stop
@@ -64,6 +64,10 @@ class CPSolverConstraints {
     }
 };
 
+// annealing chains run side by side, the candidates they
+// propose are costed together as a single batch
+static const int CPSolverChains = 8;
+
 class CPSolver : public QObject {
 
     Q_OBJECT
@@ -80,9 +84,16 @@ class CPSolver : public QObject {
         // compute the cost, using the settings passed
         double cost(WBParms parms);
 
+        // cost a batch of candidates at once, the exhaustion
+        // series are shared out across the cores
+        void cost(const QVector<WBParms> &candidates, QVector<double> &costs);
+
         // compute ending W'bal for the exhaustion series
         double compute(QVector<int> &ride, WBParms parms);
 
+        // independent annealing chains, 1 is a single chain
+        void setChains(int chains) { this->chains = chains > 0 ? chains : 1; }
+
         WBParms neighbour(WBParms, int k, int kmax);
         double probability(double,double,double);
         double temperature(double);
@@ -110,8 +121,11 @@ class CPSolver : public QObject {
         CPSolverConstraints constraints;
         bool integral;
 
-        // an array of power data leading up to each exhaust point
-        QList<QVector<int> > data;
+        // the power data leading up to each exhaust point held in a single
+        // buffer, series i is from offsets[i] up to offsets[i+1]
+        QVector<int> samples;
+        QVector<int> offsets;
+        int chains;
         QList<RideItem*> rides;
 
         // annealling parms
@@ -23,6 +23,7 @@
 #include "Settings.h"
 #include "Athlete.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include "Units.h"
 #include <cmath>
 #include <assert.h>
@@ -59,38 +60,14 @@ class NP : public RideMetric {
             return;
         }
 
-        int rollingwindowsize = 30 / item->ride()->recIntSecs();
+        // 30s rolling average, shared with other metrics
+        QVector<double> rolling = spec.kernel()->rolling(RideFile::watts, 30);
 
         double total = 0;
-        int count = 0;
+        int count = rolling.count();
+        const double *r = rolling.constData();
+        for (int i=0; i<count; i++) total += pow(r[i],4); // raise rolling average to 4th power
 
-        // no point doing a rolling average if the
-        // sample rate is greater than the rolling average
-        // window!!
-        if (rollingwindowsize > 1) {
-
-            QVector<double> rolling(rollingwindowsize);
-            int index = 0;
-            double sum = 0;
-
-            // loop over the data and convert to a rolling
-            // average for the given windowsize
-            RideFileIterator it(item->ride(), spec);
-            while (it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-
-                sum += point->watts;
-                sum -= rolling[index];
-
-                rolling[index] = point->watts;
-
-                total += pow(sum/rollingwindowsize,4); // raise rolling average to 4th power
-                count ++;
-
-                // move index on/round
-                index = (index >= rollingwindowsize-1) ? 0 : index+1;
-            }
-        }
         if (count) {
             np = pow(total / (count), 0.25);
             secs = count * item->ride()->recIntSecs();
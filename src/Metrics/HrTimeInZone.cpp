@@ -23,6 +23,7 @@
 #include "Context.h"
 #include "Athlete.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include <cmath>
 #include <assert.h>
 #include <QApplication>
@@ -63,13 +64,9 @@ public:
 
         // get zone ranges
         if (item->context->athlete->hrZones(item->isRun) && item->hrZoneRange >= 0 && item->ride()->areDataPresent()->hr) {
-            // iterate and compute
-            RideFileIterator it(item->ride(), spec);
-            while (it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-                if (item->context->athlete->hrZones(item->isRun)->whichZone(item->hrZoneRange, point->hr) == level)
-                    seconds += item->ride()->recIntSecs();
-            }
+            // all the zones are worked out in one pass, shared with other metrics
+            QVector<double> zones = spec.kernel()->zoneTime(RideKernel::Hr);
+            if (level < zones.count()) seconds = zones[level];
         }
         setValue(seconds);
     }
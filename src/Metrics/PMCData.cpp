@@ -33,8 +33,9 @@
 #include <QSharedPointer>
 #include <QProgressDialog>
 
-PMCData::PMCData(Context *context, Specification spec, QString metricName, int stsDays, int ltsDays) 
-    : context(context), specification_(spec), metricName_(metricName), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true)
+PMCData::PMCData(Context *context, Specification spec, QString metricName, int stsDays, int ltsDays, bool eager) 
+    : context(context), specification_(spec), metricName_(metricName), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true),
+      sbToday_(false), stsUsed_(0), ltsUsed_(0), from_(0)
 {
     // get defaults if not passed
     useDefaults = false;
@@ -58,15 +59,16 @@ PMCData::PMCData(Context *context, Specification spec, QString metricName, int s
     }
 
 
-    refresh();
-    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
-    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    if (eager) refresh();
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate(RideItem*)));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate(RideItem*)));
     connect(context, SIGNAL(refreshUpdate(QDate)), this, SLOT(invalidate()));
-    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate()));
+    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate(RideItem*)));
 }
 
-PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRuntime *df, int stsDays, int ltsDays) 
-    : context(context), specification_(spec), metricName_(""), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true)
+PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRuntime *df, int stsDays, int ltsDays, bool eager) 
+    : context(context), specification_(spec), metricName_(""), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true),
+      sbToday_(false), stsUsed_(0), ltsUsed_(0), from_(0)
 {
     // get defaults if not passed
     useDefaults = false;
@@ -90,15 +92,32 @@ PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRun
     }
 
 
-    refresh();
-    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
-    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    if (eager) refresh();
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate(RideItem*)));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate(RideItem*)));
     connect(context, SIGNAL(refreshUpdate(QDate)), this, SLOT(invalidate()));
-    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate()));
+    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate(RideItem*)));
 }
 
 void PMCData::invalidate()
 {
+    // everything
+    dirty_ = QDate();
+    isstale=true;
+}
+
+void PMCData::invalidate(RideItem *item)
+{
+    // already recalculating everything
+    if (isstale && dirty_ == QDate()) return;
+
+    // from the earliest of where it is now and where
+    // we counted it last time (its date may have changed)
+    QDate date = item->dateTime.date();
+    QDate counted = counted_.value(item, QDate());
+    if (counted != QDate() && counted < date) date = counted;
+
+    if (!isstale || date < dirty_) dirty_ = date;
     isstale=true;
 }
 
@@ -106,6 +125,88 @@ void PMCData::refresh()
 {
     if (!isstale) return;
 
+    refresh(QList<PMCData*>() << this);
+}
+
+void
+PMCData::refresh(QList<PMCData*> pmcs)
+{
+    QTime timer;
+    timer.start();
+
+    // which ones need calculating, and from when
+    QList<PMCData*> todo;
+    QDate earliest;
+    foreach(PMCData *pmc, pmcs) {
+        if (!pmc->isstale || !pmc->prepare()) continue;
+
+        todo << pmc;
+        QDate from = pmc->start_.addDays(pmc->from_);
+        if (earliest == QDate() || from < earliest) earliest = from;
+    }
+    if (todo.isEmpty()) return;
+
+    // add the stress scores, in a single pass over the rides. the value
+    // for each stress metric is only worked out once for each ride
+    QHash<QString, double> values;
+    foreach(RideItem *item, todo.first()->context->athlete->rideCache->rides()) {
+
+        // unchanged
+        QDate date = item->dateTime.date();
+        if (date < earliest) continue;
+
+        values.clear();
+        foreach(PMCData *pmc, todo) {
+
+            if (!pmc->specification_.pass(item)) continue;
+
+            // seed with score for this one
+            int offset = pmc->start_.daysTo(date);
+            if (offset >= pmc->from_ && offset > 0 && offset < pmc->stress_.count()) {
+
+                // although metrics are cleansed, we check here because development
+                // builds have a rideDB.json that has nan and inf values in it.
+                double value = 0;
+                QHash<QString, double>::const_iterator i = values.constFind(pmc->source_);
+                if (i != values.constEnd()) value = i.value();
+                else {
+                    value = pmc->value(item);
+                    values.insert(pmc->source_, value);
+                }
+                pmc->counted_.insert(item, date);
+
+                if (!std::isinf(value) && !std::isnan(value)) {
+                    if (item->planned)
+                        pmc->planned_stress_[offset] += value;
+                    else
+                        pmc->stress_[offset] += value;
+                    //qDebug()<<"stress_["<<offset<<"] :"<<pmc->stress_[offset];
+                }
+            }
+        }
+    }
+
+    foreach(PMCData *pmc, todo) pmc->calculate();
+
+    //qDebug()<<"refresh PMC"<<todo.count()<<"from"<<earliest<<"in="<<timer.elapsed()<<"ms";
+}
+
+double
+PMCData::value(RideItem *item)
+{
+    if (fromDataFilter) return expr->eval(df, expr, 0, item).number;
+    else return item->getForSymbol(metricName_);
+}
+
+// zero out from a day onwards, the rest we keep
+static void zero(QVector<double> &array, int from)
+{
+    for(int i=from; i<array.count(); i++) array[i] = 0;
+}
+
+bool
+PMCData::prepare()
+{
     // we need to reread config if refreshing (it might have changed)
     if (useDefaults) {
 
@@ -118,9 +219,6 @@ void PMCData::refresh()
         else stsDays_ = sts.toInt();
     }
 
-    QTime timer;
-    timer.start();
-
     //
     // STEP ONE: What is the date range ?
     //
@@ -143,41 +241,20 @@ void PMCData::refresh()
     }
 
     // what is earliest date we got ? (substract 1 day to include first ride)
-    start_ = QDate(9999,12,31);
-    if (seed != QDate() && seed < start_) start_ = seed;
-    if (first != QDate() && first < start_) start_ = first.addDays(-1);
+    QDate start = QDate(9999,12,31);
+    if (seed != QDate() && seed < start) start = seed;
+    if (first != QDate() && first < start) start = first.addDays(-1);
 
     // whats the latest date we got ? (and add a year for decay)
-    end_ = QDate();
-    if (last > seed) end_ = last.addDays(365);
-    else if (seed != QDate()) end_ = seed.addDays(365);
+    QDate end = QDate();
+    if (last > seed) end = last.addDays(365);
+    else if (seed != QDate()) end = seed.addDays(365);
 
     // back to null date if not set, just to get round date arithmetic
-    if (start_ == QDate(9999,12,31)) start_ = QDate();
+    if (start == QDate(9999,12,31)) start = QDate();
 
     // We got a valid range ?
-    if (start_ != QDate() && end_ != QDate() && start_ < end_) {
-
-        // resize arrays
-        days_ = start_.daysTo(end_)+1;
-        stress_.resize(days_);
-        lts_.resize(days_);
-        sts_.resize(days_);
-        sb_.resize(days_+1); // for SB tomorrow!
-        rr_.resize(days_);
-
-        planned_stress_.resize(days_);
-        planned_lts_.resize(days_);
-        planned_sts_.resize(days_);
-        planned_sb_.resize(days_+1); // for SB tomorrow!
-        planned_rr_.resize(days_);
-
-        expected_lts_.resize(days_);
-        expected_sts_.resize(days_);
-        expected_sb_.resize(days_+1); // for SB tomorrow!
-        expected_rr_.resize(days_);
-
-    } else {
+    if (start == QDate() || end == QDate() || start >= end) {
 
         // nothing to calculate
         start_= QDate();
@@ -200,41 +277,93 @@ void PMCData::refresh()
         expected_sb_.resize(0);
         expected_rr_.resize(0);
 
+        counted_.clear();
+        dirty_ = QDate();
 
         // give up
-        return;
+        isstale=false;
+        return false;
+    }
+
+    // can we carry on from where the last refresh got to ? we
+    // can if it still starts on the same day and the only changes
+    // are from the dirty date, if the range got longer we need to
+    // at least recalculate the days we didn't have before. the
+    // decay may have been changed in preferences since too
+    bool sbToday = appsettings->cvalue(context->athlete->cyclist, GC_SB_TODAY).toInt();
+    QDate today = QDate::currentDate();
+    int days = start.daysTo(end)+1;
+
+    from_ = 0;
+    if (dirty_ != QDate() && start == start_ && today == today_ && sbToday == sbToday_ &&
+        stsDays_ == stsUsed_ && ltsDays_ == ltsUsed_) {
+        from_ = start.daysTo(dirty_);
+        if (from_ < 0) from_ = 0;
+        if (from_ > days_) from_ = days_;
+        if (from_ > days) from_ = days;
     }
-    //qDebug()<<"refresh PMC dates:"<<metricName_<<"days="<<days_<<"start="<<start_<<"end="<<end_;
+    if (from_ == 0) counted_.clear();
+
+    start_ = start;
+    end_ = end;
+    days_ = days;
+    today_ = today;
+    sbToday_ = sbToday;
+    stsUsed_ = stsDays_;
+    ltsUsed_ = ltsDays_;
+    source_ = fromDataFilter ? QString("expr:%1").arg(expr->signature()) : metricName_;
+
+    //qDebug()<<"refresh PMC dates:"<<metricName_<<"days="<<days_<<"start="<<start_<<"end="<<end_<<"from="<<from_;
+
+    // resize arrays
+    stress_.resize(days_);
+    lts_.resize(days_);
+    sts_.resize(days_);
+    sb_.resize(days_+1); // for SB tomorrow!
+    rr_.resize(days_);
+
+    planned_stress_.resize(days_);
+    planned_lts_.resize(days_);
+    planned_sts_.resize(days_);
+    planned_sb_.resize(days_+1); // for SB tomorrow!
+    planned_rr_.resize(days_);
+
+    expected_lts_.resize(days_);
+    expected_sts_.resize(days_);
+    expected_sb_.resize(days_+1); // for SB tomorrow!
+    expected_rr_.resize(days_);
 
     //
     // STEP TWO What are the seedings and ride values
     //
-    bool sbToday = appsettings->cvalue(context->athlete->cyclist, GC_SB_TODAY).toInt();
-    double lte = (double)exp(-1.0/ltsDays_);
-    double ste = (double)exp(-1.0/stsDays_);
 
-    // clear what's there
-    stress_.fill(0);
-    lts_.fill(0);
-    sts_.fill(0);
-    sb_.fill(0);
-    rr_.fill(0);
+    // clear what we are recalculating, SB for the day we start from
+    // was set the day before unless it is shown today
+    int sbfrom = from_ ? from_ + (sbToday_ ? 0 : 1) : 0;
 
-    planned_stress_.fill(0);
-    planned_lts_.fill(0);
-    planned_sts_.fill(0);
-    planned_sb_.fill(0);
-    planned_rr_.fill(0);
+    zero(stress_, from_);
+    zero(lts_, from_);
+    zero(sts_, from_);
+    zero(sb_, sbfrom);
+    zero(rr_, from_);
 
-    expected_lts_.fill(0);
-    expected_sts_.fill(0);
-    expected_sb_.fill(0);
-    expected_rr_.fill(0);
+    zero(planned_stress_, from_);
+    zero(planned_lts_, from_);
+    zero(planned_sts_, from_);
+    zero(planned_sb_, sbfrom);
+    zero(planned_rr_, from_);
+
+    zero(expected_lts_, from_);
+    zero(expected_sts_, from_);
+    zero(expected_sb_, sbfrom);
+    zero(expected_rr_, from_);
 
     // add the seeded values from seasons
     foreach(Season x, context->athlete->seasons->seasons) {
         if (x.getSeed()) {
             int offset = start_.daysTo(x.getStart());
+            if (offset < from_) continue;
+
             lts_[offset] = x.getSeed() * -1;
             sts_[offset] = x.getSeed() * -1;
 
@@ -243,52 +372,39 @@ void PMCData::refresh()
         }
     }
 
-    // add the stress scores
-    foreach(RideItem *item, context->athlete->rideCache->rides()) {
-
-        if (!specification_.pass(item)) continue;
-
-        // seed with score for this one
-        int offset = start_.daysTo(item->dateTime.date());
-        if (offset > 0 && offset < stress_.count()) {
-
-            // although metrics are cleansed, we check here because development
-            // builds have a rideDB.json that has nan and inf values in it.
-            double value = 0;;
-            if (fromDataFilter) value = expr->eval(df, expr, 0, item).number;
-            else value = item->getForSymbol(metricName_);
-
-            if (!std::isinf(value) && !std::isnan(value)) {
-                if (item->planned)
-                    planned_stress_[offset] += value;
-                else
-                    stress_[offset] += value;
-                //qDebug()<<"stress_["<<offset<<"] :"<<stress_[offset];
-            }
-        }
-    }
+    // the stress scores are added by refresh()
+    return true;
+}
 
+void
+PMCData::calculate()
+{
     //
     // STEP THREE Calculate sts/lts, sb and rr
     //
+    bool sbToday = sbToday_;
+    double lte = (double)exp(-1.0/ltsDays_);
+    double ste = (double)exp(-1.0/stsDays_);
+
     double lastLTS=0.0f;
     double lastSTS=0.0f;
 
-    double rollingStress=0;
+    // carry on from the day before, rr is the rolling stress
+    double rollingStress = from_ ? rr_[from_-1] : 0;
 
     double planned_lastLTS=0.0f;
     double planned_lastSTS=0.0f;
 
-    double planned_rollingStress=0;
+    double planned_rollingStress = from_ ? planned_rr_[from_-1] : 0;
 
 #if notyet
     double expected_lastLTS=0.0f;
     double expected_lastSTS=0.0f;
 #endif
 
-    double expected_rollingStress=0;
+    double expected_rollingStress = from_ ? expected_rr_[from_-1] : 0;
 
-    for(int day=0; day < days_; day++) {
+    for(int day=from_; day < days_; day++) {
 
         // not seeded
         if (lts_[day] >=0 || sts_[day]>=0) {
@@ -364,14 +480,14 @@ void PMCData::refresh()
         // ****  EXPECTED  ****
         // ********************
 
-        if (start_.addDays(day).daysTo(QDate::currentDate())<0) {
+        if (start_.addDays(day).daysTo(today_)<0) {
             double lastLts = 0.0;
             double lastSts = 0.0;
             double ltsAtStsDays1 = 0.0;
             double ltsAtStsDays2 = 0.0;
 
             if (day) {
-                if (start_.addDays(day).daysTo(QDate::currentDate())<-1) {
+                if (start_.addDays(day).daysTo(today_)<-1) {
                     lastLts = expected_lts_[day-1];
                     lastSts = expected_sts_[day-1];
                 } else {
@@ -379,13 +495,13 @@ void PMCData::refresh()
                     lastSts = sts_[day-1];
                 }
                 if (day > stsDays_) {
-                    if (start_.addDays(day).daysTo(QDate::currentDate())<-1-stsDays_) {
+                    if (start_.addDays(day).daysTo(today_)<-1-stsDays_) {
                         ltsAtStsDays1 = expected_lts_[day-stsDays_-1];
                     } else {
                         ltsAtStsDays1 = lts_[day-stsDays_-1];
                     }
 
-                    if (start_.addDays(day).daysTo(QDate::currentDate())<-stsDays_) {
+                    if (start_.addDays(day).daysTo(today_)<-stsDays_) {
                         ltsAtStsDays2 = expected_lts_[day-stsDays_];
                     } else {
                         ltsAtStsDays2 = lts_[day-stsDays_];
@@ -431,8 +547,7 @@ void PMCData::refresh()
 
     }
 
-    //qDebug()<<"refresh PMC in="<<timer.elapsed()<<"ms";
-
+    dirty_ = QDate();
     isstale=false;
 }
 
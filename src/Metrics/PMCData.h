@@ -30,8 +30,10 @@
 #include <QList>
 #include <QDateTime>
 #include <QTreeWidgetItem>
+#include <QHash>
 
 class Context;
+class RideItem;
 
 class PMCData : public QObject {
 
@@ -40,9 +42,10 @@ class PMCData : public QObject {
     public:
 
         // create a PMC data series for the athlete
-        // for ALL date ranges
-        PMCData(Context *, Specification specification, QString metricName, int stsDays=-1, int ltsDays=-1);
-        PMCData(Context *, Specification specification, Leaf *expr, DataFilterRuntime *df, int stsDays=-1, int ltsDays=-1);
+        // for ALL date ranges, if not eager it is left
+        // stale until first used (or batch refreshed)
+        PMCData(Context *, Specification specification, QString metricName, int stsDays=-1, int ltsDays=-1, bool eager=true);
+        PMCData(Context *, Specification specification, Leaf *expr, DataFilterRuntime *df, int stsDays=-1, int ltsDays=-1, bool eager=true);
 
         // set parameters
         void setStsDays(int x) { stsDays_ = x; invalidate(); }
@@ -96,6 +99,11 @@ class PMCData : public QObject {
         static QColor sbColor(double, QColor defaultColor);
         static QColor rrColor(double, QColor defaultColor);
 
+        // refresh a set of PMCs for the same athlete in a single sweep
+        // over the rides, each stress metric is only evaluated once per
+        // ride however many sts/lts combinations want it
+        static void refresh(QList<PMCData*> pmcs);
+
     public slots:
 
         // as underlying ride data changes the
@@ -103,8 +111,21 @@ class PMCData : public QObject {
         void invalidate();
         void refresh();
 
+        // a single ride changed, only recalculate from its date
+        void invalidate(RideItem *item);
+
     private:
 
+        // work out the date range and where to recalculate from
+        // returns false if there is nothing to calculate
+        bool prepare();
+
+        // the stress for this ride
+        double value(RideItem *item);
+
+        // STEP THREE: sts/lts, sb and rr from day from_ onwards
+        void calculate();
+
         // who we for ?
         Context *context;
         Specification specification_;
@@ -127,6 +148,15 @@ class PMCData : public QObject {
         QVector<double> expected_lts_, expected_sts_, expected_sb_, expected_rr_;
 
         bool isstale; // needs refreshing
+
+        // incremental refresh
+        QDate dirty_;       // recalculate from here, null means everything
+        QDate today_;       // expected values are from today
+        bool sbToday_;      // sb shown today or tomorrow
+        int stsUsed_, ltsUsed_; // decay the values were calculated with
+        int from_;          // day we are recalculating from
+        QString source_;    // what we accumulate, to share across PMCs
+        QHash<RideItem*, QDate> counted_; // where each ride was counted
 };
 
 #endif // _GC_StressCalculator_h
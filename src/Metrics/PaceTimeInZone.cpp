@@ -20,6 +20,7 @@
 #include "RideMetric.h"
 #include "RideItem.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include "Context.h"
 #include "Athlete.h"
 #include "PaceZones.h"
@@ -68,13 +69,9 @@ class PaceZoneTime : public RideMetric {
 
         // get zone ranges
         if (zone && zoneRange >= 0) {
-            // iterate and compute
-            RideFileIterator it(item->ride(), spec);
-            while (it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-                if (zone->whichZone(zoneRange, point->kph) == level)
-                    seconds += item->ride()->recIntSecs();
-            }
+            // all the zones are worked out in one pass, shared with other metrics
+            QVector<double> zones = spec.kernel()->zoneTime(RideKernel::Pace);
+            if (level < zones.count()) seconds = zones[level];
         }
         setValue(seconds);
     }
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "RideKernel.h"
+#include "RideItem.h"
+#include "Context.h"
+#include "Athlete.h"
+#include "Zones.h"
+#include "HrZones.h"
+#include "PaceZones.h"
+
+#include <QMutexLocker>
+
+RideKernel::RideKernel(RideItem *item, Specification spec) : item(item), ride(NULL), first_(-1), count_(0)
+{
+    ride = item ? item->ride() : NULL;
+
+    // same samples as a RideFileIterator would visit
+    RideFileIterator it(ride, spec);
+    if (it.firstIndex() >= 0 && it.lastIndex() >= it.firstIndex()) {
+        first_ = it.firstIndex();
+        count_ = it.lastIndex() - it.firstIndex() + 1;
+    }
+}
+
+const QVector<double> &
+RideKernel::columnLocked(RideFile::SeriesType series)
+{
+    QHash<int, QVector<double> >::iterator i = columns.find(series);
+    if (i != columns.end()) return i.value();
+
+    // just our samples, the ride doesn't keep columns
+    QVector<double> values;
+    if (count_) values = ride->column(series, first_, count_);
+    return columns.insert(series, values).value();
+}
+
+QVector<double>
+RideKernel::column(RideFile::SeriesType series)
+{
+    QMutexLocker locker(&mutex);
+    return columnLocked(series);
+}
+
+QVector<double>
+RideKernel::rolling(RideFile::SeriesType series, int secs)
+{
+    QMutexLocker locker(&mutex);
+
+    qint64 key = (qint64(series) << 32) | secs;
+    QHash<qint64, QVector<double> >::const_iterator i = rollings.constFind(key);
+    if (i != rollings.constEnd()) return i.value();
+
+    QVector<double> returning;
+
+    // no point doing a rolling average if the sample
+    // rate is greater than the rolling average window!!
+    int windowsize = (ride && ride->recIntSecs()) ? secs / ride->recIntSecs() : 0;
+    if (count_ && windowsize > 1) {
+
+        const QVector<double> &values = columnLocked(series);
+        const double *v = values.constData();
+
+        returning.resize(count_);
+        double *r = returning.data();
+
+        QVector<double> window(windowsize);
+        int index = 0;
+        double sum = 0;
+
+        for (int j=0; j<count_; j++) {
+            sum += v[j];
+            sum -= window[index];
+            window[index] = v[j];
+
+            r[j] = sum / windowsize;
+
+            // move index on/round
+            index = (index >= windowsize-1) ? 0 : index+1;
+        }
+    }
+    rollings.insert(key, returning);
+    return returning;
+}
+
+QVector<double>
+RideKernel::weighted(RideFile::SeriesType series, int secs)
+{
+    QMutexLocker locker(&mutex);
+
+    qint64 key = (qint64(series) << 32) | secs;
+    QHash<qint64, QVector<double> >::const_iterator i = weighteds.constFind(key);
+    if (i != weighteds.constEnd()) return i.value();
+
+    QVector<double> returning;
+
+    if (count_ && ride->recIntSecs()) {
+
+        static const double EPSILON = 0.1;
+        static const double NEGLIGIBLE = 0.1;
+
+        double secsDelta = ride->recIntSecs();
+        double sampsPerWindow = double(secs) / secsDelta;
+        double attenuation = sampsPerWindow / (sampsPerWindow + secsDelta);
+        double sampleWeight = secsDelta / (sampsPerWindow + secsDelta);
+
+        const QVector<double> &values = columnLocked(series);
+        const QVector<double> &times = columnLocked(RideFile::secs);
+        const double *v = values.constData();
+        const double *t = times.constData();
+
+        double lastSecs = 0.0;
+        double weighted = 0.0;
+
+        returning.reserve(count_);
+        for (int j=0; j<count_; j++) {
+
+            // decay across any gaps in recording
+            while ((weighted > NEGLIGIBLE) && (t[j] > lastSecs + secsDelta + EPSILON)) {
+                weighted *= attenuation;
+                lastSecs += secsDelta;
+                returning << weighted;
+            }
+            weighted *= attenuation;
+            weighted += sampleWeight * v[j];
+            lastSecs = t[j];
+            returning << weighted;
+        }
+    }
+    weighteds.insert(key, returning);
+    return returning;
+}
+
+QVector<double>
+RideKernel::zoneTime(ZoneType type)
+{
+    QMutexLocker locker(&mutex);
+
+    QHash<int, QVector<double> >::const_iterator i = zones.constFind(type);
+    if (i != zones.constEnd()) return i.value();
+
+    QVector<double> returning;
+
+    // which zones and which series
+    const Zones *power = NULL;
+    const HrZones *hr = NULL;
+    const PaceZones *pace = NULL;
+    int range = -1;
+    RideFile::SeriesType series = RideFile::none;
+
+    if (count_) {
+        switch (type) {
+        case Power:
+            power = item->context->athlete->zones(item->isRun);
+            range = item->zoneRange;
+            series = RideFile::watts;
+            break;
+        case Hr:
+            hr = item->context->athlete->hrZones(item->isRun);
+            range = item->hrZoneRange;
+            series = RideFile::hr;
+            break;
+        case Pace:
+            pace = item->context->athlete->paceZones(item->isSwim);
+            range = item->paceZoneRange;
+            series = RideFile::kph;
+            break;
+        }
+    }
+
+    if ((power || hr || pace) && range >= 0) {
+
+        const QVector<double> &values = columnLocked(series);
+        const double *v = values.constData();
+        const double secs = ride->recIntSecs();
+
+        for (int j=0; j<count_; j++) {
+            int zone = power ? power->whichZone(range, v[j])
+                             : (hr ? hr->whichZone(range, v[j]) : pace->whichZone(range, v[j]));
+            if (zone < 0) continue;
+            if (zone >= returning.count()) returning.resize(zone+1);
+            returning[zone] += secs;
+        }
+    }
+    zones.insert(type, returning);
+    return returning;
+}
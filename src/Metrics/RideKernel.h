@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_RideKernel_h
+#define _GC_RideKernel_h 1
+
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+
+#include "RideFile.h"
+#include "Specification.h"
+
+class RideItem;
+
+// RideKernel holds the series that several metrics derive from the same
+// samples, for the samples in scope of one RideMetric::computeMetrics
+// pass (the whole ride or an interval). Each series is worked out the
+// first time a metric asks for it and then handed to the rest as a
+// contiguous array, so e.g. the 30s rolling power is computed once for
+// NP and not again for every metric that needs it.
+//
+// Metrics running in parallel (see RideMetric::computeMetrics) may ask
+// at the same time, so the series are built under a mutex.
+//
+class RideKernel
+{
+    public:
+
+        enum zonetype { Power=0, Hr, Pace };
+        typedef enum zonetype ZoneType;
+
+        RideKernel(RideItem *item, Specification spec);
+
+        // the samples in scope, dataPoints()[first] onwards
+        int first() const { return first_; }
+        int count() const { return count_; }
+
+        // raw series for the samples in scope
+        QVector<double> column(RideFile::SeriesType series);
+
+        // rolling average over secs, as used by NP. The window
+        // starts empty (zeroes) at the first sample in scope
+        QVector<double> rolling(RideFile::SeriesType series, int secs);
+
+        // exponentially weighted average over secs, as used by xPower.
+        // gaps in recording are filled while the average decays so
+        // there may be more values than samples
+        QVector<double> weighted(RideFile::SeriesType series, int secs);
+
+        // seconds spent in each zone, using the ranges for the ride
+        // empty if there are no zones configured
+        QVector<double> zoneTime(ZoneType type);
+
+    private:
+
+        RideItem *item;
+        RideFile *ride;
+        int first_, count_;
+
+        QMutex mutex;
+        QHash<int, QVector<double> > columns;
+        QHash<qint64, QVector<double> > rollings, weighteds;
+        QHash<int, QVector<double> > zones;
+
+        // call with mutex locked
+        const QVector<double> &columnLocked(RideFile::SeriesType series);
+};
+
+#endif
@@ -24,6 +24,9 @@
 #include "TimeUtils.h"
 #include "Zones.h"
 #include "HrZones.h"
+#include "RideKernel.h"
+
+#include <QtConcurrent>
 
 // DB Schema Version - YOU MUST UPDATE THIS IF THE SCHEMA VERSION CHANGES!!!
 // Schema version will change if a) the default metadata.xml is updated
@@ -172,28 +175,140 @@ RideMetric::userMetricFingerprint(QList<UserMetricSettings> these)
     return qChecksum(fingers.constData(), fingers.size());
 }
 
+// rides with this many samples (3 hours at 1s) have the
+// independent metrics computed in parallel
+static const int RideMetricParallel = 10800;
+
+// depth first, so dependencies come before dependants and
+// otherwise metrics are computed in the order they were added
+static int planMetric(RideMetricPlan &plan, QVector<char> &state, int index)
+{
+    if (state[index] == 2) return plan.level[index];
+    if (state[index] == 1) {
+        qDebug()<<"metric dep cycle:"<<index;
+        return -1;
+    }
+
+    state[index] = 1;
+    int level = 0;
+    foreach(int dep, plan.deps[index]) {
+        int below = planMetric(plan, state, dep);
+        if (below >= level) level = below + 1;
+    }
+    state[index] = 2;
+
+    plan.level[index] = level;
+    plan.order << index;
+    if (!plan.user[index] && level >= plan.levels) plan.levels = level + 1;
+    return level;
+}
+
+QSharedPointer<const RideMetricPlan>
+RideMetricFactory::plan() const
+{
+    QMutexLocker locker(&planMutex);
+    if (plan_) return plan_;
+
+    checkDependencies();
+
+    // dependencies by index, any we don't know are dropped
+    // (checkDependencies moans about those)
+    RideMetricPlan *plan = new RideMetricPlan;
+    const int count = metricNames.count();
+    plan->deps.resize(count);
+    plan->level.fill(0, count);
+    plan->user.fill(false, count);
+    for (int i=0; i<count; i++) {
+        const RideMetric *m = metrics.value(metricNames[i]);
+        plan->user[i] = m->isUser();
+        foreach(const QString &dep, dependencies(metricNames[i])) {
+            const RideMetric *d = metrics.value(dep, NULL);
+            if (d) plan->deps[i] << d->index();
+        }
+    }
+
+    // topological sort
+    QVector<char> state(count, 0);
+    for (int i=0; i<count; i++) planMetric(*plan, state, i);
+
+    plan_ = QSharedPointer<const RideMetricPlan>(plan);
+    return plan_;
+}
+
+// one metric in the plan
+struct RideMetricStep {
+    RideItem *item;
+    Specification *spec;
+    const QHash<QString,RideMetric*> *done;
+    QString symbol;
+    RideMetric *metric;
+};
+
+static void computeStep(RideMetricStep &step)
+{
+    // we clone so we can remain thread safe
+    // do not be tempted to change this (!)
+    RideMetric *m = RideMetricFactory::instance().newMetric(step.symbol);
+    m->setValue(0.0);
+    m->setCount(0);
+    m->compute(step.item, *step.spec, *step.done);
+
+    // override the computed value if set by user, but not for intervals
+    if (!step.spec->interval() && step.item->ride() && step.item->ride()->metricOverrides.contains(step.symbol))
+        m->override(step.item->ride()->metricOverrides.value(step.symbol));
+
+    step.metric = m;
+}
+
 QHash<QString,RideMetricPtr>
 RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList &metrics)
 {
     const RideMetricFactory &factory = RideMetricFactory::instance();
 
-    // generate worklist from metrics we know
-    // bear in mind this can change as users add
-    // and remove user metrics
-    // builtin User metrics are computed after builtins
-    // since they don't have explicit dependencies set, yet.
-    QStringList builtin;
-    QStringList user;
-    foreach(QString metric, metrics)
-        if (factory.haveMetric(metric)) {
-            if (factory.rideMetric(metric)->isUser())
-                user << metric;
-            else
-                builtin << metric;
+    // the plan is recomputed when user metrics are added
+    // or removed, so hang on to the one we start with
+    QSharedPointer<const RideMetricPlan> plan = factory.plan();
+    const int count = plan->order.count();
+
+    // what was asked for, metrics we don't know are ignored
+    QVector<char> wanted(count, 0);
+    bool user = false;
+    foreach(QString metric, metrics) {
+        const RideMetric *m = factory.rideMetric(metric);
+        if (m && m->index() < count) {
+            wanted[m->index()] = 1;
+            if (m->isUser()) user = true;
         }
+    }
 
-    // this is what we've completed as we go
-    QHash<QString,RideMetric*> done;
+    // this is what we've completed as we go, by index and by
+    // symbol since that is how compute() looks up dependencies
+    QVector<RideMetric*> done(count, NULL);
+    QHash<QString,RideMetric*> symbols;
+    symbols.reserve(count);
+
+    // an interval computes its metrics as they are wanted, those it already
+    // has are used as they are rather than computed again. User metrics
+    // declare no dependencies so this is also what they get to see.
+    if (spec.interval()) {
+        IntervalItem *interval = spec.interval();
+        for (int i=0; i<count && i<interval->computed().size(); i++) {
+            if (wanted[i] || !interval->computed().testBit(i)) continue;
+
+            RideMetric *m = factory.newMetric(factory.metricName(i));
+            m->setValue(interval->metrics().value(i));
+            m->setCount(interval->counts().value(i));
+            done[i] = m;
+            symbols.insert(factory.metricName(i), m);
+        }
+    }
+
+    // and what they depend upon, dependants come before
+    // their dependencies when working backwards
+    for (int i=count-1; i>=0; i--) {
+        int index = plan->order[i];
+        if (wanted[index]) foreach(int dep, plan->deps[index]) if (!done[dep]) wanted[dep] = 1;
+    }
 
     // resize the metric array in the interval if needed
     if (spec.interval() && spec.interval()->metrics().size() < factory.metricCount()) 
@@ -203,63 +318,62 @@ RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList
     if (!spec.interval() && item->metrics().size() < factory.metricCount())
         item->metrics().resize(factory.metricCount());
 
-    // working through the todo list...
-    while (!builtin.isEmpty() || !user.isEmpty()) {
+    // user metrics will interrogate the value array for symbol values, rather
+    // than the metric pointer. this is crucial, even though RideItem and
+    // IntervalItem both update their values directly. But only need to
+    // bother if the user has defined any local metrics.
+    QVector<double> &values = spec.interval() ? spec.interval()->metrics() : item->metrics();
 
-        // next one to do, builtins first then user defined
-        QString symbol = builtin.isEmpty() ? user.takeFirst() :
-                                             builtin.takeFirst();
+    // series derived once and shared by all the metrics in this pass
+    RideKernel kernel(item, spec);
+    spec.setKernel(&kernel);
 
-        // doesn't exist !
-        if (!factory.haveMetric(symbol)) continue;
+    // long rides compute each level of the plan in parallel, the metrics in a
+    // level only depend on those in the levels below. W'bal is looked up first
+    // since it is cached on first use, and the weight is fixed for the pass.
+    RideFile *f = spec.interval() ? NULL : item->ride(false);
+    if (f && f->dataPoints().count() >= RideMetricParallel && plan->levels > 1) {
 
-        // does this one have any dependencies?
-        const QVector<QString> &deps = factory.dependencies(symbol);
+        f->wprimeData();
+        item->fixWeight(true);
 
-        bool ready = true;
+        QVector<QVector<RideMetricStep> > levels(plan->levels);
+        for (int i=0; i<count; i++) {
+            int index = plan->order[i];
+            if (!wanted[index] || plan->user[index]) continue;
 
-        // if the dependencies aren't done yet add to the end of the list
-        foreach (QString dep, deps) {
-            if (!done.contains(dep)) {
-                ready = false;
-                if (!builtin.contains(dep))
-                    builtin.append(dep);
-            }
+            RideMetricStep step = { item, &spec, &symbols, factory.metricName(index), NULL };
+            levels[plan->level[index]] << step;
         }
 
-        // if all our depencies are computed we can do this one
-        if (ready) {
-
-            // we clone so we can remain thread safe
-            // do not be tempted to change this (!)
-            RideMetric *m = factory.newMetric(symbol);
-            m->setValue(0.0);
-            m->setCount(0);
-            m->compute(item, spec, done);
-
-            // override the computed value if set by user, but not for intervals
-            if (!spec.interval() && item->ride() && item->ride()->metricOverrides.contains(symbol))
-                m->override(item->ride()->metricOverrides.value(symbol));
-
-            // all computed add to the return list
-            done.insert(symbol, m);
-
-            // put into value array too. user metrics will interrogate
-            // this for symbol values, rather than the metric pointer
-            // this is crucial, even though RideItem and IntervalItem both
-            // update their values directly. But only need to bother if the
-            // user has defined any local metrics.
-            if (user.count()) {
-                if (spec.interval()) spec.interval()->metrics()[m->index()] = m->value();
-                else item->metrics()[m->index()] = m->value();
+        for (int l=0; l<levels.count(); l++) {
+            QVector<RideMetricStep> &steps = levels[l];
+            if (steps.count() > 1) QtConcurrent::blockingMap(steps, computeStep);
+            else if (steps.count()) computeStep(steps[0]);
+
+            // all computed, add to the done list
+            foreach(const RideMetricStep &step, steps) {
+                done[step.metric->index()] = step.metric;
+                symbols.insert(step.symbol, step.metric);
+                if (user) values[step.metric->index()] = step.metric->value();
             }
+        }
+        item->fixWeight(false);
+    }
+
+    // working through the plan, builtins first then user defined
+    for (int pass=0; pass<2; pass++) {
+        for (int i=0; i<count; i++) {
+            int index = plan->order[i];
+            if (!wanted[index] || done[index] || plan->user[index] != (pass == 1)) continue;
 
-        } else {
+            RideMetricStep step = { item, &spec, &symbols, factory.metricName(index), NULL };
+            computeStep(step);
 
-            // we need to wait for our dependencies so add
-            // to the back of the list 
-            if (!builtin.contains(symbol))
-                builtin.append(symbol);
+            // all computed, add to the done list
+            done[index] = step.metric;
+            symbols.insert(step.symbol, step.metric);
+            if (user) values[index] = step.metric->value();
         }
     }
 
@@ -267,15 +381,15 @@ RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList
     // which is deleted when reference count 0 and goes out of scope
     QHash<QString,RideMetricPtr> result;
     foreach (QString symbol, metrics) {
-        if (factory.haveMetric(symbol)) {
-            result.insert(symbol, QSharedPointer<RideMetric>(done.value(symbol)));
-            done.remove(symbol);
+        const RideMetric *m = factory.rideMetric(symbol);
+        if (m && m->index() < count && done[m->index()]) {
+            result.insert(symbol, QSharedPointer<RideMetric>(done[m->index()]));
+            done[m->index()] = NULL;
         }
     }
 
     // delete the cloned metrics, no memory leak here :)
-    foreach (QString symbol, done.keys())
-        delete done.value(symbol);
+    foreach (RideMetric *m, done) delete m;
 
     // and we're done
     return result;
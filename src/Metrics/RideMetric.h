@@ -345,6 +345,23 @@ public:
 
 };
 
+//
+// The order metrics are computed in. It is worked out once for the
+// metrics we have (see RideMetricFactory::plan) and then used by
+// RideMetric::computeMetrics for every ride and interval.
+// Everything is addressed by metric index.
+//
+struct RideMetricPlan {
+
+    QVector<int> order;             // metric indexes, dependencies before dependants
+    QVector<QVector<int> > deps;    // dependencies of each metric
+    QVector<int> level;             // longest chain of dependencies below each metric
+    QVector<bool> user;             // user metrics are computed after the builtins
+    int levels;
+
+    RideMetricPlan() : levels(0) {}
+};
+
 class RideMetricFactory {
 
     static RideMetricFactory *_instance;
@@ -356,6 +373,11 @@ class RideMetricFactory {
     QHash<QString,QVector<QString>*> dependencyMap;
     bool dependenciesChecked;
 
+    // rebuilt on first use after metrics are added or removed
+    mutable QMutex planMutex;
+    mutable QSharedPointer<const RideMetricPlan> plan_;
+    void invalidatePlan() { QMutexLocker locker(&planMutex); plan_.clear(); }
+
     RideMetricFactory() : dependenciesChecked(false) {}
     RideMetricFactory(const RideMetricFactory &other);
     RideMetricFactory &operator=(const RideMetricFactory &other);
@@ -423,6 +445,7 @@ class RideMetricFactory {
                 metricNames.takeAt(firstUser);
                 metricTypes.remove(firstUser);
             }
+            invalidatePlan();
         }
     }
 
@@ -441,6 +464,7 @@ class RideMetricFactory {
             dependencyMap.insert(metric.symbol(), copy);
             dependenciesChecked = false;
         }
+        invalidatePlan();
         return true;
     }
 
@@ -449,6 +473,9 @@ class RideMetricFactory {
         QVector<QString> *result = dependencyMap.value(symbol);
         return result ? *result : noDeps;
     }
+
+    // the execution plan for the metrics we have now
+    QSharedPointer<const RideMetricPlan> plan() const;
 };
 
 #endif // _GC_RideMetric_h
@@ -22,6 +22,7 @@
 #include "Context.h"
 #include "Athlete.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include "Zones.h"
 #include <cmath>
 #include <assert.h>
@@ -62,13 +63,9 @@ class ZoneTime : public RideMetric {
 
         seconds = 0;
 
-        // iterate and compute
-        RideFileIterator it(item->ride(), spec);
-        while (it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            if (item->context->athlete->zones(item->isRun)->whichZone(item->zoneRange, point->watts) == level)
-                seconds += item->ride()->recIntSecs();
-        }
+        // all the zones are worked out in one pass, shared with other metrics
+        QVector<double> zones = spec.kernel()->zoneTime(RideKernel::Power);
+        if (level < zones.count()) seconds = zones[level];
         setValue(seconds);
     }
 
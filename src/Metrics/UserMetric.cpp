@@ -38,6 +38,12 @@ UserMetric::UserMetric(Context *context, UserMetricSettings settings)
     fvalue = rt->functions.contains("value") ? rt->functions.value("value") : NULL;
     fcount = rt->functions.contains("count") ? rt->functions.value("count") : NULL;
 
+    // compile them now so clones get a copy
+    foreach(Leaf *f, QList<Leaf*>() << finit << frelevant << fsample << fbefore << fafter << fvalue << fcount)
+        if (f) rt->program(f);
+    foreach(Leaf *f, QList<Leaf*>() << fsample << fbefore << fafter)
+        if (f) rt->batch(f);
+
     // we're not a clone, we're the original
     clone_ = false;
 }
@@ -184,7 +190,7 @@ UserMetric::isRelevantForRide(const RideItem *item) const
 {
     if (item->context && root) {
         if (frelevant) {
-            Result res = root->eval(rt, frelevant, 0, const_cast<RideItem*>(item), NULL);
+            Result res = rt->evaluate(frelevant, 0, const_cast<RideItem*>(item), NULL);
             return res.number;
         } else
             return true;
@@ -216,7 +222,7 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
 
     //qDebug()<<"INIT";
     // always init first
-    if (finit) root->eval(rt, finit, 0, const_cast<RideItem*>(item), NULL, c);
+    if (finit) rt->evaluate(finit, 0, const_cast<RideItem*>(item), NULL, c);
 
     //qDebug()<<"CHECK";
     // can it provide a value and is it relevant ?
@@ -230,9 +236,15 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     if (!spec.isEmpty(item->ride()) && fbefore) {
         RideFileIterator it(item->ride(), spec, RideFileIterator::Before);
 
-        while(it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            root->eval(rt, fbefore, 0, const_cast<RideItem*>(item), point, c);
+        // over whole columns if we can, otherwise point by point
+        const DataFilterBatch &batch = rt->batch(fbefore);
+        if (batch.isValid()) {
+            if (it.hasNext()) batch.run(rt, 0, const_cast<RideItem*>(item), it.firstIndex(), it.lastIndex(), c);
+        } else {
+            while(it.hasNext()) {
+                struct RideFilePoint *point = it.next();
+                rt->evaluate(fbefore, 0, const_cast<RideItem*>(item), point, c);
+            }
         }
     }
 
@@ -241,9 +253,15 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     if (!spec.isEmpty(item->ride()) && fsample) {
         RideFileIterator it(item->ride(), spec);
 
-        while(it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            root->eval(rt, fsample, 0, const_cast<RideItem*>(item), point, c);
+        // over whole columns if we can, otherwise point by point
+        const DataFilterBatch &batch = rt->batch(fsample);
+        if (batch.isValid()) {
+            if (it.hasNext()) batch.run(rt, 0, const_cast<RideItem*>(item), it.firstIndex(), it.lastIndex(), c);
+        } else {
+            while(it.hasNext()) {
+                struct RideFilePoint *point = it.next();
+                rt->evaluate(fsample, 0, const_cast<RideItem*>(item), point, c);
+            }
         }
     }
 
@@ -251,9 +269,15 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     if (!spec.isEmpty(item->ride()) && fafter) {
         RideFileIterator it(item->ride(), spec, RideFileIterator::After);
 
-        while(it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            root->eval(rt, fafter, 0, const_cast<RideItem*>(item), point, c);
+        // over whole columns if we can, otherwise point by point
+        const DataFilterBatch &batch = rt->batch(fafter);
+        if (batch.isValid()) {
+            if (it.hasNext()) batch.run(rt, 0, const_cast<RideItem*>(item), it.firstIndex(), it.lastIndex(), c);
+        } else {
+            while(it.hasNext()) {
+                struct RideFilePoint *point = it.next();
+                rt->evaluate(fafter, 0, const_cast<RideItem*>(item), point, c);
+            }
         }
     }
 
@@ -261,14 +285,14 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     //qDebug()<<"VALUE";
     // value ?
     if (fvalue) {
-        Result v = root->eval(rt, fvalue, 0, const_cast<RideItem*>(item), NULL, c);
+        Result v = rt->evaluate(fvalue, 0, const_cast<RideItem*>(item), NULL, c);
         setValue(v.number);
     }
 
     //qDebug()<<"COUNT";
     // count?
     if (fcount) {
-        Result n = root->eval(rt, fcount, 0, const_cast<RideItem*>(item), NULL, c);
+        Result n = rt->evaluate(fcount, 0, const_cast<RideItem*>(item), NULL, c);
         setCount(n.number);
     }
 
@@ -30,22 +30,14 @@
 // 
 // To optimise the original implementation that computed the integral at
 // each point t as a function of the preceding power above CP at time u through t
-// we did 2 things;
+// we compute the exp decay for each power above CP and integrate the decay
+// into the future.
 //
-// 1. compute the exp decay for each poweer above CP and integrate the decay
-//    into the future -- but crucially, no need to bother if power above CP is 0.
-//    This typically reduces the cpu cycles by a factor of 4
-//
-// 2. Because the decay is calculated forward at time u we can do these in parallel;
-//    i.e. run multiple threads for t=0 through t=time/nthreads. This reduced the
-//    elapsed time by a factor of about 2/3rds on a dual core processor.
-//
-// We could extend the threading to have more than 2 threads on PCs with more cores
-// but this would conflict with the ridefilecache computations anyway.
-//
-// There may be room for improvement by adopting a different integration strategy
-// in the future, but now, a typical 4 hour hilly ride can be computed in 250ms on
-// and Athlon dual core CPU where previously it took 4000ms.
+// That was originally summed as exp(u/TAU) terms which overflow on long rides
+// so was split across threads; it is now carried forward as a running sum that
+// is decayed by exp(-1/TAU) each second, see WPrimeIntegrator in WPrime.h. A
+// typical 4 hour hilly ride is one multiply-add per second and takes well
+// under a millisecond.
 
 
 #include "WPrime.h"
@@ -133,35 +125,38 @@ WPrime::setRide(RideFile *input)
     double offset = 0; // always start from zero seconds (e.g. intervals start at and offset in ride)
     bool first = true;
 
-    RideFilePoint *lp=NULL;
-    foreach(RideFilePoint *p, input->dataPoints()) {
+    // scan the columns rather than the points
+    const QVector<double> secs = input->column(RideFile::secs);
+    const QVector<double> watts = input->column(RideFile::watts);
+    const QVector<double> km = input->column(RideFile::km);
+
+    for (int i=0; i<secs.count(); i++) {
 
         // yuck! nasty data
-        if (p->secs > (25*60*60)) return;
+        if (secs[i] > (25*60*60)) return;
 
         if (first) {
-            offset = p->secs;
+            offset = secs[i];
             first = false;
         }
 
         // fill gaps in recording with zeroes
-        if (lp)
-            for(double t=lp->secs+input->recIntSecs();
-                (t + input->recIntSecs()) < p->secs;
+        if (i)
+            for(double t=secs[i-1]+input->recIntSecs();
+                (t + input->recIntSecs()) < secs[i];
                 t += input->recIntSecs()) {
                 points << QPointF(t-offset, 0);
-                pointsd << QPointF(t-offset, p->km * convert); // not zero !!!! this is a map from secs -> km not a series
+                pointsd << QPointF(t-offset, km[i] * convert); // not zero !!!! this is a map from secs -> km not a series
             }
 
         // lets not go backwards -- or two samples at the same time
-        if ((lp && p->secs > lp->secs) || !lp) {
-            points << QPointF(p->secs - offset, p->watts);
-            pointsd << QPointF(p->secs - offset, p->km * convert);
+        if ((i && secs[i] > secs[i-1]) || !i) {
+            points << QPointF(secs[i] - offset, watts[i]);
+            pointsd << QPointF(secs[i] - offset, km[i] * convert);
         }
 
         // update state
-        last = p->secs - offset;
-        lp = p;
+        last = secs[i] - offset;
     }
 
     // Create a spline
@@ -233,14 +228,12 @@ WPrime::setRide(RideFile *input)
 
         QVector<double> myvalues(last+1);
 
-        WPrimeIntegrator a(powerValues, 0, last, TAU);
-
-        a.start();
-        a.wait();
+        QVector<double> output;
+        WPrimeIntegrator::integrate(powerValues, last, TAU, output);
 
         // sum values
         for (int t=0; t<=last; t++) {
-            values[t] = a.output[t];
+            values[t] = output[t];
             xvalues[t] = t / 60.00f;
         }
 
@@ -415,14 +408,12 @@ WPrime::setWatts(Context *context, QVector<int>&wattsArray, int CP, int WPRIME)
 
         QVector<double> myvalues(last+1);
 
-        WPrimeIntegrator a(powerValues, 0, last, TAU);
-
-        a.start();
-        a.wait();
+        QVector<double> output;
+        WPrimeIntegrator::integrate(powerValues, last, TAU, output);
 
         // sum values
         for (int t=0; t<=last; t++) {
-            values[t] = a.output[t];
+            values[t] = output[t];
             xvalues[t] = t * 1000.00f;
         }
 
@@ -532,14 +523,12 @@ WPrime::setErg(ErgFile *input)
 
         QVector<double> myvalues(last+1);
 
-        WPrimeIntegrator a(powerValues, 0, last, TAU);
-
-        a.start();
-        a.wait();
+        QVector<double> output;
+        WPrimeIntegrator::integrate(powerValues, last, TAU, output);
 
         // sum values
         for (int t=0; t<=last; t++) {
-            values[t] = a.output[t];
+            values[t] = output[t];
             xvalues[t] = t * 1000.00f;
         }
 
@@ -638,23 +627,71 @@ WPrime::maxMatch()
 }
 
 
-// decay and integrate -- split into threads for best performance
-WPrimeIntegrator::WPrimeIntegrator(QVector<int> &source, int begin, int end, double TAU) :
-    source(source), begin(begin), end(end), TAU(TAU)
+// streaming
+WPrimeIntegrator::WPrimeIntegrator(double TAU, double step) : TAU(0), step(step), decay(0), I(0), secs(0)
 {
-    output.resize(source.size());
+    setTAU(TAU);
 }
 
 void
-WPrimeIntegrator::run()
+WPrimeIntegrator::setTAU(double TAU)
 {
-    // run from start to stop adding decay to end
+    if (TAU == this->TAU) return;
+    this->TAU = TAU;
+    decay = TAU > 0 ? exp(-step / TAU) : 0;
+}
+
+double
+WPrimeIntegrator::push(double source, double secs)
+{
+    // decay since the last sample, which may be irregular
+    if (TAU > 0) I *= exp(-(secs - this->secs) / TAU);
+    else I = 0;
+    I += source;
+
+    this->secs = secs;
+    return I;
+}
+
+// batch, 1s samples
+void
+WPrimeIntegrator::integrate(const QVector<int> &source, int end, double TAU, QVector<double> &output)
+{
+    output.resize(source.size());
+    if (end >= source.size()) end = source.size()-1;
+
+    const double decay = exp(-1.0 / TAU);
+    const int *in = source.constData();
+    double *out = output.data();
+
     double I = 0.00f;
     for (int t=0; t<=end; t++) {
+        I = I * decay + in[t];
+        out[t] = I;
+    }
+}
 
-        I += exp(((double)(t) / TAU)) * source[t];
-        output[t] = exp(-((double)(t) / TAU)) * I;
+// batch, many parameter sets at once
+void
+WPrimeIntegrator::wbal(const int *watts, int n, int count, const double *CP,
+                       const double *W, const double *TAU, double *wbal)
+{
+    QVector<double> decay(count), I(count, 0.00f);
+    double *d = decay.data();
+    double *sum = I.data();
+
+    for (int i=0; i<count; i++) d[i] = exp(-1.0 / TAU[i]);
+
+    for (int t=0; t<n; t++) {
+
+        const double value = watts[t];
+        for (int i=0; i<count; i++) {
+            double above = value - CP[i];
+            sum[i] = sum[i] * d[i] + (above > 0 ? above : 0);
+        }
     }
+
+    for (int i=0; i<count; i++) wbal[i] = W[i] - sum[i];
 }
 
 //
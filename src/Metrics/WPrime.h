@@ -100,21 +100,47 @@ class WPrime {
         bool wasIntegral;
 };
 
-class WPrimeIntegrator : public QThread
+// The integral model has W' expended at time t as the sum of all the power
+// above CP before it, each decaying with time constant TAU;
+//
+//      I(t) = sum(u<=t) P(u) * exp(-(t-u)/TAU)
+//
+// This used to be computed as exp(-t/TAU) * sum(exp(u/TAU) * P(u)) which
+// is two exp() calls per sample and overflows a double on long rides, so
+// instead we carry the sum forward and decay it at each step;
+//
+//      I(t) = I(t-1) * exp(-1/TAU) + P(t)
+//
+// which is one multiply-add per sample. All the integral W'bal
+// computations (WPrime, CPSolver and train mode) use this.
+class WPrimeIntegrator
 {
     public:
-        WPrimeIntegrator(QVector<int> &source, int begin, int end, double TAU);
+        // streaming, one sample at a time
+        WPrimeIntegrator(double TAU=300, double step=1.0);
 
-        // integrate from start to stop from source into output
-        // basically sums in the exponential decays, but we break it
-        // into threads to parallelise the work
-        void run();
+        void setTAU(double TAU);
+        void reset() { I = 0; secs = 0; }
 
-        QVector<int> &source;
-        int begin, end;
-        double TAU;
+        // add the next sample at a fixed step, or at a time in seconds
+        // for an irregular step (e.g. the train mode telemetry loop)
+        double push(double source) { I = I * decay + source; return I; }
+        double push(double source, double secs);
 
-        // resized to match source holds results
-        QVector<double> output;
+        // W' expended so far
+        double value() const { return I; }
+
+        // batch, source is power above CP in 1s samples, output[0..end]
+        // is W' expended at each second and is resized to match source
+        static void integrate(const QVector<int> &source, int end, double TAU, QVector<double> &output);
+
+        // W'bal at the end of n watts (1s samples) for count sets of CP, W'
+        // and TAU, the inner loop is across the parameter sets so it can
+        // be vectorised by the compiler
+        static void wbal(const int *watts, int n, int count, const double *CP,
+                         const double *W, const double *TAU, double *wbal);
+
+    private:
+        double TAU, step, decay, I, secs;
 };
 #endif
@@ -21,6 +21,7 @@
 #include "Context.h"
 #include "Athlete.h"
 #include "Specification.h"
+#include "RideKernel.h"
 #include "Zones.h"
 #include <cmath>
 #include <assert.h>
@@ -56,38 +57,14 @@ class aNP : public RideMetric {
             return;
         }
 
-        int rollingwindowsize = 30 / item->ride()->recIntSecs();
+        // 30s rolling average, shared with other metrics
+        QVector<double> rolling = spec.kernel()->rolling(RideFile::aPower, 30);
 
         double total = 0;
-        int count = 0;
+        int count = rolling.count();
+        const double *r = rolling.constData();
+        for (int i=0; i<count; i++) total += pow(r[i],4); // raise rolling average to 4th power
 
-        // no point doing a rolling average if the
-        // sample rate is greater than the rolling average
-        // window!!
-        if (rollingwindowsize > 1) {
-
-            QVector<double> rolling(rollingwindowsize);
-            int index = 0;
-            double sum = 0;
-
-            RideFileIterator it(item->ride(), spec);
-
-            // loop over the data and convert to a rolling
-            // average for the given windowsize
-            for (int i=it.firstIndex(); i >=0 && i<=it.lastIndex(); i++) {
-
-                sum += item->ride()->dataPoints()[i]->apower;
-                sum -= rolling[index];
-
-                rolling[index] = item->ride()->dataPoints()[i]->apower;
-
-                total += pow(sum/rollingwindowsize,4); // raise rolling average to 4th power
-                count ++;
-
-                // move index on/round
-                index = (index >= rollingwindowsize-1) ? 0 : index+1;
-            }
-        }
         if (count) {
             np = pow(total / (count), 0.25);
             secs = count * item->ride()->recIntSecs();
@@ -1134,6 +1134,12 @@ Bindings::seasonIntervals(DateRange range, QString type) const
     PyDict_SetItemString(dict, "type", typelist);
     PyDict_SetItemString(dict, "color", colorlist);
 
+    // interval metrics are computed on demand, get them all now
+    foreach(RideItem *ride, context->athlete->rideCache->rides()) {
+        if (!specification.pass(ride)) continue;
+        if (range.pass(ride->dateTime.date())) ride->computeIntervalMetrics();
+    }
+
     //
     // METRICS
     //
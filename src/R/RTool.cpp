@@ -1508,6 +1508,12 @@ RTool::dfForDateRangeIntervals(DateRange range, QStringList types)
     // time + clas + name + type, but not ans!
     UNPROTECT(6);
 
+    // interval metrics are computed on demand, get them all now
+    foreach(RideItem *ride, rtool->context->athlete->rideCache->rides()) {
+        if (!specification.pass(ride)) continue;
+        if (range.pass(ride->dateTime.date())) ride->computeIntervalMetrics();
+    }
+
     //
     // METRICS
     //
@@ -57,9 +57,10 @@ public:
     virtual void getRealtimeData(RealtimeData &rtData); // update realtime data with current values
     virtual void pushRealtimeData(RealtimeData &rtData); // update realtime data with current values
 
-    // only relevant for Computrainer like devices
-    virtual void setLoad(double) { return; }
-    virtual void setGradient(double) { return; }
+    // only relevant for Computrainer like devices, TrainControl queues
+    // these so they run on our thread, as getRealtimeData() does
+    Q_INVOKABLE virtual void setLoad(double) { return; }
+    Q_INVOKABLE virtual void setGradient(double) { return; }
     virtual void setMode(int) { return; }
 
     virtual uint8_t  getCalibrationType() { return CALIBRATION_TYPE_NOT_SUPPORTED; }
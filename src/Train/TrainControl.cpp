@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TrainControl.h"
+#include "ErgFile.h"
+#include "RealtimeController.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+TrainControl::TrainControl(QObject *parent) : QThread(parent), ergFile(NULL), ergo(true),
+    period(1000), running(false), distance(0)
+{
+}
+
+TrainControl::~TrainControl()
+{
+    stopControl();
+}
+
+void
+TrainControl::startControl(ErgFile *ergFile, QList<RealtimeController*> devices, bool ergo, long msecs, int period)
+{
+    stopControl();
+
+    this->ergFile = ergFile;
+    this->devices = devices;
+    this->ergo = ergo;
+    this->period = period > 0 ? period : 1000;
+
+    state = Snapshot();
+    state.msecs = msecs;
+    running = true;
+
+    start(QThread::TimeCriticalPriority);
+}
+
+long
+TrainControl::stopControl()
+{
+    pvars.lock();
+    running = false;
+    wake.wakeAll();
+    pvars.unlock();
+
+    wait();
+
+    QMutexLocker locker(&pvars);
+    if (state.ticks) {
+        qDebug() << "train control:" << state.ticks << "ticks"
+                 << "max jitter" << state.maxjitter << "us"
+                 << "max latency" << state.maxlatency << "us"
+                 << "overruns" << state.overruns;
+    }
+    return state.msecs;
+}
+
+void
+TrainControl::setDistance(double km)
+{
+    QMutexLocker locker(&pvars);
+    distance = km;
+}
+
+long
+TrainControl::seek(long msecs)
+{
+    QMutexLocker locker(&pvars);
+    state.msecs = msecs < 0 ? 0 : msecs;
+    return state.msecs;
+}
+
+long
+TrainControl::skip(long msecs)
+{
+    QMutexLocker locker(&pvars);
+    state.msecs += msecs;
+    if (state.msecs < 0) state.msecs = 0;
+    return state.msecs;
+}
+
+TrainControl::Snapshot
+TrainControl::snapshot()
+{
+    QMutexLocker locker(&pvars);
+    return state;
+}
+
+void
+TrainControl::run()
+{
+    // all times in nanoseconds since we started
+    QElapsedTimer clock;
+    clock.start();
+
+    const qint64 periodns = qint64(period) * 1000000;
+    qint64 next = periodns; // when the next tick is due
+    qint64 last = 0;        // when the last tick started
+
+    pvars.lock();
+    while (running) {
+
+        // wait for the tick to be due, or to be stopped
+        qint64 now = clock.nsecsElapsed();
+        if (now < next) {
+            wake.wait(&pvars, (next - now + 999999) / 1000000);
+            continue;
+        }
+
+        // keep to the schedule, if we are more than a period
+        // late we skip the ticks we missed rather than bunch up
+        qint64 late = now - next;
+        next += periodns;
+        if (next <= now) {
+            state.overruns += (now - next) / periodns + 1;
+            next = now + periodns;
+        }
+
+        // milliseconds since the last tick, the period is not
+        // exactly period but differencing whole msecs doesn't drift
+        long elapsed = (now / 1000000) - (last / 1000000);
+        last = now;
+
+        pvars.unlock();
+        bool more = control(elapsed);
+        qint64 done = clock.nsecsElapsed();
+        pvars.lock();
+
+        state.ticks++;
+        state.jitter = late / 1000;
+        state.latency = (done - now) / 1000;
+        if (state.jitter > state.maxjitter) state.maxjitter = state.jitter;
+        if (state.latency > state.maxlatency) state.maxlatency = state.latency;
+
+        // we got to the end
+        if (!more) running = false;
+
+        pvars.unlock();
+        emit tick();
+        pvars.lock();
+    }
+    pvars.unlock();
+}
+
+bool
+TrainControl::control(long elapsed)
+{
+    if (!ergFile) return false;
+
+    pvars.lock();
+    state.msecs += elapsed;
+    long msecs = state.msecs;
+    double km = distance;
+    pvars.unlock();
+
+    int lap = 0;
+    double load = 0, slope = 0;
+
+    erg.lock();
+    if (ergo) load = ergFile->wattsAt(msecs, lap);
+    else slope = ergFile->gradientAt(km * 1000, lap);
+    erg.unlock();
+
+    // the devices are set on the thread they live on, where the GUI reads
+    // their telemetry, since most controllers don't lock what they share
+    bool finished = ergo ? (load == -100) : (slope == -100);
+    if (!finished) {
+        foreach(RealtimeController *device, devices) {
+            if (ergo) QMetaObject::invokeMethod(device, "setLoad", Qt::QueuedConnection, Q_ARG(double, load));
+            else QMetaObject::invokeMethod(device, "setGradient", Qt::QueuedConnection, Q_ARG(double, slope));
+        }
+    }
+
+    QMutexLocker locker(&pvars);
+    state.lap = lap;
+    state.finished = finished;
+    if (!finished) {
+        if (ergo) state.load = load;
+        else state.slope = slope;
+    }
+    return !finished;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_TrainControl_h
+#define _GC_TrainControl_h 1
+#include "GoldenCheetah.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QList>
+
+class ErgFile;
+class RealtimeController;
+
+// TrainControl runs the workout while training: every period it works
+// out where we are in the ergFile, the load (erg) or gradient (slope)
+// to apply and sets it on the devices. It runs on its own high priority
+// thread on a fixed schedule, so the GUI repainting charts or decoding
+// video doesn't delay or stretch the control period. The devices are
+// set with queued calls that run on the thread each controller lives
+// on, so they never race with the GUI reading their telemetry.
+//
+// The GUI gets the latest state with snapshot(), the tick() signal says
+// a new one is available. Laps, reaching the end of the workout and
+// telling everyone where we are is left to the GUI thread (see
+// TrainSidebar::loadUpdate).
+//
+// It also keeps track of how well it is keeping to the schedule, the
+// jitter is how late a tick started and the latency how long it took
+// to compute the load and queue it for the devices.
+//
+class TrainControl : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+        struct Snapshot {
+
+            Snapshot() : msecs(0), lap(0), load(0), slope(0), finished(false), ticks(0),
+                         jitter(0), maxjitter(0), latency(0), maxlatency(0), overruns(0) {}
+
+            long msecs;         // into the workout
+            int lap;            // workout lap we are in
+            double load, slope; // as set on the devices
+            bool finished;      // reached the end of the workout
+
+            // instrumentation, microseconds
+            long ticks;
+            qint64 jitter, maxjitter, latency, maxlatency;
+            long overruns;      // ticks skipped as we were too late
+        };
+
+        TrainControl(QObject *parent=0);
+        ~TrainControl();
+
+        // run the workout msecs in, the devices must outlive the run
+        void startControl(ErgFile *ergFile, QList<RealtimeController*> devices, bool ergo, long msecs, int period);
+
+        // stop running, returns msecs into the workout
+        long stopControl();
+
+        // slope mode follows the distance ridden (km)
+        void setDistance(double km);
+
+        // move around the workout whilst running, returns msecs into the workout
+        long seek(long msecs);
+        long skip(long msecs);
+
+        Snapshot snapshot();
+
+        // hold whilst changing the ergFile as we run
+        QMutex *ergLock() { return &erg; }
+
+    signals:
+
+        void tick();
+
+    protected:
+
+        void run();
+
+    private:
+
+        // one control period, elapsed msecs since the last
+        bool control(long elapsed);
+
+        ErgFile *ergFile;
+        QList<RealtimeController*> devices;
+        bool ergo;
+        int period;
+
+        QMutex erg;         // ergFile
+        QMutex pvars;       // state and snapshot
+        QWaitCondition wake;
+        bool running;
+
+        double distance;
+        Snapshot state;
+};
+
+#endif // _GC_TrainControl_h
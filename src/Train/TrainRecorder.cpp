@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TrainRecorder.h"
+
+#include <QTextStream>
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// snapshots come in at 5 a second, so this is well over a minute
+static const int TrainRecorderRing = 512;
+
+// how often the recorder wakes up to write, and syncs to disk
+static const int TrainRecorderWrite = 250;
+static const int TrainRecorderSync = 10000;
+
+TrainRecorder::TrainRecorder(QObject *parent) : QThread(parent), file(NULL), running(0),
+    ring(TrainRecorderRing), head(0), tail(0), dropped(0), lastsecs(-1)
+{
+}
+
+TrainRecorder::~TrainRecorder()
+{
+    stopRecording();
+}
+
+void
+TrainRecorder::startRecording(QFile *file)
+{
+    stopRecording();
+
+    this->file = file;
+    head.store(0);
+    tail.store(0);
+    dropped.store(0);
+    lastsecs = -1;
+    synced.start();
+
+    running.store(1);
+    start();
+}
+
+void
+TrainRecorder::stopRecording()
+{
+    if (!isRunning()) return;
+
+    running.store(0);
+    wait();
+
+    // anything that came in as we stopped
+    drain();
+    sync();
+
+    // once for the session, not as it happens
+    if (dropped.load()) qDebug() << "train recorder fell behind, dropped" << dropped.load() << "samples";
+}
+
+bool
+TrainRecorder::record(const RealtimeData &rtData)
+{
+    if (!running.load()) return false;
+
+    int h = head.load();
+    int next = (h + 1) % TrainRecorderRing;
+
+    // full, the recorder is stuck
+    if (next == tail.loadAcquire()) {
+        dropped.ref();
+        return false;
+    }
+
+    ring[h] = rtData;
+    head.storeRelease(next);
+    return true;
+}
+
+void
+TrainRecorder::run()
+{
+    while (running.load()) {
+        drain();
+        if (synced.elapsed() > TrainRecorderSync) sync();
+        msleep(TrainRecorderWrite);
+    }
+}
+
+void
+TrainRecorder::drain()
+{
+    QByteArray batch;
+    QTextStream recordFileStream(&batch);
+
+    int t = tail.load();
+    int h = head.loadAcquire();
+    while (t != h) {
+
+        const RealtimeData &rtData = ring.at(t);
+
+        // the first snapshot in each second of the session
+        long secs = rtData.getMsecs() / 1000;
+        if (secs > lastsecs) {
+            lastsecs = secs;
+
+            long torq = 0, altitude = 0;
+
+            // GoldenCheetah CVS Format "secs, cad, hr, km, kph, nm, watts, alt, lon, lat, headwind, slope, temp, interval, lrbalance, lte, rte, lps, rps, smo2, thb, o2hb, hhb\n";
+
+            recordFileStream    << int(secs)
+                                << "," << rtData.getCadence()
+                                << "," << rtData.getHr()
+                                << "," << rtData.getDistance()
+                                << "," << rtData.getSpeed()
+                                << "," << torq
+                                << "," << rtData.getWatts()
+                                << "," << altitude
+                                << "," // lon
+                                << "," // lat
+                                << "," // headwind
+                                << "," // slope
+                                << "," // temp
+                                << "," << rtData.getLap()
+                                << "," << rtData.getLRBalance()
+                                << "," << rtData.getLTE()
+                                << "," << rtData.getRTE()
+                                << "," << rtData.getLPS()
+                                << "," << rtData.getRPS()
+                                << "," << rtData.getSmO2()
+                                << "," << rtData.gettHb()
+                                << "," << rtData.getO2Hb()
+                                << "," << rtData.getHHb()
+                                << "," << long(rtData.getLoad())
+                                << "," << "\n";
+        }
+
+        t = (t + 1) % TrainRecorderRing;
+    }
+    tail.storeRelease(t);
+
+    recordFileStream.flush();
+    if (batch.count() && file) {
+        file->write(batch);
+        file->flush();
+    }
+}
+
+void
+TrainRecorder::sync()
+{
+    if (file && file->isOpen()) {
+        file->flush();
+#ifdef Q_OS_WIN
+        _commit(file->handle());
+#else
+        fsync(file->handle());
+#endif
+    }
+    synced.start();
+}
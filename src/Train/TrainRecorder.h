@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2018 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_TrainRecorder_h
+#define _GC_TrainRecorder_h 1
+#include "GoldenCheetah.h"
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QVector>
+#include <QFile>
+#include <QTime>
+
+#include "RealtimeData.h"
+
+// TrainRecorder writes the .csv record of a train session on its own
+// thread, so a stalled GUI does not hold up the disk and the disk does
+// not hold up the GUI.
+//
+// TrainSidebar hands over each telemetry snapshot with record() as
+// soon as the devices have been read, before any of the display work,
+// it is timestamped (getMsecs) with the session time of that read.
+// The snapshots go through a single producer, single consumer ring
+// buffer so neither side ever waits on a lock. The recorder writes the
+// first snapshot in each second of the session in the same format the
+// disk timer used to, in batches, and syncs the file to disk now and
+// again so a crash loses little of the session.
+//
+class TrainRecorder : public QThread
+{
+    public:
+
+        TrainRecorder(QObject *parent=0);
+        ~TrainRecorder();
+
+        // recording to a file that is open, header written
+        void startRecording(QFile *file);
+
+        // write out what's left and sync, the file stays open
+        void stopRecording();
+
+        // GUI thread only, false if the recorder has fallen too far behind
+        // and the sample was dropped, drops are reported when we stop
+        bool record(const RealtimeData &rtData);
+
+    protected:
+
+        void run();
+
+    private:
+
+        // write out whatever is in the ring buffer
+        void drain();
+        void sync();
+
+        QFile *file;
+        QAtomicInt running;
+
+        // ring buffer, head is only moved by record()
+        // and tail is only moved by the recorder
+        QVector<RealtimeData> ring;
+        QAtomicInt head, tail;
+        QAtomicInt dropped; // samples lost this session
+
+        long lastsecs; // last second written
+        QTime synced;  // since we last synced to disk
+};
+
+#endif // _GC_TrainRecorder_h
@@ -26,6 +26,8 @@
 #include "DeviceTypes.h"
 #include "DeviceConfiguration.h"
 #include "RideImportWizard.h"
+#include "TrainRecorder.h"
+#include "TrainControl.h"
 #include <QApplication>
 #include <QtGui>
 #include <QRegExp>
@@ -325,10 +327,11 @@ TrainSidebar::TrainSidebar(Context *context) : GcWindow(context), context(contex
 
     // now the GUI is setup lets sort our control variables
     gui_timer = new QTimer(this);
-    disk_timer = new QTimer(this);
-    load_timer = new QTimer(this);
+    gui_timer->setTimerType(Qt::PreciseTimer); // devices are read on this tick
+    recorder = new TrainRecorder(this);
+    control = new TrainControl(this);
 
-    session_time = QTime();
+    session_time.invalidate();
     session_elapsed_msec = 0;
     lap_time = QTime();
     lap_elapsed_msec = 0;
@@ -345,7 +348,8 @@ TrainSidebar::TrainSidebar(Context *context) : GcWindow(context), context(contex
     hrcount = 0;
     spdcount = 0;
     lodcount = 0;
-    wbalr = wbal = 0;
+    wbalr.reset();
+    wbal = 0;
     load_msecs = total_msecs = lap_msecs = 0;
     displayWorkoutDistance = displayDistance = displayPower = displayHeartRate =
     displaySpeed = displayCadence = slope = load = 0;
@@ -353,8 +357,7 @@ TrainSidebar::TrainSidebar(Context *context) : GcWindow(context), context(contex
     displayLRBalance = displayLTE = displayRTE = displayLPS = displayRPS = 0;
 
     connect(gui_timer, SIGNAL(timeout()), this, SLOT(guiUpdate()));
-    connect(disk_timer, SIGNAL(timeout()), this, SLOT(diskUpdate()));
-    connect(load_timer, SIGNAL(timeout()), this, SLOT(loadUpdate()));
+    connect(control, SIGNAL(tick()), this, SLOT(loadUpdate()));
 
     configChanged(CONFIG_APPEARANCE | CONFIG_DEVICES | CONFIG_ZONES); // will reset the workout tree
     setLabels();
@@ -1054,9 +1057,7 @@ void TrainSidebar::Start()       // when start button is pressed
         clearStatusFlags(RT_PAUSED);
         //foreach(int dev, activeDevices) Devices[dev].controller->restart();
         //gui_timer->start(REFRESHRATE);
-        if (status & RT_RECORDING) disk_timer->start(SAMPLERATE);
-        load_period.restart();
-        if (status & RT_WORKOUT) load_timer->start(LOADRATE);
+        if (status & RT_WORKOUT) startControl();
 
 #if !defined GC_VIDEO_NONE
         mediaTree->setEnabled(false);
@@ -1080,9 +1081,7 @@ void TrainSidebar::Start()       // when start button is pressed
         setStatusFlags(RT_PAUSED);
         //foreach(int dev, activeDevices) Devices[dev].controller->pause();
         //gui_timer->stop();
-        if (status & RT_RECORDING) disk_timer->stop();
-        if (status & RT_WORKOUT) load_timer->stop();
-        load_msecs += load_period.restart();
+        if (status & RT_WORKOUT) load_msecs = control->stopControl();
 
 #if !defined GC_VIDEO_NONE
         // enable media tree so we can change movie - mid workout
@@ -1140,12 +1139,11 @@ void TrainSidebar::Start()       // when start button is pressed
         // tell the world
         context->notifyStart();
 
-        load_period.restart();
         session_time.start();
         session_elapsed_msec = 0;
         lap_time.start();
         lap_elapsed_msec = 0;
-        wbalr = 0;
+        wbalr.reset();
         wbal = WPRIME;
         lapAudioThisLap = true;
 
@@ -1162,7 +1160,7 @@ void TrainSidebar::Start()       // when start button is pressed
         //}
 
         if (status & RT_WORKOUT) {
-            load_timer->start(LOADRATE);      // start recording
+            startControl();                 // start the workout
         }
 
         if (recordSelector->isChecked()) {
@@ -1190,8 +1188,10 @@ void TrainSidebar::Start()       // when start button is pressed
 
                 QTextStream recordFileStream(recordFile);
                 recordFileStream << "secs, cad, hr, km, kph, nm, watts, alt, lon, lat, headwind, slope, temp, interval, lrbalance, lte, rte, lps, rps, smo2, thb, o2hb, hhb, target\n";
+                recordFileStream.flush();
 
-                disk_timer->start(SAMPLERATE);  // start screen
+                // samples are written by the recorder thread
+                recorder->startRecording(recordFile);
             }
         }
         gui_timer->start(REFRESHRATE);      // start recording
@@ -1214,9 +1214,7 @@ void TrainSidebar::Pause()        // pause capture to recalibrate
         clearStatusFlags(RT_PAUSED);
         foreach(int dev, activeDevices) Devices[dev].controller->restart();
         gui_timer->start(REFRESHRATE);
-        if (status & RT_RECORDING) disk_timer->start(SAMPLERATE);
-        load_period.restart();
-        if (status & RT_WORKOUT) load_timer->start(LOADRATE);
+        if (status & RT_WORKOUT) startControl();
 
 #if !defined GC_VIDEO_NONE
         mediaTree->setEnabled(false);
@@ -1234,9 +1232,7 @@ void TrainSidebar::Pause()        // pause capture to recalibrate
         foreach(int dev, activeDevices) Devices[dev].controller->pause();
         setStatusFlags(RT_PAUSED);
         gui_timer->stop();
-        if (status & RT_RECORDING) disk_timer->stop();
-        if (status & RT_WORKOUT) load_timer->stop();
-        load_msecs += load_period.restart();
+        if (status & RT_WORKOUT) load_msecs = control->stopControl();
 
         // enable media tree so we can change movie
 #if !defined GC_VIDEO_NONE
@@ -1291,7 +1287,7 @@ void TrainSidebar::Stop(int deviceStatus)        // when stop button is pressed
     QDateTime now = QDateTime::currentDateTime();
 
     if (status & RT_RECORDING) {
-        disk_timer->stop();
+        recorder->stopRecording();
 
         // close and reset File
         recordFile->close();
@@ -1314,8 +1310,8 @@ void TrainSidebar::Stop(int deviceStatus)        // when stop button is pressed
     }
 
     if (status & RT_WORKOUT) {
-        load_timer->stop();
-        load_msecs = 0;
+        control->stopControl();
+        load_msecs = control->seek(0);
     }
 
     // get back to normal after it may have been adusted by the user
@@ -1342,7 +1338,7 @@ void TrainSidebar::Stop(int deviceStatus)        // when stop button is pressed
     spdcount = 0;
     lodcount = 0;
     displayWorkoutLap = displayLap =0;
-    wbalr = 0;
+    wbalr.reset();
     wbal = WPRIME;
     session_elapsed_msec = 0;
     session_time.restart();
@@ -1587,6 +1583,7 @@ void TrainSidebar::guiUpdate()           // refreshes the telemetry
                 else
                     displayWorkoutDistance += displaySpeed / (5 * 3600); // assumes 200ms refreshrate
                 rtData.setDistance(displayDistance);
+                control->setDistance(displayWorkoutDistance);
 
                 // time
                 total_msecs = session_elapsed_msec + session_time.elapsed();
@@ -1595,6 +1592,11 @@ void TrainSidebar::guiUpdate()           // refreshes the telemetry
                 rtData.setMsecs(total_msecs);
                 rtData.setLapMsecs(lap_msecs);
 
+                // record to disk as soon as the devices are read, so the
+                // samples are not held up by the display work below
+                // paused and calibrating are never recorded
+                if (status&RT_RECORDING) recorder->record(rtData);
+
                 long lapTimeRemaining;
                 if (ergFile) lapTimeRemaining = ergFile->nextLap(load_msecs) - load_msecs;
                 else lapTimeRemaining = 0;
@@ -1688,8 +1690,8 @@ void TrainSidebar::guiUpdate()           // refreshes the telemetry
             if (JOULES < 0) JOULES = 0;
 
             // running total of replenishment
-            wbalr += JOULES * exp((total_msecs/1000.00f) / TAU);
-            wbal = WPRIME - (wbalr * exp((-total_msecs/1000.00f) / TAU));
+            wbalr.setTAU(TAU);
+            wbal = WPRIME - wbalr.push(JOULES, total_msecs/1000.00f);
 
             rtData.setWbal(wbal);
 
@@ -1757,100 +1759,48 @@ void TrainSidebar::warnnoConfig()
     QMessageBox::warning(this, tr("No Devices Configured"), tr("Please configure a device in Preferences."));
 }
 
-//----------------------------------------------------------------------
-// DISK UPDATE FUNCTIONS
-//----------------------------------------------------------------------
-void TrainSidebar::diskUpdate()
-{
-    int  secs;
-
-    long torq = 0, altitude = 0;
-    QTextStream recordFileStream(recordFile);
-
-    if (calibrating) return;
-
-    // convert from milliseconds to secondes
-    total_msecs = session_elapsed_msec + session_time.elapsed();
-    secs = total_msecs;
-    secs /= 1000.0;
-
-    // GoldenCheetah CVS Format "secs, cad, hr, km, kph, nm, watts, alt, lon, lat, headwind, slope, temp, interval, lrbalance, lte, rte, lps, rps, smo2, thb, o2hb, hhb\n";
-
-    recordFileStream    << secs
-                        << "," << displayCadence
-                        << "," << displayHeartRate
-                        << "," << displayDistance
-                        << "," << displaySpeed
-                        << "," << torq
-                        << "," << displayPower
-                        << "," << altitude
-                        << "," // lon
-                        << "," // lat
-                        << "," // headwind
-                        << "," // slope
-                        << "," // temp
-                        << "," << (displayLap + displayWorkoutLap)
-                        << "," << displayLRBalance
-                        << "," << displayLTE
-                        << "," << displayRTE
-                        << "," << displayLPS
-                        << "," << displayRPS
-                        << "," << displaySMO2
-                        << "," << displayTHB
-                        << "," << displayO2HB
-                        << "," << displayHHB
-                        << "," << load
-                        << "," << "\n";
-}
-
 //----------------------------------------------------------------------
 // WORKOUT MODE
 //----------------------------------------------------------------------
 
 void TrainSidebar::loadUpdate()
 {
-    int curLap;
+    // the control thread has moved the workout on
+    // and set the load/gradient, we catch up here
+    if ((status&RT_RUNNING) == 0) return;
 
     // we hold our horses whilst calibration is taking place...
     if (calibrating) return;
 
-    // the period between loadUpdate calls is not constant, and not exactly LOADRATE,
-    // therefore, use a QTime timer to measure the load period
-    load_msecs += load_period.restart();
+    TrainControl::Snapshot now = control->snapshot();
+    load_msecs = now.msecs;
 
-    if (status&RT_MODE_ERGO) {
-        load = ergFile->wattsAt(load_msecs, curLap);
+    if (status&RT_MODE_ERGO) load = now.load;
+    else slope = now.slope;
 
-        if(displayWorkoutLap != curLap)
-        {
-            context->notifyNewLap();
-        }
-        displayWorkoutLap = curLap;
+    if(displayWorkoutLap != now.lap)
+    {
+        context->notifyNewLap();
+    }
+    displayWorkoutLap = now.lap;
 
-        // we got to the end!
-        if (load == -100) {
-            Stop(DEVICE_OK);
-        } else {
-            foreach(int dev, activeDevices) Devices[dev].controller->setLoad(load);
-            context->notifySetNow(load_msecs);
-        }
+    // we got to the end!
+    if (now.finished) {
+        Stop(DEVICE_OK);
+    } else if (status&RT_MODE_ERGO) {
+        context->notifySetNow(load_msecs);
     } else {
-        slope = ergFile->gradientAt(displayWorkoutDistance*1000, curLap);
+        context->notifySetNow(displayWorkoutDistance * 1000);
+    }
+}
 
-        if(displayWorkoutLap != curLap)
-        {
-            context->notifyNewLap();
-        }
-        displayWorkoutLap = curLap;
+// start the control thread running the workout from where we are
+void TrainSidebar::startControl()
+{
+    QList<RealtimeController*> devices;
+    foreach(int dev, activeDevices) devices << Devices[dev].controller;
 
-        // we got to the end!
-        if (slope == -100) {
-            Stop(DEVICE_OK);
-        } else {
-            foreach(int dev, activeDevices) Devices[dev].controller->setGradient(slope);
-            context->notifySetNow(displayWorkoutDistance * 1000);
-        }
-    }
+    control->startControl(ergFile, devices, status&RT_MODE_ERGO, load_msecs, LOADRATE);
 }
 
 void TrainSidebar::Calibrate()
@@ -1871,11 +1821,9 @@ void TrainSidebar::toggleCalibration()
         // exiting calibration - restart gui etc
         session_time.start();
         lap_time.start();
-        load_period.restart();
 
         clearStatusFlags(RT_CALIBRATING);
-        if (status & RT_WORKOUT) load_timer->start(LOADRATE);
-        if (status & RT_RECORDING) disk_timer->start(SAMPLERATE);
+        if (status & RT_WORKOUT) startControl();
         context->notifyUnPause(); // get video started again, amongst other things
 
         // back to ergo/slope mode and restore load/gradient
@@ -1907,9 +1855,7 @@ void TrainSidebar::toggleCalibration()
         lap_elapsed_msec += lap_time.elapsed();
 
         setStatusFlags(RT_CALIBRATING);
-        if (status & RT_RECORDING) disk_timer->stop();
-        if (status & RT_WORKOUT) load_timer->stop();
-        load_msecs += load_period.restart();
+        if (status & RT_WORKOUT) load_msecs = control->stopControl();
 
         context->notifyPause(); // get video started again, amongst other things
 
@@ -2151,7 +2097,7 @@ void TrainSidebar::FFwd()
     if (((status&RT_RUNNING) == 0) || (status&RT_PAUSED)) return;
 
     if (status&RT_MODE_ERGO) {
-        load_msecs += 10000; // jump forward 10 seconds
+        load_msecs = control->skip(10000); // jump forward 10 seconds
         context->notifySeek(load_msecs);
     }
     else if (context->currentVideoSyncFile())
@@ -2168,8 +2114,7 @@ void TrainSidebar::Rewind()
     if (((status&RT_RUNNING) == 0) || (status&RT_PAUSED)) return;
 
     if (status&RT_MODE_ERGO) {
-        load_msecs -=10000; // jump back 10 seconds
-        if (load_msecs < 0) load_msecs = 0;
+        load_msecs = control->skip(-10000); // jump back 10 seconds
         context->notifySeek(load_msecs);
     }
     else if (context->currentVideoSyncFile())
@@ -2194,7 +2139,7 @@ void TrainSidebar::FFwdLap()
 
     if (status&RT_MODE_ERGO) {
         lapmarker = ergFile->nextLap(load_msecs);
-        if (lapmarker != -1) load_msecs = lapmarker; // jump forward to lapmarker
+        if (lapmarker != -1) load_msecs = control->seek(lapmarker); // jump forward to lapmarker
         context->notifySeek(load_msecs);
     } else {
         lapmarker = ergFile->nextLap(displayWorkoutDistance*1000);
@@ -2288,6 +2233,9 @@ void TrainSidebar::adjustIntensity(int value)
     // block signals temporarily
     context->mainWindow->blockSignals(true);
 
+    // the control thread reads the workout as we change it
+    control->ergLock()->lock();
+
     // work through the ergFile from NOW
     // adjusting back from last setting
     // and increasing to new intensity setting
@@ -2343,6 +2291,7 @@ void TrainSidebar::adjustIntensity(int value)
 
     // recalculate metrics
     context->currentErgFile()->calculateMetrics();
+    control->ergLock()->unlock();
     setLabels();
 
     // unblock signals now we are done
@@ -28,6 +28,7 @@
 #include "ErgFile.h"
 #include "VideoSyncFile.h"
 #include "ErgFilePlot.h"
+#include "WPrime.h"
 #include "GcSideBarItem.h"
 #include "RemoteControl.h"
 #include "Tab.h"
@@ -43,6 +44,7 @@
 #include <QHeaderView>
 #include <QFormLayout>
 #include <QSqlTableModel>
+#include <QElapsedTimer>
 
 #include "cmath" // for round()
 #include "Units.h" // for MILES_PER_KM
@@ -64,7 +66,6 @@
 // msecs constants for timers
 #define REFRESHRATE    200 // screen refresh in milliseconds
 #define STREAMRATE     200 // rate at which we stream updates to remote peer
-#define SAMPLERATE     1000 // disk update in milliseconds
 #define LOADRATE       1000 // rate at which load is adjusted
 
 // device treeview node types
@@ -80,6 +81,8 @@ class RealtimePlot;
 class RealtimeData;
 class MultiDeviceDialog;
 class TrainBottom;
+class TrainRecorder;
+class TrainControl;
 
 class TrainSidebar : public GcWindow
 {
@@ -189,8 +192,7 @@ class TrainSidebar : public GcWindow
 
         // Timed actions
         void guiUpdate();           // refreshes the telemetry
-        void diskUpdate();          // writes to CSV file
-        void loadUpdate();          // sets Load on CT like devices
+        void loadUpdate();          // catch up with the control thread
 
         // When no config has been setup
         void warnnoConfig();
@@ -208,6 +210,9 @@ class TrainSidebar : public GcWindow
         // watch keyboard events.
         bool eventFilter(QObject *object, QEvent *e);
 
+        // start running the workout on the control thread
+        void startControl();
+
         GcSplitter   *trainSplitter;
         GcSplitterItem *deviceItem,
                        *workoutItem,
@@ -272,14 +277,15 @@ class TrainSidebar : public GcWindow
         long total_msecs,
              lap_msecs,
              load_msecs;
-        QTime load_period;
 
         uint session_elapsed_msec, lap_elapsed_msec;
-        QTime session_time, lap_time;
+        QElapsedTimer session_time; // monotonic, samples are stamped with it
+        QTime lap_time;
+
+        QTimer      *gui_timer;     // refresh the gui
+        TrainControl *control;      // change the load on the device
 
-        QTimer      *gui_timer,     // refresh the gui
-                    *load_timer,    // change the load on the device
-                    *disk_timer;    // write to .CSV file
+        TrainRecorder *recorder;    // write to .CSV file
 
         bool autoConnect;
         bool pendingConfigChange;
@@ -290,7 +296,8 @@ class TrainSidebar : public GcWindow
         QCheckBox   *recordSelector;
         QSharedPointer<QFileSystemWatcher> watcher;
         bool calibrating;
-        double wbalr, wbal;
+        WPrimeIntegrator wbalr; // W' expended, decayed as we go
+        double wbal;
 };
 
 class MultiDeviceDialog : public QDialog
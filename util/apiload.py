@@ -0,0 +1,93 @@
+#!/usr/bin/python
+
+#
+# Load test the API served by GoldenCheetah --server
+#
+# Starts a number of client threads, each repeatedly requesting the
+# endpoints for an athlete over a keep-alive connection, and reports
+# the requests per second and the status codes returned.
+#
+# usage: apiload.py athlete [host:port] [threads] [seconds] [--revalidate]
+#
+#   --revalidate sends back the ETag from the last response, as a
+#                caching client would, so unchanged data is a 304
+#
+
+import sys
+import time
+import threading
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+
+args = [a for a in sys.argv[1:] if not a.startswith('--')]
+if len(args) < 1:
+    print('usage: apiload.py athlete [host:port] [threads] [seconds] [--revalidate]')
+    sys.exit(1)
+
+athlete = args[0]
+server = args[1] if len(args) > 1 else 'localhost:12021'
+threads = int(args[2]) if len(args) > 2 else 8
+seconds = float(args[3]) if len(args) > 3 else 10
+revalidate = '--revalidate' in sys.argv
+
+paths = [ '/' + athlete,
+          '/' + athlete + '?metrics=TSS,Duration&metadata=all',
+          '/' + athlete + '/meanmax/bests',
+          '/' + athlete + '/meanmax/bests?series=hr' ]
+
+lock = threading.Lock()
+statuses = {}
+latencies = []
+received = [0]
+
+def client(stop):
+    connection = httplib.HTTPConnection(server)
+    etags = {}
+    n = 0
+    while time.time() < stop:
+        path = paths[n % len(paths)]
+        n += 1
+
+        headers = {}
+        if revalidate and path in etags: headers['If-None-Match'] = etags[path]
+
+        start = time.time()
+        try:
+            connection.request('GET', path, headers=headers)
+            response = connection.getresponse()
+            body = response.read()
+            status = response.status
+            if response.getheader('ETag'): etags[path] = response.getheader('ETag')
+        except Exception:
+            connection.close()
+            connection = httplib.HTTPConnection(server)
+            status, body = 'error', ''
+        took = time.time() - start
+
+        with lock:
+            statuses[status] = statuses.get(status, 0) + 1
+            latencies.append(took)
+            received[0] += len(body)
+    connection.close()
+
+stop = time.time() + seconds
+workers = [threading.Thread(target=client, args=(stop,)) for i in range(threads)]
+started = time.time()
+for worker in workers: worker.start()
+for worker in workers: worker.join()
+elapsed = time.time() - started
+
+latencies.sort()
+count = len(latencies)
+if count == 0:
+    print('no requests completed')
+    sys.exit(1)
+
+print('%d requests in %.1fs with %d threads: %.1f req/s, %.1f KB/s' %
+      (count, elapsed, threads, count / elapsed, received[0] / 1024.0 / elapsed))
+print('latency ms: median %.1f, 95%% %.1f, max %.1f' %
+      (latencies[count // 2] * 1000, latencies[int(count * 0.95)] * 1000, latencies[-1] * 1000))
+print('status: ' + ', '.join('%s=%d' % (k, statuses[k]) for k in sorted(statuses, key=str)))